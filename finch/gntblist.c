@@ -97,12 +97,24 @@ typedef struct
 	guint new_group_timeout;
 
 	FinchBlistManager *manager;
+
+	/* Nodes libpurple updated that haven't been redrawn yet. A status
+	 * change updates the buddy, its contact and its group, often several
+	 * times over, so the updates are drawn together once we are idle.
+	 */
+	GHashTable *dirty;
+	guint update_idle;
 } FinchBlist;
 
 typedef struct
 {
 	gpointer row;                /* the row in the GntTree */
 	guint signed_timer;          /* used when 'recently' signed on/off */
+
+	/* What the row was last drawn with, so unchanged rows are left alone */
+	char *text;
+	int color;                   /* -1 until the row is first colored */
+	GntTextFormatFlags flags;
 } FinchBlistNode;
 
 typedef enum
@@ -330,7 +342,7 @@ static FinchBlistManager default_manager =
 static GList *managers;
 
 static FinchBlistNode *
-create_finch_blist_node(PurpleBlistNode *node, gpointer row)
+create_finch_blist_node(PurpleBlistNode *node, gpointer row, const char *text)
 {
 	FinchBlistNode *fnode = FINCH_GET_DATA(node);
 	if (!fnode) {
@@ -339,6 +351,9 @@ create_finch_blist_node(PurpleBlistNode *node, gpointer row)
 		FINCH_SET_DATA(node, fnode);
 	}
 	fnode->row = row;
+	g_free(fnode->text);
+	fnode->text = g_strdup(text);
+	fnode->color = -1;
 	return fnode;
 }
 
@@ -350,6 +365,7 @@ reset_blist_node_ui_data(PurpleBlistNode *node)
 		return;
 	if (fnode->signed_timer)
 		purple_timeout_remove(fnode->signed_timer);
+	g_free(fnode->text);
 	g_free(fnode);
 	FINCH_SET_DATA(node, NULL);
 }
@@ -425,8 +441,49 @@ get_blist_node_flag(PurpleBlistNode *node)
 static void
 blist_update_row_flags(PurpleBlistNode *node)
 {
-	gnt_tree_set_row_flags(GNT_TREE(ggblist->tree), node, get_blist_node_flag(node));
-	gnt_tree_set_row_color(GNT_TREE(ggblist->tree), node, get_display_color(node));
+	FinchBlistNode *fnode = FINCH_GET_DATA(node);
+	GntTextFormatFlags flags = get_blist_node_flag(node);
+	int color = get_display_color(node);
+
+	if (fnode && fnode->color == color && fnode->flags == flags)
+		return;
+
+	gnt_tree_set_row_flags(GNT_TREE(ggblist->tree), node, flags);
+	gnt_tree_set_row_color(GNT_TREE(ggblist->tree), node, color);
+	if (fnode) {
+		fnode->flags = flags;
+		fnode->color = color;
+	}
+}
+
+/* Sets the text of a node's row, if it changed */
+static void
+blist_update_row_text(PurpleBlistNode *node)
+{
+	FinchBlistNode *fnode = FINCH_GET_DATA(node);
+	const char *text;
+
+	if (fnode == NULL)
+		return;
+
+	text = get_display_name(node);
+	if (purple_strequal(text, fnode->text))
+		return;
+
+	g_free(fnode->text);
+	fnode->text = g_strdup(text);
+	gnt_tree_change_text(GNT_TREE(ggblist->tree), node, 0, text);
+}
+
+/* Redraws a node's row. The row is always re-sorted, since the sort
+ * functions look at more than what is drawn (the presence, the contact
+ * alias, the log size). */
+static void
+blist_update_row(PurpleBlistNode *node)
+{
+	blist_update_row_text(node);
+	blist_update_row_flags(node);
+	gnt_tree_sort_row(GNT_TREE(ggblist->tree), node);
 }
 
 #if 0
@@ -547,10 +604,7 @@ node_update(PurpleBuddyList *list, PurpleBlistNode *node)
 		return;
 
 	if (FINCH_GET_DATA(node)!= NULL) {
-		gnt_tree_change_text(GNT_TREE(ggblist->tree), node,
-				0, get_display_name(node));
-		gnt_tree_sort_row(GNT_TREE(ggblist->tree), node);
-		blist_update_row_flags(node);
+		blist_update_row(node);
 		if (gnt_tree_get_parent_key(GNT_TREE(ggblist->tree), node) !=
 				ggblist->manager->find_parent(node))
 			node_remove(list, node);
@@ -579,6 +633,51 @@ node_update(PurpleBuddyList *list, PurpleBlistNode *node)
 	}
 }
 
+static gboolean
+flush_updates_cb(gpointer data)
+{
+	PurpleBuddyList *list = purple_get_blist();
+	GList *nodes;
+
+	ggblist->update_idle = 0;
+
+	/* Redrawing rows doesn't change the buddy list itself, so the nodes
+	 * are all still there by the time we get to them. */
+	nodes = g_hash_table_get_keys(ggblist->dirty);
+	g_hash_table_remove_all(ggblist->dirty);
+
+	for (; nodes; nodes = g_list_delete_link(nodes, nodes))
+		node_update(list, nodes->data);
+
+	return FALSE;
+}
+
+static void
+queue_node_update(PurpleBuddyList *list, PurpleBlistNode *node)
+{
+	g_return_if_fail(node != NULL);
+
+	if (FINCH_GET_DATA(list) == NULL || ggblist->window == NULL) {
+		node_update(list, node);
+		return;
+	}
+
+	if (ggblist->dirty == NULL)
+		ggblist->dirty = g_hash_table_new(g_direct_hash, g_direct_equal);
+	g_hash_table_insert(ggblist->dirty, node, node);
+	if (!ggblist->update_idle)
+		ggblist->update_idle = g_idle_add(flush_updates_cb, NULL);
+}
+
+/* libpurple is about to free the node, so it can't wait for an update */
+static void
+node_removed(PurpleBuddyList *list, PurpleBlistNode *node)
+{
+	if (ggblist && ggblist->dirty)
+		g_hash_table_remove(ggblist->dirty, node);
+	node_remove(list, node);
+}
+
 static void
 new_list(PurpleBuddyList *list)
 {
@@ -864,8 +963,8 @@ static PurpleBlistUiOps blist_ui_ops =
 	new_list,
 	new_node,
 	blist_show,
-	node_update,
-	node_remove,
+	queue_node_update,
+	node_removed,
 	destroy_list,
 	NULL,
 	finch_request_add_buddy,
@@ -890,12 +989,14 @@ add_group(PurpleGroup *group, FinchBlist *ggblist)
 {
 	gpointer parent;
 	PurpleBlistNode *node = (PurpleBlistNode *)group;
+	const char *name;
 	if (FINCH_GET_DATA(node))
 		return;
 	parent = ggblist->manager->find_parent((PurpleBlistNode*)group);
+	name = get_display_name(node);
 	create_finch_blist_node(node, gnt_tree_add_row_after(GNT_TREE(ggblist->tree), group,
-			gnt_tree_create_row(GNT_TREE(ggblist->tree), get_display_name(node)),
-			parent, NULL));
+			gnt_tree_create_row(GNT_TREE(ggblist->tree), name),
+			parent, NULL), name);
 	gnt_tree_set_expanded(GNT_TREE(ggblist->tree), node,
 		!purple_blist_node_get_bool(node, "collapsed"));
 }
@@ -963,6 +1064,7 @@ add_chat(PurpleChat *chat, FinchBlist *ggblist)
 {
 	gpointer parent;
 	PurpleBlistNode *node = (PurpleBlistNode *)chat;
+	const char *name;
 	if (FINCH_GET_DATA(node))
 		return;
 	if (!purple_account_is_connected(purple_chat_get_account(chat)))
@@ -970,9 +1072,10 @@ add_chat(PurpleChat *chat, FinchBlist *ggblist)
 
 	parent = ggblist->manager->find_parent((PurpleBlistNode*)chat);
 
+	name = get_display_name(node);
 	create_finch_blist_node(node, gnt_tree_add_row_after(GNT_TREE(ggblist->tree), chat,
-				gnt_tree_create_row(GNT_TREE(ggblist->tree), get_display_name(node)),
-				parent, NULL));
+				gnt_tree_create_row(GNT_TREE(ggblist->tree), name),
+				parent, NULL), name);
 }
 
 static void
@@ -993,7 +1096,7 @@ add_contact(PurpleContact *contact, FinchBlist *ggblist)
 
 	create_finch_blist_node(node, gnt_tree_add_row_after(GNT_TREE(ggblist->tree), contact,
 				gnt_tree_create_row(GNT_TREE(ggblist->tree), name),
-				parent, NULL));
+				parent, NULL), name);
 
 	gnt_tree_set_expanded(GNT_TREE(ggblist->tree), contact, FALSE);
 }
@@ -1004,6 +1107,7 @@ add_buddy(PurpleBuddy *buddy, FinchBlist *ggblist)
 	gpointer parent;
 	PurpleBlistNode *node = (PurpleBlistNode *)buddy;
 	PurpleContact *contact;
+	const char *name;
 
 	if (FINCH_GET_DATA(node))
 		return;
@@ -1011,9 +1115,10 @@ add_buddy(PurpleBuddy *buddy, FinchBlist *ggblist)
 	contact = purple_buddy_get_contact(buddy);
 	parent = ggblist->manager->find_parent((PurpleBlistNode*)buddy);
 
+	name = get_display_name(node);
 	create_finch_blist_node(node, gnt_tree_add_row_after(GNT_TREE(ggblist->tree), buddy,
-				gnt_tree_create_row(GNT_TREE(ggblist->tree), get_display_name(node)),
-				parent, NULL));
+				gnt_tree_create_row(GNT_TREE(ggblist->tree), name),
+				parent, NULL), name);
 
 	blist_update_row_flags((PurpleBlistNode*)buddy);
 	if (buddy == purple_contact_get_priority_buddy(contact))
@@ -1984,8 +2089,7 @@ key_pressed(GntWidget *widget, const char *text, FinchBlist *ggblist)
 static void
 update_node_display(PurpleBlistNode *node, FinchBlist *ggblist)
 {
-	GntTextFormatFlags flag = get_blist_node_flag(node);
-	gnt_tree_set_row_flags(GNT_TREE(ggblist->tree), node, flag);
+	blist_update_row_flags(node);
 }
 
 static void
@@ -1995,8 +2099,8 @@ update_buddy_display(PurpleBuddy *buddy, FinchBlist *ggblist)
 
 	contact = purple_buddy_get_contact(buddy);
 
-	gnt_tree_change_text(GNT_TREE(ggblist->tree), buddy, 0, get_display_name((PurpleBlistNode*)buddy));
-	gnt_tree_change_text(GNT_TREE(ggblist->tree), contact, 0, get_display_name((PurpleBlistNode*)contact));
+	blist_update_row_text((PurpleBlistNode *)buddy);
+	blist_update_row_text((PurpleBlistNode *)contact);
 
 	blist_update_row_flags((PurpleBlistNode *)buddy);
 	if (buddy == purple_contact_get_priority_buddy(contact))
@@ -2009,13 +2113,13 @@ update_buddy_display(PurpleBuddy *buddy, FinchBlist *ggblist)
 static void
 buddy_status_changed(PurpleBuddy *buddy, PurpleStatus *old, PurpleStatus *now, FinchBlist *ggblist)
 {
-	update_buddy_display(buddy, ggblist);
+	queue_node_update(purple_get_blist(), (PurpleBlistNode *)buddy);
 }
 
 static void
 buddy_idle_changed(PurpleBuddy *buddy, int old, int new, FinchBlist *ggblist)
 {
-	update_buddy_display(buddy, ggblist);
+	queue_node_update(purple_get_blist(), (PurpleBlistNode *)buddy);
 }
 
 static void
@@ -2067,6 +2171,11 @@ reset_blist_window(GntWidget *window, gpointer null)
 	if (ggblist->new_group)
 		g_list_free(ggblist->new_group);
 
+	if (ggblist->update_idle)
+		g_source_remove(ggblist->update_idle);
+	if (ggblist->dirty)
+		g_hash_table_destroy(ggblist->dirty);
+
 	g_free(ggblist);
 	ggblist = NULL;
 }
@@ -113,7 +113,7 @@ static void historize(PurpleConversation *c)
 		return;
 
 	mflag = PURPLE_MESSAGE_NO_LOG | PURPLE_MESSAGE_SYSTEM | PURPLE_MESSAGE_DELAYED;
-	history = purple_log_read((PurpleLog*)logs->data, &flags);
+	history = purple_log_read_tail((PurpleLog*)logs->data, HISTORY_SIZE, &flags);
 
 	header = g_strdup_printf(_("<b>Conversation with %s on %s:</b><br>"), alias,
 			purple_date_format_full(localtime(&((PurpleLog *)logs->data)->time)));
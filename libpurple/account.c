@@ -1771,6 +1771,8 @@ purple_account_set_connection(PurpleAccount *account, PurpleConnection *gc)
 {
 	g_return_if_fail(account != NULL);
 
+	if (account->gc != gc)
+		_purple_presence_scores_changed();
 	account->gc = gc;
 }
 
@@ -3337,6 +3339,8 @@ purple_accounts_uninit(void)
 		sync_accounts();
 	}
 
+	_purple_log_activity_flush();
+
 	for (; accounts; accounts = g_list_delete_link(accounts, accounts))
 		purple_account_destroy(accounts->data);
 
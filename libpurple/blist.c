@@ -35,6 +35,7 @@
 #include "prpl.h"
 #include "server.h"
 #include "signals.h"
+#include "stringref.h"
 #include "util.h"
 #include "value.h"
 #include "xmlnode.h"
@@ -86,7 +87,7 @@ struct _list_account_buddies {
 };
 
 struct _purple_hbuddy {
-	char *name;
+	char *name;		/**< Interned normalized name, except in lookup keys */
 	PurpleAccount *account;
 	PurpleBlistNode *group;
 };
@@ -102,12 +103,12 @@ static guint _purple_blist_hbuddy_equal(struct _purple_hbuddy *hb1, struct _purp
 {
 	return (hb1->group == hb2->group &&
 	        hb1->account == hb2->account &&
-	        purple_strequal(hb1->name, hb2->name));
+	        (hb1->name == hb2->name || purple_strequal(hb1->name, hb2->name)));
 }
 
 static void _purple_blist_hbuddy_free_key(struct _purple_hbuddy *hb)
 {
-	g_free(hb->name);
+	purple_stringref_intern_unref(hb->name);
 	g_free(hb);
 }
 
@@ -947,7 +948,7 @@ purple_blist_update_buddy_status(PurpleBuddy *buddy, PurpleStatus *old_status)
 	 * because something, somewhere changed.  Calling the stuff below
 	 * certainly won't hurt anything.  Unless you're on a K6-2 300.
 	 */
-	purple_contact_invalidate_priority_buddy(purple_buddy_get_contact(buddy));
+	_purple_contact_buddy_presence_changed(buddy);
 	if (ops && ops->update)
 		ops->update(purplebuddylist, (PurpleBlistNode *)buddy);
 }
@@ -990,18 +991,18 @@ void purple_blist_rename_buddy(PurpleBuddy *buddy, const char *name)
 	account_buddies = g_hash_table_lookup(buddies_cache, buddy->account);
 	g_hash_table_remove(account_buddies, hb);
 
-	hb->name = g_strdup(purple_normalize(buddy->account, name));
+	hb->name = (gchar *)purple_stringref_intern(purple_normalize(buddy->account, name));
 	g_hash_table_replace(purplebuddylist->buddies, hb, buddy);
 
 	hb2 = g_new(struct _purple_hbuddy, 1);
-	hb2->name = g_strdup(hb->name);
+	hb2->name = (gchar *)purple_stringref_intern_ref(hb->name);
 	hb2->account = buddy->account;
 	hb2->group = ((PurpleBlistNode *)buddy)->parent->parent;
 
 	g_hash_table_replace(account_buddies, hb2, buddy);
 
-	g_free(buddy->name);
-	buddy->name = g_strdup(name);
+	purple_stringref_intern_unref(buddy->name);
+	buddy->name = (gchar *)purple_stringref_intern(name);
 
 	if (ops && ops->save_node)
 		ops->save_node((PurpleBlistNode *) buddy);
@@ -1243,8 +1244,8 @@ void purple_blist_rename_group(PurpleGroup *source, const char *name)
 			child = next;
 		}
 
-		/* Make a copy of the old group name and then delete the old group */
-		old_name = g_strdup(source->name);
+		/* Hold on to the old group name and then delete the old group */
+		old_name = (gchar *)purple_stringref_intern_ref(source->name);
 		purple_blist_remove_group(source);
 		source = dest;
 		g_free(new_name);
@@ -1261,7 +1262,7 @@ void purple_blist_rename_group(PurpleGroup *source, const char *name)
 		}
 
 		old_name = source->name;
-		source->name = new_name;
+		source->name = (gchar *)purple_stringref_intern(new_name);
 
 		key = g_utf8_collate_key(old_name, -1);
 		g_hash_table_remove(groups_cache, key);
@@ -1269,6 +1270,7 @@ void purple_blist_rename_group(PurpleGroup *source, const char *name)
 
 		key = g_utf8_collate_key(new_name, -1);
 		g_hash_table_insert(groups_cache, key, source);
+		g_free(new_name);
 	}
 
 	/* Save our changes */
@@ -1327,7 +1329,7 @@ void purple_blist_rename_group(PurpleGroup *source, const char *name)
 		}
 	}
 	g_list_free(moved_buddies);
-	g_free(old_name);
+	purple_stringref_intern_unref(old_name);
 }
 
 static void purple_blist_node_initialize_settings(PurpleBlistNode *node);
@@ -1369,14 +1371,17 @@ PurpleBuddy *purple_buddy_new(PurpleAccount *account, const char *name, const ch
 {
 	PurpleBlistUiOps *ops = purple_blist_get_ui_ops();
 	PurpleBuddy *buddy;
+	char *stripped;
 
 	g_return_val_if_fail(account != NULL, NULL);
 	g_return_val_if_fail(name != NULL, NULL);
 
 	buddy = g_new0(PurpleBuddy, 1);
 	buddy->account  = account;
-	buddy->name     = purple_utf8_strip_unprintables(name);
+	stripped        = purple_utf8_strip_unprintables(name);
+	buddy->name     = (char *)purple_stringref_intern(stripped);
 	buddy->alias    = purple_utf8_strip_unprintables(alias);
+	g_free(stripped);
 	buddy->presence = purple_presence_new_for_buddy(buddy);
 	((PurpleBlistNode *)buddy)->type = PURPLE_BLIST_BUDDY_NODE;
 
@@ -1412,7 +1417,7 @@ purple_buddy_destroy(PurpleBuddy *buddy)
 	purple_buddy_icon_unref(buddy->icon);
 	g_hash_table_destroy(buddy->node.settings);
 	purple_presence_destroy(buddy->presence);
-	g_free(buddy->name);
+	purple_stringref_intern_unref(buddy->name);
 	g_free(buddy->alias);
 	g_free(buddy->server_alias);
 
@@ -1689,7 +1694,7 @@ void purple_blist_add_buddy(PurpleBuddy *buddy, PurpleContact *contact, PurpleGr
 	PURPLE_CONTACT(bnode->parent)->totalsize++;
 
 	hb = g_new(struct _purple_hbuddy, 1);
-	hb->name = g_strdup(purple_normalize(buddy->account, buddy->name));
+	hb->name = (gchar *)purple_stringref_intern(purple_normalize(buddy->account, buddy->name));
 	hb->account = buddy->account;
 	hb->group = ((PurpleBlistNode*)buddy)->parent->parent;
 
@@ -1698,7 +1703,7 @@ void purple_blist_add_buddy(PurpleBuddy *buddy, PurpleContact *contact, PurpleGr
 	account_buddies = g_hash_table_lookup(buddies_cache, buddy->account);
 
 	hb2 = g_new(struct _purple_hbuddy, 1);
-	hb2->name = g_strdup(hb->name);
+	hb2->name = (gchar *)purple_stringref_intern_ref(hb->name);
 	hb2->account = buddy->account;
 	hb2->group = ((PurpleBlistNode*)buddy)->parent->parent;
 
@@ -1796,10 +1801,45 @@ void purple_contact_invalidate_priority_buddy(PurpleContact *contact)
 	contact->priority_valid = FALSE;
 }
 
+void
+_purple_contact_buddy_presence_changed(PurpleBuddy *buddy)
+{
+	PurpleContact *contact = purple_buddy_get_contact(buddy);
+	PurpleBuddy *priority;
+	int cmp = 1;
+
+	if (contact == NULL || !contact->priority_valid)
+		return;
+
+	/* If the priority buddy got worse, someone else may be ahead now and
+	 * only going through them all will tell.  Ties are settled by the
+	 * buddies' order, so those need the whole walk as well. */
+	priority = contact->priority;
+	if (priority == NULL || priority == buddy) {
+		contact->priority_valid = FALSE;
+		return;
+	}
+
+	/* Otherwise the others are where they were, below the priority buddy,
+	 * and it's enough to check whether this one has passed it. */
+	if (!purple_account_is_connected(buddy->account))
+		return;
+
+	if (purple_account_is_connected(priority->account))
+		cmp = purple_presence_compare(purple_buddy_get_presence(priority),
+				purple_buddy_get_presence(buddy));
+
+	if (cmp > 0)
+		contact->priority = buddy;
+	else if (cmp == 0)
+		contact->priority_valid = FALSE;
+}
+
 PurpleGroup *purple_group_new(const char *name)
 {
 	PurpleBlistUiOps *ops = purple_blist_get_ui_ops();
 	PurpleGroup *group;
+	char *stripped;
 
 	g_return_val_if_fail(name  != NULL, NULL);
 	g_return_val_if_fail(*name != '\0', NULL);
@@ -1808,8 +1848,10 @@ PurpleGroup *purple_group_new(const char *name)
 	if (group != NULL)
 		return group;
 
+	stripped = purple_utf8_strip_unprintables(name);
 	group = g_new0(PurpleGroup, 1);
-	group->name = purple_utf8_strip_unprintables(name);
+	group->name = (char *)purple_stringref_intern(stripped);
+	g_free(stripped);
 	group->totalsize = 0;
 	group->currentsize = 0;
 	group->online = 0;
@@ -1827,7 +1869,7 @@ void
 purple_group_destroy(PurpleGroup *group)
 {
 	g_hash_table_destroy(group->node.settings);
-	g_free(group->name);
+	purple_stringref_intern_unref(group->name);
 	PURPLE_DBUS_UNREGISTER_POINTER(group);
 	g_free(group);
 }
@@ -1879,7 +1921,7 @@ void purple_blist_add_contact(PurpleContact *contact, PurpleGroup *group, Purple
 				struct _purple_hbuddy *hb, *hb2;
 
 				hb = g_new(struct _purple_hbuddy, 1);
-				hb->name = g_strdup(purple_normalize(b->account, b->name));
+				hb->name = (gchar *)purple_stringref_intern(purple_normalize(b->account, b->name));
 				hb->account = b->account;
 				hb->group = cnode->parent;
 
@@ -1893,7 +1935,7 @@ void purple_blist_add_contact(PurpleContact *contact, PurpleGroup *group, Purple
 					g_hash_table_replace(purplebuddylist->buddies, hb, b);
 
 					hb2 = g_new(struct _purple_hbuddy, 1);
-					hb2->name = g_strdup(hb->name);
+					hb2->name = (gchar *)purple_stringref_intern_ref(hb->name);
 					hb2->account = b->account;
 					hb2->group = gnode;
 
@@ -1906,8 +1948,7 @@ void purple_blist_add_contact(PurpleContact *contact, PurpleGroup *group, Purple
 
 					/* this buddy already exists in the group, so we're
 					 * gonna delete it instead */
-					g_free(hb->name);
-					g_free(hb);
+					_purple_blist_hbuddy_free_key(hb);
 					if (purple_account_get_connection(b->account))
 						purple_account_remove_buddy(b->account, b, (PurpleGroup *)cnode->parent);
 
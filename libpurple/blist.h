@@ -139,7 +139,7 @@ struct _PurpleBlistNode {
  */
 struct _PurpleBuddy {
 	PurpleBlistNode node;                     /**< The node that this buddy inherits from */
-	char *name;                             /**< The name of the buddy. */
+	char *name;                             /**< The name of the buddy (interned). */
 	char *alias;                            /**< The user-set alias of the buddy */
 	char *server_alias;                     /**< The server-specified alias of the buddy */
 	void *proto_data;                       /**< This allows the prpl to associate whatever data it wants with a buddy */
@@ -168,7 +168,7 @@ struct _PurpleContact {
  */
 struct _PurpleGroup {
 	PurpleBlistNode node;                    /**< The node that this group inherits from */
-	char *name;                            /**< The name of this group. */
+	char *name;                            /**< The name of this group (interned). */
 	int totalsize;			       /**< The number of chats and contacts in this group */
 	int currentsize;		       /**< The number of chats and contacts in this group corresponding to online accounts */
 	int online;			       /**< The number of chats and contacts in this group who are currently online */
@@ -32,6 +32,7 @@
 #include "prpl.h"
 #include "request.h"
 #include "signals.h"
+#include "stringref.h"
 #include "util.h"
 
 #define SEND_TYPED_TIMEOUT_SECONDS 5
@@ -85,7 +86,9 @@ static guint _purple_conversation_user_hash(gconstpointer data)
 
 static gboolean _purple_conversation_user_equal(gconstpointer a, gconstpointer b)
 {
-	return !g_utf8_collate(a, b);
+	/* Keys are interned, so a lookup by a buddy's own name is a
+	 * pointer comparison. */
+	return a == b || !g_utf8_collate(a, b);
 }
 
 void
@@ -463,7 +466,8 @@ purple_conversation_new(PurpleConversationType type, PurpleAccount *account,
 		conv->u.chat = g_new0(PurpleConvChat, 1);
 		conv->u.chat->conv = conv;
 		conv->u.chat->users = g_hash_table_new_full(_purple_conversation_user_hash,
-				_purple_conversation_user_equal, g_free, NULL);
+				_purple_conversation_user_equal,
+				(GDestroyNotify)purple_stringref_intern_unref, NULL);
 		PURPLE_DBUS_REGISTER_POINTER(conv->u.chat, PurpleConvChat);
 
 		chats = g_list_prepend(chats, conv);
@@ -1784,7 +1788,8 @@ purple_conv_chat_add_users(PurpleConvChat *chat, GList *users, GList *extra_msgs
 		cbuddy->buddy = purple_find_buddy(conv->account, user) != NULL;
 
 		chat->in_room = g_list_prepend(chat->in_room, cbuddy);
-		g_hash_table_replace(chat->users, g_strdup(cbuddy->name), cbuddy);
+		g_hash_table_replace(chat->users,
+				(gpointer)purple_stringref_intern_ref(cbuddy->name), cbuddy);
 
 		cbuddies = g_list_prepend(cbuddies, cbuddy);
 
@@ -1889,7 +1894,8 @@ purple_conv_chat_rename_user(PurpleConvChat *chat, const char *old_user,
 	cb->buddy = purple_find_buddy(conv->account, new_user) != NULL;
 
 	chat->in_room = g_list_prepend(chat->in_room, cb);
-	g_hash_table_replace(chat->users, g_strdup(cb->name), cb);
+	g_hash_table_replace(chat->users,
+			(gpointer)purple_stringref_intern_ref(cb->name), cb);
 
 	if (ops != NULL && ops->chat_rename_user != NULL)
 		ops->chat_rename_user(conv, old_user, new_user, new_alias);
@@ -2261,7 +2267,7 @@ purple_conv_chat_cb_new(const char *name, const char *alias, PurpleConvChatBuddy
 	g_return_val_if_fail(name != NULL, NULL);
 
 	cb = g_new0(PurpleConvChatBuddy, 1);
-	cb->name = g_strdup(name);
+	cb->name = (char *)purple_stringref_intern(name);
 	cb->flags = flags;
 	cb->alias = g_strdup(alias);
 	cb->attributes = g_hash_table_new_full(g_str_hash, g_str_equal,
@@ -2291,7 +2297,7 @@ purple_conv_chat_cb_destroy(PurpleConvChatBuddy *cb)
 
 	g_free(cb->alias);
 	g_free(cb->alias_key);
-	g_free(cb->name);
+	purple_stringref_intern_unref(cb->name);
 	g_hash_table_destroy(cb->attributes);
 
 	PURPLE_DBUS_UNREGISTER_POINTER(cb);
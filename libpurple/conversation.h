@@ -294,7 +294,8 @@ struct _PurpleConvChat
  */
 struct _PurpleConvChatBuddy
 {
-	char *name;                      /**< The chat participant's name in the chat. */
+	char *name;                      /**< The chat participant's name in the chat;
+	                                  *   interned with purple_stringref_intern(). */
 	char *alias;                     /**< The chat participant's alias, if known;
 	                                  *   @a NULL otherwise.
 	                                  */
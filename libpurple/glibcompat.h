@@ -53,6 +53,15 @@ g_slist_free_full(GSList *l, GDestroyNotify free_func) {
 
 	g_slist_free(l);
 }
+
+static inline gint64
+g_get_monotonic_time(void) {
+	GTimeVal now;
+
+	/* Not monotonic, but close enough for measuring intervals */
+	g_get_current_time(&now);
+	return (gint64)now.tv_sec * G_USEC_PER_SEC + now.tv_usec;
+}
 #endif /* !GLIB_CHECK_VERSION(2,23,0) */
 
 #if !GLIB_CHECK_VERSION(2,32,0)
@@ -173,6 +173,7 @@ typedef union
 /* INTERNAL FUNCTIONS */
 
 #include "account.h"
+#include "blist.h"
 #include "connection.h"
 
 /* This is for the accounts code to notify the buddy icon code that
@@ -191,6 +192,24 @@ _purple_buddy_icons_blist_loaded_cb(void);
 void
 _purple_buddy_icon_set_old_icons_dir(const char *dirname);
 
+/* This is for the accounts code to tell the status code when an account
+ * connects or disconnects, since presence scores depend on which buddies
+ * can be sent offline messages. */
+void
+_purple_presence_scores_changed(void);
+
+/* This is for the status code to tell the buddy list that a buddy's
+ * status or idleness changed, so the contact's priority buddy can be
+ * updated without going through all of the contact's buddies. */
+void
+_purple_contact_buddy_presence_changed(PurpleBuddy *buddy);
+
+/* This is for the accounts code to have pending log activity scores
+ * saved while the accounts they belong to (and the config directory)
+ * are still around at shutdown. */
+void
+_purple_log_activity_flush(void);
+
 /**
  * Creates a connection to the specified account and either connects
  * or attempts to register a new account.  If you are logging in,
@@ -47,10 +47,29 @@ struct _purple_logsize_user {
 	PurpleAccount *account;
 };
 static GHashTable *logsize_users = NULL;
-static GHashTable *logsize_users_decayed = NULL;
+
+/* Activity score counts bytes in the log, exponentially decayed with a
+ * half-life of 14 days.  Scores are kept as the decayed total as of a
+ * timestamp, so they can be decayed to any later time in closed form and
+ * bumped as the loggers write.  They're saved in logactivity.xml, so the
+ * logs only ever need to be scanned for someone we have no score for. */
+#define LOG_ACTIVITY_HALF_LIFE 1209600.0
+
+struct _purple_log_activity {
+	double score;
+	time_t stamp;
+};
+static GHashTable *log_activity = NULL;
+static gboolean log_activity_loaded = FALSE;
+static guint log_activity_save_timer = 0;
 
 static void log_get_log_sets_common(GHashTable *sets);
 
+static struct _purple_log_activity *log_activity_lookup(struct _purple_logsize_user *lu);
+static void log_activity_add(struct _purple_log_activity *activity, gsize size, time_t when);
+static void log_activity_schedule_save(void);
+static void log_activity_sync(void);
+
 static void html_logger_create(PurpleLog *log);
 static gsize html_logger_write(PurpleLog *log, PurpleMessageFlags type,
 							  const char *from, time_t time, const char *message);
@@ -58,6 +77,7 @@ static void html_logger_finalize(PurpleLog *log);
 static GList *html_logger_list(PurpleLogType type, const char *sn, PurpleAccount *account);
 static GList *html_logger_list_syslog(PurpleAccount *account);
 static char *html_logger_read(PurpleLog *log, PurpleLogReadFlags *flags);
+static char *html_logger_read_tail(PurpleLog *log, gsize max, PurpleLogReadFlags *flags);
 static int html_logger_total_size(PurpleLogType type, const char *name, PurpleAccount *account);
 
 static GList *old_logger_list(PurpleLogType type, const char *sn, PurpleAccount *account);
@@ -75,6 +95,7 @@ static void txt_logger_finalize(PurpleLog *log);
 static GList *txt_logger_list(PurpleLogType type, const char *sn, PurpleAccount *account);
 static GList *txt_logger_list_syslog(PurpleAccount *account);
 static char *txt_logger_read(PurpleLog *log, PurpleLogReadFlags *flags);
+static char *txt_logger_read_tail(PurpleLog *log, gsize max, PurpleLogReadFlags *flags);
 static int txt_logger_total_size(PurpleLogType type, const char *name, PurpleAccount *account);
 
 /**************************************************************************
@@ -150,6 +171,7 @@ void purple_log_write(PurpleLog *log, PurpleMessageFlags type,
 		    const char *from, time_t time, const char *message)
 {
 	struct _purple_logsize_user *lu;
+	struct _purple_log_activity *activity;
 	gsize written, total = 0;
 	gpointer ptrsize;
 
@@ -164,24 +186,18 @@ void purple_log_write(PurpleLog *log, PurpleMessageFlags type,
 	lu->name = g_strdup(purple_normalize(log->account, log->name));
 	lu->account = log->account;
 
-	if(g_hash_table_lookup_extended(logsize_users, lu, NULL, &ptrsize)) {
-		char *tmp = lu->name;
-
-		total = GPOINTER_TO_INT(ptrsize);
-		total += written;
-		g_hash_table_replace(logsize_users, lu, GINT_TO_POINTER(total));
-
-		/* The hash table takes ownership of lu, so create a new one
-		 * for the logsize_users_decayed check below. */
-		lu = g_new(struct _purple_logsize_user, 1);
-		lu->name = g_strdup(tmp);
-		lu->account = log->account;
+	/* If there's no score yet, the logs get scanned when one is asked
+	 * for, and that will include what was just written. */
+	activity = log_activity_lookup(lu);
+	if (activity != NULL) {
+		log_activity_add(activity, written, time);
+		log_activity_schedule_save();
 	}
 
-	if(g_hash_table_lookup_extended(logsize_users_decayed, lu, NULL, &ptrsize)) {
+	if(g_hash_table_lookup_extended(logsize_users, lu, NULL, &ptrsize)) {
 		total = GPOINTER_TO_INT(ptrsize);
 		total += written;
-		g_hash_table_replace(logsize_users_decayed, lu, GINT_TO_POINTER(total));
+		g_hash_table_replace(logsize_users, lu, GINT_TO_POINTER(total));
 	} else {
 		g_free(lu->name);
 		g_free(lu);
@@ -194,12 +210,42 @@ char *purple_log_read(PurpleLog *log, PurpleLogReadFlags *flags)
 	g_return_val_if_fail(log && log->logger, NULL);
 	if (log->logger->read) {
 		char *ret = (log->logger->read)(log, flags ? flags : &mflags);
-		purple_str_strip_char(ret, '\r');
+		if (ret)
+			purple_str_strip_char(ret, '\r');
 		return ret;
 	}
 	return g_strdup(_("<b><font color=\"red\">The logger has no read function</font></b>"));
 }
 
+char *purple_log_read_tail(PurpleLog *log, gsize max, PurpleLogReadFlags *flags)
+{
+	PurpleLogReadFlags mflags;
+	char *ret, *start;
+	gsize len;
+
+	g_return_val_if_fail(log && log->logger, NULL);
+
+	if (log->logger->read_tail) {
+		ret = (log->logger->read_tail)(log, max, flags ? flags : &mflags);
+		if (ret)
+			purple_str_strip_char(ret, '\r');
+		return ret;
+	}
+
+	/* Read the whole thing and keep the lines that fit */
+	ret = purple_log_read(log, flags);
+	if (ret == NULL)
+		return NULL;
+
+	len = strlen(ret);
+	if (len > max) {
+		start = strchr(ret + len - max, '\n');
+		start = start ? start + 1 : ret + len;
+		memmove(ret, start, ret + len - start + 1);
+	}
+	return ret;
+}
+
 int purple_log_get_size(PurpleLog *log)
 {
 	g_return_val_if_fail(log && log->logger, 0);
@@ -226,6 +272,140 @@ static void _purple_logsize_user_free_key(struct _purple_logsize_user *lu)
 	g_free(lu);
 }
 
+static void log_activity_add(struct _purple_log_activity *activity, gsize size, time_t when)
+{
+	if (when > activity->stamp) {
+		/* Bring the total forward to the new timestamp first. */
+		activity->score = activity->score *
+			pow(0.5, difftime(when, activity->stamp) / LOG_ACTIVITY_HALF_LIFE) + size;
+		activity->stamp = when;
+	} else {
+		activity->score += size *
+			pow(0.5, difftime(activity->stamp, when) / LOG_ACTIVITY_HALF_LIFE);
+	}
+}
+
+static void log_activity_load(void)
+{
+	xmlnode *root, *entry;
+
+	log_activity_loaded = TRUE;
+
+	root = purple_util_read_xml_from_file("logactivity.xml",
+			_("log activity scores"));
+	if (root == NULL)
+		return;
+
+	for (entry = xmlnode_get_child(root, "entry"); entry != NULL;
+			entry = xmlnode_get_next_twin(entry)) {
+		const char *protocol = xmlnode_get_attrib(entry, "protocol");
+		const char *username = xmlnode_get_attrib(entry, "account");
+		const char *name = xmlnode_get_attrib(entry, "name");
+		const char *score = xmlnode_get_attrib(entry, "score");
+		const char *stamp = xmlnode_get_attrib(entry, "stamp");
+		struct _purple_logsize_user *lu;
+		struct _purple_log_activity *activity;
+		PurpleAccount *account;
+
+		if (!protocol || !username || !name || !score || !stamp)
+			continue;
+
+		/* Scores for accounts that are gone are dropped on the next save. */
+		account = purple_accounts_find(username, protocol);
+		if (account == NULL)
+			continue;
+
+		lu = g_new(struct _purple_logsize_user, 1);
+		lu->name = g_strdup(name);
+		lu->account = account;
+
+		activity = g_new(struct _purple_log_activity, 1);
+		activity->score = g_ascii_strtod(score, NULL);
+		activity->stamp = (time_t)g_ascii_strtoll(stamp, NULL, 10);
+
+		g_hash_table_replace(log_activity, lu, activity);
+	}
+
+	xmlnode_free(root);
+}
+
+static struct _purple_log_activity *log_activity_lookup(struct _purple_logsize_user *lu)
+{
+	if (!log_activity_loaded)
+		log_activity_load();
+
+	return g_hash_table_lookup(log_activity, lu);
+}
+
+static void log_activity_sync(void)
+{
+	GHashTableIter iter;
+	struct _purple_logsize_user *lu;
+	struct _purple_log_activity *activity;
+	xmlnode *root;
+	char *data;
+
+	root = xmlnode_new("logactivity");
+	xmlnode_set_attrib(root, "version", "1.0");
+
+	g_hash_table_iter_init(&iter, log_activity);
+	while (g_hash_table_iter_next(&iter, (gpointer *)&lu, (gpointer *)&activity)) {
+		xmlnode *entry = xmlnode_new_child(root, "entry");
+		char buf[G_ASCII_DTOSTR_BUF_SIZE];
+
+		xmlnode_set_attrib(entry, "protocol",
+				purple_account_get_protocol_id(lu->account));
+		xmlnode_set_attrib(entry, "account",
+				purple_account_get_username(lu->account));
+		xmlnode_set_attrib(entry, "name", lu->name);
+		xmlnode_set_attrib(entry, "score",
+				g_ascii_formatd(buf, sizeof(buf), "%.1f", activity->score));
+		g_snprintf(buf, sizeof(buf), "%" G_GINT64_FORMAT, (gint64)activity->stamp);
+		xmlnode_set_attrib(entry, "stamp", buf);
+	}
+
+	data = xmlnode_to_formatted_str(root, NULL);
+	purple_util_write_data_to_file("logactivity.xml", data, -1);
+	g_free(data);
+	xmlnode_free(root);
+}
+
+static gboolean log_activity_save_cb(gpointer data)
+{
+	log_activity_sync();
+	log_activity_save_timer = 0;
+	return FALSE;
+}
+
+static void log_activity_schedule_save(void)
+{
+	/* Scores only move slowly, so there's no hurry to save them. */
+	if (log_activity_save_timer == 0)
+		log_activity_save_timer = purple_timeout_add_seconds(60,
+				log_activity_save_cb, NULL);
+}
+
+void _purple_log_activity_flush(void)
+{
+	if (log_activity_save_timer != 0) {
+		purple_timeout_remove(log_activity_save_timer);
+		log_activity_save_timer = 0;
+		log_activity_sync();
+	}
+}
+
+static void log_activity_account_removed_cb(PurpleAccount *account, gpointer data)
+{
+	GHashTableIter iter;
+	struct _purple_logsize_user *lu;
+
+	g_hash_table_iter_init(&iter, log_activity);
+	while (g_hash_table_iter_next(&iter, (gpointer *)&lu, NULL)) {
+		if (lu->account == account)
+			g_hash_table_iter_remove(&iter);
+	}
+}
+
 int purple_log_get_total_size(PurpleLogType type, const char *name, PurpleAccount *account)
 {
 	gpointer ptrsize;
@@ -269,23 +449,19 @@ int purple_log_get_total_size(PurpleLogType type, const char *name, PurpleAccoun
 
 gint purple_log_get_activity_score(PurpleLogType type, const char *name, PurpleAccount *account)
 {
-	gpointer ptrscore;
-	int score;
+	struct _purple_logsize_user lu;
+	struct _purple_log_activity *activity;
 	GSList *n;
-	struct _purple_logsize_user *lu;
 	time_t now;
 	time(&now);
 
-	lu = g_new(struct _purple_logsize_user, 1);
-	lu->name = g_strdup(purple_normalize(account, name));
-	lu->account = account;
+	lu.name = (char *)purple_normalize(account, name);
+	lu.account = account;
+
+	activity = log_activity_lookup(&lu);
+	if (activity == NULL) {
+		activity = g_new0(struct _purple_log_activity, 1);
 
-	if(g_hash_table_lookup_extended(logsize_users_decayed, lu, NULL, &ptrscore)) {
-		score = GPOINTER_TO_INT(ptrscore);
-		g_free(lu->name);
-		g_free(lu);
-	} else {
-		double score_double = 0.0;
 		for (n = loggers; n; n = n->next) {
 			PurpleLogLogger *logger = n->data;
 
@@ -294,20 +470,25 @@ gint purple_log_get_activity_score(PurpleLogType type, const char *name, PurpleA
 
 				while (logs) {
 					PurpleLog *log = (PurpleLog*)(logs->data);
-					/* Activity score counts bytes in the log, exponentially
-					   decayed with a half-life of 14 days. */
-					score_double += purple_log_get_size(log) *
-						pow(0.5, difftime(now, log->time)/1209600.0);
+					log_activity_add(activity, purple_log_get_size(log),
+							log->time);
 					purple_log_free(log);
 					logs = g_list_delete_link(logs, logs);
 				}
 			}
 		}
 
-		score = (gint) ceil(score_double);
-		g_hash_table_replace(logsize_users_decayed, lu, GINT_TO_POINTER(score));
+		if (activity->stamp == 0)
+			activity->stamp = now;
+
+		lu.name = g_strdup(lu.name);
+		g_hash_table_replace(log_activity,
+				g_memdup2(&lu, sizeof(lu)), activity);
+		log_activity_schedule_save();
 	}
-	return score;
+
+	return (gint) ceil(activity->score *
+			pow(0.5, difftime(now, activity->stamp) / LOG_ACTIVITY_HALF_LIFE));
 }
 
 gboolean purple_log_is_deletable(PurpleLog *log)
@@ -329,8 +510,22 @@ gboolean purple_log_delete(PurpleLog *log)
 	g_return_val_if_fail(log != NULL, FALSE);
 	g_return_val_if_fail(log->logger != NULL, FALSE);
 
-	if (log->logger->remove != NULL)
-		return log->logger->remove(log);
+	if (log->logger->remove != NULL) {
+		if (!log->logger->remove(log))
+			return FALSE;
+
+		/* Rescan for a fresh score the next time it's asked for. */
+		if (log_activity != NULL) {
+			struct _purple_logsize_user lu;
+
+			lu.name = (char *)purple_normalize(log->account, log->name);
+			lu.account = log->account;
+			if (g_hash_table_remove(log_activity, &lu))
+				log_activity_schedule_save();
+		}
+
+		return TRUE;
+	}
 
 	return FALSE;
 }
@@ -407,7 +602,8 @@ PurpleLogLogger *purple_log_logger_new(const char *id, const char *name, int fun
 				GList*(*list_syslog)(PurpleAccount *account),
 				void(*get_log_sets)(PurpleLogSetCallback cb, GHashTable *sets),
 				gboolean(*remove)(PurpleLog *log),
-				gboolean(*is_deletable)(PurpleLog *log))
+				gboolean(*is_deletable)(PurpleLog *log),
+				char*(*read_tail)(PurpleLog*, gsize, PurpleLogReadFlags*))
 #endif
 	PurpleLogLogger *logger;
 	va_list args;
@@ -446,6 +642,9 @@ PurpleLogLogger *purple_log_logger_new(const char *id, const char *name, int fun
 		logger->is_deletable = va_arg(args, void *);
 
 	if (functions >= 12)
+		logger->read_tail = va_arg(args, void *);
+
+	if (functions >= 13)
 		purple_debug_info("log", "Dropping new functions for logger: %s (%s)\n", name, id);
 
 	va_end(args);
@@ -654,7 +853,7 @@ void purple_log_init(void)
 
 	purple_prefs_add_string("/purple/logging/format", "html");
 
-	html_logger = purple_log_logger_new("html", _("HTML"), 11,
+	html_logger = purple_log_logger_new("html", _("HTML"), 12,
 									  html_logger_create,
 									  html_logger_write,
 									  html_logger_finalize,
@@ -665,10 +864,11 @@ void purple_log_init(void)
 									  html_logger_list_syslog,
 									  NULL,
 									  purple_log_common_deleter,
-									  purple_log_common_is_deletable);
+									  purple_log_common_is_deletable,
+									  html_logger_read_tail);
 	purple_log_logger_add(html_logger);
 
-	txt_logger = purple_log_logger_new("txt", _("Plain text"), 11,
+	txt_logger = purple_log_logger_new("txt", _("Plain text"), 12,
 									 txt_logger_create,
 									 txt_logger_write,
 									 txt_logger_finalize,
@@ -679,7 +879,8 @@ void purple_log_init(void)
 									 txt_logger_list_syslog,
 									 NULL,
 									 purple_log_common_deleter,
-									 purple_log_common_is_deletable);
+									 purple_log_common_is_deletable,
+									 txt_logger_read_tail);
 	purple_log_logger_add(txt_logger);
 
 	old_logger = purple_log_logger_new("old", _("Old flat format"), 9,
@@ -721,15 +922,26 @@ void purple_log_init(void)
 	logsize_users = g_hash_table_new_full((GHashFunc)_purple_logsize_user_hash,
 			(GEqualFunc)_purple_logsize_user_equal,
 			(GDestroyNotify)_purple_logsize_user_free_key, NULL);
-	logsize_users_decayed = g_hash_table_new_full((GHashFunc)_purple_logsize_user_hash,
+	log_activity = g_hash_table_new_full((GHashFunc)_purple_logsize_user_hash,
 				(GEqualFunc)_purple_logsize_user_equal,
-				(GDestroyNotify)_purple_logsize_user_free_key, NULL);
+				(GDestroyNotify)_purple_logsize_user_free_key, g_free);
+
+	purple_signal_connect(purple_accounts_get_handle(), "account-removed",
+			handle, PURPLE_CALLBACK(log_activity_account_removed_cb), NULL);
 }
 
 void
 purple_log_uninit(void)
 {
 	purple_signals_unregister_by_instance(purple_log_get_handle());
+	purple_signals_disconnect_by_handle(purple_log_get_handle());
+
+	/* Anything still pending was saved by _purple_log_activity_flush, while
+	 * the accounts were still around; it's too late to write it now. */
+	if (log_activity_save_timer != 0) {
+		purple_timeout_remove(log_activity_save_timer);
+		log_activity_save_timer = 0;
+	}
 
 	purple_log_logger_remove(html_logger);
 	purple_log_logger_free(html_logger);
@@ -744,7 +956,9 @@ purple_log_uninit(void)
 	old_logger = NULL;
 
 	g_hash_table_destroy(logsize_users);
-	g_hash_table_destroy(logsize_users_decayed);
+	g_hash_table_destroy(log_activity);
+	log_activity = NULL;
+	log_activity_loaded = FALSE;
 }
 
 /****************************************************************************
@@ -1166,6 +1380,58 @@ static void log_get_log_sets_common(GHashTable *sets)
 	g_dir_close(log_dir);
 }
 
+char *purple_log_common_tail_reader(PurpleLog *log, gsize max, gboolean *header)
+{
+	PurpleLogCommonLoggerData *data;
+	struct stat st;
+	FILE *file;
+	char *read, *start;
+	off_t offset = 0;
+	gsize len;
+
+	g_return_val_if_fail(log != NULL, NULL);
+
+	if (header)
+		*header = TRUE;
+
+	data = log->logger_data;
+	if (data == NULL || data->path == NULL || g_stat(data->path, &st))
+		return NULL;
+
+	file = g_fopen(data->path, "rb");
+	if (file == NULL)
+		return NULL;
+
+	/* Start one byte early so a line beginning exactly at the cut
+	 * is kept: everything up to the first newline gets dropped. */
+	len = st.st_size;
+	if (len > max) {
+		offset = st.st_size - max - 1;
+		len = max + 1;
+	}
+
+	if (offset > 0 && fseek(file, offset, SEEK_SET) != 0) {
+		purple_debug_error("log", "Unable to seek in log file: %s\n", data->path);
+		fclose(file);
+		return NULL;
+	}
+
+	read = g_malloc(len + 1);
+	len = fread(read, 1, len, file);
+	fclose(file);
+	read[len] = '\0';
+
+	if (offset > 0) {
+		if (header)
+			*header = FALSE;
+		start = strchr(read, '\n');
+		start = start ? start + 1 : read + len;
+		memmove(read, start, read + len - start + 1);
+	}
+
+	return read;
+}
+
 gboolean purple_log_common_deleter(PurpleLog *log)
 {
 	PurpleLogCommonLoggerData *data;
@@ -1530,6 +1796,24 @@ static char *html_logger_read(PurpleLog *log, PurpleLogReadFlags *flags)
 	return g_strdup_printf(_("<font color=\"red\"><b>Could not read file: %s</b></font>"), data->path);
 }
 
+static char *html_logger_read_tail(PurpleLog *log, gsize max, PurpleLogReadFlags *flags)
+{
+	gboolean header;
+	char *read = purple_log_common_tail_reader(log, max, &header);
+
+	if (read == NULL)
+		return html_logger_read(log, flags);
+
+	*flags = PURPLE_LOG_READ_NO_NEWLINE;
+	if (header) {
+		char *minus_header = strchr(read, '\n');
+
+		if (minus_header)
+			memmove(read, minus_header + 1, strlen(minus_header + 1) + 1);
+	}
+	return read;
+}
+
 static int html_logger_total_size(PurpleLogType type, const char *name, PurpleAccount *account)
 {
 	return purple_log_common_total_sizer(type, name, account, ".html");
@@ -1671,6 +1955,24 @@ static char *txt_logger_read(PurpleLog *log, PurpleLogReadFlags *flags)
 	return g_strdup_printf(_("<font color=\"red\"><b>Could not read file: %s</b></font>"), data->path);
 }
 
+static char *txt_logger_read_tail(PurpleLog *log, gsize max, PurpleLogReadFlags *flags)
+{
+	gboolean header;
+	char *read = purple_log_common_tail_reader(log, max, &header);
+
+	if (read == NULL)
+		return txt_logger_read(log, flags);
+
+	*flags = 0;
+	if (header) {
+		char *minus_header = strchr(read, '\n');
+
+		if (minus_header)
+			return process_txt_log(minus_header + 1, read);
+	}
+	return process_txt_log(read, NULL);
+}
+
 static int txt_logger_total_size(PurpleLogType type, const char *name, PurpleAccount *account)
 {
 	return purple_log_common_total_sizer(type, name, account, ".txt");
@@ -112,7 +112,12 @@ struct _PurpleLogLogger {
 	/* Tests whether a log is deletable */
 	gboolean (*is_deletable)(PurpleLog *log);
 
-	void (*_purple_reserved1)(void);
+	/** Like read, but only returns roughly the last @a max bytes of the
+	 *  log, starting at a line boundary.  If this is undefined, the whole
+	 *  log is read and cut down.
+	 *  @since 2.15.0 */
+	char *(*read_tail)(PurpleLog *log, gsize max, PurpleLogReadFlags *flags);
+
 	void (*_purple_reserved2)(void);
 	void (*_purple_reserved3)(void);
 	void (*_purple_reserved4)(void);
@@ -239,6 +244,23 @@ void purple_log_write(PurpleLog *log,
  */
 char *purple_log_read(PurpleLog *log, PurpleLogReadFlags *flags);
 
+/**
+ * Reads the end of a log
+ *
+ * This reads only the last @a max bytes or so of the log, starting at a
+ * line boundary, so showing the end of a long log doesn't mean reading
+ * all of it.  The result may be empty if the last line alone is longer
+ * than @a max.
+ *
+ * @param log   The log to read from
+ * @param max   The most bytes of the log to read
+ * @param flags The returned logging flags.
+ *
+ * @return The end of this log in Purple Markup.
+ * @since 2.15.0
+ */
+char *purple_log_read_tail(PurpleLog *log, gsize max, PurpleLogReadFlags *flags);
+
 /**
  * Returns a list of all available logs
  *
@@ -297,6 +319,10 @@ int purple_log_get_total_size(PurpleLogType type, const char *name, PurpleAccoun
  * Returns the activity score of a log, based on total size in bytes,
  * which is then decayed based on age
  *
+ * Scores are kept up to date as logs are written and saved between
+ * sessions, so the logs are only read the first time a score is asked
+ * for.
+ *
  * @param type                The type of the log
  * @param name                The name of the log
  * @param account             The account
@@ -446,6 +472,25 @@ int purple_log_common_total_sizer(PurpleLogType type, const char *name,
  */
 int purple_log_common_sizer(PurpleLog *log);
 
+/**
+ * Reads the end of a log file
+ *
+ * This function should only be used with logs that are written
+ * with purple_log_common_writer().  It's intended to be used by
+ * a logger's @c read_tail function, which turns what it returns into
+ * markup.  It seeks to the last @a max bytes of the file and skips
+ * ahead to the start of a line.
+ *
+ * @param log      The PurpleLog to read from.
+ * @param max      The most bytes to read.
+ * @param header   Set to whether the file was read from its start, in
+ *                 which case the result begins with the log's header line.
+ *
+ * @return The end of the log file, or @c NULL if it could not be read.
+ * @since 2.15.0
+ */
+char *purple_log_common_tail_reader(PurpleLog *log, gsize max, gboolean *header);
+
 /**
  * Deletes a log
  *
@@ -492,7 +537,7 @@ gboolean purple_log_common_is_deletable(PurpleLog *log);
  *                     functions are currently available (in order): @c create,
  *                     @c write, @c finalize, @c list, @c read, @c size,
  *                     @c total_size, @c list_syslog, @c get_log_sets,
- *                     @c remove, @c is_deletable.
+ *                     @c remove, @c is_deletable, @c read_tail.
  *                     For details on these functions, see PurpleLogLogger.
  *                     Functions may not be skipped. For example, passing
  *                     @c create and @c write is acceptable (for a total of
@@ -318,8 +318,8 @@ bonjour_convo_closed(PurpleConnection *connection, const char *who)
 		return;
 	}
 
-	bonjour_jabber_close_conversation(bb->conversation);
-	bb->conversation = NULL;
+	if (bonjour_jabber_release_conversation(bb->conversation))
+		bb->conversation = NULL;
 }
 
 static
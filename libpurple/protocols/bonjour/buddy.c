@@ -249,6 +249,42 @@ void bonjour_buddy_got_buddy_icon(BonjourBuddy *buddy, gconstpointer data, gsize
 	g_free(hash);
 }
 
+/* The address index lives with the jabber data of the connection */
+static BonjourJabber *
+_buddy_jabber_data(BonjourBuddy *buddy)
+{
+	PurpleConnection *gc = purple_account_get_connection(buddy->account);
+	BonjourData *bd = gc ? gc->proto_data : NULL;
+
+	return bd ? bd->jabber_data : NULL;
+}
+
+void
+bonjour_buddy_add_ip(BonjourBuddy *buddy, gchar *ip, gboolean prefer)
+{
+	BonjourJabber *jdata = _buddy_jabber_data(buddy);
+
+	if (prefer)
+		buddy->ips = g_slist_prepend(buddy->ips, ip);
+	else
+		buddy->ips = g_slist_append(buddy->ips, ip);
+
+	if (jdata != NULL)
+		bonjour_jabber_index_ip(jdata, buddy, ip);
+}
+
+void
+bonjour_buddy_remove_ip(BonjourBuddy *buddy, gchar *ip)
+{
+	BonjourJabber *jdata = _buddy_jabber_data(buddy);
+
+	if (jdata != NULL)
+		bonjour_jabber_unindex_ip(jdata, buddy, ip);
+
+	buddy->ips = g_slist_remove(buddy->ips, ip);
+	g_free(ip);
+}
+
 /**
  * Deletes a buddy from memory.
  */
@@ -256,10 +292,8 @@ void
 bonjour_buddy_delete(BonjourBuddy *buddy)
 {
 	g_free(buddy->name);
-	while (buddy->ips != NULL) {
-		g_free(buddy->ips->data);
-		buddy->ips = g_slist_delete_link(buddy->ips, buddy->ips);
-	}
+	while (buddy->ips != NULL)
+		bonjour_buddy_remove_ip(buddy, buddy->ips->data);
 	g_free(buddy->first);
 	g_free(buddy->phsh);
 	g_free(buddy->status);
@@ -106,6 +106,18 @@ void bonjour_buddy_signed_off(PurpleBuddy *purple_buddy);
  */
 void bonjour_buddy_got_buddy_icon(BonjourBuddy *buddy, gconstpointer data, gsize len);
 
+/**
+ * Adds an address for the buddy, taking ownership of ip. Preferred addresses
+ * go at the front of the list, the others at the end.
+ */
+void bonjour_buddy_add_ip(BonjourBuddy *buddy, gchar *ip, gboolean prefer);
+
+/**
+ * Removes and frees an address of the buddy. ip must be the entry in
+ * buddy->ips itself, as duplicates are kept.
+ */
+void bonjour_buddy_remove_ip(BonjourBuddy *buddy, gchar *ip);
+
 /**
  * Deletes a buddy from memory.
  */
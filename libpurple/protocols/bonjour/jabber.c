@@ -71,6 +71,11 @@
 #endif
 
 #define STREAM_END "</stream:stream>"
+
+/* How long, in seconds, a stream is kept after its conversation is closed,
+ * and how many such streams are kept at most. */
+#define IDLE_STREAM_TIMEOUT 300
+#define IDLE_STREAMS_MAX 32
 /* TODO: specify version='1.0' and send stream features */
 #define DOCTYPE "<?xml version=\"1.0\" encoding=\"UTF-8\" ?>\n" \
 		"<stream:stream xmlns=\"jabber:client\" xmlns:stream=\"http://etherx.jabber.org/streams\" from=\"%s\" to=\"%s\">"
@@ -236,38 +241,137 @@ _jabber_parse_and_write_message_to_ui(xmlnode *message_node, PurpleBuddy *pb)
 	g_free(body);
 }
 
-struct _match_buddies_by_address_t {
-	const char *address;
-	GSList *matched_buddies;
-};
+void
+bonjour_jabber_index_ip(BonjourJabber *jdata, BonjourBuddy *bb, const char *ip)
+{
+	gchar *key;
+	GSList *list;
 
+	if (jdata->buddies_by_ip == NULL || ip == NULL)
+		return;
+
+	/* A buddy is listed once per entry in bb->ips, duplicates included */
+	key = g_ascii_strdown(ip, -1);
+	list = g_hash_table_lookup(jdata->buddies_by_ip, key);
+	g_hash_table_insert(jdata->buddies_by_ip, key, g_slist_prepend(list, bb));
+}
+
+void
+bonjour_jabber_unindex_ip(BonjourJabber *jdata, BonjourBuddy *bb, const char *ip)
+{
+	gchar *key;
+	GSList *list;
+
+	if (jdata->buddies_by_ip == NULL || ip == NULL)
+		return;
+
+	key = g_ascii_strdown(ip, -1);
+	list = g_slist_remove(g_hash_table_lookup(jdata->buddies_by_ip, key), bb);
+	if (list != NULL)
+		g_hash_table_insert(jdata->buddies_by_ip, key, list);
+	else {
+		g_hash_table_remove(jdata->buddies_by_ip, key);
+		g_free(key);
+	}
+}
+
+/* Returns the buddies in the buddy list that announce address */
+static GSList *
+_match_buddies_by_address(BonjourJabber *jdata, const char *address)
+{
+	GSList *matched_buddies = NULL, *l;
+	gchar *key;
+
+	if (jdata->buddies_by_ip == NULL || address == NULL)
+		return NULL;
+
+	key = g_ascii_strdown(address, -1);
+	l = g_hash_table_lookup(jdata->buddies_by_ip, key);
+	g_free(key);
+
+	for (; l != NULL; l = l->next) {
+		BonjourBuddy *bb = l->data;
+		PurpleBuddy *pb = purple_find_buddy(jdata->account, bb->name);
+
+		if (pb != NULL && purple_buddy_get_protocol_data(pb) == bb
+				&& g_slist_find(matched_buddies, pb) == NULL)
+			matched_buddies = g_slist_prepend(matched_buddies, pb);
+	}
+
+	return matched_buddies;
+}
+
+/* Take a stream out of the idle pool, because it is being used again */
 static void
-_match_buddies_by_address(gpointer value, gpointer data)
+_conv_unpool(BonjourJabberConversation *bconv)
 {
-	PurpleBuddy *pb = value;
-	BonjourBuddy *bb = NULL;
-	struct _match_buddies_by_address_t *mbba = data;
+	if (bconv->idle_link != NULL) {
+		BonjourData *bd = bconv->account->gc->proto_data;
 
-	bb = purple_buddy_get_protocol_data(pb);
+		g_queue_delete_link(&bd->jabber_data->idle_conversations, bconv->idle_link);
+		bconv->idle_link = NULL;
+	}
+	if (bconv->idle_timeout != 0) {
+		purple_timeout_remove(bconv->idle_timeout);
+		bconv->idle_timeout = 0;
+	}
+}
 
-	/*
-	 * If the current PurpleBuddy's data is not null, then continue to determine
-	 * whether one of the buddies IPs matches the target IP.
-	 */
-	if (bb != NULL)
-	{
-		const char *ip;
-		GSList *tmp = bb->ips;
+static void
+_close_pooled_conversation(BonjourJabberConversation *bconv)
+{
+	BonjourBuddy *bb = purple_buddy_get_protocol_data(bconv->pb);
 
-		while(tmp) {
-			ip = tmp->data;
-			if (ip != NULL && g_ascii_strcasecmp(ip, mbba->address) == 0) {
-				mbba->matched_buddies = g_slist_prepend(mbba->matched_buddies, pb);
-				break;
-			}
-			tmp = tmp->next;
-		}
+	if (bb != NULL && bb->conversation == bconv)
+		bb->conversation = NULL;
+	bonjour_jabber_close_conversation(bconv);
+}
+
+static gboolean
+_idle_conversation_timeout_cb(gpointer data)
+{
+	BonjourJabberConversation *bconv = data;
+
+	bconv->idle_timeout = 0;
+	purple_debug_info("bonjour", "Closing idle stream with %s.\n",
+			purple_buddy_get_name(bconv->pb));
+	_close_pooled_conversation(bconv);
+
+	return FALSE;
+}
+
+gboolean
+bonjour_jabber_release_conversation(BonjourJabberConversation *bconv)
+{
+	BonjourJabber *jdata;
+
+	if (bconv == NULL)
+		return TRUE;
+
+	if (bconv->idle_link != NULL)
+		return FALSE;
+
+	/* Only a stream that is fully up and has nothing queued is worth keeping */
+	if (bconv->pb == NULL || bconv->socket < 0 || bconv->connect_data != NULL
+			|| bconv->sent_stream_start != FULLY_SENT || !bconv->recv_stream_start
+			|| purple_circ_buffer_get_max_read(bconv->tx_buf) > 0
+			|| !PURPLE_CONNECTION_IS_VALID(bconv->account->gc)) {
+		bonjour_jabber_close_conversation(bconv);
+		return TRUE;
 	}
+
+	jdata = ((BonjourData*) bconv->account->gc->proto_data)->jabber_data;
+
+	g_queue_push_tail(&jdata->idle_conversations, bconv);
+	bconv->idle_link = jdata->idle_conversations.tail;
+	bconv->idle_timeout = purple_timeout_add_seconds(IDLE_STREAM_TIMEOUT,
+			_idle_conversation_timeout_cb, bconv);
+
+	/* Evict the streams that have been idle longest */
+	while (g_queue_get_length(&jdata->idle_conversations) > IDLE_STREAMS_MAX)
+		_close_pooled_conversation(g_queue_peek_head(&jdata->idle_conversations));
+
+	return FALSE;
 }
 
 static void
@@ -373,8 +477,14 @@ void bonjour_jabber_process_packet(PurpleBuddy *pb, xmlnode *packet) {
 	g_return_if_fail(packet != NULL);
 	g_return_if_fail(pb != NULL);
 
-	if (purple_strequal(packet->name, "message"))
+	if (purple_strequal(packet->name, "message")) {
+		BonjourBuddy *bb = purple_buddy_get_protocol_data(pb);
+
+		/* The conversation is back in use */
+		if (bb != NULL && bb->conversation != NULL)
+			_conv_unpool(bb->conversation);
 		_jabber_parse_and_write_message_to_ui(packet, pb);
+	}
 	else if (purple_strequal(packet->name, "iq"))
 		xep_iq_parse(packet, pb);
 	else {
@@ -641,7 +751,6 @@ _server_socket_handler(gpointer data, int server_socket, PurpleInputCondition co
 	char addrstr[INET6_ADDRSTRLEN];
 #endif
 	const char *address_text;
-	struct _match_buddies_by_address_t *mbba;
 	BonjourJabberConversation *bconv;
 	GSList *buddies;
 
@@ -670,22 +779,15 @@ _server_socket_handler(gpointer data, int server_socket, PurpleInputCondition co
 	address_text = inet_ntoa(their_addr.in.sin_addr);
 #endif
 	purple_debug_info("bonjour", "Received incoming connection from %s.\n", address_text);
-	mbba = g_new0(struct _match_buddies_by_address_t, 1);
-	mbba->address = address_text;
+	buddies = _match_buddies_by_address(jdata, address_text);
 
-	buddies = purple_find_buddies(jdata->account, NULL);
-	g_slist_foreach(buddies, _match_buddies_by_address, mbba);
-	g_slist_free(buddies);
-
-	if (mbba->matched_buddies == NULL) {
+	if (buddies == NULL) {
 		purple_debug_info("bonjour", "We don't like invisible buddies, this is not a superheroes comic\n");
-		g_free(mbba);
 		close(client_socket);
 		return;
 	}
 
-	g_slist_free(mbba->matched_buddies);
-	g_free(mbba);
+	g_slist_free(buddies);
 
 	/* We've established that this *could* be from one of our buddies.
 	 * Wait for the stream open to see if that matches too before assigning it.
@@ -755,6 +857,9 @@ bonjour_jabber_start(BonjourJabber *jdata)
 {
 	int ipv6_port = -1, ipv4_port = -1;
 
+	jdata->buddies_by_ip = g_hash_table_new_full(g_str_hash, g_str_equal,
+			g_free, NULL);
+
 	/* Open a listening socket for incoming conversations */
 #ifdef PF_INET6
 	jdata->socket6 = socket(PF_INET6, SOCK_STREAM, 0);
@@ -961,22 +1066,16 @@ bonjour_jabber_conv_match_by_name(BonjourJabberConversation *bconv) {
 void
 bonjour_jabber_conv_match_by_ip(BonjourJabberConversation *bconv) {
 	BonjourJabber *jdata = ((BonjourData*) bconv->account->gc->proto_data)->jabber_data;
-	struct _match_buddies_by_address_t *mbba;
-	GSList *buddies;
-
-	mbba = g_new0(struct _match_buddies_by_address_t, 1);
-	mbba->address = bconv->ip;
+	GSList *matched_buddies;
 
-	buddies = purple_find_buddies(jdata->account, NULL);
-	g_slist_foreach(buddies, _match_buddies_by_address, mbba);
-	g_slist_free(buddies);
+	matched_buddies = _match_buddies_by_address(jdata, bconv->ip);
 
 	/* If there is exactly one match, use it */
-	if(mbba->matched_buddies != NULL) {
-		if(mbba->matched_buddies->next != NULL)
+	if(matched_buddies != NULL) {
+		if(matched_buddies->next != NULL)
 			purple_debug_error("bonjour", "More than one buddy matched for ip %s.\n", bconv->ip);
 		else {
-			PurpleBuddy *pb = mbba->matched_buddies->data;
+			PurpleBuddy *pb = matched_buddies->data;
 			BonjourBuddy *bb = purple_buddy_get_protocol_data(pb);
 
 			purple_debug_info("bonjour", "Matched buddy %s to incoming conversation using IP (%s)\n",
@@ -1003,8 +1102,7 @@ bonjour_jabber_conv_match_by_ip(BonjourJabberConversation *bconv) {
 		async_bonjour_jabber_close_conversation(bconv);
 	}
 
-	g_slist_free(mbba->matched_buddies);
-	g_free(mbba);
+	g_slist_free(matched_buddies);
 }
 
 static PurpleBuddy *
@@ -1022,7 +1120,9 @@ _find_or_start_conversation(BonjourJabber *jdata, const gchar *to)
 		return NULL;
 
 	/* Check if there is a previously open conversation */
-	if (bb->conversation == NULL)
+	if (bb->conversation != NULL)
+		_conv_unpool(bb->conversation);
+	else
 	{
 		PurpleProxyConnectData *connect_data;
 		PurpleProxyInfo *proxy_info;
@@ -1199,6 +1299,11 @@ bonjour_jabber_close_conversation(BonjourJabberConversation *bconv)
 		if (bconv->close_timeout != 0)
 			purple_timeout_remove(bconv->close_timeout);
 
+		if (bconv->idle_link != NULL && bd != NULL)
+			g_queue_delete_link(&bd->jabber_data->idle_conversations, bconv->idle_link);
+		if (bconv->idle_timeout != 0)
+			purple_timeout_remove(bconv->idle_timeout);
+
 		g_free(bconv->buddy_name);
 		g_free(bconv->ip);
 		g_free(bconv);
@@ -1241,6 +1346,17 @@ bonjour_jabber_stop(BonjourJabber *jdata)
 		bonjour_jabber_close_conversation(jdata->pending_conversations->data);
 		jdata->pending_conversations = g_slist_delete_link(jdata->pending_conversations, jdata->pending_conversations);
 	}
+
+	if (jdata->buddies_by_ip != NULL) {
+		GHashTableIter iter;
+		GSList *list;
+
+		g_hash_table_iter_init(&iter, jdata->buddies_by_ip);
+		while (g_hash_table_iter_next(&iter, NULL, (gpointer *)&list))
+			g_slist_free(list);
+		g_hash_table_destroy(jdata->buddies_by_ip);
+		jdata->buddies_by_ip = NULL;
+	}
 }
 
 XepIq *
@@ -42,6 +42,10 @@ typedef struct _BonjourJabber
 	gint watcher_id6;
 	PurpleAccount *account;
 	GSList *pending_conversations;
+	/* Lower-cased address -> GSList of the BonjourBuddys announcing it */
+	GHashTable *buddies_by_ip;
+	/* Established streams kept open after their conversation was closed */
+	GQueue idle_conversations;
 } BonjourJabber;
 
 typedef struct _BonjourJabberConversation
@@ -65,8 +69,14 @@ typedef struct _BonjourJabberConversation
 	gchar *ip;
 	/* This points to a data entry in BonjourBuddy->ips */
 	const gchar *ip_link;
+
+	/* Set while the stream is in the idle pool */
+	GList *idle_link;
+	guint idle_timeout;
 } BonjourJabberConversation;
 
+struct _BonjourBuddy;
+
 /**
  * Start listening for jabber connections.
  *
@@ -81,6 +91,23 @@ void bonjour_jabber_close_conversation(BonjourJabberConversation *bconv);
 
 void async_bonjour_jabber_close_conversation(BonjourJabberConversation *bconv);
 
+/**
+ * Called when the conversation with a buddy is closed. An established stream
+ * is kept open for a while, so talking to the buddy again doesn't need a new
+ * connection; anything else is closed.
+ *
+ * @return TRUE if the conversation was closed and must be detached from
+ *         the buddy.
+ */
+gboolean bonjour_jabber_release_conversation(BonjourJabberConversation *bconv);
+
+/**
+ * Maintain the index used to find the buddies an incoming connection
+ * could be from.
+ */
+void bonjour_jabber_index_ip(BonjourJabber *jdata, struct _BonjourBuddy *bb, const char *ip);
+void bonjour_jabber_unindex_ip(BonjourJabber *jdata, struct _BonjourBuddy *bb, const char *ip);
+
 void bonjour_jabber_stream_started(BonjourJabberConversation *bconv);
 
 void bonjour_jabber_process_packet(PurpleBuddy *pb, xmlnode *packet);
@@ -187,18 +187,12 @@ _resolver_callback(AvahiServiceResolver *r, AvahiIfIndex interface, AvahiProtoco
 
 			if (rd->ip == NULL || !purple_strequal(rd->ip, ip)) {
 				/* We store duplicates in bb->ips, so we always remove the one */
-				if (rd->ip != NULL) {
-					bb->ips = g_slist_remove(bb->ips, rd->ip);
-					g_free((gchar *) rd->ip);
-				}
+				if (rd->ip != NULL)
+					bonjour_buddy_remove_ip(bb, (gchar *) rd->ip);
 				/* IPv6 goes at the front of the list and IPv4 at the end so that we "prefer" IPv6, if present */
-				if (protocol == AVAHI_PROTO_INET6) {
-					rd->ip = g_strdup_printf("%s", ip);
-					bb->ips = g_slist_prepend(bb->ips, (gchar *) rd->ip);
-				} else {
-					rd->ip = g_strdup(ip);
-					bb->ips = g_slist_append(bb->ips, (gchar *) rd->ip);
-				}
+				rd->ip = g_strdup(ip);
+				bonjour_buddy_add_ip(bb, (gchar *) rd->ip,
+						protocol == AVAHI_PROTO_INET6);
 			}
 
 			bb->port_p2pj = port;
@@ -294,10 +288,8 @@ _browser_callback(AvahiServiceBrowser *b, AvahiIfIndex interface,
 					AvahiSvcResolverData *rd = l->data;
 					b_impl->resolvers = g_slist_remove(b_impl->resolvers, rd);
 					/* This IP is no longer available */
-					if (rd->ip != NULL) {
-						bb->ips = g_slist_remove(bb->ips, rd->ip);
-						g_free((gchar *) rd->ip);
-					}
+					if (rd->ip != NULL)
+						bonjour_buddy_remove_ip(bb, (gchar *) rd->ip);
 					_cleanup_resolver_data(rd);
 
 					/* If this was the last resolver, remove the buddy */
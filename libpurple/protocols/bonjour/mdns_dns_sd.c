@@ -207,8 +207,8 @@ _mdns_resolve_host_callback(DNSServiceRef sdRef, DNSServiceFlags flags,
 
 			purple_debug_info("bonjour", "Found buddy %s at %s:%d\n", args->bb->name, ip, args->bb->port_p2pj);
 
-			args->bb->ips = g_slist_prepend(args->bb->ips, g_strdup(ip));
-			args->res_data->ip = args->bb->ips->data;
+			args->res_data->ip = g_strdup(ip);
+			bonjour_buddy_add_ip(args->bb, (gchar *) args->res_data->ip, TRUE);
 
 			args->res_data->txt_query = g_new(DnsSDServiceRefHandlerData, 1);
 			args->res_data->txt_query->sdRef = txt_query_sr;
@@ -433,10 +433,8 @@ _mdns_service_browse_callback(DNSServiceRef sdRef, DNSServiceFlags flags, uint32
 				Win32SvcResolverData *rd = l->data;
 				idata->resolvers = g_slist_delete_link(idata->resolvers, l);
 				/* This IP is no longer available */
-				if (rd->ip != NULL) {
-					bb->ips = g_slist_remove(bb->ips, rd->ip);
-					g_free((gchar *) rd->ip);
-				}
+				if (rd->ip != NULL)
+					bonjour_buddy_remove_ip(bb, (gchar *) rd->ip);
 				_cleanup_resolver_data(rd);
 
 				/* If this was the last resolver, remove the buddy */
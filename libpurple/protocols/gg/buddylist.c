@@ -23,6 +23,8 @@
 
 #include <libgadu.h>
 
+#include <glib/gstdio.h>
+
 #include "gg.h"
 #include "gg-utils.h"
 #include "buddylist.h"
@@ -74,86 +76,261 @@ void ggp_buddylist_send(PurpleConnection *gc)
 }
 /* }}} */
 
-/* void ggp_buddylist_load(PurpleConnection *gc, char *buddylist) {{{ */
-void ggp_buddylist_load(PurpleConnection *gc, char *buddylist)
+/*
+ * The userlist is read incrementally: each block of input is split into
+ * lines as it arrives and every complete line is parsed right away,
+ * instead of reading the whole file and splitting it into an array of
+ * lines first. The buddies found are added to the buddy list in one pass
+ * at the end.
+ */
+typedef struct {
+	gchar *name;
+	gchar *alias;
+	gchar *group;
+} ggp_buddylist_entry;
+
+struct _GGPBuddylistParser {
+	PurpleConnection *gc;
+	GIConv cd;		/* CP1250 to UTF-8 */
+	GString *line;		/* the incomplete last line, still in CP1250 */
+	int lineno;
+	GHashTable *seen;	/* UINs already in the list, to skip repeats */
+	GQueue entries;		/* of ggp_buddylist_entry */
+	gint64 started;		/* for the summary, in microseconds */
+};
+
+/* GGPBuddylistParser *ggp_buddylist_parser_new(PurpleConnection *gc) {{{ */
+GGPBuddylistParser *ggp_buddylist_parser_new(PurpleConnection *gc)
 {
-	PurpleBuddy *buddy;
-	PurpleGroup *group;
-	gchar **users_tbl;
-	int i;
-	char *utf8buddylist = charset_convert(buddylist, "CP1250", "UTF-8");
-
-	/* Don't limit the number of records in a buddylist. */
-	users_tbl = g_strsplit(utf8buddylist, "\r\n", -1);
-
-	for (i = 0; users_tbl[i] != NULL; i++) {
-		gchar **data_tbl;
-		gchar *name, *show, *g;
-
-		if (strlen(users_tbl[i]) == 0)
-			continue;
-
-		data_tbl = g_strsplit(users_tbl[i], ";", 8);
-		if (ggp_array_size(data_tbl) < 8) {
-			purple_debug_warning("gg",
-				"Something is wrong on line %d of the buddylist. Skipping.\n",
-				i + 1);
-			continue;
-		}
+	GGPBuddylistParser *parser = g_new0(GGPBuddylistParser, 1);
 
-		show = data_tbl[F_NICKNAME];
-		name = data_tbl[F_UIN];
-		if ('\0' == *name || !atol(name)) {
-			purple_debug_warning("gg",
-				"Identifier on line %d of the buddylist is not a number. Skipping.\n",
-				i + 1);
-			continue;
-		}
+	parser->gc = gc;
+	parser->cd = g_iconv_open("UTF-8", "CP1250");
+	parser->line = g_string_sized_new(128);
+	parser->seen = g_hash_table_new(g_str_hash, g_str_equal);
+	g_queue_init(&parser->entries);
+	parser->started = g_get_monotonic_time();
 
-		if ('\0' == *show) {
-			show = name;
-		}
+	return parser;
+}
+/* }}} */
+
+/* static gchar *ggp_buddylist_convert(GGPBuddylistParser *parser, const gchar *line, gsize len) {{{ */
+static gchar *ggp_buddylist_convert(GGPBuddylistParser *parser,
+		const gchar *line, gsize len)
+{
+	gchar *utf8 = NULL;
 
-		purple_debug_info("gg", "got buddy: name=%s; show=%s\n", name, show);
+	if (parser->cd != (GIConv)-1)
+		utf8 = g_convert_with_iconv(line, len, parser->cd, NULL, NULL, NULL);
 
-		if (purple_find_buddy(purple_connection_get_account(gc), name)) {
-			g_strfreev(data_tbl);
-			continue;
-		}
+	/* A few bytes are unassigned in CP1250; let the fallback handle them. */
+	if (utf8 == NULL) {
+		gchar *tmp = g_strndup(line, len);
+		utf8 = charset_convert(tmp, "CP1250", "UTF-8");
+		g_free(tmp);
+	}
+
+	return utf8;
+}
+/* }}} */
 
-		g = g_strdup("Gadu-Gadu");
+/* static void ggp_buddylist_parse_line(GGPBuddylistParser *parser, const gchar *line, gsize len) {{{ */
+static void ggp_buddylist_parse_line(GGPBuddylistParser *parser,
+		const gchar *line, gsize len)
+{
+	ggp_buddylist_entry *entry;
+	gchar *utf8, *data_tbl[8], *p;
+	gchar *name, *show, *g, *comma;
+	int fields;
 
-		if ('\0' != *(data_tbl[F_GROUP])) {
-			/* XXX: Probably buddy should be added to all the groups. */
-			/* Hard limit to at most 50 groups */
-			gchar **group_tbl = g_strsplit(data_tbl[F_GROUP], ",", 50);
-			if (ggp_array_size(group_tbl) > 0) {
-				g_free(g);
-				g = g_strdup(group_tbl[0]);
-			}
-			g_strfreev(group_tbl);
+	parser->lineno++;
+
+	if (len > 0 && line[len - 1] == '\r')
+		len--;
+	if (len == 0)
+		return;
+
+	utf8 = ggp_buddylist_convert(parser, line, len);
+
+	/* Split into at most 8 fields in place; the last one keeps the rest. */
+	data_tbl[0] = utf8;
+	for (fields = 1, p = utf8; fields < 8 && (p = strchr(p, ';')); fields++) {
+		*p++ = '\0';
+		data_tbl[fields] = p;
+	}
+
+	if (fields < 8) {
+		purple_debug_warning("gg",
+			"Something is wrong on line %d of the buddylist. Skipping.\n",
+			parser->lineno);
+		g_free(utf8);
+		return;
+	}
+
+	show = data_tbl[F_NICKNAME];
+	name = data_tbl[F_UIN];
+	if ('\0' == *name || !atol(name)) {
+		purple_debug_warning("gg",
+			"Identifier on line %d of the buddylist is not a number. Skipping.\n",
+			parser->lineno);
+		g_free(utf8);
+		return;
+	}
+
+	if (g_hash_table_lookup(parser->seen, name) ||
+			purple_find_buddy(purple_connection_get_account(parser->gc), name)) {
+		g_free(utf8);
+		return;
+	}
+
+	/* XXX: Probably buddy should be added to all the groups. */
+	g = data_tbl[F_GROUP];
+	if ((comma = strchr(g, ',')))
+		*comma = '\0';
+
+	entry = g_new(ggp_buddylist_entry, 1);
+	entry->name = g_strdup(name);
+	entry->alias = g_strdup('\0' != *show ? show : name);
+	entry->group = g_strdup('\0' != *g ? g : "Gadu-Gadu");
+	g_hash_table_insert(parser->seen, entry->name, entry);
+	g_queue_push_tail(&parser->entries, entry);
+
+	g_free(utf8);
+}
+/* }}} */
+
+/* void ggp_buddylist_parser_feed(GGPBuddylistParser *parser, const gchar *data, gsize len) {{{ */
+void ggp_buddylist_parser_feed(GGPBuddylistParser *parser, const gchar *data,
+		gsize len)
+{
+	const gchar *end = data + len, *eol;
+
+	while (data < end && (eol = memchr(data, '\n', end - data)) != NULL) {
+		if (parser->line->len > 0) {
+			g_string_append_len(parser->line, data, eol - data);
+			ggp_buddylist_parse_line(parser, parser->line->str,
+					parser->line->len);
+			g_string_truncate(parser->line, 0);
+		} else {
+			ggp_buddylist_parse_line(parser, data, eol - data);
 		}
+		data = eol + 1;
+	}
+
+	g_string_append_len(parser->line, data, end - data);
+}
+/* }}} */
+
+/* static void ggp_buddylist_entry_free(ggp_buddylist_entry *entry) {{{ */
+static void ggp_buddylist_entry_free(ggp_buddylist_entry *entry)
+{
+	g_free(entry->name);
+	g_free(entry->alias);
+	g_free(entry->group);
+	g_free(entry);
+}
+/* }}} */
+
+/* void ggp_buddylist_parser_free(GGPBuddylistParser *parser) {{{ */
+void ggp_buddylist_parser_free(GGPBuddylistParser *parser)
+{
+	ggp_buddylist_entry *entry;
+
+	if (parser->cd != (GIConv)-1)
+		g_iconv_close(parser->cd);
+	g_string_free(parser->line, TRUE);
+	g_hash_table_destroy(parser->seen);
+	while ((entry = g_queue_pop_head(&parser->entries)) != NULL)
+		ggp_buddylist_entry_free(entry);
+	g_free(parser);
+}
+/* }}} */
+
+/* void ggp_buddylist_parser_finish(GGPBuddylistParser *parser) {{{ */
+void ggp_buddylist_parser_finish(GGPBuddylistParser *parser)
+{
+	PurpleConnection *gc = parser->gc;
+	PurpleAccount *account = purple_connection_get_account(gc);
+	GHashTable *groups;
+	ggp_buddylist_entry *entry;
+	int count = 0;
 
-		buddy = purple_buddy_new(purple_connection_get_account(gc), name,
-					 strlen(show) ? show : NULL);
+	if (parser->line->len > 0)
+		ggp_buddylist_parse_line(parser, parser->line->str,
+				parser->line->len);
 
-		if (!(group = purple_find_group(g))) {
-			group = purple_group_new(g);
-			purple_blist_add_group(group, NULL);
+	/* Most lists use a handful of groups; look each up only once. */
+	groups = g_hash_table_new_full(g_str_hash, g_str_equal, g_free, NULL);
+
+	while ((entry = g_queue_pop_head(&parser->entries)) != NULL) {
+		PurpleBuddy *buddy;
+		PurpleGroup *group = g_hash_table_lookup(groups, entry->group);
+
+		if (group == NULL) {
+			if (!(group = purple_find_group(entry->group))) {
+				group = purple_group_new(entry->group);
+				purple_blist_add_group(group, NULL);
+			}
+			g_hash_table_insert(groups, g_strdup(entry->group), group);
 		}
 
+		buddy = purple_buddy_new(account, entry->name, entry->alias);
 		purple_blist_add_buddy(buddy, NULL, group, NULL);
-		g_free(g);
+		count++;
 
-		g_strfreev(data_tbl);
+		g_hash_table_remove(parser->seen, entry->name);
+		ggp_buddylist_entry_free(entry);
 	}
-	g_strfreev(users_tbl);
-	g_free(utf8buddylist);
+
+	purple_debug_info("gg", "Loaded %d buddies from %d lines of the "
+			"buddylist in %" G_GINT64_FORMAT " ms.\n", count, parser->lineno,
+			(g_get_monotonic_time() - parser->started) / 1000);
+
+	g_hash_table_destroy(groups);
+	ggp_buddylist_parser_free(parser);
 
 	ggp_buddylist_send(gc);
 }
 /* }}} */
 
+/* gboolean ggp_buddylist_load_file(PurpleConnection *gc, const char *file, GError **error) {{{ */
+gboolean ggp_buddylist_load_file(PurpleConnection *gc, const char *file,
+		GError **error)
+{
+	GGPBuddylistParser *parser;
+	gchar buf[8192];
+	FILE *fp;
+	size_t len;
+
+	if ((fp = g_fopen(file, "rb")) == NULL) {
+		int errsv = errno;
+		g_set_error(error, G_FILE_ERROR, g_file_error_from_errno(errsv),
+				_("Failed to open file '%s': %s"), file, g_strerror(errsv));
+		return FALSE;
+	}
+
+	parser = ggp_buddylist_parser_new(gc);
+
+	while ((len = fread(buf, 1, sizeof(buf), fp)) > 0)
+		ggp_buddylist_parser_feed(parser, buf, len);
+
+	if (ferror(fp)) {
+		int errsv = errno;
+		g_set_error(error, G_FILE_ERROR, g_file_error_from_errno(errsv),
+				_("Failed to read file '%s': %s"), file, g_strerror(errsv));
+		ggp_buddylist_parser_free(parser);
+		fclose(fp);
+		return FALSE;
+	}
+
+	fclose(fp);
+	ggp_buddylist_parser_finish(parser);
+
+	return TRUE;
+}
+/* }}} */
+
 /* char *ggp_buddylist_dump(PurpleAccount *account) {{{ */
 char *ggp_buddylist_dump(PurpleAccount *account)
 {
@@ -30,15 +30,56 @@
 void
 ggp_buddylist_send(PurpleConnection *gc);
 
+typedef struct _GGPBuddylistParser GGPBuddylistParser;
+
 /**
- * Load buddylist from server into the roster.
+ * Start reading a buddylist incrementally.
  *
  * @param gc PurpleConnection
- * @param buddylist Pointer to the buddylist that will be loaded.
+ *
+ * @return The parser, to be fed and finally finished or freed.
+ */
+GGPBuddylistParser *
+ggp_buddylist_parser_new(PurpleConnection *gc);
+
+/**
+ * Parse the next block of a buddylist. Blocks may split lines anywhere.
+ *
+ * @param parser The parser.
+ * @param data The block, in CP1250.
+ * @param len Length of the block.
+ */
+void
+ggp_buddylist_parser_feed(GGPBuddylistParser *parser, const gchar *data, gsize len);
+
+/**
+ * Add the buddies read by the parser to the roster in one pass, send the
+ * new list to the server and free the parser.
+ *
+ * @param parser The parser.
  */
-/* void ggp_buddylist_load(PurpleConnection *gc, char *buddylist) {{{ */
 void
-ggp_buddylist_load(PurpleConnection *gc, char *buddylist);
+ggp_buddylist_parser_finish(GGPBuddylistParser *parser);
+
+/**
+ * Free a parser without adding anything to the roster.
+ *
+ * @param parser The parser.
+ */
+void
+ggp_buddylist_parser_free(GGPBuddylistParser *parser);
+
+/**
+ * Load a buddylist file into the roster, reading it in blocks.
+ *
+ * @param gc PurpleConnection
+ * @param file Name of the file.
+ * @param error Set if the file couldn't be read.
+ *
+ * @return TRUE if the file was read.
+ */
+gboolean
+ggp_buddylist_load_file(PurpleConnection *gc, const char *file, GError **error);
 
 /**
  * Get all the buddies in the current account.
@@ -149,12 +149,10 @@ static void ggp_callback_buddylist_load_ok(PurpleConnection *gc, gchar *file)
 {
 	PurpleAccount *account = purple_connection_get_account(gc);
 	GError *error = NULL;
-	char *buddylist = NULL;
-	gsize length;
 
 	purple_debug_info("gg", "file_name = %s\n", file);
 
-	if (!g_file_get_contents(file, &buddylist, &length, &error)) {
+	if (!ggp_buddylist_load_file(gc, file, &error)) {
 		purple_notify_error(account,
 				_("Couldn't load buddylist"),
 				_("Couldn't load buddylist"),
@@ -169,9 +167,6 @@ static void ggp_callback_buddylist_load_ok(PurpleConnection *gc, gchar *file)
 		return;
 	}
 
-	ggp_buddylist_load(gc, buddylist);
-	g_free(buddylist);
-
 	purple_notify_info(account,
 			 _("Load Buddylist..."),
 			 _("Buddylist loaded successfully!"), NULL);
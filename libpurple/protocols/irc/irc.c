@@ -86,152 +86,383 @@ static void irc_view_motd(PurplePluginAction *action)
 	g_free(body);
 }
 
-static int do_send(struct irc_conn *irc, const char *buf, gsize len)
+static gint64
+irc_send_now(void)
 {
-	gchar *tosend = g_strndup(buf, len);
-	int ret;
+	return g_get_monotonic_time() / 1000;
+}
+
+static IrcSendClass
+irc_send_classify(const char *buf, gsize len)
+{
+	static const struct {
+		const char *cmd;
+		IrcSendClass class;
+	} classes[] = {
+		{ "PONG", IRC_SEND_CONTROL },
+		{ "PING", IRC_SEND_CONTROL },
+		{ "PASS", IRC_SEND_CONTROL },
+		{ "USER", IRC_SEND_CONTROL },
+		{ "NICK", IRC_SEND_CONTROL },
+		{ "CAP", IRC_SEND_CONTROL },
+		{ "AUTHENTICATE", IRC_SEND_CONTROL },
+		{ "QUIT", IRC_SEND_CONTROL },
+		{ "ISON", IRC_SEND_BULK },
+		{ "WHO", IRC_SEND_BULK },
+		{ "USERHOST", IRC_SEND_BULK },
+		{ "MONITOR", IRC_SEND_BULK },
+		{ "WATCH", IRC_SEND_BULK },
+		{ "LIST", IRC_SEND_BULK },
+		{ NULL, IRC_SEND_INTERACTIVE }
+	};
+	gsize cmdlen = 0;
+	int i;
+
+	while (cmdlen < len && buf[cmdlen] != ' ' && buf[cmdlen] != '\r' &&
+	       buf[cmdlen] != '\n')
+		cmdlen++;
+
+	for (i = 0; classes[i].cmd != NULL; i++) {
+		if (strlen(classes[i].cmd) == cmdlen &&
+		    !g_ascii_strncasecmp(buf, classes[i].cmd, cmdlen))
+			return classes[i].class;
+	}
+
+	return IRC_SEND_INTERACTIVE;
+}
+
+static void
+irc_send_queue_push(struct irc_send_queue *queue, const char *buf, gsize len)
+{
+	guint linelen = len;
+
+	g_string_append_len(queue->data, buf, len);
+	g_array_append_val(queue->lens, linelen);
+}
+
+static gboolean
+irc_send_queue_peek(struct irc_send_queue *queue, const char **buf, gsize *len)
+{
+	if (queue->first >= queue->lens->len)
+		return FALSE;
+
+	*buf = queue->data->str + queue->head;
+	*len = g_array_index(queue->lens, guint, queue->first);
+
+	return TRUE;
+}
+
+static void
+irc_send_queue_pop(struct irc_send_queue *queue)
+{
+	queue->head += g_array_index(queue->lens, guint, queue->first);
+	queue->first++;
+
+	if (queue->first == queue->lens->len) {
+		g_string_truncate(queue->data, 0);
+		g_array_set_size(queue->lens, 0);
+		queue->head = 0;
+		queue->first = 0;
+	} else if (queue->head > IRC_SEND_COALESCE_MAX &&
+	           queue->head > queue->data->len / 2) {
+		/* Don't let a queue that never quite drains grow forever. */
+		g_string_erase(queue->data, 0, queue->head);
+		g_array_remove_range(queue->lens, 0, queue->first);
+		queue->head = 0;
+		queue->first = 0;
+	}
+}
+
+static gint64
+irc_send_cost(gint interval, gsize len)
+{
+	gint64 cost = (gint64)interval * 1000;
+
+	if (len > IRC_SEND_SHORT_LINE)
+		cost += cost * (MIN(len, IRC_MAX_MSG_SIZE) - IRC_SEND_SHORT_LINE) /
+		        (IRC_MAX_MSG_SIZE - IRC_SEND_SHORT_LINE);
+
+	return cost;
+}
+
+static void
+irc_send_refill(struct irc_conn *irc, gint interval)
+{
+	gint64 now = irc_send_now();
+	gint64 capacity;
+	gint burst;
+
+	burst = purple_account_get_int(irc->account, "ratelimit-burst",
+	                               IRC_DEFAULT_COMMAND_MAX_BURST);
+	capacity = (gint64)MAX(burst, 1) * interval * 1000;
+
+	irc->send_tokens += now - irc->send_time;
+	irc->send_time = now;
+
+	if (irc->send_tokens > capacity)
+		irc->send_tokens = capacity;
+	else if (irc->send_tokens < -capacity)
+		irc->send_tokens = -capacity;
+}
+
+/*
+ * Move the next line of a queue into the write buffer, giving
+ * irc-sending-text a chance to change or drop it.  Returns the number of
+ * bytes appended.
+ */
+static gsize
+irc_send_take(struct irc_conn *irc, struct irc_send_queue *queue)
+{
+	const char *buf;
+	gsize len;
+	gchar *tosend;
+
+	irc_send_queue_peek(queue, &buf, &len);
+	tosend = g_strndup(buf, len);
+	irc_send_queue_pop(queue);
 
 	purple_signal_emit(_irc_plugin, "irc-sending-text", purple_account_get_connection(irc->account), &tosend);
 
-	if(tosend == NULL) {
+	if (tosend == NULL)
 		return 0;
-	}
 
-	if(purple_debug_is_verbose()) {
+	if (purple_debug_is_verbose()) {
 		char *clean = purple_utf8_salvage(tosend);
 		clean = g_strstrip(clean);
 		purple_debug_misc("irc", "<< %s\n", clean);
 		g_free(clean);
 	}
 
-	if (irc->gsc) {
-		ret = purple_ssl_write(irc->gsc, tosend, strlen(tosend));
-	} else {
-		ret = write(irc->fd, tosend, strlen(tosend));
-	}
-
-	irc->send_time = time(NULL);
-
+	len = strlen(tosend);
+	g_string_append_len(irc->outbuf, tosend, len);
 	g_free(tosend);
 
-	return ret;
+	return len;
 }
 
-int irc_priority_send(struct irc_conn *irc, const char *buf)
+static void irc_send_writable_cb(gpointer data, gint source, PurpleInputCondition cond);
+static gboolean irc_send_handler_cb(gpointer data);
+
+/*
+ * Write as much of the write buffer as the socket takes.  Returns -1 on a
+ * fatal error, otherwise the number of bytes still pending.
+ */
+static gssize
+irc_send_write(struct irc_conn *irc)
 {
-	if(irc->sent_partial) {
-		g_queue_insert_after(irc->send_queue, irc->send_queue->head,
-		                     g_strdup(buf));
+	gsize pending = irc->outbuf->len - irc->outbuf_sent;
+	gssize ret;
+
+	if (pending == 0)
 		return 0;
+
+	if (irc->gsc) {
+		ret = purple_ssl_write(irc->gsc, irc->outbuf->str + irc->outbuf_sent, pending);
+	} else if (irc->fd >= 0) {
+		ret = write(irc->fd, irc->outbuf->str + irc->outbuf_sent, pending);
 	} else {
-		return do_send(irc, buf, strlen(buf));
+		/* Not connected yet; do_login() kicks us once we are. */
+		return pending;
 	}
-}
 
-static int irc_send_raw(PurpleConnection *gc, const char *buf, int len)
-{
-	struct irc_conn *irc = (struct irc_conn*)gc->proto_data;
-	if (len == -1) {
-		len = strlen(buf);
+	if (ret < 0) {
+		if (errno != EAGAIN)
+			return -1;
+		ret = 0;
 	}
-	irc_send_len(irc, buf, len);
-	return len;
+
+	irc->outbuf_sent += ret;
+	pending -= ret;
+
+	if (pending == 0) {
+		g_string_truncate(irc->outbuf, 0);
+		irc->outbuf_sent = 0;
+		if (irc->writeh) {
+			purple_input_remove(irc->writeh);
+			irc->writeh = 0;
+		}
+	} else if (irc->writeh == 0) {
+		irc->writeh = purple_input_add(irc->gsc ? irc->gsc->fd : irc->fd,
+		                               PURPLE_INPUT_WRITE,
+		                               irc_send_writable_cb, irc);
+	}
+
+	return pending;
 }
 
+/*
+ * Drain whatever the rate limit allows into a single write, then arrange to
+ * be called again exactly when the next queued line becomes affordable.
+ * Control lines are always sent, but are still charged to the bucket.
+ */
 static gboolean
-irc_send_handler_cb(gpointer data) {
-	struct irc_conn *irc = (struct irc_conn *)data;
-	gint available = 0;
-	gint interval = 0;
+irc_send_run(struct irc_conn *irc)
+{
+	struct irc_send_queue *queue;
+	gint interval;
+	gint64 wait = -1;
+	gssize pending;
+	int class;
+
+	if (irc->outbuf->len > irc->outbuf_sent) {
+		/* Finish a partial write before adding anything behind it. */
+		pending = irc_send_write(irc);
+		if (pending != 0)
+			return pending > 0;
+	}
 
 	interval = purple_account_get_int(irc->account, "ratelimit-interval",
 	                                  IRC_DEFAULT_COMMAND_INTERVAL);
+	if (interval > 0)
+		irc_send_refill(irc, interval);
 
-	/* Check if we're enabled. */
-	if(interval < 1) {
-		available = G_MAXINT;
-	} else {
-		gint burst = purple_account_get_int(irc->account, "ratelimit-burst",
-		                                    IRC_DEFAULT_COMMAND_MAX_BURST);
-		available = (time(NULL) - irc->send_time) / interval;
-		if(available > burst) {
-			available = burst;
+	for (class = IRC_SEND_CONTROL; class < IRC_SEND_CLASSES; class++) {
+		const char *buf;
+		gsize len;
+
+		queue = &irc->send_queue[class];
+
+		while (irc->outbuf->len < IRC_SEND_COALESCE_MAX &&
+		       irc_send_queue_peek(queue, &buf, &len)) {
+			gint64 cost = 0;
+
+			if (interval > 0) {
+				cost = irc_send_cost(interval, len);
+				if (class != IRC_SEND_CONTROL && irc->send_tokens < cost) {
+					wait = cost - irc->send_tokens;
+					break;
+				}
+			}
+
+			len = irc_send_take(irc, queue);
+			if (interval > 0 && len > 0)
+				irc->send_tokens -= irc_send_cost(interval, len);
 		}
+
+		if (wait >= 0)
+			break;
 	}
 
-	while(available > 0) {
-		gchar *msg = NULL;
-		gpointer raw = NULL;
-		gint length = 0, ret = 0;
+	pending = irc_send_write(irc);
+	if (pending < 0)
+		return FALSE;
 
-		/* No message in the queue should be NULL, so a NULL value means the
-		 * queue is empty.
-		 */
-		raw = g_queue_pop_head(irc->send_queue);
-		if(raw == NULL) {
-			break;
+	if (pending == 0 && irc->send_handler == 0) {
+		if (wait >= 0) {
+			irc->send_handler = purple_timeout_add(wait, irc_send_handler_cb, irc);
+		} else {
+			/* We stopped at the coalescing limit; keep going. */
+			for (class = IRC_SEND_CONTROL; class < IRC_SEND_CLASSES; class++) {
+				if (irc->send_queue[class].first < irc->send_queue[class].lens->len) {
+					irc->send_handler = purple_timeout_add(0, irc_send_handler_cb, irc);
+					break;
+				}
+			}
 		}
+	}
+
+	return TRUE;
+}
 
-		msg = (gchar *)raw;
-		length = strlen(msg);
+static void
+irc_send_error(struct irc_conn *irc)
+{
+	PurpleConnection *gc = purple_account_get_connection(irc->account);
+	gchar *tmp = g_strdup_printf(_("Lost connection with server: %s"),
+	                             g_strerror(errno));
 
-		ret = do_send(irc, msg, length);
-		if(ret < 0 && errno != EAGAIN) {
-			PurpleConnection *gc = purple_account_get_connection(irc->account);
-			gchar *tmp = g_strdup_printf(_("Lost connection with server: %s"),
-			                             g_strerror(errno));
+	purple_connection_error_reason(gc,
+	                               PURPLE_CONNECTION_ERROR_NETWORK_ERROR,
+	                               tmp);
+	g_free(tmp);
+}
 
-			purple_connection_error_reason(gc,
-			                               PURPLE_CONNECTION_ERROR_NETWORK_ERROR,
-			                               tmp);
-			g_free(tmp);
+static gboolean
+irc_send_handler_cb(gpointer data)
+{
+	struct irc_conn *irc = (struct irc_conn *)data;
 
-			g_free(msg);
+	irc->send_handler = 0;
 
-			irc->send_handler = 0;
+	if (!irc_send_run(irc))
+		irc_send_error(irc);
 
-			return FALSE;
-		} else if(ret < length) {
-			gchar *partial = NULL;
-
-			/* The preceeding conditional allows EAGAIN to fall through to
-			 * here so that we can retransmit it.  There shouldn't even be a
-			 * case where ret < 0 and != EAGAIN, which is why we have the
-			 * assert.
-			 */
-			if(ret < 0) {
-				if(ret == EAGAIN) {
-					ret = 0;
-				} else {
-					g_assert_not_reached();
-				}
-			}
+	return FALSE;
+}
 
-			/* We need to move past the characters we already wrote and requeue
-			 * the rest of the string. We know ret is less than length, so the
-			 * starting address of msg plus ret can never get outside of the
-			 * string, and likewise, length minus ret will always be < length
-			 * because ret is less than length and if it was somehow negative,
-			 * it has been reset to zero.
-			 */
-			partial = g_strndup(msg + ret, length - ret);
-
-			/* requeue the item to the start of the queue */
-			g_queue_push_head(irc->send_queue, partial);
-			irc->sent_partial = TRUE;
-		} else {
-			/* We successfully sent a message so decrement the counter. */
-			available -= 1;
-			irc->sent_partial = FALSE;
-		}
+static void
+irc_send_writable_cb(gpointer data, gint source, PurpleInputCondition cond)
+{
+	struct irc_conn *irc = (struct irc_conn *)data;
+
+	if (!irc_send_run(irc))
+		irc_send_error(irc);
+}
+
+static void
+irc_send_schedule(struct irc_conn *irc)
+{
+	/* A pending timer or write watch will pick the new line up. */
+	if (irc->send_handler == 0 && irc->writeh == 0)
+		irc->send_handler = purple_timeout_add(0, irc_send_handler_cb, irc);
+}
 
-		/* Message was processed successfully or a partial message was
-		 * allocated and requeued so we can free the one we popped off.
-		 */
-		g_free(msg);
+static void
+irc_send_init(struct irc_conn *irc)
+{
+	int class;
+
+	for (class = IRC_SEND_CONTROL; class < IRC_SEND_CLASSES; class++) {
+		irc->send_queue[class].data = g_string_new(NULL);
+		irc->send_queue[class].lens = g_array_new(FALSE, FALSE, sizeof(guint));
 	}
+	irc->outbuf = g_string_sized_new(IRC_MAX_MSG_SIZE);
+}
 
-	return TRUE;
+static void
+irc_send_destroy(struct irc_conn *irc)
+{
+	int class;
+
+	for (class = IRC_SEND_CONTROL; class < IRC_SEND_CLASSES; class++) {
+		g_string_free(irc->send_queue[class].data, TRUE);
+		g_array_free(irc->send_queue[class].lens, TRUE);
+	}
+	g_string_free(irc->outbuf, TRUE);
+
+	if (irc->send_handler != 0)
+		purple_timeout_remove(irc->send_handler);
+	if (irc->writeh != 0)
+		purple_input_remove(irc->writeh);
+}
+
+static int
+irc_send_control(struct irc_conn *irc, const char *buf, gsize len)
+{
+	irc_send_queue_push(&irc->send_queue[IRC_SEND_CONTROL], buf, len);
+
+	/* Control lines go out right away, behind any partial write. */
+	if (!irc_send_run(irc)) {
+		irc_send_error(irc);
+		return -1;
+	}
+
+	return len;
+}
+
+int irc_priority_send(struct irc_conn *irc, const char *buf)
+{
+	return irc_send_control(irc, buf, strlen(buf));
+}
+
+static int irc_send_raw(PurpleConnection *gc, const char *buf, int len)
+{
+	struct irc_conn *irc = (struct irc_conn*)gc->proto_data;
+	if (len == -1) {
+		len = strlen(buf);
+	}
+	irc_send_len(irc, buf, len);
+	return len;
 }
 
 void irc_send(struct irc_conn *irc, const char *buf)
@@ -241,7 +472,15 @@ void irc_send(struct irc_conn *irc, const char *buf)
 
 void
 irc_send_len(struct irc_conn *irc, const char *buf, int buflen) {
-	g_queue_push_tail(irc->send_queue, g_strdup(buf));
+	IrcSendClass class = irc_send_classify(buf, buflen);
+
+	if (class == IRC_SEND_CONTROL) {
+		irc_send_control(irc, buf, buflen);
+		return;
+	}
+
+	irc_send_queue_push(&irc->send_queue[class], buf, buflen);
+	irc_send_schedule(irc);
 }
 
 /* XXX I don't like messing directly with these buddies */
@@ -251,6 +490,11 @@ gboolean irc_blist_timeout(struct irc_conn *irc)
 		return TRUE;
 	}
 
+	/* Everyone is on the MONITOR or WATCH list; nothing to poll. */
+	if (irc->presence_count >= g_hash_table_size(irc->buddies)) {
+		return TRUE;
+	}
+
 	g_hash_table_foreach(irc->buddies, (GHFunc)irc_ison_buddy_init,
 	                     (gpointer *)&irc->buddies_outstanding);
 
@@ -290,7 +534,11 @@ void irc_buddy_query(struct irc_conn *irc)
 
 static void irc_ison_buddy_init(char *name, struct irc_buddy *ib, GList **list)
 {
-	*list = g_list_append(*list, ib);
+	/* The server tells us about these itself. */
+	if (ib->monitored)
+		return;
+
+	*list = g_list_prepend(*list, ib);
 }
 
 
@@ -299,7 +547,7 @@ static void irc_ison_one(struct irc_conn *irc, struct irc_buddy *ib)
 	char *buf;
 
 	if (irc->buddies_outstanding != NULL) {
-		irc->buddies_outstanding = g_list_append(irc->buddies_outstanding, ib);
+		irc->buddies_outstanding = g_list_prepend(irc->buddies_outstanding, ib);
 		return;
 	}
 
@@ -309,6 +557,106 @@ static void irc_ison_one(struct irc_conn *irc, struct irc_buddy *ib)
 	g_free(buf);
 }
 
+static void irc_monitor_send(struct irc_conn *irc, const char *targets)
+{
+	char *buf;
+
+	if (irc->presence == IRC_PRESENCE_MONITOR)
+		buf = irc_format(irc, "vvn", "MONITOR", "+", targets);
+	else
+		buf = irc_format(irc, "vn", "WATCH", targets);
+	irc_send(irc, buf);
+	g_free(buf);
+}
+
+/*
+ * Put buddies on the server's MONITOR or WATCH list, as many per line as
+ * fit, until the server's limit is reached.  The server answers with the
+ * current status of each one and then notifies us of every change, so
+ * anyone added here is left out of ISON polling.
+ */
+void irc_buddy_monitor(struct irc_conn *irc, GList *buddies)
+{
+	GString *string;
+	struct irc_buddy *ib;
+
+	if (irc->presence == IRC_PRESENCE_ISON)
+		return;
+
+	string = g_string_sized_new(512);
+
+	for (; buddies; buddies = buddies->next) {
+		ib = (struct irc_buddy *)buddies->data;
+		if (ib->monitored)
+			continue;
+		if (irc->presence_limit && irc->presence_count >= irc->presence_limit)
+			break;
+
+		if (string->len + strlen(ib->name) + 2 > 450) {
+			irc_monitor_send(irc, string->str);
+			g_string_truncate(string, 0);
+		}
+
+		if (irc->presence == IRC_PRESENCE_MONITOR) {
+			if (string->len)
+				g_string_append_c(string, ',');
+		} else {
+			g_string_append(string, string->len ? " +" : "+");
+		}
+		g_string_append(string, ib->name);
+
+		ib->monitored = TRUE;
+		irc->presence_count++;
+	}
+
+	if (string->len)
+		irc_monitor_send(irc, string->str);
+
+	g_string_free(string, TRUE);
+}
+
+void irc_buddy_monitor_all(struct irc_conn *irc)
+{
+	GList *buddies = NULL;
+
+	g_hash_table_foreach(irc->buddies, (GHFunc)irc_ison_buddy_init,
+	                     (gpointer *)&buddies);
+	irc_buddy_monitor(irc, buddies);
+	g_list_free(buddies);
+}
+
+static void irc_buddy_unmonitor(struct irc_conn *irc, struct irc_buddy *ib)
+{
+	char *buf;
+
+	if (irc->presence == IRC_PRESENCE_MONITOR) {
+		buf = irc_format(irc, "vvn", "MONITOR", "-", ib->name);
+	} else {
+		char *target = g_strconcat("-", ib->name, NULL);
+		buf = irc_format(irc, "vn", "WATCH", target);
+		g_free(target);
+	}
+	irc_send(irc, buf);
+	g_free(buf);
+
+	ib->monitored = FALSE;
+	irc->presence_count--;
+}
+
+void irc_buddy_set_online(struct irc_conn *irc, const char *name, gboolean online)
+{
+	struct irc_buddy *ib;
+
+	if ((ib = g_hash_table_lookup(irc->buddies, name)) == NULL)
+		return;
+
+	if (ib->online != online) {
+		ib->online = online;
+		purple_prpl_got_user_status(irc->account, ib->name,
+		                            online ? "available" : "offline", NULL);
+	}
+}
+
 
 static const char *irc_blist_icon(PurpleAccount *a, PurpleBuddy *b)
 {
@@ -399,8 +747,7 @@ static void irc_login(PurpleAccount *account)
 	irc->fd = -1;
 	irc->account = account;
 
-	irc->send_queue = g_queue_new();
-	irc->sent_partial = FALSE;
+	irc_send_init(irc);
 
 	userparts = g_strsplit(username, "@", 2);
 	purple_connection_set_display_name(gc, userparts[0]);
@@ -517,8 +864,11 @@ static gboolean do_login(PurpleConnection *gc) {
 	burst = purple_account_get_int(irc->account, "ratelimit-burst",
 	                               IRC_DEFAULT_COMMAND_MAX_BURST);
 
-	irc->send_time = time(NULL) - (interval * burst);
-	irc->send_handler = g_timeout_add_seconds(1, irc_send_handler_cb, irc);
+	irc->send_time = irc_send_now();
+	irc->send_tokens = (gint64)MAX(burst, 1) * MAX(interval, 0) * 1000;
+
+	/* Anything queued before we were connected can go out now. */
+	irc_send_schedule(irc);
 
 	return TRUE;
 }
@@ -579,6 +929,9 @@ static void irc_close(PurpleConnection *gc)
 	if (gc->inpa)
 		purple_input_remove(gc->inpa);
 
+	irc_send_destroy(irc);
+	irc_encodings_free(irc);
+
 	g_free(irc->inbuf);
 	if (irc->gsc) {
 		purple_ssl_close(irc->gsc);
@@ -594,11 +947,6 @@ static void irc_close(PurpleConnection *gc)
 		g_string_free(irc->motd, TRUE);
 	g_free(irc->server);
 
-	g_queue_free_full(irc->send_queue, g_free);
-	if(irc->send_handler != 0) {
-		g_source_remove(irc->send_handler);
-	}
-
 	g_free(irc->mode_chars);
 	g_free(irc->reqnick);
 
@@ -687,8 +1035,13 @@ static void irc_add_buddy(PurpleConnection *gc, PurpleBuddy *buddy, PurpleGroup
 	/* if the timer isn't set, this is during signon, so we don't want to flood
 	 * ourself off with ISON's, so we don't, but after that we want to know when
 	 * someone's online asap */
-	if (irc->timer)
-		irc_ison_one(irc, ib);
+	if (irc->timer && !ib->monitored) {
+		GList one = { ib, NULL, NULL };
+
+		irc_buddy_monitor(irc, &one);
+		if (!ib->monitored)
+			irc_ison_one(irc, ib);
+	}
 }
 
 static void irc_remove_buddy(PurpleConnection *gc, PurpleBuddy *buddy, PurpleGroup *group)
@@ -698,6 +1051,9 @@ static void irc_remove_buddy(PurpleConnection *gc, PurpleBuddy *buddy, PurpleGro
 
 	ib = g_hash_table_lookup(irc->buddies, purple_buddy_get_name(buddy));
 	if (ib && --ib->ref == 0) {
+		if (ib->monitored)
+			irc_buddy_unmonitor(irc, ib);
+		irc->buddies_outstanding = g_list_remove(irc->buddies_outstanding, ib);
 		g_hash_table_remove(irc->buddies, purple_buddy_get_name(buddy));
 	}
 }
@@ -49,17 +49,51 @@
 #define IRC_DEFAULT_COMMAND_INTERVAL 2
 #define IRC_DEFAULT_COMMAND_MAX_BURST 5
 
+/* Lines up to this many bytes cost one command interval.  Longer lines cost
+ * proportionally more, up to two intervals for a full IRC_MAX_MSG_SIZE line,
+ * since servers penalize long lines the same way.
+ */
+#define IRC_SEND_SHORT_LINE 128
+
+/* Upper bound on how much queued text is coalesced into a single write. */
+#define IRC_SEND_COALESCE_MAX 4096
+
 #define IRC_BUFSIZE_INCREMENT 1024
 #define IRC_MAX_BUFSIZE 16384
 
 #define IRC_MAX_MSG_SIZE 512
 
+/* Length of the longest format string in the parse.c message table
+ * ("ncvvvnv:", for 352 RPL_WHOREPLY). irc_msg_table_build() refuses
+ * entries with longer ones. */
+#define IRC_MAX_MSG_ARGS 8
+
 #define IRC_NAMES_FLAG "irc-namelist"
 
 
 enum { IRC_USEROPT_SERVER, IRC_USEROPT_PORT, IRC_USEROPT_CHARSET };
 enum irc_state { IRC_STATE_NEW, IRC_STATE_ESTABLISHED };
 
+/* How buddy presence is tracked, from the server's RPL_ISUPPORT. */
+enum irc_presence { IRC_PRESENCE_ISON, IRC_PRESENCE_MONITOR, IRC_PRESENCE_WATCH };
+
+/* Outgoing lines are queued per class and drained in this order.  Control
+ * lines are never held back by the rate limit.
+ */
+typedef enum {
+	IRC_SEND_CONTROL = 0,	/* PONG, QUIT, registration and CAP */
+	IRC_SEND_INTERACTIVE,	/* PRIVMSG, JOIN and anything else */
+	IRC_SEND_BULK,		/* ISON, WHO and other background queries */
+	IRC_SEND_CLASSES
+} IrcSendClass;
+
+struct irc_send_queue {
+	GString *data;		/* queued lines, back to back */
+	gsize head;		/* offset of the first queued line in data */
+	GArray *lens;		/* length of each queued line, as guint */
+	guint first;		/* index of the first queued line in lens */
+};
+
 struct irc_conn {
 	PurpleAccount *account;
 	GHashTable *msgs;
@@ -72,10 +106,23 @@ struct irc_conn {
 	gboolean ison_outstanding;
 	GList *buddies_outstanding;
 
+	enum irc_presence presence;
+	guint presence_limit;	/* 0 if the server didn't give one */
+	guint presence_count;	/* buddies on the MONITOR or WATCH list */
+
 	char *inbuf;
 	int inbuflen;
 	int inbufused;
 
+	/* Converters for the "encoding" setting they were opened for.  A NULL
+	 * converter means UTF-8, which needs none; (GIConv)-1 means the
+	 * charset couldn't be opened. */
+	char *encodings;
+	gboolean autodetect;
+	GIConv send_cd;
+	GIConv *recv_cd;
+	guint recv_cd_count;
+
 	GString *motd;
 	GString *names;
 	struct _whois {
@@ -100,10 +147,13 @@ struct irc_conn {
 
 	time_t recv_time;
 
-	GQueue *send_queue;
-	time_t send_time;
+	struct irc_send_queue send_queue[IRC_SEND_CLASSES];
+	gint64 send_time;	/* monotonic ms of the last bucket refill */
+	gint64 send_tokens;	/* rate limit credit, in ms */
 	guint send_handler;
-	gboolean sent_partial;
+	guint writeh;
+	GString *outbuf;	/* coalesced lines being written */
+	gsize outbuf_sent;
 
 	char *mode_chars;
 	char *reqnick;
@@ -122,6 +172,7 @@ struct irc_buddy {
 	gboolean online;
 	gboolean flag;
  	gboolean new_online_status;
+	gboolean monitored;
 	int ref;
 };
 
@@ -133,6 +184,9 @@ int irc_priority_send(struct irc_conn *irc, const char *buf);
 gboolean irc_blist_timeout(struct irc_conn *irc);
 gboolean irc_who_channel_timeout(struct irc_conn *irc);
 void irc_buddy_query(struct irc_conn *irc);
+void irc_buddy_monitor(struct irc_conn *irc, GList *buddies);
+void irc_buddy_monitor_all(struct irc_conn *irc);
+void irc_buddy_set_online(struct irc_conn *irc, const char *name, gboolean online);
 
 char *irc_escape_privmsg(const char *text, gssize length);
 
@@ -148,6 +202,7 @@ void irc_msg_table_build(struct irc_conn *irc);
 void irc_parse_msg(struct irc_conn *irc, char *input);
 char *irc_parse_ctcp(struct irc_conn *irc, const char *from, const char *to, const char *msg, int notice);
 char *irc_format(struct irc_conn *irc, const char *format, ...);
+void irc_encodings_free(struct irc_conn *irc);
 
 void irc_msg_default(struct irc_conn *irc, const char *name, const char *from, char **args);
 void irc_msg_away(struct irc_conn *irc, const char *name, const char *from, char **args);
@@ -162,6 +217,9 @@ void irc_msg_features(struct irc_conn *irc, const char *name, const char *from,
 void irc_msg_invite(struct irc_conn *irc, const char *name, const char *from, char **args);
 void irc_msg_inviteonly(struct irc_conn *irc, const char *name, const char *from, char **args);
 void irc_msg_ison(struct irc_conn *irc, const char *name, const char *from, char **args);
+void irc_msg_monitor(struct irc_conn *irc, const char *name, const char *from, char **args);
+void irc_msg_monlistfull(struct irc_conn *irc, const char *name, const char *from, char **args);
+void irc_msg_watch(struct irc_conn *irc, const char *name, const char *from, char **args);
 void irc_msg_join(struct irc_conn *irc, const char *name, const char *from, char **args);
 void irc_msg_kick(struct irc_conn *irc, const char *name, const char *from, char **args);
 void irc_msg_list(struct irc_conn *irc, const char *name, const char *from, char **args);
@@ -128,6 +128,10 @@ static void irc_connected(struct irc_conn *irc, const char *nick)
 		g_hash_table_replace(irc->buddies, ib->name, ib);
 	}
 
+	/* Servers with MONITOR or WATCH push presence changes to us; only
+	 * whoever doesn't fit on that list needs polling with ISON. */
+	irc_buddy_monitor_all(irc);
+
 	irc_blist_timeout(irc);
 	if (!irc->timer)
 		irc->timer = purple_timeout_add_seconds(45, (GSourceFunc)irc_blist_timeout, (gpointer)irc);
@@ -222,6 +226,16 @@ void irc_msg_features(struct irc_conn *irc, const char *name, const char *from,
 		if (!strncmp(features[i], "PREFIX=", 7)) {
 			if ((val = strchr(features[i] + 7, ')')) != NULL)
 				irc->mode_chars = g_strdup(val + 1);
+		} else if (!strncmp(features[i], "MONITOR", 7) &&
+		           (features[i][7] == '=' || features[i][7] == '\0')) {
+			/* Prefer MONITOR over WATCH when a server offers both. */
+			irc->presence = IRC_PRESENCE_MONITOR;
+			irc->presence_limit = features[i][7] ? atoi(features[i] + 8) : 0;
+		} else if (!strncmp(features[i], "WATCH", 5) &&
+		           (features[i][5] == '=' || features[i][5] == '\0') &&
+		           irc->presence != IRC_PRESENCE_MONITOR) {
+			irc->presence = IRC_PRESENCE_WATCH;
+			irc->presence_limit = features[i][5] ? atoi(features[i] + 6) : 0;
 		}
 	}
 
@@ -935,12 +949,62 @@ void irc_msg_ison(struct irc_conn *irc, const char *name, const char *from, char
 		g_hash_table_foreach(irc->buddies, (GHFunc)irc_buddy_status, (gpointer)irc);
 }
 
+/* MONITOR replies: 730 is online, 731 is offline, each with a list of
+ * targets which may carry a !user@host. */
+void irc_msg_monitor(struct irc_conn *irc, const char *name, const char *from, char **args)
+{
+	gboolean online = purple_strequal(name, "730");
+	char **targets;
+	int i;
+
+	targets = g_strsplit(args[1], ",", -1);
+	for (i = 0; targets[i]; i++) {
+		char *bang = strchr(targets[i], '!');
+		if (bang)
+			*bang = '\0';
+		if (*targets[i])
+			irc_buddy_set_online(irc, targets[i], online);
+	}
+	g_strfreev(targets);
+}
+
+/* Whoever didn't fit on the MONITOR list goes back to ISON polling. */
+void irc_msg_monlistfull(struct irc_conn *irc, const char *name, const char *from, char **args)
+{
+	char **targets;
+	struct irc_buddy *ib;
+	int i;
+
+	purple_debug_info("irc", "MONITOR list is full (limit %s)\n", args[1]);
+
+	targets = g_strsplit(args[2], ",", -1);
+	for (i = 0; targets[i]; i++) {
+		if ((ib = g_hash_table_lookup(irc->buddies, targets[i])) == NULL ||
+		    !ib->monitored)
+			continue;
+		ib->monitored = FALSE;
+		irc->presence_count--;
+	}
+	g_strfreev(targets);
+
+	if (irc->presence_limit == 0 || irc->presence_limit > irc->presence_count)
+		irc->presence_limit = irc->presence_count;
+}
+
+/* WATCH replies: 600 logon, 601 logoff, 604 now on, 605 now off. */
+void irc_msg_watch(struct irc_conn *irc, const char *name, const char *from, char **args)
+{
+	gboolean online = purple_strequal(name, "600") || purple_strequal(name, "604");
+
+	irc_buddy_set_online(irc, args[1], online);
+}
+
 static void irc_buddy_status(char *name, struct irc_buddy *ib, struct irc_conn *irc)
 {
 	PurpleConnection *gc = purple_account_get_connection(irc->account);
 	PurpleBuddy *buddy = purple_find_buddy(irc->account, name);
 
-	if (!gc || !buddy)
+	if (!gc || !buddy || ib->monitored)
 		return;
 
 	if (ib->online && !ib->new_online_status) {
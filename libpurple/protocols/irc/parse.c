@@ -35,7 +35,6 @@
 #include <ctype.h>
 
 static char *irc_send_convert(struct irc_conn *irc, const char *string);
-static char *irc_recv_convert(struct irc_conn *irc, const char *string);
 
 static void irc_parse_error_cb(struct irc_conn *irc, char *input);
 
@@ -108,6 +107,13 @@ static struct _irc_msg {
 	{ "501", "n:", 2, irc_msg_badmode },		/* Unknown mode flag		*/
 	{ "506", "nc:", 3, irc_msg_nosend },		/* Must identify to send	*/
 	{ "515", "nc:", 3, irc_msg_regonly },		/* Registration required	*/
+	{ "600", "nnvvv:", 2, irc_msg_watch },		/* WATCH logon			*/
+	{ "601", "nnvvv:", 2, irc_msg_watch },		/* WATCH logoff			*/
+	{ "604", "nnvvv:", 2, irc_msg_watch },		/* WATCH now on			*/
+	{ "605", "nnvvv:", 2, irc_msg_watch },		/* WATCH now off		*/
+	{ "730", "n:", 2, irc_msg_monitor },		/* MONITOR online		*/
+	{ "731", "n:", 2, irc_msg_monitor },		/* MONITOR offline		*/
+	{ "734", "nvv:", 3, irc_msg_monlistfull },	/* MONITOR list is full		*/
 #ifdef HAVE_CYRUS_SASL
 	{ "903", "*", 0, irc_msg_authok},		/* SASL auth successful		*/
 	{ "904", "*", 0, irc_msg_authtryagain },	/* SASL auth failed, can recover*/
@@ -240,73 +246,140 @@ void irc_register_commands(void)
 		irc_register_command(c);
 }
 
-static char *irc_send_convert(struct irc_conn *irc, const char *string)
+static GIConv irc_iconv_open(const char *to, const char *from)
 {
-	char *utf8;
-	GError *err = NULL;
-	gchar **encodings;
-	const gchar *enclist;
+	GIConv cd = g_iconv_open(to, from);
 
-	enclist = purple_account_get_string(irc->account, "encoding", IRC_DEFAULT_CHARSET);
-	encodings = g_strsplit(enclist, ",", 2);
+	if (cd == (GIConv)-1)
+		purple_debug(PURPLE_DEBUG_ERROR, "irc", "Unable to convert between %s and %s\n", from, to);
 
-	if (encodings[0] == NULL || !g_ascii_strcasecmp("UTF-8", encodings[0])) {
-		g_strfreev(encodings);
-		return NULL;
-	}
+	return cd;
+}
 
-	utf8 = g_convert(string, strlen(string), encodings[0], "UTF-8", NULL, NULL, &err);
-	if (err) {
-		purple_debug(PURPLE_DEBUG_ERROR, "irc", "Send conversion error: %s\n", err->message);
-		purple_debug(PURPLE_DEBUG_ERROR, "irc", "Sending as UTF-8 instead of %s\n", encodings[0]);
-		utf8 = g_strdup(string);
-		g_error_free(err);
-	}
-	g_strfreev(encodings);
+static void irc_iconv_close(GIConv cd)
+{
+	if (cd != NULL && cd != (GIConv)-1)
+		g_iconv_close(cd);
+}
 
-	return utf8;
+void irc_encodings_free(struct irc_conn *irc)
+{
+	guint i;
+
+	irc_iconv_close(irc->send_cd);
+	irc->send_cd = NULL;
+
+	for (i = 0; i < irc->recv_cd_count; i++)
+		irc_iconv_close(irc->recv_cd[i]);
+	g_free(irc->recv_cd);
+	irc->recv_cd = NULL;
+	irc->recv_cd_count = 0;
+
+	g_free(irc->encodings);
+	irc->encodings = NULL;
 }
 
-static char *irc_recv_convert(struct irc_conn *irc, const char *string)
+/*
+ * Make sure the cached converters match the account's encoding settings.
+ * This is called once per message, so the converters are only reopened
+ * when the settings actually change.
+ */
+static void irc_encodings_update(struct irc_conn *irc)
 {
-	char *utf8 = NULL;
-	const gchar *charset, *enclist;
+	const gchar *enclist;
 	gchar **encodings;
-	gboolean autodetect;
-	int i;
-
-	autodetect = purple_account_get_bool(irc->account, "autodetect_utf8", IRC_DEFAULT_AUTODETECT);
+	guint i;
 
-	if (autodetect && g_utf8_validate(string, -1, NULL)) {
-		return g_strdup(string);
-	}
+	irc->autodetect = purple_account_get_bool(irc->account, "autodetect_utf8", IRC_DEFAULT_AUTODETECT);
 
 	enclist = purple_account_get_string(irc->account, "encoding", IRC_DEFAULT_CHARSET);
-	encodings = g_strsplit(enclist, ",", -1);
+	if (enclist == NULL)
+		enclist = "";
+	if (irc->encodings && purple_strequal(enclist, irc->encodings))
+		return;
 
-	if (encodings[0] == NULL) {
-		g_strfreev(encodings);
-		return purple_utf8_salvage(string);
-	}
+	irc_encodings_free(irc);
+	irc->encodings = g_strdup(enclist);
+
+	encodings = g_strsplit(enclist, ",", -1);
+	irc->recv_cd_count = g_strv_length(encodings);
+	irc->recv_cd = g_new0(GIConv, irc->recv_cd_count);
 
 	for (i = 0; encodings[i] != NULL; i++) {
-		charset = encodings[i];
+		const gchar *charset = encodings[i];
 		while (*charset == ' ')
 			charset++;
 
-		if (!g_ascii_strcasecmp("UTF-8", charset)) {
-			if (g_utf8_validate(string, -1, NULL))
-				utf8 = g_strdup(string);
-		} else {
-			utf8 = g_convert(string, -1, "UTF-8", charset, NULL, NULL, NULL);
+		if (g_ascii_strcasecmp("UTF-8", charset))
+			irc->recv_cd[i] = irc_iconv_open("UTF-8", charset);
+	}
+
+	/* Only the first encoding is used for sending, as-is. */
+	if (encodings[0] != NULL && g_ascii_strcasecmp("UTF-8", encodings[0]))
+		irc->send_cd = irc_iconv_open(encodings[0], "UTF-8");
+
+	g_strfreev(encodings);
+}
+
+static char *irc_send_convert(struct irc_conn *irc, const char *string)
+{
+	char *utf8;
+	GError *err = NULL;
+
+	if (irc->send_cd == NULL)
+		return NULL;
+
+	if (irc->send_cd == (GIConv)-1) {
+		utf8 = NULL;
+	} else {
+		utf8 = g_convert_with_iconv(string, strlen(string), irc->send_cd, NULL, NULL, &err);
+	}
+	if (utf8 == NULL) {
+		purple_debug(PURPLE_DEBUG_ERROR, "irc", "Send conversion error: %s\n", err ? err->message : "no converter");
+		purple_debug(PURPLE_DEBUG_ERROR, "irc", "Sending as UTF-8 instead of %s\n", irc->encodings);
+		utf8 = g_strdup(string);
+		if (err) {
+			g_error_free(err);
+			/* Don't let a failed conversion's shift state leak into the next one. */
+			g_iconv(irc->send_cd, NULL, NULL, NULL, NULL);
 		}
+	}
+
+	return utf8;
+}
+
+/*
+ * Convert an incoming string to UTF-8.  Returns NULL when the string can be
+ * used as-is, which is the usual case with UTF-8 servers, so that callers
+ * can avoid copying it; otherwise returns a newly allocated string.
+ */
+static char *irc_recv_convert_maybe(struct irc_conn *irc, const char *string)
+{
+	char *utf8;
+	guint i;
+	int valid = -1;
+
+	if (irc->autodetect) {
+		valid = g_utf8_validate(string, -1, NULL);
+		if (valid)
+			return NULL;
+	}
 
-		if (utf8) {
-			g_strfreev(encodings);
-			return utf8;
+	for (i = 0; i < irc->recv_cd_count; i++) {
+		GIConv cd = irc->recv_cd[i];
+
+		if (cd == NULL) {
+			if (valid < 0)
+				valid = g_utf8_validate(string, -1, NULL);
+			if (valid)
+				return NULL;
+		} else if (cd != (GIConv)-1) {
+			utf8 = g_convert_with_iconv(string, -1, cd, NULL, NULL, NULL);
+			if (utf8)
+				return utf8;
+			g_iconv(cd, NULL, NULL, NULL, NULL);
 		}
 	}
-	g_strfreev(encodings);
 
 	return purple_utf8_salvage(string);
 }
@@ -609,6 +682,11 @@ void irc_msg_table_build(struct irc_conn *irc)
 	}
 
 	for (i = 0; _irc_msgs[i].name; i++) {
+		if (strlen(_irc_msgs[i].format) > IRC_MAX_MSG_ARGS) {
+			purple_debug_error("irc", "Format of '%s' has more than %d arguments\n",
+			                   _irc_msgs[i].name, IRC_MAX_MSG_ARGS);
+			continue;
+		}
 		g_hash_table_insert(irc->msgs, (gpointer)_irc_msgs[i].name, (gpointer)&_irc_msgs[i]);
 	}
 }
@@ -634,6 +712,8 @@ char *irc_format(struct irc_conn *irc, const char *format, ...)
 	const char *cur;
 	va_list ap;
 
+	irc_encodings_update(irc);
+
 	va_start(ap, format);
 	for (cur = format; *cur; cur++) {
 		if (cur != format)
@@ -664,10 +744,33 @@ char *irc_format(struct irc_conn *irc, const char *format, ...)
 	return (g_string_free(string, FALSE));
 }
 
+/*
+ * Decode one argument in place.  Valid input is returned as-is; anything
+ * that had to be converted or salvaged is also remembered in *owned so the
+ * caller can free it.
+ */
+static char *irc_parse_arg(struct irc_conn *irc, char *arg, gboolean verbatim, char **owned)
+{
+	if (verbatim) {
+		/* This is a string of unknown encoding which we do not
+		 * want to transcode, but it may or may not be valid
+		 * UTF-8, so we'll salvage it.  If a nick/channel/target
+		 * field has inadvertently been marked verbatim, this
+		 * could cause weirdness. */
+		*owned = g_utf8_validate(arg, -1, NULL) ? NULL : purple_utf8_salvage(arg);
+	} else {
+		*owned = irc_recv_convert_maybe(irc, arg);
+	}
+
+	return *owned ? *owned : arg;
+}
+
 void irc_parse_msg(struct irc_conn *irc, char *input)
 {
 	struct _irc_msg *msgent;
-	char *cur, *end, *tmp, *from, *msgname, *fmt, **args, *msg;
+	char *cur, *end, *tmp, *from, *fmt, *msg;
+	char *args[IRC_MAX_MSG_ARGS + 1], *owned[IRC_MAX_MSG_ARGS + 1];
+	char msgname[32], sep;
 	guint i;
 	PurpleConnection *gc = purple_account_get_connection(irc->account);
 	gboolean fmt_valid;
@@ -691,7 +794,7 @@ void irc_parse_msg(struct irc_conn *irc, char *input)
 
 	if (!strncmp(input, "PING ", 5)) {
 		msg = irc_format(irc, "vv", "PONG", input + 5);
-		irc_send(irc, msg);
+		irc_priority_send(irc, msg);
 		g_free(msg);
 		return;
 	} else if (!strncmp(input, "ERROR ", 6)) {
@@ -717,60 +820,63 @@ void irc_parse_msg(struct irc_conn *irc, char *input)
 		return;
 	}
 
-	from = g_strndup(&input[1], cur - &input[1]);
+	from = cur;
 	cur++;
 	end = strchr(cur, ' ');
 	if (!end)
 		end = cur + strlen(cur);
 
-	tmp = g_strndup(cur, end - cur);
-	msgname = g_ascii_strdown(tmp, -1);
-	g_free(tmp);
+	msgent = NULL;
+	if ((gsize)(end - cur) < sizeof(msgname)) {
+		for (i = 0; cur + i < end; i++)
+			msgname[i] = g_ascii_tolower(cur[i]);
+		msgname[i] = '\0';
+		msgent = g_hash_table_lookup(irc->msgs, msgname);
+	}
 
-	if ((msgent = g_hash_table_lookup(irc->msgs, msgname)) == NULL) {
-		irc_msg_default(irc, "", from, &input);
-		g_free(msgname);
-		g_free(from);
+	if (msgent == NULL) {
+		tmp = g_strndup(&input[1], from - &input[1]);
+		irc_msg_default(irc, "", tmp, &input);
+		g_free(tmp);
 		return;
 	}
-	g_free(msgname);
+
+	irc_encodings_update(irc);
+
+	/* From here on the line is split up in place, so each argument
+	 * only needs copying if it has to be converted. */
+	*from = '\0';
+	from = &input[1];
 
 	fmt_valid = TRUE;
-	args = g_new0(char *, strlen(msgent->format));
+	memset(args, 0, sizeof(args));
+	memset(owned, 0, sizeof(owned));
 	args_cnt = 0;
-	for (cur = end, fmt = msgent->format, i = 0; fmt[i] && *cur++; i++) {
+	sep = *end;
+	cur = end;
+	for (fmt = msgent->format, i = 0; fmt[i] && sep && i < IRC_MAX_MSG_ARGS; i++) {
+		cur++;
 		switch (fmt[i]) {
 		case 'v':
-			if (!(end = strchr(cur, ' '))) end = cur + strlen(cur);
-			/* This is a string of unknown encoding which we do not
-			 * want to transcode, but it may or may not be valid
-			 * UTF-8, so we'll salvage it.  If a nick/channel/target
-			 * field has inadvertently been marked verbatim, this
-			 * could cause weirdness. */
-			tmp = g_strndup(cur, end - cur);
-			args[i] = purple_utf8_salvage(tmp);
-			g_free(tmp);
-			cur += end - cur;
-			break;
 		case 't':
 		case 'n':
 		case 'c':
-			if (!(end = strchr(cur, ' '))) end = cur + strlen(cur);
-			tmp = g_strndup(cur, end - cur);
-			args[i] = irc_recv_convert(irc, tmp);
-			g_free(tmp);
-			cur += end - cur;
+			end = cur + strcspn(cur, " ");
+			sep = *end;
+			*end = '\0';
+			args[i] = irc_parse_arg(irc, cur, fmt[i] == 'v', &owned[i]);
+			cur = end;
 			break;
 		case ':':
 			if (*cur == ':') cur++;
-			args[i] = irc_recv_convert(irc, cur);
-			cur = cur + strlen(cur);
+			args[i] = irc_parse_arg(irc, cur, FALSE, &owned[i]);
+			sep = '\0';
 			break;
 		case '*':
 			/* Ditto 'v' above; we're going to salvage this in case
 			 * it leaks past the IRC prpl */
-			args[i] = purple_utf8_salvage(cur);
-			cur = cur + strlen(cur);
+			args[i] = irc_parse_arg(irc, cur, TRUE, &owned[i]);
+			sep = '\0';
 			break;
 		default:
 			purple_debug(PURPLE_DEBUG_ERROR, "irc", "invalid message format character '%c'\n", fmt[i]);
@@ -783,19 +889,17 @@ void irc_parse_msg(struct irc_conn *irc, char *input)
 	if (G_UNLIKELY(!fmt_valid)) {
 		purple_debug_error("irc", "message format was invalid");
 	} else if (G_LIKELY(args_cnt >= msgent->req_cnt)) {
-		tmp = irc_recv_convert(irc, from);
-		(msgent->cb)(irc, msgent->name, tmp, args);
+		tmp = irc_recv_convert_maybe(irc, from);
+		(msgent->cb)(irc, msgent->name, tmp ? tmp : from, args);
 		g_free(tmp);
 	} else {
 		purple_debug_error("irc", "args count (%d) doesn't reach "
 			"expected value of %d for the '%s' command",
 			args_cnt, msgent->req_cnt, msgent->name);
 	}
-	for (i = 0; i < strlen(msgent->format); i++) {
-		g_free(args[i]);
+	for (i = 0; i < IRC_MAX_MSG_ARGS; i++) {
+		g_free(owned[i]);
 	}
-	g_free(args);
-	g_free(from);
 }
 
 static void irc_parse_error_cb(struct irc_conn *irc, char *input)
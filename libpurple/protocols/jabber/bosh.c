@@ -31,12 +31,19 @@
 
 #include "bosh.h"
 
-/* The number of HTTP connections to use. This MUST be at least 2. */
-#define NUM_HTTP_CONNECTIONS      2
+/*
+ * The number of HTTP connections to use. We open as many as the connection
+ * manager's 'requests' attribute allows, within these bounds. The minimum
+ * MUST be at least 2.
+ */
+#define MIN_HTTP_CONNECTIONS      2
+#define MAX_HTTP_CONNECTIONS      4
 /* How many failed connection attempts before it becomes a fatal error */
 #define MAX_FAILED_CONNECTIONS    3
-/* How long in seconds to queue up outgoing messages */
+/* How long in seconds to queue up outgoing messages when nothing can send */
 #define BUFFER_SEND_IN_SECS       1
+/* How many requests may be outstanding on one persistent HTTP/1.1 connection */
+#define MAX_PIPELINED_REQUESTS    2
 
 typedef struct _PurpleHTTPConnection PurpleHTTPConnection;
 
@@ -53,9 +60,12 @@ typedef enum {
 
 struct _PurpleBOSHConnection {
 	JabberStream *js;
-	PurpleHTTPConnection *connections[NUM_HTTP_CONNECTIONS];
+	PurpleHTTPConnection *connections[MAX_HTTP_CONNECTIONS];
+	int num_connections; /* how many of connections[] we may use */
 
 	PurpleCircBuffer *pending;
+	GString *body_buf;   /* reused for building each <body/> */
+	GString *send_buf;   /* reused for building each HTTP request */
 	PurpleBOSHConnectionConnectFunction connect_cb;
 	PurpleBOSHConnectionReceiveFunction receive_cb;
 
@@ -79,10 +89,13 @@ struct _PurpleBOSHConnection {
 
 	int wait;
 
-	int max_requests;
+	int max_requests; /* negotiated 'requests' */
+	int hold;         /* negotiated 'hold' */
+	int polling;      /* minimum seconds between empty polls when hold is 0 */
 	int requests;
 
 	guint send_timer;
+	gboolean send_immediate; /* send_timer is the zero-delay flush */
 };
 
 struct _PurpleHTTPConnection {
@@ -92,6 +105,11 @@ struct _PurpleHTTPConnection {
 	PurpleCircBuffer *write_buf;
 	GString *read_buf;
 
+	/*
+	 * Responses are parsed in place. handled_len is how much of read_buf
+	 * has been consumed, header line by header line, so nothing is scanned
+	 * twice; the consumed prefix is dropped once per read.
+	 */
 	gsize handled_len;
 	gsize body_len;
 
@@ -106,8 +124,11 @@ struct _PurpleHTTPConnection {
 	} state;
 	int requests; /* number of outstanding HTTP requests */
 
+	gboolean status_done;
 	gboolean headers_done;
 	gboolean close;
+	gboolean pipelining; /* server has shown it keeps HTTP/1.1 connections */
+	gboolean eof;        /* read hit EOF, finishing off what we have */
 };
 
 static void
@@ -117,7 +138,7 @@ debug_dump_http_connections(PurpleBOSHConnection *conn)
 
 	g_return_if_fail(conn != NULL);
 
-	for (i = 0; i < NUM_HTTP_CONNECTIONS; ++i) {
+	for (i = 0; i < conn->num_connections; ++i) {
 		PurpleHTTPConnection *httpconn = conn->connections[i];
 		if (httpconn == NULL)
 			purple_debug_misc("jabber", "BOSH %p->connections[%d] = (nil)\n",
@@ -131,7 +152,7 @@ debug_dump_http_connections(PurpleBOSHConnection *conn)
 
 static void http_connection_connect(PurpleHTTPConnection *conn);
 static void http_connection_send_request(PurpleHTTPConnection *conn,
-                                         const GString *req);
+                                         const char *body, gsize len);
 static gboolean send_timer_cb(gpointer data);
 
 void jabber_bosh_init(void)
@@ -237,6 +258,14 @@ jabber_bosh_connection_init(JabberStream *js, const char *url)
 	conn->rid &= 0xFFFFFFFFFFFFFLL;
 
 	conn->pending = purple_circ_buffer_new(0 /* default grow size */);
+	conn->body_buf = g_string_sized_new(512);
+	conn->send_buf = g_string_sized_new(1024);
+
+	/* Until the session creation response says otherwise */
+	conn->num_connections = MIN_HTTP_CONNECTIONS;
+	conn->max_requests = 2;
+	conn->hold = 1;
+	conn->polling = BUFFER_SEND_IN_SECS;
 
 	conn->state = BOSH_CONN_OFFLINE;
 	if (purple_strcasestr(url, "https://") != NULL)
@@ -261,8 +290,10 @@ jabber_bosh_connection_destroy(PurpleBOSHConnection *conn)
 		purple_timeout_remove(conn->send_timer);
 
 	purple_circ_buffer_destroy(conn->pending);
+	g_string_free(conn->body_buf, TRUE);
+	g_string_free(conn->send_buf, TRUE);
 
-	for (i = 0; i < NUM_HTTP_CONNECTIONS; ++i) {
+	for (i = 0; i < MAX_HTTP_CONNECTIONS; ++i) {
 		if (conn->connections[i])
 			jabber_bosh_http_connection_destroy(conn->connections[i]);
 	}
@@ -275,56 +306,124 @@ gboolean jabber_bosh_connection_is_ssl(PurpleBOSHConnection *conn)
 	return conn->ssl;
 }
 
+static gboolean
+http_connection_is_usable(PurpleHTTPConnection *httpconn)
+{
+	return httpconn != NULL && httpconn->state == HTTP_CONN_CONNECTED &&
+	       !httpconn->eof;
+}
+
+/*
+ * Pick the connection the next request should go out on: an idle one if
+ * there is one, otherwise the least loaded connection that we know can
+ * pipeline. If start_connections is TRUE and nothing is connecting yet,
+ * also bring up another connection from the pool for next time.
+ */
 static PurpleHTTPConnection *
-find_available_http_connection(PurpleBOSHConnection *conn)
+find_available_http_connection(PurpleBOSHConnection *conn,
+                               gboolean start_connections)
 {
+	PurpleHTTPConnection *pipeline = NULL;
+	gboolean connecting = FALSE;
 	int i;
 
-	if (purple_debug_is_verbose())
+	if (start_connections && purple_debug_is_verbose())
 		debug_dump_http_connections(conn);
 
+	/* Never have more requests outstanding than the manager allows */
+	if (conn->requests >= conn->max_requests)
+		return NULL;
+
 	/* First loop, look for a connection that's ready */
-	for (i = 0; i < NUM_HTTP_CONNECTIONS; ++i) {
-		if (conn->connections[i] &&
-				conn->connections[i]->state == HTTP_CONN_CONNECTED &&
-				conn->connections[i]->requests == 0)
-			return conn->connections[i];
-	}
+	for (i = 0; i < conn->num_connections; ++i) {
+		PurpleHTTPConnection *httpconn = conn->connections[i];
 
-	/* Second loop, is something currently connecting? If so, just queue up. */
-	for (i = 0; i < NUM_HTTP_CONNECTIONS; ++i) {
-		if (conn->connections[i] &&
-				conn->connections[i]->state == HTTP_CONN_CONNECTING)
-			return NULL;
+		if (httpconn && httpconn->state == HTTP_CONN_CONNECTING)
+			connecting = TRUE;
+
+		if (!http_connection_is_usable(httpconn))
+			continue;
+
+		if (httpconn->requests == 0)
+			return httpconn;
+
+		if (httpconn->pipelining && !httpconn->close &&
+				httpconn->requests < MAX_PIPELINED_REQUESTS &&
+				(!pipeline || httpconn->requests < pipeline->requests))
+			pipeline = httpconn;
 	}
 
-	/* Third loop, is something offline that we can connect? */
-	for (i = 0; i < NUM_HTTP_CONNECTIONS; ++i) {
+	if (!start_connections || connecting)
+		return pipeline;
+
+	/* Second loop, is something offline that we can connect? */
+	for (i = 0; i < conn->num_connections; ++i) {
 		if (conn->connections[i] &&
 				conn->connections[i]->state == HTTP_CONN_OFFLINE) {
 			purple_debug_info("jabber", "bosh: Reconnecting httpconn "
 			                            "(%i, %p)\n", i, conn->connections[i]);
 			http_connection_connect(conn->connections[i]);
-			return NULL;
+			return pipeline;
 		}
 	}
 
-	/* Fourth loop, look for one that's NULL and create a new connection */
-	for (i = 0; i < NUM_HTTP_CONNECTIONS; ++i) {
+	/* Third loop, look for one that's NULL and create a new connection */
+	for (i = 0; i < conn->num_connections; ++i) {
 		if (!conn->connections[i]) {
 			conn->connections[i] = jabber_bosh_http_connection_init(conn);
 			purple_debug_info("jabber", "bosh: Creating and connecting new httpconn "
 			                            "(%i, %p)\n", i, conn->connections[i]);
 
 			http_connection_connect(conn->connections[i]);
-			return NULL;
+			return pipeline;
 		}
 	}
 
-	purple_debug_warning("jabber", "Could not find a HTTP connection!\n");
+	if (!pipeline && purple_debug_is_verbose())
+		purple_debug_misc("jabber", "bosh: All HTTP connections are busy\n");
 
-	/* None available. */
-	return NULL;
+	return pipeline;
+}
+
+/*
+ * Arrange for the pending buffer to be sent. Anything queued during this
+ * trip through the main loop goes out in one request as soon as a
+ * connection can take it; we only wait BUFFER_SEND_IN_SECS when none can.
+ */
+static void
+jabber_bosh_connection_schedule_flush(PurpleBOSHConnection *conn)
+{
+	gboolean now = find_available_http_connection(conn, FALSE) != NULL;
+
+	if (conn->send_timer != 0) {
+		if (conn->send_immediate || !now)
+			return;
+		purple_timeout_remove(conn->send_timer);
+	}
+
+	conn->send_immediate = now;
+	if (now)
+		conn->send_timer = purple_timeout_add(0, send_timer_cb, conn);
+	else
+		conn->send_timer = purple_timeout_add_seconds(BUFFER_SEND_IN_SECS,
+				send_timer_cb, conn);
+}
+
+/*
+ * Keep a request outstanding so the manager has somewhere to put incoming
+ * stanzas. In polling sessions (hold of 0) the manager answers at once, so
+ * empty requests are spaced out by the 'polling' interval instead.
+ */
+static void
+jabber_bosh_connection_poll(PurpleBOSHConnection *conn)
+{
+	if (conn->pending->bufused > 0 || conn->hold > 0) {
+		jabber_bosh_connection_schedule_flush(conn);
+	} else if (conn->send_timer == 0) {
+		conn->send_immediate = FALSE;
+		conn->send_timer = purple_timeout_add_seconds(conn->polling,
+				send_timer_cb, conn);
+	}
 }
 
 static void
@@ -332,13 +431,12 @@ jabber_bosh_connection_send(PurpleBOSHConnection *conn,
                             const PurpleBOSHPacketType type, const char *data)
 {
 	PurpleHTTPConnection *chosen;
-	GString *packet = NULL;
+	GString *packet;
 
 	if (type != PACKET_FLUSH && type != PACKET_TERMINATE) {
 		/*
 		 * Unless this is a flush (or session terminate, which needs to be
-		 * sent immediately), queue up the data and start a timer to flush
-		 * the buffer.
+		 * sent immediately), queue up the data and schedule a flush.
 		 */
 		if (data)
 			purple_circ_buffer_append(conn->pending, data, strlen(data));
@@ -346,13 +444,11 @@ jabber_bosh_connection_send(PurpleBOSHConnection *conn,
 		if (purple_debug_is_verbose())
 			purple_debug_misc("jabber", "bosh: %p has %" G_GSIZE_FORMAT " bytes in "
 			                  "the buffer.\n", conn, conn->pending->bufused);
-		if (conn->send_timer == 0)
-			conn->send_timer = purple_timeout_add_seconds(BUFFER_SEND_IN_SECS,
-					send_timer_cb, conn);
+		jabber_bosh_connection_schedule_flush(conn);
 		return;
 	}
 
-	chosen = find_available_http_connection(conn);
+	chosen = find_available_http_connection(conn, TRUE);
 
 	if (!chosen) {
 		if (type == PACKET_FLUSH)
@@ -376,9 +472,9 @@ jabber_bosh_connection_send(PurpleBOSHConnection *conn,
 		conn->send_timer = 0;
 	}
 
-	packet = g_string_new(NULL);
-
-	g_string_printf(packet, "<body "
+	packet = conn->body_buf;
+	g_string_truncate(packet, 0);
+	g_string_append_printf(packet, "<body "
 	                "rid='%" G_GUINT64_FORMAT "' "
 	                "sid='%s' "
 	                "to='%s' "
@@ -410,7 +506,7 @@ jabber_bosh_connection_send(PurpleBOSHConnection *conn,
 		packet = g_string_append(packet, "</body>");
 	}
 
-	http_connection_send_request(chosen, packet);
+	http_connection_send_request(chosen, packet->str, packet->len);
 }
 
 void jabber_bosh_connection_close(PurpleBOSHConnection *conn)
@@ -492,7 +588,7 @@ static void jabber_bosh_connection_received(PurpleBOSHConnection *conn, xmlnode
 static void boot_response_cb(PurpleBOSHConnection *conn, xmlnode *node) {
 	JabberStream *js = conn->js;
 	const char *sid, *version;
-	const char *inactivity, *requests;
+	const char *inactivity, *requests, *hold, *polling;
 	xmlnode *packet;
 
 	g_return_if_fail(node != NULL);
@@ -504,6 +600,8 @@ static void boot_response_cb(PurpleBOSHConnection *conn, xmlnode *node) {
 
 	inactivity = xmlnode_get_attrib(node, "inactivity");
 	requests = xmlnode_get_attrib(node, "requests");
+	hold = xmlnode_get_attrib(node, "hold");
+	polling = xmlnode_get_attrib(node, "polling");
 
 	if (sid) {
 		conn->sid = g_strdup(sid);
@@ -553,8 +651,18 @@ static void boot_response_cb(PurpleBOSHConnection *conn, xmlnode *node) {
 		}
 	}
 
-	if (requests)
+	if (requests && atoi(requests) > 0)
 		conn->max_requests = atoi(requests);
+	if (hold && atoi(hold) >= 0)
+		conn->hold = atoi(hold);
+	if (polling && atoi(polling) > 0)
+		conn->polling = atoi(polling);
+
+	conn->num_connections = CLAMP(conn->max_requests, MIN_HTTP_CONNECTIONS,
+	                              MAX_HTTP_CONNECTIONS);
+	purple_debug_info("jabber", "BOSH session allows %d requests, hold %d; "
+	                  "using %d HTTP connections\n", conn->max_requests,
+	                  conn->hold, conn->num_connections);
 
 	jabber_stream_set_state(js, JABBER_STREAM_AUTHENTICATING);
 
@@ -587,7 +695,7 @@ static void jabber_bosh_connection_boot(PurpleBOSHConnection *conn) {
 	purple_debug_misc("jabber", "SendBOSH Boot %s(%" G_GSIZE_FORMAT "): %s\n",
 	                  conn->ssl ? "(ssl)" : "", buf->len, buf->str);
 	conn->receive_cb = boot_response_cb;
-	http_connection_send_request(conn->connections[0], buf);
+	http_connection_send_request(conn->connections[0], buf->str, buf->len);
 	g_string_free(buf, TRUE);
 }
 
@@ -640,12 +748,12 @@ connection_common_established_cb(PurpleHTTPConnection *conn)
 		                   conn, conn->requests);
 
 	conn->requests = 0;
-	if (conn->read_buf) {
-		g_string_free(conn->read_buf, TRUE);
-		conn->read_buf = NULL;
-	}
+	if (conn->read_buf)
+		g_string_truncate(conn->read_buf, 0);
 	conn->close = FALSE;
-	conn->headers_done = FALSE;
+	conn->eof = FALSE;
+	conn->pipelining = FALSE;
+	conn->status_done = conn->headers_done = FALSE;
 	conn->handled_len = conn->body_len = 0;
 
 	if (purple_debug_is_verbose())
@@ -689,14 +797,29 @@ static void http_connection_disconnected(PurpleHTTPConnection *conn)
 		conn->writeh = 0;
 	}
 
+	/*
+	 * Whatever complete responses were buffered have been handled by now,
+	 * so anything still outstanding on this connection is never coming
+	 * back.
+	 */
 	had_requests = (conn->requests > 0);
-	if (had_requests && conn->read_buf->len == 0) {
+	if (had_requests) {
 		purple_debug_error("jabber", "bosh: Adjusting BOSHconn requests (%d) to %d\n",
 		                   conn->bosh->requests, conn->bosh->requests - conn->requests);
 		conn->bosh->requests -= conn->requests;
 		conn->requests = 0;
 	}
 
+	if (conn->read_buf)
+		g_string_truncate(conn->read_buf, 0);
+	while (purple_circ_buffer_get_max_read(conn->write_buf) > 0)
+		purple_circ_buffer_mark_read(conn->write_buf,
+				purple_circ_buffer_get_max_read(conn->write_buf));
+	conn->eof = FALSE;
+	conn->pipelining = FALSE;
+	conn->status_done = conn->headers_done = FALSE;
+	conn->handled_len = conn->body_len = 0;
+
 	if (!had_requests)
 		/* If the server disconnected us without any requests, let's
 		 * just wait until we have something to send before we reconnect
@@ -722,111 +845,133 @@ void jabber_bosh_connection_connect(PurpleBOSHConnection *bosh) {
 	http_connection_connect(conn);
 }
 
+/*
+ * Handle one header line of a response (without its CRLF). The status
+ * line tells us whether the server speaks persistent HTTP/1.1, which we
+ * need to know before pipelining requests on this connection.
+ */
+static void
+http_connection_parse_header(PurpleHTTPConnection *conn, const char *line,
+                             gsize len)
+{
+	if (!conn->status_done) {
+		conn->status_done = TRUE;
+		if (len >= 12 && !strncmp(line, "HTTP/1.", 7)) {
+			/* HTTP/1.0 closes unless told otherwise, HTTP/1.1 keeps */
+			conn->close = (line[7] == '0');
+			if (strncmp(line + 9, "200", 3))
+				purple_debug_warning("jabber", "BOSH: Unexpected HTTP status "
+				                     "%.3s\n", line + 9);
+		}
+		return;
+	}
+
+#define HEADER_IS(name) \
+	(len > sizeof(name) - 1 && !g_ascii_strncasecmp(line, name, sizeof(name) - 1))
+
+	if (HEADER_IS("Content-Length:")) {
+		int body_len = atoi(line + sizeof("Content-Length:") - 1);
+		if (body_len == 0)
+			purple_debug_warning("jabber", "Found mangled Content-Length header, or server returned 0-length response.\n");
+
+		conn->body_len = body_len;
+	} else if (HEADER_IS("Connection:")) {
+		const char *tmp = line + sizeof("Connection:") - 1;
+		gsize left = len - (sizeof("Connection:") - 1);
+
+		while (left > 0 && (*tmp == ' ' || *tmp == '\t')) {
+			++tmp;
+			--left;
+		}
+
+		if (left >= 5 && !g_ascii_strncasecmp(tmp, "close", 5))
+			conn->close = TRUE;
+		else if (left >= 10 && !g_ascii_strncasecmp(tmp, "keep-alive", 10))
+			conn->close = FALSE;
+	}
+
+#undef HEADER_IS
+}
+
 /**
- * @return TRUE if we want to be called again immediately. This happens when
- *         we parse an HTTP response AND there is more data in read_buf. FALSE
- *         if we should not be called again unless more data has been read.
+ * Parse as much of read_buf as we can, dispatching every complete response.
+ * Header lines are consumed as they arrive, so a response that trickles in
+ * over several reads is never rescanned from the start.
  */
-static gboolean
+static void
 jabber_bosh_http_connection_process(PurpleHTTPConnection *conn)
 {
-	const char *cursor;
-
-	cursor = conn->read_buf->str + conn->handled_len;
+	PurpleBOSHConnection *bosh = conn->bosh;
+	gboolean responded = FALSE;
 
 	if (purple_debug_is_verbose())
-		purple_debug_misc("jabber", "BOSH server sent: %s\n", cursor);
-
-	/* TODO: Chunked encoding and check response version :/ */
-	if (!conn->headers_done) {
-		const char *content_length = purple_strcasestr(cursor, "\r\nContent-Length:");
-		const char *connection = purple_strcasestr(cursor, "\r\nConnection:");
-		const char *end_of_headers = strstr(cursor, "\r\n\r\n");
-
-		/* Make sure Content-Length is in headers, not body */
-		if (content_length && (!end_of_headers || content_length < end_of_headers)) {
-			int len;
-
-			if (strstr(content_length, "\r\n") == NULL)
-				/*
-				 * The packet ends in the middle of the Content-Length line.
-				 * We'll try again later when we have more.
-				 */
-				return FALSE;
-
-			len = atoi(content_length + strlen("\r\nContent-Length:"));
-			if (len == 0)
-				purple_debug_warning("jabber", "Found mangled Content-Length header, or server returned 0-length response.\n");
-
-			conn->body_len = len;
-		}
+		purple_debug_misc("jabber", "BOSH server sent: %s\n",
+		                  conn->read_buf->str + conn->handled_len);
 
-		if (connection && (!end_of_headers || connection < end_of_headers)) {
-			const char *tmp;
-			if (strstr(connection, "\r\n") == NULL)
-				return FALSE;
+	/* TODO: Chunked encoding :/ */
+	for (;;) {
+		const char *cursor = conn->read_buf->str + conn->handled_len;
+		gsize avail = conn->read_buf->len - conn->handled_len;
 
+		if (!conn->headers_done) {
+			const char *eol = avail ? g_strstr_len(cursor, avail, "\r\n") : NULL;
 
-			tmp = connection + strlen("\r\nConnection:");
-			while (*tmp && (*tmp == ' ' || *tmp == '\t'))
-				++tmp;
+			if (eol == NULL)
+				/* Wait for the rest of the line */
+				break;
 
-			if (!g_ascii_strncasecmp(tmp, "close", strlen("close"))) {
-				conn->close = TRUE;
-			}
-		}
+			if (eol == cursor)
+				conn->headers_done = TRUE;
+			else
+				http_connection_parse_header(conn, cursor, eol - cursor);
 
-		if (end_of_headers) {
-			conn->headers_done = TRUE;
-			conn->handled_len = end_of_headers - conn->read_buf->str + 4;
-		} else {
-			conn->handled_len = conn->read_buf->len;
-			return FALSE;
+			conn->handled_len += eol - cursor + 2;
+			continue;
 		}
-	}
 
-	/* Have we handled everything in the buffer? */
-	if (conn->handled_len >= conn->read_buf->len)
-		return FALSE;
+		/* Have we read all that the Content-Length promised us? */
+		if (avail < conn->body_len)
+			break;
 
-	/* Have we read all that the Content-Length promised us? */
-	if (conn->read_buf->len - conn->handled_len < conn->body_len)
-		return FALSE;
+		--conn->requests;
+		--bosh->requests;
+		responded = TRUE;
 
-	--conn->requests;
-	--conn->bosh->requests;
+		/* The persistent connection survived a response; it can pipeline */
+		if (!conn->close)
+			conn->pipelining = TRUE;
 
-	http_received_cb(conn->read_buf->str + conn->handled_len, conn->body_len,
-	                 conn->bosh);
+		if (conn->body_len > 0)
+			http_received_cb(cursor, conn->body_len, bosh);
 
-	/* Is there another response in the buffer ? */
-	if (conn->read_buf->len > conn->body_len + conn->handled_len) {
-		g_string_erase(conn->read_buf, 0, conn->handled_len + conn->body_len);
-		conn->headers_done = FALSE;
-		conn->handled_len = conn->body_len = 0;
-		return TRUE;
+		conn->handled_len += conn->body_len;
+		conn->status_done = conn->headers_done = FALSE;
+		conn->body_len = 0;
 	}
 
+	/* Drop what we've consumed in one go rather than once per response */
+	if (conn->handled_len > 0) {
+		g_string_erase(conn->read_buf, 0, conn->handled_len);
+		conn->handled_len = 0;
+	}
+
+	if (!responded)
+		return;
+
 	/* Connection: Close? */
-	if (conn->close && conn->state == HTTP_CONN_CONNECTED) {
+	if (conn->close && conn->requests == 0 &&
+			conn->state == HTTP_CONN_CONNECTED) {
 		if (purple_debug_is_verbose())
 			purple_debug_misc("jabber", "bosh (%p), server sent Connection: "
 			                            "close\n", conn);
 		http_connection_disconnected(conn);
 	}
 
-	if (conn->bosh->state == BOSH_CONN_ONLINE &&
-			(conn->bosh->requests == 0 || conn->bosh->pending->bufused > 0)) {
+	if (bosh->state == BOSH_CONN_ONLINE &&
+			(bosh->requests == 0 || bosh->pending->bufused > 0)) {
 		purple_debug_misc("jabber", "BOSH: Sending an empty request\n");
-		jabber_bosh_connection_send(conn->bosh, PACKET_NORMAL, NULL);
+		jabber_bosh_connection_poll(bosh);
 	}
-
-	g_string_free(conn->read_buf, TRUE);
-	conn->read_buf = NULL;
-	conn->headers_done = FALSE;
-	conn->handled_len = conn->body_len = 0;
-
-	return FALSE;
 }
 
 /*
@@ -836,11 +981,11 @@ jabber_bosh_http_connection_process(PurpleHTTPConnection *conn)
 static void
 http_connection_read(PurpleHTTPConnection *conn)
 {
-	char buffer[1025];
+	char buffer[4096];
 	int cnt;
 
 	if (!conn->read_buf)
-		conn->read_buf = g_string_new(NULL);
+		conn->read_buf = g_string_sized_new(sizeof(buffer));
 
 	do {
 		if (conn->psc)
@@ -862,17 +1007,18 @@ http_connection_read(PurpleHTTPConnection *conn)
 			                  conn);
 
 		/*
-		 * If the socket is closed, the processing really needs to know about
-		 * it. Handle that now.
+		 * Process what we do have first, but make sure nothing new gets
+		 * sent on this connection while we do.
 		 */
-		http_connection_disconnected(conn);
-
-		/* Process what we do have */
+		conn->eof = TRUE;
 	}
 
-	if (conn->read_buf->len > 0) {
-		while (jabber_bosh_http_connection_process(conn));
-	}
+	if (conn->read_buf->len > 0)
+		jabber_bosh_http_connection_process(conn);
+
+	/* Unless handling the last response already hung up */
+	if (conn->eof)
+		http_connection_disconnected(conn);
 }
 
 static void
@@ -1019,25 +1165,29 @@ http_connection_send_cb(gpointer data, gint source, PurpleInputCondition cond)
 }
 
 static void
-http_connection_send_request(PurpleHTTPConnection *conn, const GString *req)
+http_connection_send_request(PurpleHTTPConnection *conn, const char *body,
+                             gsize body_len)
 {
-	char *data;
+	GString *req = conn->bosh->send_buf;
+	const char *data;
 	int ret;
 	size_t len;
 
 	/* Sending something to the server, restart the inactivity timer */
 	jabber_stream_restart_inactivity_timer(conn->bosh->js);
 
-	data = g_strdup_printf("POST %s HTTP/1.1\r\n"
+	g_string_truncate(req, 0);
+	g_string_append_printf(req, "POST %s HTTP/1.1\r\n"
 	                       "Host: %s\r\n"
 	                       "User-Agent: %s\r\n"
 	                       "Content-Encoding: text/xml; charset=utf-8\r\n"
-	                       "Content-Length: %" G_GSIZE_FORMAT "\r\n\r\n"
-	                       "%s",
+	                       "Content-Length: %" G_GSIZE_FORMAT "\r\n\r\n",
 	                       conn->bosh->path, conn->bosh->host, bosh_useragent,
-	                       req->len, req->str);
+	                       body_len);
+	g_string_append_len(req, body, body_len);
 
-	len = strlen(data);
+	data = req->str;
+	len = req->len;
 
 	++conn->requests;
 	++conn->bosh->requests;
@@ -27,6 +27,7 @@
 #include "prpl.h"
 #include "notify.h"
 #include "request.h"
+#include "stringref.h"
 #include "util.h"
 #include "xmlnode.h"
 
@@ -78,8 +79,9 @@ jabber_buddy_resource_free(JabberBuddyResource *jbr)
 		g_free(jbr->caps.exts->data);
 		jbr->caps.exts = g_list_delete_link(jbr->caps.exts, jbr->caps.exts);
 	}
+	jabber_caps_client_info_unref(jbr->caps.info);
 
-	g_free(jbr->name);
+	purple_stringref_intern_unref(jbr->name);
 	g_free(jbr->status);
 	g_free(jbr->thread_id);
 	g_free(jbr->client.name);
@@ -115,9 +117,11 @@ JabberBuddy *jabber_buddy_find(JabberStream *js, const char *name,
 
 	if(!jb && create) {
 		jb = g_new0(JabberBuddy, 1);
-		g_hash_table_insert(js->buddies, realname, jb);
-	} else
-		g_free(realname);
+		g_hash_table_insert(js->buddies,
+				(gpointer)purple_stringref_intern(realname), jb);
+	}
+
+	g_free(realname);
 
 	return jb;
 }
@@ -236,7 +240,7 @@ JabberBuddyResource *jabber_buddy_track_resource(JabberBuddy *jb, const char *re
 	} else {
 		jbr = g_new0(JabberBuddyResource, 1);
 		jbr->jb = jb;
-		jbr->name = g_strdup(resource);
+		jbr->name = (char *)purple_stringref_intern(resource);
 		jbr->capabilities = JABBER_CAP_NONE;
 		jbr->tz_off = PURPLE_NO_TZ_OFF;
 	}
@@ -28,19 +28,44 @@
 #include "cipher.h"
 #include "iq.h"
 #include "presence.h"
+#include "stringref.h"
 #include "util.h"
 #include "xdata.h"
 
 #define JABBER_CAPS_FILENAME "xmpp-caps.xml"
 
+/*
+ * The most (node,ver,hash) entries we keep, in memory and on disk.  Entries
+ * in use by a resource are never evicted, so this can be exceeded while
+ * more distinct clients than this are online at once.
+ */
+#define JABBER_CAPS_MAX_ENTRIES 512
+
 typedef struct _JabberDataFormField {
 	gchar *var;
 	GList *values;
 } JabberDataFormField;
 
+/*
+ * A sorted list of interned feature vars, shared by every ClientInfo that
+ * advertises exactly that list.  Most ver hashes for a given client differ
+ * only in the identity name or software version form.
+ */
+struct _JabberCapsFeatureSet {
+	guint ref;
+	guint hash;
+	GList *features;
+};
+
+/* The node strings and feature vars are interned; the same handful of
+ * clients and namespaces show up on every roster. */
 static GHashTable *capstable = NULL; /* JabberCapsTuple -> JabberCapsClientInfo */
-static GHashTable *nodetable = NULL; /* char *node -> JabberCapsNodeExts */
+static GHashTable *nodetable = NULL; /* const char *node atom -> JabberCapsNodeExts */
+static GHashTable *featuretable = NULL; /* JabberCapsFeatureSet -> itself */
+static GHashTable *pendingtable = NULL; /* JabberCapsTuple -> jabber_caps_cbplususerdata */
+static GQueue      lru = G_QUEUE_INIT; /* JabberCapsClientInfo, most recent first */
 static guint       save_timer = 0;
+static JabberCapsStats stats;
 
 /* Free a GList of allocated char* */
 static void
@@ -52,6 +77,80 @@ free_string_glist(GList *list)
 	}
 }
 
+/* Free a GList of interned feature vars */
+static void
+free_feature_glist(GList *list)
+{
+	while (list) {
+		purple_stringref_intern_unref(list->data);
+		list = g_list_delete_link(list, list);
+	}
+}
+
+static guint
+jabber_caps_feature_set_hash(gconstpointer data)
+{
+	return ((const JabberCapsFeatureSet *)data)->hash;
+}
+
+static gboolean
+jabber_caps_feature_set_equal(gconstpointer v1, gconstpointer v2)
+{
+	const GList *a = ((const JabberCapsFeatureSet *)v1)->features;
+	const GList *b = ((const JabberCapsFeatureSet *)v2)->features;
+
+	/* The vars are interned, so comparing the pointers is enough */
+	for (; a && b; a = a->next, b = b->next)
+		if (a->data != b->data)
+			return FALSE;
+
+	return a == NULL && b == NULL;
+}
+
+/*
+ * Returns the shared set equal to 'features', taking ownership of the list
+ * (which is freed if an equal set already exists).
+ */
+static JabberCapsFeatureSet *
+jabber_caps_feature_set_get(GList *features)
+{
+	JabberCapsFeatureSet key, *set;
+	GList *l;
+
+	key.features = g_list_sort(features, (GCompareFunc)strcmp);
+	key.hash = 0;
+	for (l = key.features; l; l = l->next)
+		key.hash = (key.hash * 33) ^ g_direct_hash(l->data);
+
+	set = g_hash_table_lookup(featuretable, &key);
+	if (set) {
+		free_feature_glist(key.features);
+		++set->ref;
+		return set;
+	}
+
+	set = g_new(JabberCapsFeatureSet, 1);
+	set->ref = 1;
+	set->hash = key.hash;
+	set->features = key.features;
+	g_hash_table_insert(featuretable, set, set);
+
+	return set;
+}
+
+static void
+jabber_caps_feature_set_unref(JabberCapsFeatureSet *set)
+{
+	g_return_if_fail(set->ref != 0);
+
+	if (--set->ref != 0)
+		return;
+
+	g_hash_table_remove(featuretable, set);
+	free_feature_glist(set->features);
+	g_free(set);
+}
+
 static JabberCapsNodeExts*
 jabber_caps_node_exts_ref(JabberCapsNodeExts *exts)
 {
@@ -114,7 +213,10 @@ jabber_caps_client_info_destroy(JabberCapsClientInfo *info)
 		info->identities = g_list_delete_link(info->identities, info->identities);
 	}
 
-	free_string_glist(info->features);
+	if (info->featureset)
+		jabber_caps_feature_set_unref(info->featureset);
+	else
+		free_feature_glist(info->features);
 
 	while (info->forms) {
 		xmlnode_free(info->forms->data);
@@ -123,13 +225,45 @@ jabber_caps_client_info_destroy(JabberCapsClientInfo *info)
 
 	jabber_caps_node_exts_unref(info->exts);
 
-	g_free((char *)info->tuple.node);
+	if (info->stored)
+		xmlnode_free(info->stored);
+
+	purple_stringref_intern_unref(info->tuple.node);
 	g_free((char *)info->tuple.ver);
 	g_free((char *)info->tuple.hash);
 
 	g_free(info);
 }
 
+JabberCapsClientInfo *
+jabber_caps_client_info_ref(JabberCapsClientInfo *info)
+{
+	g_return_val_if_fail(info != NULL, NULL);
+
+	++info->ref;
+	return info;
+}
+
+void
+jabber_caps_client_info_unref(JabberCapsClientInfo *info)
+{
+	if (info == NULL)
+		return;
+
+	g_return_if_fail(info->ref != 0);
+
+	if (--info->ref != 0)
+		return;
+
+	jabber_caps_client_info_destroy(info);
+}
+
+const JabberCapsStats *
+jabber_caps_get_stats(void)
+{
+	return &stats;
+}
+
 /* NOTE: Takes a reference to the exts, unref it if you don't really want to
  * keep it around. */
 static JabberCapsNodeExts*
@@ -139,8 +273,9 @@ jabber_caps_find_exts_by_node(const char *node)
 	if (NULL == (exts = g_hash_table_lookup(nodetable, node))) {
 		exts = g_new0(JabberCapsNodeExts, 1);
 		exts->exts = g_hash_table_new_full(g_str_hash, g_str_equal, g_free,
-		                                   (GDestroyNotify)free_string_glist);
-		g_hash_table_insert(nodetable, g_strdup(node), jabber_caps_node_exts_ref(exts));
+		                                   (GDestroyNotify)free_feature_glist);
+		g_hash_table_insert(nodetable, (gpointer)purple_stringref_intern(node),
+		                    jabber_caps_node_exts_ref(exts));
 	}
 
 	return jabber_caps_node_exts_ref(exts);
@@ -162,11 +297,11 @@ exts_to_xmlnode(gconstpointer key, gconstpointer value, gpointer user_data)
 	}
 }
 
-static void jabber_caps_store_client(gpointer key, gpointer value, gpointer user_data) {
-	const JabberCapsTuple *tuple = key;
-	const JabberCapsClientInfo *props = value;
-	xmlnode *root = user_data;
-	xmlnode *client = xmlnode_new_child(root, "client");
+static xmlnode *
+jabber_caps_client_to_xmlnode(const JabberCapsClientInfo *props)
+{
+	const JabberCapsTuple *tuple = &props->tuple;
+	xmlnode *client = xmlnode_new("client");
 	GList *iter;
 
 	xmlnode_set_attrib(client, "node", tuple->node);
@@ -199,6 +334,14 @@ static void jabber_caps_store_client(gpointer key, gpointer value, gpointer user
 	/* TODO: Ideally, only save this once-per-node... */
 	if (props->exts)
 		g_hash_table_foreach(props->exts->exts, (GHFunc)exts_to_xmlnode, client);
+
+	return client;
+}
+
+static void
+clear_exts_dirty(gpointer key, gpointer value, gpointer user_data)
+{
+	((JabberCapsNodeExts *)value)->dirty = FALSE;
 }
 
 static gboolean
@@ -207,12 +350,55 @@ do_jabber_caps_store(gpointer data)
 	char *str;
 	int length = 0;
 	xmlnode *root = xmlnode_new("capabilities");
-	g_hash_table_foreach(capstable, jabber_caps_store_client, root);
+	xmlnode *client, *next;
+	GList *l;
+	guint rebuilt = 0;
+
+	/*
+	 * Entries that have not changed since they were last loaded or saved
+	 * keep their <client/> around, so only new entries (and v1.3 entries
+	 * whose node learned new exts) are serialized again.  They are linked
+	 * into the document just long enough to write it out; oldest first,
+	 * so that the next load rebuilds the same LRU order.
+	 */
+	for (l = lru.tail; l; l = l->prev) {
+		JabberCapsClientInfo *info = l->data;
+
+		if (info->stored && info->loaded && info->exts && info->exts->dirty) {
+			xmlnode_free(info->stored);
+			info->stored = NULL;
+		}
+
+		if (info->stored == NULL) {
+			info->stored = jabber_caps_client_to_xmlnode(info);
+			++rebuilt;
+		}
+
+		xmlnode_insert_child(root, info->stored);
+	}
+
 	str = xmlnode_to_formatted_str(root, &length);
+
+	for (client = root->child; client; client = next) {
+		next = client->next;
+		client->parent = NULL;
+		client->next = NULL;
+	}
+	root->child = root->lastchild = NULL;
 	xmlnode_free(root);
+
 	purple_util_write_data_to_file(JABBER_CAPS_FILENAME, str, length);
 	g_free(str);
 
+	g_hash_table_foreach(nodetable, clear_exts_dirty, NULL);
+
+	purple_debug_info("jabber", "Saved %u caps entries (%u changed); "
+	                  "%u hits, %u loads, %u misses (%u coalesced), "
+	                  "%u evictions\n",
+	                  g_hash_table_size(capstable), rebuilt, stats.hits,
+	                  stats.loads, stats.misses, stats.coalesced,
+	                  stats.evictions);
+
 	save_timer = 0;
 	return FALSE;
 }
@@ -224,11 +410,162 @@ schedule_caps_save(void)
 		save_timer = purple_timeout_add_seconds(5, do_jabber_caps_store, NULL);
 }
 
+/*
+ * Parse the saved <client/> of a lazily loaded entry.
+ */
+static void
+jabber_caps_client_info_load(JabberCapsClientInfo *value)
+{
+	const JabberCapsTuple *key = &value->tuple;
+	xmlnode *child;
+	JabberCapsNodeExts *exts = NULL;
+	GList *features = NULL;
+
+	value->loaded = TRUE;
+
+	/* v1.3 capabilities */
+	if (key->hash == NULL)
+		exts = jabber_caps_find_exts_by_node(key->node);
+
+	for (child = value->stored->child; child; child = child->next) {
+		if (child->type != XMLNODE_TYPE_TAG)
+			continue;
+		if (purple_strequal(child->name, "feature")) {
+			const char *var = xmlnode_get_attrib(child, "var");
+			if(!var)
+				continue;
+			features = g_list_prepend(features,
+					(gpointer)purple_stringref_intern(var));
+		} else if (purple_strequal(child->name, "identity")) {
+			const char *category = xmlnode_get_attrib(child, "category");
+			const char *type = xmlnode_get_attrib(child, "type");
+			const char *name = xmlnode_get_attrib(child, "name");
+			const char *lang = xmlnode_get_attrib(child, "lang");
+			JabberIdentity *id;
+
+			if (!category || !type)
+				continue;
+
+			id = g_new0(JabberIdentity, 1);
+			id->category = g_strdup(category);
+			id->type = g_strdup(type);
+			id->name = g_strdup(name);
+			id->lang = g_strdup(lang);
+
+			value->identities = g_list_append(value->identities,id);
+		} else if (purple_strequal(child->name, "x")) {
+			/* TODO: See #7814 -- this might cause problems if anyone
+			 * ever actually specifies forms. In fact, for this to
+			 * work properly, that bug needs to be fixed in
+			 * xmlnode_from_str, not the output version... */
+			value->forms = g_list_append(value->forms, xmlnode_copy(child));
+		} else if (purple_strequal(child->name, "ext")) {
+			if (key->hash != NULL)
+				purple_debug_warning("jabber", "Ignoring exts when reading new-style caps\n");
+			else {
+				/* TODO: Do we care about reading in the identities listed here? */
+				const char *identifier = xmlnode_get_attrib(child, "identifier");
+				xmlnode *node;
+				GList *ext_features = NULL;
+
+				if (!identifier)
+					continue;
+
+				/* Another entry for this node may already have
+				 * loaded (or fetched) this ext */
+				if (g_hash_table_lookup(exts->exts, identifier))
+					continue;
+
+				for (node = child->child; node; node = node->next) {
+					if (node->type != XMLNODE_TYPE_TAG)
+						continue;
+					if (purple_strequal(node->name, "feature")) {
+						const char *var = xmlnode_get_attrib(node, "var");
+						if (!var)
+							continue;
+						ext_features = g_list_prepend(ext_features,
+								(gpointer)purple_stringref_intern(var));
+					}
+				}
+
+				if (ext_features) {
+					g_hash_table_insert(exts->exts, g_strdup(identifier),
+					                    ext_features);
+				} else
+					purple_debug_warning("jabber", "Caps ext %s had no features.\n",
+					                     identifier);
+			}
+		}
+	}
+
+	value->features = NULL;
+	if (features) {
+		value->featureset = jabber_caps_feature_set_get(features);
+		value->features = value->featureset->features;
+	}
+	value->exts = exts;
+}
+
+/*
+ * Add a new entry to the cache, which takes a reference to it.  If this
+ * pushes the cache over its limit, the least recently used entries that
+ * nothing else holds a reference to are dropped.
+ */
+static void
+jabber_caps_insert(JabberCapsClientInfo *info)
+{
+	GList *l, *prev;
+
+	info->lru = g_list_alloc();
+	info->lru->data = info;
+	g_queue_push_head_link(&lru, info->lru);
+	g_hash_table_insert(capstable, (JabberCapsTuple *)&info->tuple,
+	                    jabber_caps_client_info_ref(info));
+
+	for (l = lru.tail; l && g_hash_table_size(capstable) > JABBER_CAPS_MAX_ENTRIES; l = prev) {
+		JabberCapsClientInfo *victim = l->data;
+		prev = l->prev;
+
+		if (victim == info || victim->ref > 1)
+			continue;
+
+		g_queue_delete_link(&lru, l);
+		victim->lru = NULL;
+		++stats.evictions;
+		/* This drops the last reference */
+		g_hash_table_remove(capstable, &victim->tuple);
+	}
+}
+
+/*
+ * Look up a (node,ver,hash) in the cache, parsing it first if it has not
+ * been used since it was loaded from disk.
+ */
+static JabberCapsClientInfo *
+jabber_caps_lookup(const JabberCapsTuple *key)
+{
+	JabberCapsClientInfo *info = g_hash_table_lookup(capstable, key);
+
+	if (info == NULL)
+		return NULL;
+
+	if (!info->loaded) {
+		jabber_caps_client_info_load(info);
+		++stats.loads;
+	} else
+		++stats.hits;
+
+	g_queue_unlink(&lru, info->lru);
+	g_queue_push_head_link(&lru, info->lru);
+
+	return info;
+}
+
 static void
 jabber_caps_load(void)
 {
 	xmlnode *capsdata = purple_util_read_xml_from_file(JABBER_CAPS_FILENAME, "XMPP capabilities cache");
-	xmlnode *client;
+	xmlnode *client, *next;
 
 	if(!capsdata)
 		return;
@@ -238,98 +575,53 @@ jabber_caps_load(void)
 		return;
 	}
 
-	for (client = capsdata->child; client; client = client->next) {
-		if (client->type != XMLNODE_TYPE_TAG)
-			continue;
-		if (purple_strequal(client->name, "client")) {
+	/*
+	 * Only index the entries here; the features and identities of each
+	 * one are parsed the first time someone actually advertises it.  Each
+	 * entry keeps its <client/>, detached from the document, until then.
+	 */
+	for (client = capsdata->child; client; client = next) {
+		next = client->next;
+
+		if (client->type == XMLNODE_TYPE_TAG &&
+				purple_strequal(client->name, "client") &&
+				xmlnode_get_attrib(client, "node") &&
+				xmlnode_get_attrib(client, "ver")) {
 			JabberCapsClientInfo *value = g_new0(JabberCapsClientInfo, 1);
 			JabberCapsTuple *key = (JabberCapsTuple*)&value->tuple;
-			xmlnode *child;
-			JabberCapsNodeExts *exts = NULL;
-			key->node = g_strdup(xmlnode_get_attrib(client,"node"));
+
+			key->node = purple_stringref_intern(xmlnode_get_attrib(client,"node"));
 			key->ver  = g_strdup(xmlnode_get_attrib(client,"ver"));
 			key->hash = g_strdup(xmlnode_get_attrib(client,"hash"));
 
-			/* v1.3 capabilities */
-			if (key->hash == NULL)
-				exts = jabber_caps_find_exts_by_node(key->node);
-
-			for (child = client->child; child; child = child->next) {
-				if (child->type != XMLNODE_TYPE_TAG)
-					continue;
-				if (purple_strequal(child->name, "feature")) {
-					const char *var = xmlnode_get_attrib(child, "var");
-					if(!var)
-						continue;
-					value->features = g_list_append(value->features,g_strdup(var));
-				} else if (purple_strequal(child->name, "identity")) {
-					const char *category = xmlnode_get_attrib(child, "category");
-					const char *type = xmlnode_get_attrib(child, "type");
-					const char *name = xmlnode_get_attrib(child, "name");
-					const char *lang = xmlnode_get_attrib(child, "lang");
-					JabberIdentity *id;
-
-					if (!category || !type)
-						continue;
-
-					id = g_new0(JabberIdentity, 1);
-					id->category = g_strdup(category);
-					id->type = g_strdup(type);
-					id->name = g_strdup(name);
-					id->lang = g_strdup(lang);
-
-					value->identities = g_list_append(value->identities,id);
-				} else if (purple_strequal(child->name, "x")) {
-					/* TODO: See #7814 -- this might cause problems if anyone
-					 * ever actually specifies forms. In fact, for this to
-					 * work properly, that bug needs to be fixed in
-					 * xmlnode_from_str, not the output version... */
-					value->forms = g_list_append(value->forms, xmlnode_copy(child));
-				} else if (purple_strequal(child->name, "ext")) {
-					if (key->hash != NULL)
-						purple_debug_warning("jabber", "Ignoring exts when reading new-style caps\n");
-					else {
-						/* TODO: Do we care about reading in the identities listed here? */
-						const char *identifier = xmlnode_get_attrib(child, "identifier");
-						xmlnode *node;
-						GList *features = NULL;
-
-						if (!identifier)
-							continue;
-
-						for (node = child->child; node; node = node->next) {
-							if (node->type != XMLNODE_TYPE_TAG)
-								continue;
-							if (purple_strequal(node->name, "feature")) {
-								const char *var = xmlnode_get_attrib(node, "var");
-								if (!var)
-									continue;
-								features = g_list_prepend(features, g_strdup(var));
-							}
-						}
-
-						if (features) {
-							g_hash_table_insert(exts->exts, g_strdup(identifier),
-							                    features);
-						} else
-							purple_debug_warning("jabber", "Caps ext %s had no features.\n",
-							                     identifier);
-					}
-				}
-			}
-
-			value->exts = exts;
-			g_hash_table_replace(capstable, key, value);
+			client->parent = NULL;
+			client->next = NULL;
+			value->stored = client;
 
+			if (g_hash_table_lookup(capstable, key))
+				jabber_caps_client_info_destroy(value);
+			else
+				jabber_caps_insert(value);
+		} else {
+			client->parent = NULL;
+			client->next = NULL;
+			xmlnode_free(client);
 		}
 	}
+
+	capsdata->child = capsdata->lastchild = NULL;
 	xmlnode_free(capsdata);
 }
 
 void jabber_caps_init(void)
 {
-	nodetable = g_hash_table_new_full(g_str_hash, g_str_equal, g_free, (GDestroyNotify)jabber_caps_node_exts_unref);
-	capstable = g_hash_table_new_full(jabber_caps_hash, jabber_caps_compare, NULL, (GDestroyNotify)jabber_caps_client_info_destroy);
+	nodetable = g_hash_table_new_full(g_str_hash, g_str_equal,
+	                                  (GDestroyNotify)purple_stringref_intern_unref,
+	                                  (GDestroyNotify)jabber_caps_node_exts_unref);
+	capstable = g_hash_table_new_full(jabber_caps_hash, jabber_caps_compare, NULL, (GDestroyNotify)jabber_caps_client_info_unref);
+	featuretable = g_hash_table_new(jabber_caps_feature_set_hash, jabber_caps_feature_set_equal);
+	pendingtable = g_hash_table_new_full(jabber_caps_hash, jabber_caps_compare, g_free, NULL);
+	memset(&stats, 0, sizeof(stats));
 	jabber_caps_load();
 }
 
@@ -340,9 +632,12 @@ void jabber_caps_uninit(void)
 		save_timer = 0;
 		do_jabber_caps_store(NULL);
 	}
+	g_queue_clear(&lru);
 	g_hash_table_destroy(capstable);
 	g_hash_table_destroy(nodetable);
-	capstable = nodetable = NULL;
+	g_hash_table_destroy(featuretable);
+	g_hash_table_destroy(pendingtable);
+	capstable = nodetable = featuretable = pendingtable = NULL;
 }
 
 gboolean jabber_caps_exts_known(const JabberCapsClientInfo *info,
@@ -373,8 +668,9 @@ typedef struct _jabber_caps_cbplususerdata {
 	jabber_caps_get_info_cb cb;
 	gpointer cb_data;
 
+	JabberStream *js;
 	char *who;
-	char *node;
+	const char *node; /* interned */
 	char *ver;
 	char *hash;
 
@@ -383,6 +679,9 @@ typedef struct _jabber_caps_cbplususerdata {
 	GList *exts;
 	guint extOutstanding;
 	JabberCapsNodeExts *node_exts;
+
+	/* Other lookups for the same (node,ver,hash) waiting on our query */
+	GList *waiters;
 } jabber_caps_cbplususerdata;
 
 static jabber_caps_cbplususerdata*
@@ -406,11 +705,11 @@ cbplususerdata_unref(jabber_caps_cbplususerdata *data)
 		return;
 
 	g_free(data->who);
-	g_free(data->node);
+	purple_stringref_intern_unref(data->node);
 	g_free(data->ver);
 	g_free(data->hash);
 
-	/* If we have info here, it's already in the capstable, so don't free it */
+	jabber_caps_client_info_unref(data->info);
 	if (data->exts)
 		free_string_glist(data->exts);
 	if (data->node_exts)
@@ -418,12 +717,24 @@ cbplususerdata_unref(jabber_caps_cbplususerdata *data)
 	g_free(data);
 }
 
+static gboolean
+pending_for_stream(gpointer key, gpointer value, gpointer user_data)
+{
+	return ((jabber_caps_cbplususerdata *)value)->js == user_data;
+}
+
+void jabber_caps_cancel_queries(JabberStream *js)
+{
+	/* The IQ callbacks will never fire, so don't let anyone wait on them */
+	if (pendingtable)
+		g_hash_table_foreach_remove(pendingtable, pending_for_stream, js);
+}
+
 static void
 jabber_caps_get_info_complete(jabber_caps_cbplususerdata *userdata)
 {
 	if (userdata->cb) {
 		userdata->cb(userdata->info, userdata->exts, userdata->cb_data);
-		userdata->info = NULL;
 		userdata->exts = NULL;
 	}
 
@@ -441,45 +752,64 @@ jabber_caps_client_iqcb(JabberStream *js, const char *from, JabberIqType type,
 	jabber_caps_cbplususerdata *userdata = data;
 	JabberCapsClientInfo *info = NULL, *value;
 	JabberCapsTuple key;
+	GList *waiters;
 
-	if (!query || type == JABBER_IQ_ERROR) {
-		/* Any outstanding exts will be dealt with via ref-counting */
-		userdata->cb(NULL, NULL, userdata->cb_data);
-		cbplususerdata_unref(userdata);
-		return;
-	}
+	key.node = userdata->node;
+	key.ver  = userdata->ver;
+	key.hash = userdata->hash;
 
-	/* check hash */
-	info = jabber_caps_parse_client_info(query);
-
-	/* Only validate if these are v1.5 capabilities */
-	if (userdata->hash) {
-		gchar *hash = NULL;
-		/*
-		 * TODO: If you add *any* hash here, make sure the checksum buffer
-		 * size in jabber_caps_calculate_hash is large enough. The cipher API
-		 * doesn't seem to offer a "Get the hash size" function(?).
-		 */
-		if (purple_strequal(userdata->hash, "sha-1")) {
-			hash = jabber_caps_calculate_hash(info, "sha1");
-		} else if (purple_strequal(userdata->hash, "md5")) {
-			hash = jabber_caps_calculate_hash(info, "md5");
-		}
+	/* Anyone else asking about this client from now on needs a new query */
+	if (g_hash_table_lookup(pendingtable, &key) == userdata)
+		g_hash_table_remove(pendingtable, &key);
+	waiters = userdata->waiters;
+	userdata->waiters = NULL;
+
+	if (query && type != JABBER_IQ_ERROR) {
+		/* check hash */
+		info = jabber_caps_parse_client_info(query);
+
+		/* Only validate if these are v1.5 capabilities */
+		if (userdata->hash) {
+			gchar *hash = NULL;
+			/*
+			 * TODO: If you add *any* hash here, make sure the checksum buffer
+			 * size in jabber_caps_calculate_hash is large enough. The cipher API
+			 * doesn't seem to offer a "Get the hash size" function(?).
+			 */
+			if (purple_strequal(userdata->hash, "sha-1")) {
+				hash = jabber_caps_calculate_hash(info, "sha1");
+			} else if (purple_strequal(userdata->hash, "md5")) {
+				hash = jabber_caps_calculate_hash(info, "md5");
+			}
 
-		if (!hash || !purple_strequal(hash, userdata->ver)) {
-			purple_debug_warning("jabber", "Could not validate caps info from "
-			                     "%s. Expected %s, got %s\n",
-			                     xmlnode_get_attrib(packet, "from"),
-			                     userdata->ver, hash ? hash : "(null)");
+			if (!hash || !purple_strequal(hash, userdata->ver)) {
+				purple_debug_warning("jabber", "Could not validate caps info from "
+				                     "%s. Expected %s, got %s\n",
+				                     xmlnode_get_attrib(packet, "from"),
+				                     userdata->ver, hash ? hash : "(null)");
+
+				jabber_caps_client_info_destroy(info);
+				info = NULL;
+			}
 
-			userdata->cb(NULL, NULL, userdata->cb_data);
-			jabber_caps_client_info_destroy(info);
-			cbplususerdata_unref(userdata);
 			g_free(hash);
-			return;
 		}
+	}
 
-		g_free(hash);
+	if (!info) {
+		/* Any outstanding exts will be dealt with via ref-counting */
+		userdata->cb(NULL, NULL, userdata->cb_data);
+		cbplususerdata_unref(userdata);
+
+		/* The waiters may well get a different answer, but a client that
+		 * sent us garbage once will probably do so again. */
+		while (waiters) {
+			jabber_caps_cbplususerdata *waiter = waiters->data;
+			waiter->cb(NULL, NULL, waiter->cb_data);
+			cbplususerdata_unref(waiter);
+			waiters = g_list_delete_link(waiters, waiters);
+		}
+		return;
 	}
 
 	if (!userdata->hash && userdata->node_exts) {
@@ -489,33 +819,48 @@ jabber_caps_client_iqcb(JabberStream *js, const char *from, JabberIqType type,
 		userdata->node_exts = NULL;
 	}
 
-	key.node = userdata->node;
-	key.ver  = userdata->ver;
-	key.hash = userdata->hash;
-
 	/* Use the copy of this data already in the table if it exists or insert
 	 * a new one if we need to */
 	if ((value = g_hash_table_lookup(capstable, &key))) {
 		jabber_caps_client_info_destroy(info);
 		info = value;
+		if (!info->loaded)
+			jabber_caps_client_info_load(info);
 	} else {
 		JabberCapsTuple *n_key = (JabberCapsTuple *)&info->tuple;
-		n_key->node = userdata->node;
-		n_key->ver  = userdata->ver;
-		n_key->hash = userdata->hash;
-		userdata->node = userdata->ver = userdata->hash = NULL;
+		n_key->node = purple_stringref_intern_ref(userdata->node);
+		n_key->ver  = g_strdup(userdata->ver);
+		n_key->hash = g_strdup(userdata->hash);
+
+		/* Share the feature list with any other client advertising the
+		 * same one */
+		if (info->features) {
+			info->featureset = jabber_caps_feature_set_get(info->features);
+			info->features = info->featureset->features;
+		}
 
 		/* The capstable gets a reference */
-		g_hash_table_insert(capstable, n_key, info);
+		jabber_caps_insert(info);
 		schedule_caps_save();
 	}
 
-	userdata->info = info;
+	userdata->info = jabber_caps_client_info_ref(info);
 
 	if (userdata->extOutstanding == 0)
 		jabber_caps_get_info_complete(userdata);
 
 	cbplususerdata_unref(userdata);
+
+	while (waiters) {
+		jabber_caps_cbplususerdata *waiter = waiters->data;
+
+		waiter->info = jabber_caps_client_info_ref(info);
+		if (waiter->extOutstanding == 0)
+			jabber_caps_get_info_complete(waiter);
+
+		cbplususerdata_unref(waiter);
+		waiters = g_list_delete_link(waiters, waiters);
+	}
 }
 
 typedef struct {
@@ -575,10 +920,12 @@ jabber_caps_ext_iqcb(JabberStream *js, const char *from, JabberIqType type,
 	        child = xmlnode_get_next_twin(child)) {
 		const char *var = xmlnode_get_attrib(child, "var");
 		if (var)
-			features = g_list_prepend(features, g_strdup(var));
+			features = g_list_prepend(features,
+					(gpointer)purple_stringref_intern(var));
 	}
 
 	g_hash_table_insert(node_exts->exts, g_strdup(userdata->name), features);
+	node_exts->dirty = TRUE;
 	schedule_caps_save();
 
 	/* Are we done? */
@@ -609,7 +956,7 @@ void jabber_caps_get_info(JabberStream *js, const char *who, const char *node,
 	key.ver = (char *)ver;
 	key.hash = (char *)hash;
 
-	info = g_hash_table_lookup(capstable, &key);
+	info = jabber_caps_lookup(&key);
 	if (info && hash) {
 		/* v1.5 - We already have all the information we care about */
 		if (cb)
@@ -621,32 +968,53 @@ void jabber_caps_get_info(JabberStream *js, const char *who, const char *node,
 	/* We start out with 0 references. Every query takes one */
 	userdata->cb = cb;
 	userdata->cb_data = user_data;
+	userdata->js = js;
 	userdata->who = g_strdup(who);
-	userdata->node = g_strdup(node);
+	userdata->node = purple_stringref_intern(node);
 	userdata->ver = g_strdup(ver);
 	userdata->hash = g_strdup(hash);
 
 	if (info) {
-		userdata->info = info;
+		userdata->info = jabber_caps_client_info_ref(info);
 	} else {
 		/* If we don't have the basic information about the client, we need
-		 * to fetch it. */
-		JabberIq *iq;
-		xmlnode *query;
-		char *nodever;
+		 * to fetch it, unless someone else on this connection already asked. */
+		jabber_caps_cbplususerdata *pending = g_hash_table_lookup(pendingtable, &key);
 
-		iq = jabber_iq_new_query(js, JABBER_IQ_GET, NS_DISCO_INFO);
-		query = xmlnode_get_child_with_namespace(iq->node, "query",
-					NS_DISCO_INFO);
-		nodever = g_strdup_printf("%s#%s", node, ver);
-		xmlnode_set_attrib(query, "node", nodever);
-		g_free(nodever);
-		xmlnode_set_attrib(iq->node, "to", who);
+		++stats.misses;
 
-		cbplususerdata_ref(userdata);
+		if (pending && pending->js == js) {
+			++stats.coalesced;
+			pending->waiters = g_list_prepend(pending->waiters,
+			                                  cbplususerdata_ref(userdata));
+		} else {
+			JabberIq *iq;
+			xmlnode *query;
+			char *nodever;
+			JabberCapsTuple *pending_key;
+
+			iq = jabber_iq_new_query(js, JABBER_IQ_GET, NS_DISCO_INFO);
+			query = xmlnode_get_child_with_namespace(iq->node, "query",
+						NS_DISCO_INFO);
+			nodever = g_strdup_printf("%s#%s", node, ver);
+			xmlnode_set_attrib(query, "node", nodever);
+			g_free(nodever);
+			xmlnode_set_attrib(iq->node, "to", who);
+
+			cbplususerdata_ref(userdata);
+
+			/* The key points into userdata, which outlives the entry */
+			if (!pending) {
+				pending_key = g_new(JabberCapsTuple, 1);
+				pending_key->node = userdata->node;
+				pending_key->ver = userdata->ver;
+				pending_key->hash = userdata->hash;
+				g_hash_table_insert(pendingtable, pending_key, userdata);
+			}
 
-		jabber_iq_set_callback(iq, jabber_caps_client_iqcb, userdata);
-		jabber_iq_send(iq);
+			jabber_iq_set_callback(iq, jabber_caps_client_iqcb, userdata);
+			jabber_iq_send(iq);
+		}
 	}
 
 	/* Are there any exts that we don't recognize? */
@@ -733,6 +1101,7 @@ JabberCapsClientInfo *jabber_caps_parse_client_info(xmlnode *query)
 		return NULL;
 
 	info = g_new0(JabberCapsClientInfo, 1);
+	info->loaded = TRUE;
 
 	for(child = query->child; child; child = child->next) {
 		if (child->type != XMLNODE_TYPE_TAG)
@@ -759,7 +1128,8 @@ JabberCapsClientInfo *jabber_caps_parse_client_info(xmlnode *query)
 			/* parse feature */
 			const char *var = xmlnode_get_attrib(child, "var");
 			if (var)
-				info->features = g_list_prepend(info->features, g_strdup(var));
+				info->features = g_list_prepend(info->features,
+						(gpointer)purple_stringref_intern(var));
 		} else if (purple_strequal(child->name, "x")) {
 			if (purple_strequal(child->xmlns, "jabber:x:data")) {
 				/* x-data form */
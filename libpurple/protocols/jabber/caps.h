@@ -31,6 +31,7 @@ typedef struct _JabberCapsClientInfo JabberCapsClientInfo;
 /* Implementation of XEP-0115 - Entity Capabilities */
 
 typedef struct _JabberCapsNodeExts JabberCapsNodeExts;
+typedef struct _JabberCapsFeatureSet JabberCapsFeatureSet;
 
 typedef struct _JabberCapsTuple {
 	const char *node;
@@ -45,6 +46,17 @@ struct _JabberCapsClientInfo {
 	JabberCapsNodeExts *exts;
 
 	const JabberCapsTuple tuple;
+
+	/*
+	 * Everything below is private to caps.c.  Anyone who keeps a pointer
+	 * to a cached ClientInfo (e.g. jbr->caps.info) must hold a reference,
+	 * otherwise it may be evicted from the cache out from under them.
+	 */
+	guint ref;
+	GList *lru;                        /* Our link in the LRU queue */
+	JabberCapsFeatureSet *featureset;  /* Shared owner of 'features' */
+	xmlnode *stored;                   /* Last saved <client/>, NULL if dirty */
+	gboolean loaded;                   /* FALSE until 'stored' is parsed */
 };
 
 /*
@@ -63,13 +75,40 @@ struct _JabberCapsClientInfo {
 struct _JabberCapsNodeExts {
 	guint ref;
 	GHashTable *exts; /* char *ext_name -> GList *features */
+	gboolean dirty; /* exts were learned since the last save */
 };
 
+/*
+ * Cache statistics, since jabber_caps_init.
+ */
+typedef struct {
+	guint hits;       /* Lookups answered from memory */
+	guint loads;      /* Lookups answered by parsing a saved entry */
+	guint misses;     /* Lookups that needed a disco#info query */
+	guint coalesced;  /* Misses that piggy-backed on a query in flight */
+	guint evictions;  /* Entries dropped to stay under the size limit */
+} JabberCapsStats;
+
 typedef void (*jabber_caps_get_info_cb)(JabberCapsClientInfo *info, GList *exts, gpointer user_data);
 
 void jabber_caps_init(void);
 void jabber_caps_uninit(void);
 
+JabberCapsClientInfo *jabber_caps_client_info_ref(JabberCapsClientInfo *info);
+void jabber_caps_client_info_unref(JabberCapsClientInfo *info);
+
+/**
+ * Returns the capabilities cache statistics.  The hit rate is
+ * (hits + loads) / (hits + loads + misses).
+ */
+const JabberCapsStats *jabber_caps_get_stats(void);
+
+/**
+ * Forget the disco#info queries in flight on a connection that is going
+ * away, so that other connections don't wait on them.
+ */
+void jabber_caps_cancel_queries(JabberStream *js);
+
 /**
  * Check whether all of the exts in a char* array are known to the given info.
  */
@@ -80,7 +119,11 @@ gboolean jabber_caps_exts_known(const JabberCapsClientInfo *info, char **exts);
  *
  * The callback will be called synchronously if we already have the
  * capabilities for the specified (node,ver,hash) (and, if exts are specified,
- * if we know what each means)
+ * if we know what each means).  Concurrent lookups for the same unknown
+ * (node,ver,hash) share a single disco#info query.
+ *
+ * The callback does not own the JabberCapsClientInfo; take a reference
+ * with jabber_caps_client_info_ref() to keep it.
  *
  * @param exts A g_strsplit'd (NULL-terminated) array of strings. This
  *             function is responsible for freeing it.
@@ -27,10 +27,16 @@
 #include "xmlnode.h"
 
 #define JABBER_IBB_SESSION_DEFAULT_BLOCK_SIZE 4096
+#define JABBER_IBB_SESSION_DEFAULT_WINDOW 8
 
 static GHashTable *jabber_ibb_sessions = NULL;
 static GList *open_handlers = NULL;
 
+/* scratch space for encoding and decoding blocks, shared by all sessions so
+   a transfer doesn't allocate a pair of buffers per block */
+static GString *ibb_encode_buffer = NULL;
+static GByteArray *ibb_decode_buffer = NULL;
+
 JabberIBBSession *
 jabber_ibb_session_create(JabberStream *js, const gchar *sid, const gchar *who,
 	gpointer user_data)
@@ -44,6 +50,8 @@ jabber_ibb_session_create(JabberStream *js, const gchar *sid, const gchar *who,
 	}
 	sess->who = g_strdup(who);
 	sess->block_size = JABBER_IBB_SESSION_DEFAULT_BLOCK_SIZE;
+	sess->stanza = JABBER_IBB_STANZA_IQ;
+	sess->window = JABBER_IBB_SESSION_DEFAULT_WINDOW;
 	sess->state = JABBER_IBB_SESSION_NOT_OPENED;
 	sess->user_data = user_data;
 
@@ -59,6 +67,7 @@ jabber_ibb_session_create_from_xmlnode(JabberStream *js, const char *from,
 	JabberIBBSession *sess = NULL;
 	const gchar *sid = xmlnode_get_attrib(open, "sid");
 	const gchar *block_size = xmlnode_get_attrib(open, "block-size");
+	const gchar *stanza = xmlnode_get_attrib(open, "stanza");
 
 	if (!open) {
 		return NULL;
@@ -74,6 +83,9 @@ jabber_ibb_session_create_from_xmlnode(JabberStream *js, const char *from,
 	sess = jabber_ibb_session_create(js, sid, from, user_data);
 	sess->id = g_strdup(id);
 	sess->block_size = atoi(block_size);
+	if (purple_strequal(stanza, "message")) {
+		sess->stanza = JABBER_IBB_STANZA_MESSAGE;
+	}
 	/* if we create a session from an incoming <open/> request, it means the
 	  session is immediatly open... */
 	sess->state = JABBER_IBB_SESSION_OPENED;
@@ -81,6 +93,22 @@ jabber_ibb_session_create_from_xmlnode(JabberStream *js, const char *from,
 	return sess;
 }
 
+/* forget about the results of any <data/> IQs still out */
+static void
+jabber_ibb_session_cancel_pending(JabberIBBSession *sess)
+{
+	while (sess->pending_iqs) {
+		gchar *id = sess->pending_iqs->data;
+
+		purple_debug_info("jabber", "IBB: removing callback for <iq/> %s\n",
+			id);
+		jabber_iq_remove_callback_by_id(jabber_ibb_session_get_js(sess), id);
+		g_free(id);
+		sess->pending_iqs =
+			g_list_delete_link(sess->pending_iqs, sess->pending_iqs);
+	}
+}
+
 void
 jabber_ibb_session_destroy(JabberIBBSession *sess)
 {
@@ -91,13 +119,11 @@ jabber_ibb_session_destroy(JabberIBBSession *sess)
 		jabber_ibb_session_close(sess);
 	}
 
-	if (sess->last_iq_id) {
-		purple_debug_info("jabber", "IBB: removing callback for <iq/> %s\n",
-			sess->last_iq_id);
-		jabber_iq_remove_callback_by_id(jabber_ibb_session_get_js(sess),
-			sess->last_iq_id);
-		g_free(sess->last_iq_id);
-		sess->last_iq_id = NULL;
+	jabber_ibb_session_cancel_pending(sess);
+
+	if (sess->sent_timeout) {
+		purple_timeout_remove(sess->sent_timeout);
+		sess->sent_timeout = 0;
 	}
 
 	g_hash_table_remove(jabber_ibb_sessions, sess->sid);
@@ -160,6 +186,56 @@ jabber_ibb_session_set_block_size(JabberIBBSession *sess, gsize size)
 	}
 }
 
+JabberIBBStanzaType
+jabber_ibb_session_get_stanza(const JabberIBBSession *sess)
+{
+	return sess->stanza;
+}
+
+void
+jabber_ibb_session_set_stanza(JabberIBBSession *sess,
+	JabberIBBStanzaType stanza)
+{
+	if (jabber_ibb_session_get_state(sess) == JABBER_IBB_SESSION_NOT_OPENED) {
+		sess->stanza = stanza;
+	} else {
+		purple_debug_error("jabber",
+			"Can't set stanza type on an open IBB session\n");
+	}
+}
+
+guint
+jabber_ibb_session_get_window(const JabberIBBSession *sess)
+{
+	return sess->window;
+}
+
+void
+jabber_ibb_session_set_window(JabberIBBSession *sess, guint window)
+{
+	sess->window = MAX(window, 1);
+}
+
+guint
+jabber_ibb_session_get_in_flight(const JabberIBBSession *sess)
+{
+	return g_list_length(sess->pending_iqs);
+}
+
+gboolean
+jabber_ibb_session_can_send(const JabberIBBSession *sess)
+{
+	if (jabber_ibb_session_get_state(sess) != JABBER_IBB_SESSION_OPENED)
+		return FALSE;
+
+	/* message stanzas aren't acknowledged, the caller is paced by the
+	   sent callback instead */
+	if (sess->stanza == JABBER_IBB_STANZA_MESSAGE)
+		return sess->sent_timeout == 0;
+
+	return jabber_ibb_session_get_in_flight(sess) < sess->window;
+}
+
 gsize
 jabber_ibb_session_get_max_data_size(const JabberIBBSession *sess)
 {
@@ -242,6 +318,9 @@ jabber_ibb_session_open(JabberIBBSession *sess)
 		g_snprintf(block_size, sizeof(block_size), "%" G_GSIZE_FORMAT,
 			jabber_ibb_session_get_block_size(sess));
 		xmlnode_set_attrib(open, "block-size", block_size);
+		if (sess->stanza == JABBER_IBB_STANZA_MESSAGE) {
+			xmlnode_set_attrib(open, "stanza", "message");
+		}
 		xmlnode_insert_child(set->node, open);
 
 		jabber_iq_set_callback(set, jabber_ibb_session_opened_cb, sess);
@@ -293,13 +372,18 @@ jabber_ibb_session_send_acknowledge_cb(JabberStream *js, const char *from,
 	JabberIBBSession *sess = (JabberIBBSession *) data;
 
 	if (sess) {
+		GList *link = g_list_find_custom(sess->pending_iqs, id,
+			(GCompareFunc) g_strcmp0);
+
 		/* reset callback */
-		if (sess->last_iq_id) {
-			g_free(sess->last_iq_id);
-			sess->last_iq_id = NULL;
+		if (link) {
+			g_free(link->data);
+			sess->pending_iqs = g_list_delete_link(sess->pending_iqs, link);
 		}
 
 		if (type == JABBER_IQ_ERROR) {
+			/* the rest of the window is of no use now */
+			jabber_ibb_session_cancel_pending(sess);
 			jabber_ibb_session_close(sess);
 			sess->state = JABBER_IBB_SESSION_ERROR;
 
@@ -318,13 +402,56 @@ jabber_ibb_session_send_acknowledge_cb(JabberStream *js, const char *from,
 	}
 }
 
+static gboolean
+jabber_ibb_session_message_sent_cb(gpointer data)
+{
+	JabberIBBSession *sess = (JabberIBBSession *) data;
+
+	sess->sent_timeout = 0;
+
+	if (sess->data_sent_cb) {
+		sess->data_sent_cb(sess);
+	}
+
+	return FALSE;
+}
+
+/* builds the <data/> element for a block, encoding it through the shared
+   buffer instead of allocating a new string for every block */
+static xmlnode *
+jabber_ibb_session_data_new(JabberIBBSession *sess, gconstpointer data,
+                            gsize size)
+{
+	xmlnode *data_element = xmlnode_new("data");
+	gint state = 0, save = 0;
+	gsize len;
+	char seq[10];
+
+	g_snprintf(seq, sizeof(seq), "%u", jabber_ibb_session_get_send_seq(sess));
+
+	xmlnode_set_namespace(data_element, NS_IBB);
+	xmlnode_set_attrib(data_element, "sid", jabber_ibb_session_get_sid(sess));
+	xmlnode_set_attrib(data_element, "seq", seq);
+
+	if (size > 0) {
+		g_string_set_size(ibb_encode_buffer, (size / 3 + 1) * 4 + 4);
+		len = g_base64_encode_step(data, size, FALSE, ibb_encode_buffer->str,
+			&state, &save);
+		len += g_base64_encode_close(FALSE, ibb_encode_buffer->str + len,
+			&state, &save);
+		xmlnode_insert_data(data_element, ibb_encode_buffer->str, len);
+	}
+
+	return data_element;
+}
+
 void
 jabber_ibb_session_send_data(JabberIBBSession *sess, gconstpointer data,
                              gsize size)
 {
 	JabberIBBSessionState state = jabber_ibb_session_get_state(sess);
 
-	purple_debug_info("jabber", "sending data block of %" G_GSIZE_FORMAT " bytes on IBB stream\n",
+	purple_debug_misc("jabber", "sending data block of %" G_GSIZE_FORMAT " bytes on IBB stream\n",
 		size);
 
 	if (state != JABBER_IBB_SESSION_OPENED) {
@@ -333,32 +460,40 @@ jabber_ibb_session_send_data(JabberIBBSession *sess, gconstpointer data,
 	} else if (size > jabber_ibb_session_get_max_data_size(sess)) {
 		purple_debug_error("jabber",
 			"trying to send a too large packet in the IBB session\n");
+	} else if (sess->stanza == JABBER_IBB_STANZA_MESSAGE) {
+		JabberStream *js = jabber_ibb_session_get_js(sess);
+		xmlnode *message = xmlnode_new("message");
+		gchar *id = jabber_get_next_id(js);
+
+		xmlnode_set_attrib(message, "to", jabber_ibb_session_get_who(sess));
+		xmlnode_set_attrib(message, "id", id);
+		xmlnode_insert_child(message,
+			jabber_ibb_session_data_new(sess, data, size));
+
+		jabber_send(js, message);
+		xmlnode_free(message);
+		g_free(id);
+		(sess->send_seq)++;
+
+		/* nothing comes back for these, so let the caller know the block is
+		   gone once we're back in the main loop */
+		if (!sess->sent_timeout) {
+			sess->sent_timeout = purple_timeout_add(0,
+				jabber_ibb_session_message_sent_cb, sess);
+		}
 	} else {
 		JabberIq *set = jabber_iq_new(jabber_ibb_session_get_js(sess),
 			JABBER_IQ_SET);
-		xmlnode *data_element = xmlnode_new("data");
-		char *base64 = purple_base64_encode(data, size);
-		char seq[10];
-		g_snprintf(seq, sizeof(seq), "%u", jabber_ibb_session_get_send_seq(sess));
 
 		xmlnode_set_attrib(set->node, "to", jabber_ibb_session_get_who(sess));
-		xmlnode_set_namespace(data_element, NS_IBB);
-		xmlnode_set_attrib(data_element, "sid", jabber_ibb_session_get_sid(sess));
-		xmlnode_set_attrib(data_element, "seq", seq);
-		xmlnode_insert_data(data_element, base64, -1);
-
-		xmlnode_insert_child(set->node, data_element);
+		xmlnode_insert_child(set->node,
+			jabber_ibb_session_data_new(sess, data, size));
 
-		purple_debug_info("jabber",
-			"IBB: setting send <iq/> callback for session %p %s\n", sess,
-			sess->sid);
 		jabber_iq_set_callback(set, jabber_ibb_session_send_acknowledge_cb, sess);
-		sess->last_iq_id = g_strdup(xmlnode_get_attrib(set->node, "id"));
-		purple_debug_info("jabber", "IBB: set sess->last_iq_id: %s\n",
-			sess->last_iq_id);
+		sess->pending_iqs = g_list_append(sess->pending_iqs,
+			g_strdup(xmlnode_get_attrib(set->node, "id")));
 		jabber_iq_send(set);
 
-		g_free(base64);
 		(sess->send_seq)++;
 	}
 }
@@ -381,6 +516,113 @@ jabber_ibb_send_error_response(JabberStream *js, const char *to, const char *id)
 	jabber_iq_send(result);
 }
 
+/* checks a piece of the BASE64 text of a <data/> element, carrying the number
+   of characters and of padding characters seen across pieces. Whitespace is
+   skipped, and padding may only come at the very end */
+static gboolean
+jabber_ibb_base64_check(const gchar *text, gsize len, gsize *chars,
+	guint *pad)
+{
+	gsize i;
+
+	for (i = 0; i < len; i++) {
+		guchar c = text[i];
+
+		if (g_ascii_isspace(c))
+			continue;
+
+		if (c == '=') {
+			if (++(*pad) > 2)
+				return FALSE;
+		} else if (*pad || !(g_ascii_isalnum(c) || c == '+' || c == '/')) {
+			return FALSE;
+		}
+		(*chars)++;
+	}
+
+	return TRUE;
+}
+
+/* decodes a <data/> element and passes it to the session's data callback.
+   Returns FALSE, after putting the session in error, if the block was out of
+   order, too large or not valid BASE64 */
+static gboolean
+jabber_ibb_session_got_data(JabberIBBSession *sess, xmlnode *child)
+{
+	const gchar *seq_attr = xmlnode_get_attrib(child, "seq");
+	guint16 seq = (seq_attr ? atoi(seq_attr) : 0);
+
+	/* reject the data, and set the session in error if we get an
+	  out-of-order packet */
+	if (!seq_attr || seq != jabber_ibb_session_get_recv_seq(sess)) {
+		purple_debug_error("jabber",
+			"Received an out-of-order/invalid IBB packet\n");
+		sess->state = JABBER_IBB_SESSION_ERROR;
+
+		if (sess->error_cb) {
+			sess->error_cb(sess);
+		}
+		return FALSE;
+	}
+
+	/* sequence # is the expected... */
+	if (sess->data_received_cb) {
+		xmlnode *node;
+		gsize encoded = 0, chars = 0, size = 0;
+		gboolean valid = TRUE;
+		gint state = 0;
+		guint save = 0, pad = 0;
+
+		/* decode the text straight out of the element's data nodes, without
+		  joining them into a string first */
+		for (node = child->child; node && valid; node = node->next) {
+			if (node->type == XMLNODE_TYPE_DATA) {
+				encoded += node->data_sz;
+				valid = jabber_ibb_base64_check(node->data, node->data_sz,
+					&chars, &pad);
+			}
+		}
+
+		if (!valid || chars == 0 || chars % 4 != 0) {
+			purple_debug_error("jabber",
+				"IBB: invalid BASE64 data received\n");
+			if (sess->error_cb)
+				sess->error_cb(sess);
+			return FALSE;
+		}
+
+		g_byte_array_set_size(ibb_decode_buffer, (encoded / 4) * 3 + 3);
+		for (node = child->child; node; node = node->next) {
+			if (node->type == XMLNODE_TYPE_DATA)
+				size += g_base64_decode_step(node->data, node->data_sz,
+					ibb_decode_buffer->data + size, &state, &save);
+		}
+
+		purple_debug_misc("jabber",
+			"got %" G_GSIZE_FORMAT " bytes of data on IBB stream\n", size);
+
+		/* we accept other clients to send up to block-size
+		 of _unencoded_ data, since there's been some confusions
+		 regarding the interpretation of this attribute
+		 (including previous versions of libpurple) */
+		if (size > jabber_ibb_session_get_block_size(sess)) {
+			purple_debug_error("jabber",
+				"IBB: received a too large packet\n");
+			if (sess->error_cb)
+				sess->error_cb(sess);
+			return FALSE;
+		}
+
+		/* the callback may well end the session */
+		(sess->recv_seq)++;
+		sess->data_received_cb(sess, ibb_decode_buffer->data, size);
+		return TRUE;
+	}
+
+	(sess->recv_seq)++;
+	return TRUE;
+}
+
 void
 jabber_ibb_parse(JabberStream *js, const char *who, JabberIqType type,
                  const char *id, xmlnode *child)
@@ -402,67 +644,12 @@ jabber_ibb_parse(JabberStream *js, const char *who, JabberIqType type,
 			purple_debug_error("jabber",
 				"Got IBB iq from wrong JID, ignoring\n");
 		} else if (data) {
-			const gchar *seq_attr = xmlnode_get_attrib(child, "seq");
-			guint16 seq = (seq_attr ? atoi(seq_attr) : 0);
-
-			/* reject the data, and set the session in error if we get an
-			  out-of-order packet */
-			if (seq_attr && seq == jabber_ibb_session_get_recv_seq(sess)) {
-				/* sequence # is the expected... */
+			if (jabber_ibb_session_got_data(sess, child)) {
 				JabberIq *result = jabber_iq_new(js, JABBER_IQ_RESULT);
 
 				jabber_iq_set_id(result, id);
 				xmlnode_set_attrib(result->node, "to", who);
-
-				if (sess->data_received_cb) {
-					gchar *base64 = xmlnode_get_data(child);
-					gsize size;
-					gpointer rawdata = purple_base64_decode(base64, &size);
-
-					g_free(base64);
-
-					if (rawdata) {
-						purple_debug_info("jabber",
-							"got %" G_GSIZE_FORMAT " bytes of data on IBB stream\n",
-							size);
-						/* we accept other clients to send up to block-size
-						 of _unencoded_ data, since there's been some confusions
-						 regarding the interpretation of this attribute
-						 (including previous versions of libpurple) */
-						if (size > jabber_ibb_session_get_block_size(sess)) {
-							purple_debug_error("jabber",
-								"IBB: received a too large packet\n");
-							if (sess->error_cb)
-								sess->error_cb(sess);
-							g_free(rawdata);
-							return;
-						} else {
-							purple_debug_info("jabber",
-								"calling IBB callback for received data\n");
-							sess->data_received_cb(sess, rawdata, size);
-						}
-						g_free(rawdata);
-					} else {
-						purple_debug_error("jabber",
-							"IBB: invalid BASE64 data received\n");
-						if (sess->error_cb)
-							sess->error_cb(sess);
-						return;
-
-					}
-				}
-
-				(sess->recv_seq)++;
 				jabber_iq_send(result);
-
-			} else {
-				purple_debug_error("jabber",
-					"Received an out-of-order/invalid IBB packet\n");
-				sess->state = JABBER_IBB_SESSION_ERROR;
-
-				if (sess->error_cb) {
-					sess->error_cb(sess);
-				}
 			}
 		} else if (close) {
 			sess->state = JABBER_IBB_SESSION_CLOSED;
@@ -498,6 +685,29 @@ jabber_ibb_parse(JabberStream *js, const char *who, JabberIqType type,
 	}
 }
 
+gboolean
+jabber_ibb_parse_message(JabberStream *js, const char *who, xmlnode *data)
+{
+	const gchar *sid = xmlnode_get_attrib(data, "sid");
+	JabberIBBSession *sess =
+		sid ? g_hash_table_lookup(jabber_ibb_sessions, sid) : NULL;
+
+	if (!sess) {
+		return FALSE;
+	}
+
+	if (!purple_strequal(who, jabber_ibb_session_get_who(sess))) {
+		purple_debug_error("jabber",
+			"Got IBB message from wrong JID, ignoring\n");
+	} else {
+		/* there's no result to send for a message, errors are reported to
+		  the session's owner */
+		jabber_ibb_session_got_data(sess, data);
+	}
+
+	return TRUE;
+}
+
 void
 jabber_ibb_register_open_handler(JabberIBBOpenHandler *cb)
 {
@@ -514,6 +724,8 @@ void
 jabber_ibb_init(void)
 {
 	jabber_ibb_sessions = g_hash_table_new(g_str_hash, g_str_equal);
+	ibb_encode_buffer = g_string_new(NULL);
+	ibb_decode_buffer = g_byte_array_new();
 
 	jabber_add_feature(NS_IBB, NULL);
 
@@ -527,7 +739,11 @@ jabber_ibb_uninit(void)
 {
 	g_hash_table_destroy(jabber_ibb_sessions);
 	g_list_free(open_handlers);
+	g_string_free(ibb_encode_buffer, TRUE);
+	g_byte_array_free(ibb_decode_buffer, TRUE);
 	jabber_ibb_sessions = NULL;
+	ibb_encode_buffer = NULL;
+	ibb_decode_buffer = NULL;
 	open_handlers = NULL;
 }
 
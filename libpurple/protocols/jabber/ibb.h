@@ -47,6 +47,12 @@ typedef enum {
 	JABBER_IBB_SESSION_ERROR
 } JabberIBBSessionState;
 
+/* which stanza the <data/> elements of a session are carried in */
+typedef enum {
+	JABBER_IBB_STANZA_IQ,
+	JABBER_IBB_STANZA_MESSAGE
+} JabberIBBStanzaType;
+
 struct _JabberIBBSession {
 	JabberStream *js;
 	gchar *who;
@@ -55,6 +61,10 @@ struct _JabberIBBSession {
 	guint16 send_seq;
 	guint16 recv_seq;
 	gsize block_size;
+	JabberIBBStanzaType stanza;
+
+	/* how many <data/> IQs may be waiting for a result at once */
+	guint window;
 
 	/* session state */
 	JabberIBBSessionState state;
@@ -70,8 +80,12 @@ struct _JabberIBBSession {
 	JabberIBBDataCallback *data_received_cb;
 	JabberIBBErrorCallback *error_cb;
 
-	/* store the last sent IQ (to permit cancel of callback) */
-	gchar *last_iq_id;
+	/* the ids of the sent <data/> IQs still waiting for a result (to permit
+	   cancel of callbacks) */
+	GList *pending_iqs;
+
+	/* reports message stanza blocks as sent from the main loop */
+	guint sent_timeout;
 };
 
 JabberIBBSession *jabber_ibb_session_create(JabberStream *js, const gchar *sid,
@@ -110,6 +124,20 @@ JabberIBBSessionState jabber_ibb_session_get_state(const JabberIBBSession *sess)
 gsize jabber_ibb_session_get_block_size(const JabberIBBSession *sess);
 void jabber_ibb_session_set_block_size(JabberIBBSession *sess, gsize size);
 
+JabberIBBStanzaType jabber_ibb_session_get_stanza(const JabberIBBSession *sess);
+/* like the block size, this can only be set before the session is opened */
+void jabber_ibb_session_set_stanza(JabberIBBSession *sess,
+	JabberIBBStanzaType stanza);
+
+guint jabber_ibb_session_get_window(const JabberIBBSession *sess);
+void jabber_ibb_session_set_window(JabberIBBSession *sess, guint window);
+
+/* number of sent blocks the other end hasn't acknowledged yet */
+guint jabber_ibb_session_get_in_flight(const JabberIBBSession *sess);
+
+/* whether another block can be sent without overrunning the window */
+gboolean jabber_ibb_session_can_send(const JabberIBBSession *sess);
+
 /* get maximum size data block to send (in bytes)
  (before encoded to BASE64) */
 gsize jabber_ibb_session_get_max_data_size(const JabberIBBSession *sess);
@@ -120,6 +148,11 @@ gpointer jabber_ibb_session_get_user_data(JabberIBBSession *sess);
 void jabber_ibb_parse(JabberStream *js, const char *who, JabberIqType type,
                       const char *id, xmlnode *child);
 
+/* handle a <data/> element carried in a message stanza, returns TRUE if it
+   belonged to an IBB session */
+gboolean jabber_ibb_parse_message(JabberStream *js, const char *who,
+                                  xmlnode *data);
+
 /* add a handler for open session */
 void jabber_ibb_register_open_handler(JabberIBBOpenHandler *cb);
 void jabber_ibb_unregister_open_handler(JabberIBBOpenHandler *cb);
@@ -49,10 +49,26 @@
 static GHashTable *iq_handlers = NULL;
 static GHashTable *signal_iq_handlers = NULL;
 
+/*
+ * Outstanding requests are keyed by the sequence number in the id that
+ * jabber_get_next_id() gave them, and their deadlines live on a timer
+ * wheel with one-second buckets. Deadlines further away than one turn of
+ * the wheel just sit out the extra revolutions.
+ */
+#define JABBER_IQ_WHEEL_SLOTS 64
+
 struct _JabberIqCallbackData {
 	JabberIqCallback *callback;
 	gpointer data;
 	JabberID *to;
+
+	JabberStream *js;
+	guint seq;
+	JabberIqStats *stats;
+	gint64 sent;       /* monotonic, in microseconds */
+	GList *link;       /* in js->iq_wheel[slot], NULL without a deadline */
+	guint slot;
+	guint rounds;
 };
 
 void jabber_iq_callbackdata_free(JabberIqCallbackData *jcd)
@@ -61,6 +77,154 @@ void jabber_iq_callbackdata_free(JabberIqCallbackData *jcd)
 	g_free(jcd);
 }
 
+/*
+ * Recover the sequence number from an id made by jabber_get_next_id().
+ * Only the exact spelling we generate is accepted, so that "purple0a"
+ * can't be used to answer "purplea".
+ */
+static gboolean
+jabber_iq_id_to_seq(const char *id, guint *seq)
+{
+	char canonical[sizeof("purple") + 8];
+	char *end;
+	gulong val;
+
+	if (id == NULL || strncmp(id, "purple", 6) != 0 ||
+			!g_ascii_isxdigit(id[6]))
+		return FALSE;
+
+	val = strtoul(id + 6, &end, 16);
+	if (*end != '\0' || val > G_MAXUINT)
+		return FALSE;
+
+	g_snprintf(canonical, sizeof(canonical), "purple%x", (guint)val);
+	if (!purple_strequal(canonical, id))
+		return FALSE;
+
+	*seq = (guint)val;
+	return TRUE;
+}
+
+static void
+jabber_iq_pending_free(JabberIqCallbackData *jcd)
+{
+	if (jcd->link)
+		g_queue_delete_link(&jcd->js->iq_wheel[jcd->slot], jcd->link);
+	jcd->stats->outstanding--;
+	jabber_iq_callbackdata_free(jcd);
+}
+
+static JabberIqStats *
+jabber_iq_stats_lookup(JabberStream *js, const char *xmlns)
+{
+	JabberIqStats *stats;
+
+	if (xmlns == NULL)
+		xmlns = "";
+
+	stats = g_hash_table_lookup(js->iq_stats, xmlns);
+	if (stats == NULL) {
+		stats = g_new0(JabberIqStats, 1);
+		g_hash_table_insert(js->iq_stats, g_strdup(xmlns), stats);
+	}
+
+	return stats;
+}
+
+static gboolean
+jabber_iq_wheel_is_empty(JabberStream *js)
+{
+	int i;
+
+	for (i = 0; i < JABBER_IQ_WHEEL_SLOTS; i++)
+		if (!g_queue_is_empty(&js->iq_wheel[i]))
+			return FALSE;
+
+	return TRUE;
+}
+
+static void
+jabber_iq_timed_out(JabberStream *js, guint seq)
+{
+	JabberIqCallbackData *jcd;
+	xmlnode *packet, *error, *x;
+	char *id, *from = NULL;
+
+	jcd = g_hash_table_lookup(js->iq_callbacks, GUINT_TO_POINTER(seq));
+	if (jcd == NULL)
+		return;
+
+	/* Out of the table first, so the callback can't cancel it under us */
+	g_hash_table_steal(js->iq_callbacks, GUINT_TO_POINTER(seq));
+	jcd->stats->timed_out++;
+
+	id = g_strdup_printf("purple%x", seq);
+	if (jcd->to)
+		from = jabber_id_get_full_jid(jcd->to);
+
+	purple_debug_warning("jabber", "No reply to IQ %s from %s, giving up\n",
+			id, from ? from : "(server)");
+
+	packet = xmlnode_new("iq");
+	xmlnode_set_attrib(packet, "type", "error");
+	xmlnode_set_attrib(packet, "id", id);
+	if (from)
+		xmlnode_set_attrib(packet, "from", from);
+	error = xmlnode_new_child(packet, "error");
+	xmlnode_set_attrib(error, "type", "wait");
+	x = xmlnode_new_child(error, "remote-server-timeout");
+	xmlnode_set_namespace(x, NS_XMPP_STANZAS);
+
+	jcd->callback(js, from, JABBER_IQ_ERROR, id, packet, jcd->data);
+
+	xmlnode_free(packet);
+	g_free(from);
+	g_free(id);
+	jabber_iq_pending_free(jcd);
+}
+
+static gboolean
+jabber_iq_wheel_tick(gpointer data)
+{
+	JabberStream *js = data;
+	GQueue *slot;
+	GList *l, *next, *expired = NULL;
+
+	js->iq_wheel_pos = (js->iq_wheel_pos + 1) % JABBER_IQ_WHEEL_SLOTS;
+	slot = &js->iq_wheel[js->iq_wheel_pos];
+
+	for (l = slot->head; l; l = next) {
+		JabberIqCallbackData *jcd = l->data;
+
+		next = l->next;
+		if (jcd->rounds > 0) {
+			jcd->rounds--;
+			continue;
+		}
+
+		g_queue_delete_link(slot, l);
+		jcd->link = NULL;
+
+		expired = g_list_prepend(expired, GUINT_TO_POINTER(jcd->seq));
+	}
+
+	/*
+	 * Callbacks may send or cancel other requests, including ones that
+	 * expired in this same tick, so look each one up again by sequence.
+	 */
+	expired = g_list_reverse(expired);
+	for (l = expired; l; l = l->next)
+		jabber_iq_timed_out(js, GPOINTER_TO_UINT(l->data));
+	g_list_free(expired);
+
+	if (jabber_iq_wheel_is_empty(js)) {
+		js->iq_wheel_timer = 0;
+		return FALSE;
+	}
+
+	return TRUE;
+}
+
 JabberIq *jabber_iq_new(JabberStream *js, JabberIqType type)
 {
 	JabberIq *iq;
@@ -89,6 +253,7 @@ JabberIq *jabber_iq_new(JabberStream *js, JabberIqType type)
 	}
 
 	iq->js = js;
+	iq->timeout = JABBER_IQ_DEFAULT_TIMEOUT;
 
 	if(type == JABBER_IQ_GET || type == JABBER_IQ_SET) {
 		iq->id = jabber_get_next_id(js);
@@ -130,20 +295,71 @@ void jabber_iq_set_id(JabberIq *iq, const char *id)
 	}
 }
 
+void jabber_iq_set_timeout(JabberIq *iq, guint seconds)
+{
+	iq->timeout = seconds;
+}
+
+static void
+jabber_iq_schedule(JabberStream *js, JabberIqCallbackData *jcd, guint timeout)
+{
+	GQueue *slot;
+
+	jcd->slot = (js->iq_wheel_pos + timeout) % JABBER_IQ_WHEEL_SLOTS;
+	jcd->rounds = (timeout - 1) / JABBER_IQ_WHEEL_SLOTS;
+
+	slot = &js->iq_wheel[jcd->slot];
+	g_queue_push_tail(slot, jcd);
+	jcd->link = slot->tail;
+
+	if (js->iq_wheel_timer == 0)
+		js->iq_wheel_timer = purple_timeout_add_seconds(1,
+				jabber_iq_wheel_tick, js);
+}
+
 void jabber_iq_send(JabberIq *iq)
 {
+	JabberStream *js;
 	JabberIqCallbackData *jcd;
+	xmlnode *child;
+	guint seq;
+
 	g_return_if_fail(iq != NULL);
 
-	jabber_send(iq->js, iq->node);
+	js = iq->js;
+
+	if(iq->id && iq->callback && !jabber_iq_id_to_seq(iq->id, &seq)) {
+		/* Replies are matched by sequence number, so we need one of ours */
+		purple_debug_warning("jabber", "Replacing foreign IQ id %s\n", iq->id);
+		g_free(iq->id);
+		iq->id = jabber_get_next_id(js);
+		xmlnode_set_attrib(iq->node, "id", iq->id);
+		jabber_iq_id_to_seq(iq->id, &seq);
+	}
+
+	jabber_send(js, iq->node);
 
 	if(iq->id && iq->callback) {
+		for (child = iq->node->child; child; child = child->next)
+			if (child->type == XMLNODE_TYPE_TAG)
+				break;
+
 		jcd = g_new0(JabberIqCallbackData, 1);
 		jcd->callback = iq->callback;
 		jcd->data = iq->callback_data;
 		jcd->to = jabber_id_new(xmlnode_get_attrib(iq->node, "to"));
-
-		g_hash_table_insert(iq->js->iq_callbacks, g_strdup(iq->id), jcd);
+		jcd->js = js;
+		jcd->seq = seq;
+		jcd->stats = jabber_iq_stats_lookup(js,
+				child ? xmlnode_get_namespace(child) : NULL);
+		jcd->stats->outstanding++;
+		jcd->stats->sent++;
+		jcd->sent = g_get_monotonic_time();
+
+		if (iq->timeout > 0)
+			jabber_iq_schedule(js, jcd, iq->timeout);
+
+		g_hash_table_replace(js->iq_callbacks, GUINT_TO_POINTER(seq), jcd);
 	}
 
 	jabber_iq_free(iq);
@@ -280,7 +496,10 @@ static void jabber_iq_version_parse(JabberStream *js, const char *from,
 
 void jabber_iq_remove_callback_by_id(JabberStream *js, const char *id)
 {
-	g_hash_table_remove(js->iq_callbacks, id);
+	guint seq;
+
+	if (jabber_iq_id_to_seq(id, &seq))
+		g_hash_table_remove(js->iq_callbacks, GUINT_TO_POINTER(seq));
 }
 
 /**
@@ -346,6 +565,7 @@ void jabber_iq_parse(JabberStream *js, xmlnode *packet)
 	JabberIqType type = JABBER_IQ_NONE;
 	gboolean signal_return;
 	JabberID *from_id;
+	guint seq;
 
 	from = xmlnode_get_attrib(packet, "from");
 	id = xmlnode_get_attrib(packet, "id");
@@ -430,12 +650,20 @@ void jabber_iq_parse(JabberStream *js, xmlnode *packet)
 	}
 
 	/* First, lets see if a special callback got registered */
-	if(type == JABBER_IQ_RESULT || type == JABBER_IQ_ERROR) {
-		jcd = g_hash_table_lookup(js->iq_callbacks, id);
+	if((type == JABBER_IQ_RESULT || type == JABBER_IQ_ERROR) &&
+			jabber_iq_id_to_seq(id, &seq)) {
+		jcd = g_hash_table_lookup(js->iq_callbacks, GUINT_TO_POINTER(seq));
 		if (jcd) {
 			if (does_reply_from_match_request_to(js, jcd->to, from_id)) {
+				guint latency = (g_get_monotonic_time() - jcd->sent) / 1000;
+
+				jcd->stats->answered++;
+				jcd->stats->total_latency_ms += latency;
+				if (latency > jcd->stats->max_latency_ms)
+					jcd->stats->max_latency_ms = latency;
+
 				jcd->callback(js, from, type, id, packet, jcd->data);
-				jabber_iq_remove_callback_by_id(js, id);
+				g_hash_table_remove(js->iq_callbacks, GUINT_TO_POINTER(seq));
 				jabber_id_free(from_id);
 				return;
 			} else {
@@ -506,6 +734,68 @@ void jabber_iq_parse(JabberStream *js, xmlnode *packet)
 	jabber_id_free(from_id);
 }
 
+void jabber_iq_pending_init(JabberStream *js)
+{
+	js->iq_callbacks = g_hash_table_new_full(g_direct_hash, g_direct_equal,
+			NULL, (GDestroyNotify)jabber_iq_pending_free);
+	js->iq_stats = g_hash_table_new_full(g_str_hash, g_str_equal,
+			g_free, g_free);
+	js->iq_wheel = g_new0(GQueue, JABBER_IQ_WHEEL_SLOTS);
+	js->iq_wheel_pos = 0;
+	js->iq_wheel_timer = 0;
+}
+
+static void
+jabber_iq_stats_log(gpointer key, gpointer value, gpointer data)
+{
+	const char *xmlns = key;
+	JabberIqStats *stats = value;
+
+	purple_debug_misc("jabber", "IQ %s: %u sent, %u answered "
+			"(avg %" G_GUINT64_FORMAT " ms, max %u ms), %u timed out, "
+			"%u outstanding\n", *xmlns ? xmlns : "(no payload)",
+			stats->sent, stats->answered,
+			stats->answered ? stats->total_latency_ms / stats->answered : 0,
+			stats->max_latency_ms, stats->timed_out, stats->outstanding);
+}
+
+void jabber_iq_pending_destroy(JabberStream *js)
+{
+	if (js->iq_wheel_timer) {
+		purple_timeout_remove(js->iq_wheel_timer);
+		js->iq_wheel_timer = 0;
+	}
+
+	/* Outstanding callbacks are dropped without being called */
+	if (js->iq_callbacks) {
+		g_hash_table_destroy(js->iq_callbacks);
+		js->iq_callbacks = NULL;
+	}
+
+	g_free(js->iq_wheel);
+	js->iq_wheel = NULL;
+
+	if (js->iq_stats) {
+		g_hash_table_foreach(js->iq_stats, jabber_iq_stats_log, NULL);
+		g_hash_table_destroy(js->iq_stats);
+		js->iq_stats = NULL;
+	}
+}
+
+const JabberIqStats *jabber_iq_get_stats(JabberStream *js, const char *xmlns)
+{
+	g_return_val_if_fail(js != NULL, NULL);
+
+	return g_hash_table_lookup(js->iq_stats, xmlns ? xmlns : "");
+}
+
+void jabber_iq_stats_foreach(JabberStream *js, GHFunc func, gpointer data)
+{
+	g_return_if_fail(js != NULL);
+
+	g_hash_table_foreach(js->iq_stats, func, data);
+}
+
 void jabber_iq_register_handler(const char *node, const char *xmlns, JabberIqHandler *handlerfunc)
 {
 	/*
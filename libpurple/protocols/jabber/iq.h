@@ -89,8 +89,31 @@ struct _JabberIq {
 	gpointer callback_data;
 
 	JabberStream *js;
+
+	/* Seconds to wait for a reply before the callback is called with a
+	 * synthesized remote-server-timeout error. 0 waits forever. */
+	guint timeout;
 };
 
+/**
+ * How long, in seconds, we wait for a reply to a GET or SET before giving
+ * up on it, unless overridden with jabber_iq_set_timeout().
+ */
+#define JABBER_IQ_DEFAULT_TIMEOUT 120
+
+/**
+ * Round-trip statistics for the IQs we send, tracked per namespace of the
+ * first child element of the request.
+ */
+typedef struct {
+	guint outstanding;   /**< Requests awaiting a reply */
+	guint sent;          /**< Requests sent with a callback */
+	guint answered;      /**< Replies received (result or error) */
+	guint timed_out;     /**< Requests that hit their deadline */
+	guint64 total_latency_ms;
+	guint max_latency_ms;
+} JabberIqStats;
+
 JabberIq *jabber_iq_new(JabberStream *js, JabberIqType type);
 JabberIq *jabber_iq_new_query(JabberStream *js, JabberIqType type,
 		const char *xmlns);
@@ -102,9 +125,41 @@ void jabber_iq_remove_callback_by_id(JabberStream *js, const char *id);
 void jabber_iq_set_callback(JabberIq *iq, JabberIqCallback *cb, gpointer data);
 void jabber_iq_set_id(JabberIq *iq, const char *id);
 
+/**
+ * Set how long to wait for a reply to this IQ before its callback is
+ * called with a remote-server-timeout error.
+ *
+ * @param iq      The IQ.
+ * @param seconds The timeout, or 0 to wait until the stream closes (for
+ *                requests that are answered by a human, like stream
+ *                initiation offers).
+ */
+void jabber_iq_set_timeout(JabberIq *iq, guint seconds);
+
 void jabber_iq_send(JabberIq *iq);
 void jabber_iq_free(JabberIq *iq);
 
+void jabber_iq_pending_init(JabberStream *js);
+void jabber_iq_pending_destroy(JabberStream *js);
+
+/**
+ * Look up the round-trip statistics for a namespace.
+ *
+ * @param js    The JabberStream object.
+ * @param xmlns The namespace of the request's child element, or NULL for
+ *              requests without one.
+ *
+ * @return The statistics, or NULL if no such request was ever sent.
+ */
+const JabberIqStats *jabber_iq_get_stats(JabberStream *js, const char *xmlns);
+
+/**
+ * Call a function for each namespace with round-trip statistics. The key
+ * passed to @a func is the namespace ("" for requests without a child
+ * element) and the value is a const JabberIqStats *.
+ */
+void jabber_iq_stats_foreach(JabberStream *js, GHFunc func, gpointer data);
+
 void jabber_iq_init(void);
 void jabber_iq_uninit(void);
 
@@ -22,6 +22,10 @@
  */
 #include "internal.h"
 
+#ifndef _WIN32
+#include <sys/uio.h>
+#endif
+
 #include "account.h"
 #include "accountopt.h"
 #include "blist.h"
@@ -42,6 +46,7 @@
 #include "request.h"
 #include "server.h"
 #include "status.h"
+#include "stringref.h"
 #include "util.h"
 #include "version.h"
 #include "xmlnode.h"
@@ -676,6 +681,57 @@ void jabber_keepalive(PurpleConnection *gc)
 	}
 }
 
+/*
+ * The receive buffer starts small, doubles whenever a read fills it, and
+ * shrinks back after a run of reads that use little of it. Plain sockets
+ * also read the excess of a burst into a spill buffer with readv, so one
+ * wakeup drains it even before the buffer has grown.
+ */
+#define JABBER_RECV_BUF_MIN      4096
+#define JABBER_RECV_BUF_MAX      (256 * 1024)
+#define JABBER_RECV_SPILL        (64 * 1024)
+#define JABBER_RECV_SHRINK_AFTER 32
+
+static void
+jabber_recv_buf_adapt(JabberStream *js, gsize len)
+{
+	gsize size = js->recv_buf_size;
+
+	if (len >= size && size < JABBER_RECV_BUF_MAX) {
+		while (size < len && size < JABBER_RECV_BUF_MAX)
+			size *= 2;
+		if (size == js->recv_buf_size)
+			size *= 2;
+		js->recv_buf_small_reads = 0;
+	} else if (len < size / 4 && size > JABBER_RECV_BUF_MIN) {
+		if (++js->recv_buf_small_reads < JABBER_RECV_SHRINK_AFTER)
+			return;
+		size /= 2;
+		js->recv_buf_small_reads = 0;
+	} else {
+		js->recv_buf_small_reads = 0;
+		return;
+	}
+
+	size = CLAMP(size, JABBER_RECV_BUF_MIN, JABBER_RECV_BUF_MAX);
+	if (size != js->recv_buf_size) {
+		/* The contents have already been handed to the parser */
+		g_free(js->recv_buf);
+		js->recv_buf = g_malloc(size);
+		js->recv_buf_size = size;
+	}
+}
+
+static void
+jabber_recv_buf_ensure(JabberStream *js)
+{
+	if (js->recv_buf == NULL) {
+		js->recv_buf_size = JABBER_RECV_BUF_MIN;
+		js->recv_buf = g_malloc(js->recv_buf_size);
+		js->recv_buf_small_reads = 0;
+	}
+}
+
 static void
 jabber_recv_cb_ssl(gpointer data, PurpleSslConnection *gsc,
 		PurpleInputCondition cond)
@@ -683,7 +739,6 @@ jabber_recv_cb_ssl(gpointer data, PurpleSslConnection *gsc,
 	PurpleConnection *gc = data;
 	JabberStream *js = gc->proto_data;
 	int len;
-	static char buf[4096];
 
 	/* TODO: It should be possible to make this check unnecessary */
 	if(!PURPLE_CONNECTION_IS_VALID(gc)) {
@@ -691,13 +746,16 @@ jabber_recv_cb_ssl(gpointer data, PurpleSslConnection *gsc,
 		g_return_if_reached();
 	}
 
-	while((len = purple_ssl_read(gsc, buf, sizeof(buf) - 1)) > 0) {
+	jabber_recv_buf_ensure(js);
+
+	while((len = purple_ssl_read(gsc, js->recv_buf, js->recv_buf_size)) > 0) {
 		gc->last_received = time(NULL);
-		buf[len] = '\0';
-		purple_debug_info("jabber", "Recv (ssl)(%d): %s\n", len, buf);
-		jabber_parser_process(js, buf, len);
+		purple_debug_info("jabber", "Recv (ssl)(%d): %.*s\n", len, len,
+		                  js->recv_buf);
+		jabber_parser_process(js, js->recv_buf, len);
 		if(js->reinit)
 			jabber_stream_init(js);
+		jabber_recv_buf_adapt(js, len);
 	}
 
 	if(len < 0 && errno == EAGAIN)
@@ -715,49 +773,77 @@ jabber_recv_cb_ssl(gpointer data, PurpleSslConnection *gsc,
 	}
 }
 
+static void
+jabber_recv_data(JabberStream *js, const char *buf, int len)
+{
+#ifdef HAVE_CYRUS_SASL
+	if (js->sasl_maxbuf > 0) {
+		const char *out;
+		unsigned int olen;
+		int rc;
+
+		rc = sasl_decode(js->sasl, buf, len, &out, &olen);
+		if (rc != SASL_OK) {
+			gchar *error =
+				g_strdup_printf(_("SASL error: %s"),
+					sasl_errdetail(js->sasl));
+			purple_debug_error("jabber",
+				"sasl_decode_error %d: %s\n", rc,
+				sasl_errdetail(js->sasl));
+			purple_connection_error_reason(js->gc,
+				PURPLE_CONNECTION_ERROR_NETWORK_ERROR,
+				error);
+			g_free(error);
+		} else if (olen > 0) {
+			purple_debug_info("jabber", "RecvSASL (%u): %s\n", olen, out);
+			jabber_parser_process(js, out, olen);
+			if (js->reinit)
+				jabber_stream_init(js);
+		}
+		return;
+	}
+#endif
+	purple_debug_info("jabber", "Recv (%d): %.*s\n", len, len, buf);
+	jabber_parser_process(js, buf, len);
+	if(js->reinit)
+		jabber_stream_init(js);
+}
+
 static void
 jabber_recv_cb(gpointer data, gint source, PurpleInputCondition condition)
 {
 	PurpleConnection *gc = data;
 	JabberStream *js = purple_connection_get_protocol_data(gc);
 	int len;
-	static char buf[4096];
+#ifndef _WIN32
+	static char spill[JABBER_RECV_SPILL];
+	struct iovec iov[2];
+#endif
 
 	g_return_if_fail(PURPLE_CONNECTION_IS_VALID(gc));
 
-	if((len = read(js->fd, buf, sizeof(buf) - 1)) > 0) {
-		gc->last_received = time(NULL);
-#ifdef HAVE_CYRUS_SASL
-		if (js->sasl_maxbuf > 0) {
-			const char *out;
-			unsigned int olen;
-			int rc;
+	jabber_recv_buf_ensure(js);
 
-			rc = sasl_decode(js->sasl, buf, len, &out, &olen);
-			if (rc != SASL_OK) {
-				gchar *error =
-					g_strdup_printf(_("SASL error: %s"),
-						sasl_errdetail(js->sasl));
-				purple_debug_error("jabber",
-					"sasl_decode_error %d: %s\n", rc,
-					sasl_errdetail(js->sasl));
-				purple_connection_error_reason(gc,
-					PURPLE_CONNECTION_ERROR_NETWORK_ERROR,
-					error);
-			} else if (olen > 0) {
-				purple_debug_info("jabber", "RecvSASL (%u): %s\n", olen, out);
-				jabber_parser_process(js, out, olen);
-				if (js->reinit)
-					jabber_stream_init(js);
-			}
-			return;
-		}
+#ifdef _WIN32
+	len = read(js->fd, js->recv_buf, js->recv_buf_size);
+#else
+	iov[0].iov_base = js->recv_buf;
+	iov[0].iov_len = js->recv_buf_size;
+	iov[1].iov_base = spill;
+	iov[1].iov_len = sizeof(spill);
+	len = readv(js->fd, iov, 2);
 #endif
-		buf[len] = '\0';
-		purple_debug_info("jabber", "Recv (%d): %s\n", len, buf);
-		jabber_parser_process(js, buf, len);
-		if(js->reinit)
-			jabber_stream_init(js);
+
+	if(len > 0) {
+		int first = MIN((gsize)len, js->recv_buf_size);
+
+		gc->last_received = time(NULL);
+		jabber_recv_data(js, js->recv_buf, first);
+#ifndef _WIN32
+		if (len > first)
+			jabber_recv_data(js, spill, len - first);
+#endif
+		jabber_recv_buf_adapt(js, len);
 	} else if(len < 0 && errno == EAGAIN) {
 		return;
 	} else {
@@ -962,7 +1048,8 @@ jabber_stream_new(PurpleAccount *account)
 	}
 
 	js->buddies = g_hash_table_new_full(g_str_hash, g_str_equal,
-			g_free, (GDestroyNotify)jabber_buddy_free);
+			(GDestroyNotify)purple_stringref_intern_unref,
+			(GDestroyNotify)jabber_buddy_free);
 
 	/* This is overridden during binding, but we need it here
 	 * in case the server only does legacy non-sasl auth!.
@@ -982,8 +1069,7 @@ jabber_stream_new(PurpleAccount *account)
 
 	js->user_jb->subscription |= JABBER_SUB_BOTH;
 
-	js->iq_callbacks = g_hash_table_new_full(g_str_hash, g_str_equal,
-			g_free, (GDestroyNotify)jabber_iq_callbackdata_free);
+	jabber_iq_pending_init(js);
 	js->chats = g_hash_table_new_full(g_str_hash, g_str_equal,
 			g_free, (GDestroyNotify)jabber_chat_free);
 	js->next_id = g_random_int();
@@ -1636,11 +1722,11 @@ void jabber_close(PurpleConnection *gc)
 		jabber_bosh_connection_destroy(js->bosh);
 
 	jabber_buddy_remove_all_pending_buddy_info_requests(js);
+	jabber_caps_cancel_queries(js);
 
 	jabber_parser_free(js);
 
-	if(js->iq_callbacks)
-		g_hash_table_destroy(js->iq_callbacks);
+	jabber_iq_pending_destroy(js);
 	if(js->buddies)
 		g_hash_table_destroy(js->buddies);
 	if(js->chats)
@@ -1679,6 +1765,7 @@ void jabber_close(PurpleConnection *gc)
 
 	if (js->write_buffer)
 		purple_circ_buffer_destroy(js->write_buffer);
+	g_free(js->recv_buf);
 	if(js->writeh)
 		purple_input_remove(js->writeh);
 	if (js->auth_mech && js->auth_mech->dispose)
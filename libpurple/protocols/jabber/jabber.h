@@ -113,6 +113,10 @@ struct _JabberStream
 
 	xmlParserCtxt *context;
 	xmlnode *current;
+	/* Receive buffer, resized to fit how much each read brings in */
+	char *recv_buf;
+	gsize recv_buf_size;
+	guint recv_buf_small_reads;
 
 	struct {
 		guint8 major;
@@ -169,9 +173,15 @@ struct _JabberStream
 	PurpleRoomlist *roomlist;
 	GList *user_directories;
 
-	GHashTable *iq_callbacks;
+	GHashTable *iq_callbacks;  /* sequence number -> JabberIqCallbackData */
 	int next_id;
 
+	/* Deadlines for iq_callbacks, one bucket per second; see iq.c */
+	GQueue *iq_wheel;
+	guint iq_wheel_pos;
+	guint iq_wheel_timer;
+	GHashTable *iq_stats;      /* namespace -> JabberIqStats */
+
 	GList *bs_proxies;
 	GList *oob_file_transfers;
 	GList *file_transfers;
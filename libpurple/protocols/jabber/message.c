@@ -31,6 +31,7 @@
 #include "chat.h"
 #include "data.h"
 #include "google/google.h"
+#include "ibb.h"
 #include "message.h"
 #include "xmlnode.h"
 #include "pep.h"
@@ -532,6 +533,11 @@ void jabber_message_parse(JabberStream *js, xmlnode *packet)
 	if (signal_return)
 		return;
 
+	/* in-band bytestream data sent in message stanzas */
+	child = xmlnode_get_child_with_namespace(packet, "data", NS_IBB);
+	if (child && jabber_ibb_parse_message(js, from, child))
+		return;
+
 	jm = g_new0(JabberMessage, 1);
 	jm->js = js;
 	jm->sent = time(NULL);
@@ -77,6 +77,8 @@ void jabber_keepalive_ping(JabberStream *js)
 	xmlnode_set_namespace(ping, NS_PING);
 
 	jabber_iq_set_callback(iq, jabber_keepalive_pong_cb, NULL);
+	/* js->keepalive_timeout already bounds this one */
+	jabber_iq_set_timeout(iq, 0);
 	jabber_iq_send(iq);
 }
 
@@ -500,11 +500,15 @@ jabber_presence_set_capabilities(JabberCapsClientInfo *info, GList *exts,
 		return;
 	}
 
-	/* Any old jbr->caps.info is owned by the caps code */
 	if (jbr->caps.exts) {
 		g_list_free_full(jbr->caps.exts, g_free);
 	}
 
+	/* The resource holds a reference so the entry stays in the caps cache */
+	if (info)
+		jabber_caps_client_info_ref(info);
+	jabber_caps_client_info_unref(jbr->caps.info);
+
 	jbr->caps.info = info;
 	jbr->caps.exts = exts;
 
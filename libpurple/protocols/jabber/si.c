@@ -71,7 +71,10 @@ typedef struct _JabberSIXfer {
 
 	JabberIBBSession *ibb_session;
 	guint ibb_timeout_handle;
-	PurpleCircBuffer *ibb_buffer;
+	/* received data not yet handed to the transfer */
+	GByteArray *ibb_buffer;
+	/* keeps the IBB window full while sending */
+	guint ibb_fill_handle;
 } JabberSIXfer;
 
 /* some forward declarations */
@@ -1022,7 +1025,7 @@ jabber_si_xfer_ibb_recv_data_cb(JabberIBBSession *sess, gpointer data,
 	if (size <= purple_xfer_get_bytes_remaining(xfer)) {
 		purple_debug_info("jabber", "about to write %" G_GSIZE_FORMAT " bytes from IBB stream\n",
 			size);
-		purple_circ_buffer_append(jsx->ibb_buffer, data, size);
+		g_byte_array_append(jsx->ibb_buffer, data, size);
 		purple_xfer_prpl_ready(xfer);
 	} else {
 		/* trying to write past size of file transfers negotiated size,
@@ -1038,17 +1041,12 @@ static gssize
 jabber_si_xfer_ibb_read(guchar **out_buffer, PurpleXfer *xfer)
 {
 	JabberSIXfer *jsx = xfer->data;
-	guchar *buffer;
-	gsize size;
-	gsize tmp;
-
-	size = jsx->ibb_buffer->bufused;
-	*out_buffer = buffer = g_malloc(size);
-	while ((tmp = purple_circ_buffer_get_max_read(jsx->ibb_buffer))) {
-		memcpy(buffer, jsx->ibb_buffer->outptr, tmp);
-		buffer += tmp;
-		purple_circ_buffer_mark_read(jsx->ibb_buffer, tmp);
-	}
+	gsize size = jsx->ibb_buffer->len;
+
+	/* hand over what we have, rather than copying it out */
+	*out_buffer = g_byte_array_free(jsx->ibb_buffer, FALSE);
+	jsx->ibb_buffer = g_byte_array_sized_new(
+		jabber_ibb_session_get_block_size(jsx->ibb_session));
 
 	return size;
 }
@@ -1079,8 +1077,8 @@ jabber_si_xfer_ibb_open_cb(JabberStream *js, const char *who, const char *id,
 			/* we handle up to block-size bytes of decoded data, to handle
 			 clients interpreting the block-size attribute as that
 			 (see also remark in ibb.c) */
-			jsx->ibb_buffer =
-				purple_circ_buffer_new(jabber_ibb_session_get_block_size(sess));
+			jsx->ibb_buffer = g_byte_array_sized_new(
+				jabber_ibb_session_get_block_size(sess));
 
 			/* set up read function */
 			purple_xfer_set_read_fnc(xfer, jabber_si_xfer_ibb_read);
@@ -1107,12 +1105,55 @@ jabber_si_xfer_ibb_write(const guchar *buffer, size_t len, PurpleXfer *xfer)
 {
 	JabberSIXfer *jsx = (JabberSIXfer *) xfer->data;
 	JabberIBBSession *sess = jsx->ibb_session;
-	gsize packet_size = len < jabber_ibb_session_get_max_data_size(sess) ?
-		len : jabber_ibb_session_get_max_data_size(sess);
+	gsize max_size = jabber_ibb_session_get_max_data_size(sess);
+	gsize remaining = purple_xfer_get_bytes_remaining(xfer);
+	gsize sent = 0;
+
+	/* send as many blocks as the window allows. A short block is only sent
+	   at the end of the file, anything else is left for the next call */
+	while (sent < len && jabber_ibb_session_can_send(sess)) {
+		gsize packet_size = MIN(len - sent, max_size);
 
-	jabber_ibb_session_send_data(sess, buffer, packet_size);
+		if (packet_size < max_size && len - sent < remaining)
+			break;
 
-	return packet_size;
+		jabber_ibb_session_send_data(sess, buffer + sent, packet_size);
+		sent += packet_size;
+	}
+
+	return sent;
+}
+
+static gboolean
+jabber_si_xfer_ibb_fill_cb(gpointer data)
+{
+	PurpleXfer *xfer = (PurpleXfer *) data;
+	JabberSIXfer *jsx = (JabberSIXfer *) xfer->data;
+
+	/* each pass through the transfer sends what one buffer of the file
+	   holds, so keep going until the window is full */
+	if (purple_xfer_get_bytes_remaining(xfer) > 0 &&
+			jabber_ibb_session_can_send(jsx->ibb_session)) {
+		gsize before = purple_xfer_get_bytes_remaining(xfer);
+
+		purple_xfer_prpl_ready(xfer);
+
+		if (purple_xfer_get_bytes_remaining(xfer) < before)
+			return TRUE;
+	}
+
+	jsx->ibb_fill_handle = 0;
+	return FALSE;
+}
+
+static void
+jabber_si_xfer_ibb_fill(PurpleXfer *xfer)
+{
+	JabberSIXfer *jsx = (JabberSIXfer *) xfer->data;
+
+	if (!jsx->ibb_fill_handle)
+		jsx->ibb_fill_handle =
+			purple_timeout_add(0, jabber_si_xfer_ibb_fill_cb, xfer);
 }
 
 static void
@@ -1122,13 +1163,17 @@ jabber_si_xfer_ibb_sent_cb(JabberIBBSession *sess)
 	gsize remaining = purple_xfer_get_bytes_remaining(xfer);
 
 	if (remaining == 0) {
+		/* wait for the rest of the window to be acknowledged */
+		if (jabber_ibb_session_get_in_flight(sess) > 0)
+			return;
+
 		/* close the session */
 		jabber_ibb_session_close(sess);
 		purple_xfer_set_completed(xfer, TRUE);
 		purple_xfer_end(xfer);
 	} else {
 		/* send more... */
-		purple_xfer_prpl_ready(xfer);
+		jabber_si_xfer_ibb_fill(xfer);
 	}
 }
 
@@ -1139,7 +1184,7 @@ jabber_si_xfer_ibb_opened_cb(JabberIBBSession *sess)
 
 	if (jabber_ibb_session_get_state(sess) == JABBER_IBB_SESSION_OPENED) {
 		purple_xfer_start(xfer, -1, NULL, 0);
-		purple_xfer_prpl_ready(xfer);
+		jabber_si_xfer_ibb_fill(xfer);
 	} else {
 		/* error */
 		purple_xfer_end(xfer);
@@ -1167,9 +1212,6 @@ jabber_si_xfer_ibb_send_init(JabberStream *js, PurpleXfer *xfer)
 
 		purple_xfer_set_write_fnc(xfer, jabber_si_xfer_ibb_write);
 
-		jsx->ibb_buffer =
-			purple_circ_buffer_new(jabber_ibb_session_get_max_data_size(jsx->ibb_session));
-
 		/* open the IBB session */
 		jabber_ibb_session_open(jsx->ibb_session);
 
@@ -1299,6 +1341,8 @@ static void jabber_si_xfer_send_request(PurpleXfer *xfer)
 	xmlnode_insert_data(value, NS_IBB, -1);
 
 	jabber_iq_set_callback(iq, jabber_si_xfer_send_method_cb, xfer);
+	/* The reply waits on the remote user accepting the file */
+	jabber_iq_set_timeout(iq, 0);
 
 	/* Store the IQ id so that we can cancel the callback */
 	g_free(jsx->iq_id);
@@ -1333,6 +1377,8 @@ static void jabber_si_xfer_free(PurpleXfer *xfer)
 			purple_timeout_remove(jsx->connect_timeout);
 		if (jsx->ibb_timeout_handle > 0)
 			purple_timeout_remove(jsx->ibb_timeout_handle);
+		if (jsx->ibb_fill_handle > 0)
+			purple_timeout_remove(jsx->ibb_fill_handle);
 
 		if (jsx->streamhosts) {
 			g_list_foreach(jsx->streamhosts, jabber_si_free_streamhost, NULL);
@@ -1346,7 +1392,7 @@ static void jabber_si_xfer_free(PurpleXfer *xfer)
 		}
 
 		if (jsx->ibb_buffer) {
-			purple_circ_buffer_destroy(jsx->ibb_buffer);
+			g_byte_array_free(jsx->ibb_buffer, TRUE);
 		}
 
 		purple_debug_info("jabber", "jabber_si_xfer_free(): freeing jsx %p\n", jsx);
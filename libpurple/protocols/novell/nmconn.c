@@ -446,19 +446,18 @@ nm_send_request(NMConn *conn, char *cmd, NMField *fields,
 		}
 	}
 
-	/* Add the transaction id to the request fields */
-	if (rc == NM_OK) {
-		if (fields)
-			request_fields = nm_copy_field_array(fields);
+	/* Send the request to the server, followed by the transaction id.
+	 * The caller's fields are written as they are rather than copied
+	 * just to append the id. */
+	if (rc == NM_OK && fields) {
+		rc = nm_write_fields(conn, fields);
+	}
 
+	if (rc == NM_OK) {
 		str = g_strdup_printf("%d", ++(conn->trans_id));
 		request_fields = nm_field_add_pointer(request_fields, NM_A_SZ_TRANSACTION_ID, 0,
 											  NMFIELD_METHOD_VALID, 0,
 											  str, NMFIELD_TYPE_UTF8);
-	}
-
-	/* Send the request to the server */
-	if (rc == NM_OK) {
 		rc = nm_write_fields(conn, request_fields);
 	}
 
@@ -546,10 +545,13 @@ nm_read_fields(NMConn * conn, int count, NMField ** fields)
 	char tag[64];
 	NMField *sub_fields = NULL;
 	char *str = NULL;
+	guint32 n;
 
 	if (conn == NULL || fields == NULL)
 		return NMERR_BAD_PARM;
 
+	n = nm_count_fields(*fields);
+
 	do {
 		if (count > 0) {
 			count--;
@@ -590,8 +592,8 @@ nm_read_fields(NMConn * conn, int count, NMField ** fields)
 					break;
 			}
 
-			*fields = nm_field_add_pointer(*fields, tag, 0, method,
-									   0, sub_fields, type);
+			*fields = nm_field_append_pointer(*fields, n++, tag, 0, method,
+											  0, sub_fields, type);
 
 			sub_fields = NULL;
 
@@ -614,8 +616,8 @@ nm_read_fields(NMConn * conn, int count, NMField ** fields)
 				if (rc != NM_OK)
 					break;
 
-				*fields = nm_field_add_pointer(*fields, tag, 0, method,
-											   0, str, type);
+				*fields = nm_field_append_pointer(*fields, n++, tag, 0, method,
+												  0, str, type);
 				str = NULL;
 			}
 
@@ -626,8 +628,8 @@ nm_read_fields(NMConn * conn, int count, NMField ** fields)
 			if (rc != NM_OK)
 				break;
 
-			*fields = nm_field_add_number(*fields, tag, 0, method,
-										  0, val, type);
+			*fields = nm_field_append_number(*fields, n++, tag, 0, method,
+											 0, val, type);
 		}
 
 	} while ((type != 0) && (count != 0));
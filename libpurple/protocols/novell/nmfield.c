@@ -37,6 +37,53 @@ static void _copy_field_value(NMField * dest, NMField * src);
 /* Create a string from a value -- for debugging */
 static char *_value_to_string(NMField * field);
 
+/* Interned field tags, see _intern_tag() */
+static GHashTable *field_tags = NULL;
+
+static guint
+_tag_hash(gconstpointer key)
+{
+	const char *p = key;
+	guint h = 5381;
+
+	for (; *p; p++)
+		h = (h << 5) + h + g_ascii_tolower(*p);
+
+	return h;
+}
+
+static gboolean
+_tag_equal(gconstpointer a, gconstpointer b)
+{
+	return g_ascii_strcasecmp(a, b) == 0;
+}
+
+/*
+ * Return the shared copy of tag, adding it if add is TRUE. Tags compare
+ * case-insensitively, so all fields with equal tags point to the same
+ * string and can be compared by pointer. The set of tags the server uses is
+ * small and fixed, so the copies live as long as the process.
+ */
+static const char *
+_intern_tag(const char *tag, gboolean add)
+{
+	char *atom;
+
+	if (field_tags == NULL) {
+		if (!add)
+			return NULL;
+		field_tags = g_hash_table_new(_tag_hash, _tag_equal);
+	}
+
+	atom = g_hash_table_lookup(field_tags, tag);
+	if (atom == NULL && add) {
+		atom = g_strdup(tag);
+		g_hash_table_insert(field_tags, atom, atom);
+	}
+
+	return atom;
+}
+
 static NMField *
 _add_blank_field(NMField *fields, guint32 count)
 {
@@ -47,7 +94,8 @@ _add_blank_field(NMField *fields, guint32 count)
 		fields->len = 10;
 	} else {
 		if (fields->len < count + 2) {
-			new_len = count + 10;
+			/* Grow geometrically, the contact list arrives as one array */
+			new_len = MAX(count + 10, fields->len * 2);
 			fields = g_realloc(fields, new_len * sizeof(NMField));
 			fields->len = new_len;
 		}
@@ -59,14 +107,21 @@ NMField *
 nm_field_add_number(NMField * fields, const char *tag, guint32 size, guint8 method,
 					guint8 flags, guint32 value, guint8 type)
 {
-	guint32 count;
+	return nm_field_append_number(fields, nm_count_fields(fields), tag, size,
+								  method, flags, value, type);
+}
+
+NMField *
+nm_field_append_number(NMField * fields, guint32 count, const char *tag,
+					   guint32 size, guint8 method, guint8 flags, guint32 value,
+					   guint8 type)
+{
 	NMField *field;
 
-	count = nm_count_fields(fields);
 	fields = _add_blank_field(fields, count);
 
 	field = &(fields[count]);
-	field->tag = g_strdup(tag);
+	field->tag = _intern_tag(tag, TRUE);
 	field->size = size;
 	field->method = method;
 	field->flags = flags;
@@ -86,14 +141,21 @@ NMField *
 nm_field_add_pointer(NMField * fields, const char *tag, guint32 size, guint8 method,
 					 guint8 flags, gpointer value, guint8 type)
 {
-	guint32 count;
+	return nm_field_append_pointer(fields, nm_count_fields(fields), tag, size,
+								   method, flags, value, type);
+}
+
+NMField *
+nm_field_append_pointer(NMField * fields, guint32 count, const char *tag,
+						guint32 size, guint8 method, guint8 flags, gpointer value,
+						guint8 type)
+{
 	NMField *field = NULL;
 
-	count = nm_count_fields(fields);
 	fields = _add_blank_field(fields, count);
 
 	field = &(fields[count]);
-	field->tag = g_strdup(tag);
+	field->tag = _intern_tag(tag, TRUE);
 	field->size = size;
 	field->method = method;
 	field->flags = flags;
@@ -151,7 +213,6 @@ _free_field(NMField * field)
 		return;
 
 	_free_field_value(field);
-	g_free(field->tag);
 }
 
 static void
@@ -184,13 +245,19 @@ NMField *
 nm_locate_field(char *tag, NMField * fields)
 {
 	NMField *ret_fields = NULL;
+	const char *atom;
 
 	if ((fields == NULL) || (tag == NULL)) {
 		return NULL;
 	}
 
+	/* A tag that was never interned can't be in any array */
+	atom = _intern_tag(tag, FALSE);
+	if (atom == NULL)
+		return NULL;
+
 	while (fields->tag != NULL) {
-		if (g_ascii_strcasecmp(fields->tag, tag) == 0) {
+		if (fields->tag == atom) {
 			ret_fields = fields;
 			break;
 		}
@@ -228,7 +295,7 @@ _copy_field(NMField * dest, NMField * src)
 	dest->type = src->type;
 	dest->flags = src->flags;
 	dest->method = src->method;
-	dest->tag = g_strdup(src->tag);
+	dest->tag = src->tag;
 	_copy_field_value(dest, src);
 }
 
@@ -25,7 +25,7 @@
 
 typedef struct NMField_t
 {
-	char *tag;				/* Field tag */
+	const char *tag;		/* Field tag (interned, not to be freed) */
 	guint8 method;			/* Method of the field */
 	guint8 flags;			/* Flags */
 	guint8 type;			/* Type of value */
@@ -179,6 +179,47 @@ NMField *nm_field_add_pointer(NMField *fields, const char *tag, guint32 size, gu
 NMField *nm_field_add_number(NMField *fields, const char *tag, guint32 size, guint8 method,
 							 guint8 flags, guint32 value, guint8 type);
 
+/**
+ * Add a field to the field array like nm_field_add_pointer(), for callers that
+ * already know how many fields the array holds. This avoids counting the
+ * fields again on every add when building a large array.
+ *
+ * @param fields	Field array
+ * @param count		The number of fields in the array
+ * @param tag		Tag for the new field
+ * @param size		Size of the field value (if type = binary)
+ * @param method	Field method (see method defines above)
+ * @param flags		Flags for new field
+ * @param value		The value of the field
+ * @param type		The type of the field value
+ *
+ * @return			Pointer to the updated field array
+ *
+ */
+NMField *nm_field_append_pointer(NMField *fields, guint32 count, const char *tag,
+								 guint32 size, guint8 method, guint8 flags,
+								 gpointer value, guint8 type);
+
+/**
+ * Add a numeric field to the field array like nm_field_add_number(), for
+ * callers that already know how many fields the array holds.
+ *
+ * @param fields	Field array
+ * @param count		The number of fields in the array
+ * @param tag		Tag for the new field
+ * @param size		Size of the field value (if type = binary)
+ * @param method	Field method (see method defines above)
+ * @param flags		Flags for new field
+ * @param value		The value of the field
+ * @param type		The type of the field value
+ *
+ * @return			Pointer to the updated field array
+ *
+ */
+NMField *nm_field_append_number(NMField *fields, guint32 count, const char *tag,
+								guint32 size, guint8 method, guint8 flags,
+								guint32 value, guint8 type);
+
 /**
  * Recursively free an array of fields and set pointer to NULL.
  *
@@ -190,6 +231,9 @@ void nm_free_fields(NMField ** fields);
 /**
  * Find first field with given tag in field array.
  *
+ * Tags are interned when fields are added, so this compares pointers
+ * rather than strings.
+ *
  * Note: this will only work for 7-bit ascii tags (which is all that
  * we use currently).
  *
@@ -1574,8 +1574,10 @@ nm_call_handler(NMUser * user, NMRequest * request, NMField * fields)
 
 			user->user_record = nm_create_user_record_from_fields(fields);
 
-			/* Save the users fields */
-			user->fields = nm_copy_field_array(fields);
+			/* Save the users fields. They are taken over rather than
+			 * copied, see nm_process_response(). */
+			nm_free_fields(&user->fields);
+			user->fields = fields;
 
 			nm_create_contact_list(user);
 			done = _create_privacy_list(user, request);
@@ -1789,7 +1791,8 @@ nm_process_response(NMUser * user)
 		}
 	}
 
-	if (fields)
+	/* The login response is kept as the user's fields */
+	if (fields && fields != user->fields)
 		nm_free_fields(&fields);
 
 	return rc;
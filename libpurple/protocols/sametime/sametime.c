@@ -149,6 +149,11 @@
 #define BLIST_SAVE_SECONDS  15
 
 
+/** the most queued awareness updates applied to the blist in one go
+    before yielding back to the main loop */
+#define AWARE_BATCH_SIZE  200
+
+
 /** the possible buddy list storage settings */
 enum blist_choice {
   blist_choice_LOCAL = 1, /**< local only */
@@ -215,6 +220,17 @@ struct mwPurplePluginData {
   /** event id for the buddy list save callback */
   guint save_event;
 
+  /** awareness updates waiting to be applied to the blist, in the
+      order they arrived. A user only ever has one entry in here */
+  GQueue aware_queue;
+
+  /** map of user id:struct aware_update, for the entries in
+      aware_queue */
+  GHashTable *aware_pending;
+
+  /** event id for applying the next batch of aware_queue */
+  guint aware_event;
+
   /** socket fd */
   int socket;
   gint outpa;  /* like inpa, but the other way */
@@ -248,14 +264,18 @@ static gboolean buddy_is_external(PurpleBuddy *b);
 
 static void buddy_add(struct mwPurplePluginData *pd, PurpleBuddy *buddy);
 
+static void buddies_add(struct mwPurplePluginData *pd, PurpleGroup *group,
+			GList *buddies);
+
 static PurpleBuddy *
 buddy_ensure(PurpleConnection *gc, PurpleGroup *group,
-	     struct mwSametimeUser *stuser);
+	     struct mwSametimeUser *stuser, GList **added);
 
 static void group_add(struct mwPurplePluginData *pd, PurpleGroup *group);
 
 static PurpleGroup *
-group_ensure(PurpleConnection *gc, struct mwSametimeGroup *stgroup);
+group_ensure(PurpleConnection *gc, struct mwSametimeGroup *stgroup,
+	     GHashTable *index);
 
 static struct mwAwareList *
 list_ensure(struct mwPurplePluginData *pd, PurpleGroup *group);
@@ -464,23 +484,185 @@ static void mw_session_clear(struct mwSession *session) {
 /* ----- aware list ----- */
 
 
+/** an awareness update waiting in aware_queue to be applied to the
+    blist */
+struct aware_update {
+  char *id;
+  gboolean online;
+  const char *status;  /**< one of the MW_STATE_ values */
+  guint32 idle;
+  GSList *nab_lists;   /**< aware lists of the NAB groups listing id */
+};
+
+
+/** what blist_resolve_alias_cb needs to find the NAB group members it
+    resolved. The group is found again by name, in case it was removed
+    while the lookup was out */
+struct nab_resolve {
+  struct mwPurplePluginData *pd;
+  char *group;
+};
+
+
+static void aware_update_free(struct aware_update *au) {
+  g_free(au->id);
+  g_slist_free(au->nab_lists);
+  g_free(au);
+}
+
+
+static void nab_resolve_free(struct nab_resolve *nab) {
+  g_free(nab->group);
+  g_free(nab);
+}
+
+
 static void blist_resolve_alias_cb(struct mwServiceResolve *srvc,
 				   guint32 id, guint32 code, GList *results,
 				   gpointer data) {
-  struct mwResolveResult *result;
-  struct mwResolveMatch *match;
+  struct nab_resolve *nab = data;
+  PurpleAccount *acct;
+  PurpleGroup *group;
+
+  acct = purple_connection_get_account(nab->pd->gc);
+  group = purple_find_group(nab->group);
+  g_return_if_fail(group != NULL);
+
+  /* one result per member that was looked up, named by the id we
+     asked about */
+  for(; results; results = results->next) {
+    struct mwResolveResult *result = results->data;
+    struct mwResolveMatch *match;
+    PurpleBuddy *buddy;
+
+    if(! result || ! result->name || ! result->matches) continue;
+
+    match = result->matches->data;
+    if(! match) continue;
+
+    buddy = purple_find_buddy_in_group(acct, result->name, group);
+    if(! buddy) continue;
+
+    purple_blist_server_alias_buddy(buddy, match->name);
+    purple_blist_node_set_string((PurpleBlistNode *) buddy,
+				 BUDDY_KEY_NAME, match->name);
+  }
+}
+
+
+/** ensure a member of a NAB group seen through list is in the matching
+    PurpleGroup. Members that had to be added are prepended to the
+    list of ids kept for that group in resolve, so their names can be
+    looked up in one go */
+static void aware_nab_ensure(struct mwPurplePluginData *pd,
+			     struct mwAwareList *list, const char *id,
+			     GHashTable *resolve) {
+  PurpleAccount *acct;
+  PurpleGroup *group;
+  PurpleBuddy *buddy;
+
+  acct = purple_connection_get_account(pd->gc);
 
-  g_return_if_fail(results != NULL);
+  /* the group may have been removed since the update came in */
+  group = g_hash_table_lookup(pd->group_list_map, list);
+  if(! group) return;
 
-  result = results->data;
-  g_return_if_fail(result != NULL);
-  g_return_if_fail(result->matches != NULL);
+  buddy = purple_find_buddy_in_group(acct, id, group);
+  if(! buddy) {
+    GList *query;
+
+    buddy = purple_buddy_new(acct, id, NULL);
+    purple_blist_add_buddy(buddy, NULL, group, NULL);
+
+    query = g_hash_table_lookup(resolve, group);
+    query = g_list_prepend(query, (char *) purple_buddy_get_name(buddy));
+    g_hash_table_insert(resolve, group, query);
+  }
+
+  purple_blist_node_set_int((PurpleBlistNode *) buddy,
+			    BUDDY_KEY_TYPE, mwSametimeUser_NORMAL);
+}
+
+
+static void aware_nab_resolve(PurpleGroup *group, GList *query,
+			      struct mwPurplePluginData *pd) {
+  struct nab_resolve *nab;
+
+  nab = g_new0(struct nab_resolve, 1);
+  nab->pd = pd;
+  nab->group = g_strdup(purple_group_get_name(group));
+
+  mwServiceResolve_resolve(pd->srvc_resolve, query, mwResolveFlag_USERS,
+			   blist_resolve_alias_cb, nab,
+			   (GDestroyNotify) nab_resolve_free);
+  g_list_free(query);
+}
+
+
+/** applies up to AWARE_BATCH_SIZE of the queued awareness updates to
+    the blist. Keeps getting called until the queue is empty, so that a
+    very large NAB group coming online doesn't hold up everything else
+    while its members are added and marked online */
+static gboolean aware_apply_cb(gpointer data) {
+  struct mwPurplePluginData *pd = data;
+  PurpleAccount *acct;
+  GHashTable *resolve;
+  int count;
+
+  acct = purple_connection_get_account(pd->gc);
 
-  match = result->matches->data;
-  g_return_if_fail(match != NULL);
+  /* map of PurpleGroup:GList of ids to resolve */
+  resolve = g_hash_table_new(g_direct_hash, g_direct_equal);
+
+  for(count = 0; count < AWARE_BATCH_SIZE; count++) {
+    struct aware_update *au;
+    GSList *l;
+
+    au = g_queue_pop_head(&pd->aware_queue);
+    if(! au) break;
+
+    g_hash_table_steal(pd->aware_pending, au->id);
+
+    for(l = au->nab_lists; l; l = l->next)
+      aware_nab_ensure(pd, l->data, au->id, resolve);
+
+    if(au->online) {
+      purple_prpl_got_user_status(acct, au->id, au->status, NULL);
+      purple_prpl_got_user_idle(acct, au->id, !!au->idle, (time_t) au->idle);
+
+    } else {
+      purple_prpl_got_user_status(acct, au->id, MW_STATE_OFFLINE, NULL);
+    }
+
+    aware_update_free(au);
+  }
+
+  /* the new NAB members of each group are looked up in one request */
+  g_hash_table_foreach(resolve, (GHFunc) aware_nab_resolve, pd);
+  g_hash_table_destroy(resolve);
+
+  if(g_queue_is_empty(&pd->aware_queue)) {
+    pd->aware_event = 0;
+    return FALSE;
+  }
+
+  return TRUE;
+}
+
+
+/** drops any awareness updates that haven't been applied yet */
+static void aware_queue_clear(struct mwPurplePluginData *pd) {
+  struct aware_update *au;
+
+  if(pd->aware_event) {
+    purple_timeout_remove(pd->aware_event);
+    pd->aware_event = 0;
+  }
 
-  purple_blist_server_alias_buddy(data, match->name);
-  purple_blist_node_set_string(data, BUDDY_KEY_NAME, match->name);
+  while((au = g_queue_pop_head(&pd->aware_queue))) {
+    g_hash_table_steal(pd->aware_pending, au->id);
+    aware_update_free(au);
+  }
 }
 
 
@@ -488,16 +670,15 @@ static void mw_aware_list_on_aware(struct mwAwareList *list,
 				   struct mwAwareSnapshot *aware) {
 
   PurpleConnection *gc;
-  PurpleAccount *acct;
 
   struct mwPurplePluginData *pd;
+  struct aware_update *au;
   guint32 idle;
   guint stat;
   const char *id;
   const char *status = MW_STATE_ACTIVE;
 
   gc = mwAwareList_getClientData(list);
-  acct = purple_connection_get_account(gc);
 
   pd = gc->proto_data;
   idle = aware->status.time;
@@ -564,45 +745,27 @@ static void mw_aware_list_on_aware(struct mwAwareList *list,
     break;
   }
 
-  /* NAB group members */
-  if(aware->group) {
-    PurpleGroup *group;
-    PurpleBuddy *buddy;
-    PurpleBlistNode *bnode;
-
-    group = g_hash_table_lookup(pd->group_list_map, list);
-    buddy = purple_find_buddy_in_group(acct, id, group);
-    bnode = (PurpleBlistNode *) buddy;
-
-    if(! buddy) {
-      struct mwServiceResolve *srvc;
-      GList *query;
-
-      buddy = purple_buddy_new(acct, id, NULL);
-      purple_blist_add_buddy(buddy, NULL, group, NULL);
-
-      bnode = (PurpleBlistNode *) buddy;
-
-      srvc = pd->srvc_resolve;
-      query = g_list_append(NULL, (char *) id);
-
-      mwServiceResolve_resolve(srvc, query, mwResolveFlag_USERS,
-			       blist_resolve_alias_cb, buddy, NULL);
-      g_list_free(query);
-    }
-
-    purple_blist_node_set_int(bnode, BUDDY_KEY_TYPE, mwSametimeUser_NORMAL);
+  /* queue the update, or fold it into the one already queued for the
+     same user */
+  au = g_hash_table_lookup(pd->aware_pending, id);
+  if(! au) {
+    au = g_new0(struct aware_update, 1);
+    au->id = g_strdup(id);
+    g_hash_table_insert(pd->aware_pending, au->id, au);
+    g_queue_push_tail(&pd->aware_queue, au);
   }
 
-  if(aware->online) {
-    purple_prpl_got_user_status(acct, id, status, NULL);
-    purple_prpl_got_user_idle(acct, id, !!idle, (time_t) idle);
+  au->online = aware->online;
+  au->status = status;
+  au->idle = idle;
 
-  } else {
-    purple_prpl_got_user_status(acct, id, MW_STATE_OFFLINE, NULL);
-  }
-}
+  /* NAB group members */
+  if(aware->group && ! g_slist_find(au->nab_lists, list))
+    au->nab_lists = g_slist_prepend(au->nab_lists, list);
 
+  if(! pd->aware_event)
+    pd->aware_event = purple_timeout_add(0, aware_apply_cb, pd);
+}
 
 static void mw_aware_list_on_attrib(struct mwAwareList *list,
 				    struct mwAwareIdBlock *id,
@@ -846,12 +1009,48 @@ static void buddy_add(struct mwPurplePluginData *pd,
 }
 
 
+/** Add a group's worth of new buddies to the aware service in a single
+    request, and schedule the buddy list to be saved to the server */
+static void buddies_add(struct mwPurplePluginData *pd, PurpleGroup *group,
+			GList *buddies) {
+
+  struct mwAwareIdBlock *idbs, *idb;
+  struct mwAwareList *list;
+  GList *add = NULL, *l;
+
+  if(! buddies) return;
+
+  /* bunch of mwAwareIdBlock allocated at once, free'd at once */
+  idb = idbs = g_new(struct mwAwareIdBlock, g_list_length(buddies));
+
+  for(l = buddies; l; l = l->next) {
+    idb->type = mwAware_USER;
+    idb->user = (char *) purple_buddy_get_name(l->data);
+    idb->community = NULL;
+    add = g_list_prepend(add, idb++);
+  }
+
+  list = list_ensure(pd, group);
+
+  if(mwAwareList_addAware(list, add)) {
+    for(l = buddies; l; l = l->next)
+      purple_blist_remove_buddy(l->data);
+  }
+
+  blist_schedule(pd);
+
+  g_list_free(add);
+  g_free(idbs);
+}
+
+
 /** ensure that a PurpleBuddy exists in the group with data
-    appropriately matching the st user entry from the st list */
+    appropriately matching the st user entry from the st list. Buddies
+    that had to be created are prepended to added, for the caller to
+    pass on to buddies_add */
 static PurpleBuddy *buddy_ensure(PurpleConnection *gc, PurpleGroup *group,
-			       struct mwSametimeUser *stuser) {
+			       struct mwSametimeUser *stuser, GList **added) {
 
-  struct mwPurplePluginData *pd = gc->proto_data;
   PurpleBuddy *buddy;
   PurpleAccount *acct = purple_connection_get_account(gc);
 
@@ -868,7 +1067,7 @@ static PurpleBuddy *buddy_ensure(PurpleConnection *gc, PurpleGroup *group,
     buddy = purple_buddy_new(acct, id, alias);
 
     purple_blist_add_buddy(buddy, NULL, group, NULL);
-    buddy_add(pd, buddy);
+    *added = g_list_prepend(*added, buddy);
   }
 
   purple_blist_alias_buddy(buddy, alias);
@@ -901,10 +1100,45 @@ static void group_add(struct mwPurplePluginData *pd,
 }
 
 
+/** builds a map of st group name:PurpleGroup over the groups in the
+    blist that a st list for acct may be merged into, so that
+    group_ensure doesn't have to walk the blist for every st group */
+static GHashTable *group_index_new(PurpleAccount *acct) {
+  GHashTable *index;
+  PurpleBlistNode *gn;
+  const char *owner;
+
+  owner = purple_account_get_username(acct);
+
+  /* the keys are copies, since group_ensure replaces the group setting
+     they were read from */
+  index = g_hash_table_new_full(g_str_hash, g_str_equal, g_free, NULL);
+
+  for(gn = purple_blist_get_root(); gn;
+		  gn = purple_blist_node_get_sibling_next(gn)) {
+    const char *n, *o;
+    if(! PURPLE_BLIST_NODE_IS_GROUP(gn)) continue;
+    n = purple_blist_node_get_string(gn, GROUP_KEY_NAME);
+    o = purple_blist_node_get_string(gn, GROUP_KEY_OWNER);
+
+    if(! n) continue;
+    if(o && !purple_strequal(o, owner)) continue;
+
+    /* the first matching group in the blist wins */
+    if(! g_hash_table_lookup(index, n))
+      g_hash_table_insert(index, g_strdup(n), gn);
+  }
+
+  return index;
+}
+
+
 /** ensure that a PurpleGroup exists in the blist with data
-    appropriately matching the st group entry from the st list */
+    appropriately matching the st group entry from the st list. index
+    is the map from group_index_new, and is kept up to date */
 static PurpleGroup *group_ensure(PurpleConnection *gc,
-			       struct mwSametimeGroup *stgroup) {
+			       struct mwSametimeGroup *stgroup,
+			       GHashTable *index) {
   PurpleAccount *acct;
   PurpleGroup *group = NULL;
   PurpleBuddyList *blist;
@@ -936,23 +1170,7 @@ static PurpleGroup *group_ensure(PurpleConnection *gc,
 	     NSTR(name), NSTR(alias));
 
   /* first attempt at finding the group, by the name key */
-  for(gn = purple_blist_get_root(); gn;
-		  gn = purple_blist_node_get_sibling_next(gn)) {
-    const char *n, *o;
-    if(! PURPLE_BLIST_NODE_IS_GROUP(gn)) continue;
-    n = purple_blist_node_get_string(gn, GROUP_KEY_NAME);
-    o = purple_blist_node_get_string(gn, GROUP_KEY_OWNER);
-
-    DEBUG_INFO("found group named %s, owned by %s\n", NSTR(n), NSTR(o));
-
-    if(n && purple_strequal(n, name)) {
-      if(!o || purple_strequal(o, owner)) {
-	DEBUG_INFO("that'll work\n");
-	group = (PurpleGroup *) gn;
-	break;
-      }
-    }
-  }
+  group = g_hash_table_lookup(index, name);
 
   /* try again, by alias */
   if(! group) {
@@ -971,6 +1189,9 @@ static PurpleGroup *group_ensure(PurpleConnection *gc,
   purple_blist_node_set_string(gn, GROUP_KEY_NAME, name);
   purple_blist_node_set_int(gn, GROUP_KEY_TYPE, type);
 
+  if(! g_hash_table_lookup(index, name))
+    g_hash_table_insert(index, g_strdup(name), group);
+
   if(type == mwSametimeGroup_DYNAMIC) {
     purple_blist_node_set_string(gn, GROUP_KEY_OWNER, owner);
     group_add(gc->proto_data, group);
@@ -987,23 +1208,34 @@ static void blist_merge(PurpleConnection *gc, struct mwSametimeList *stlist) {
 
   PurpleGroup *group;
 
+  GHashTable *index;
   GList *gl, *gtl, *ul, *utl;
 
+  index = group_index_new(purple_connection_get_account(gc));
+
   gl = gtl = mwSametimeList_getGroups(stlist);
   for(; gl; gl = gl->next) {
+    GList *added = NULL;
 
     stgroup = (struct mwSametimeGroup *) gl->data;
-    group = group_ensure(gc, stgroup);
+    group = group_ensure(gc, stgroup, index);
+    if(! group) continue;
 
     ul = utl = mwSametimeGroup_getUsers(stgroup);
     for(; ul; ul = ul->next) {
 
       stuser = (struct mwSametimeUser *) ul->data;
-      buddy_ensure(gc, group, stuser);
+      buddy_ensure(gc, group, stuser, &added);
     }
     g_list_free(utl);
+
+    /* subscribe to the group's new buddies all at once */
+    buddies_add(gc->proto_data, group, added);
+    g_list_free(added);
   }
   g_list_free(gtl);
+
+  g_hash_table_destroy(index);
 }
 
 
@@ -3148,6 +3380,8 @@ static struct mwPurplePluginData *mwPurplePluginData_new(PurpleConnection *gc) {
   pd->srvc_resolve = mw_srvc_resolve_new(pd->session);
   pd->srvc_store = mw_srvc_store_new(pd->session);
   pd->group_list_map = g_hash_table_new(g_direct_hash, g_direct_equal);
+  pd->aware_pending = g_hash_table_new(g_str_hash, g_str_equal);
+  g_queue_init(&pd->aware_queue);
   pd->sock_buf = purple_circ_buffer_new(0);
 
   mwSession_addService(pd->session, MW_SERVICE(pd->srvc_aware));
@@ -3194,6 +3428,9 @@ static void mwPurplePluginData_free(struct mwPurplePluginData *pd) {
 
   mwSession_free(pd->session);
 
+  aware_queue_clear(pd);
+  g_hash_table_destroy(pd->aware_pending);
+
   g_hash_table_destroy(pd->group_list_map);
   purple_circ_buffer_destroy(pd->sock_buf);
 
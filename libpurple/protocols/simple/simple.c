@@ -90,7 +90,8 @@ static void send_open_publish(struct simple_account_data *sip);
 static void send_closed_publish(struct simple_account_data *sip);
 
 static void do_notifies(struct simple_account_data *sip) {
-	GSList *tmp = sip->watcher;
+	GHashTableIter iter;
+	struct simple_watcher *watcher;
 	purple_debug_info("simple", "do_notifies()\n");
 	if((sip->republish != -1) || sip->republish < time(NULL)) {
 		if(purple_account_get_bool(sip->account, "dopublish", TRUE)) {
@@ -98,10 +99,10 @@ static void do_notifies(struct simple_account_data *sip) {
 		}
 	}
 
-	while(tmp) {
-		purple_debug_info("simple", "notifying %s\n", ((struct simple_watcher*)tmp->data)->name);
-		send_notify(sip, tmp->data);
-		tmp = tmp->next;
+	g_hash_table_iter_init(&iter, sip->watchers);
+	while(g_hash_table_iter_next(&iter, NULL, (gpointer *)&watcher)) {
+		purple_debug_info("simple", "notifying %s\n", watcher->name);
+		send_notify(sip, watcher);
 	}
 }
 
@@ -128,26 +129,14 @@ static void simple_set_status(PurpleAccount *account, PurpleStatus *status) {
 }
 
 static struct sip_connection *connection_find(struct simple_account_data *sip, int fd) {
-	struct sip_connection *ret = NULL;
-	GSList *entry = sip->openconns;
-	while(entry) {
-		ret = entry->data;
-		if(ret->fd == fd) return ret;
-		entry = entry->next;
-	}
-	return NULL;
+	return g_hash_table_lookup(sip->openconns, GINT_TO_POINTER(fd));
 }
 
 static struct simple_watcher *watcher_find(struct simple_account_data *sip,
 		const gchar *name) {
-	struct simple_watcher *watcher;
-	GSList *entry = sip->watcher;
-	while(entry) {
-		watcher = entry->data;
-		if(purple_strequal(name, watcher->name)) return watcher;
-		entry = entry->next;
-	}
-	return NULL;
+	if(!name)
+		return NULL;
+	return g_hash_table_lookup(sip->watchers, name);
 }
 
 static struct simple_watcher *watcher_create(struct simple_account_data *sip,
@@ -159,13 +148,11 @@ static struct simple_watcher *watcher_create(struct simple_account_data *sip,
 	watcher->dialog.ourtag = g_strdup(ourtag);
 	watcher->dialog.theirtag = g_strdup(theirtag);
 	watcher->needsxpidf = needsxpidf;
-	sip->watcher = g_slist_append(sip->watcher, watcher);
+	g_hash_table_insert(sip->watchers, watcher->name, watcher);
 	return watcher;
 }
 
-static void watcher_remove(struct simple_account_data *sip, const gchar *name) {
-	struct simple_watcher *watcher = watcher_find(sip, name);
-	sip->watcher = g_slist_remove(sip->watcher, watcher);
+static void watcher_destroy(struct simple_watcher *watcher) {
 	g_free(watcher->name);
 	g_free(watcher->dialog.callid);
 	g_free(watcher->dialog.ourtag);
@@ -176,26 +163,23 @@ static void watcher_remove(struct simple_account_data *sip, const gchar *name) {
 static struct sip_connection *connection_create(struct simple_account_data *sip, int fd) {
 	struct sip_connection *ret = g_new0(struct sip_connection, 1);
 	ret->fd = fd;
-	sip->openconns = g_slist_append(sip->openconns, ret);
+	g_hash_table_insert(sip->openconns, GINT_TO_POINTER(fd), ret);
 	return ret;
 }
 
-static void connection_remove(struct simple_account_data *sip, int fd) {
-	struct sip_connection *conn = connection_find(sip, fd);
-	sip->openconns = g_slist_remove(sip->openconns, conn);
+static void connection_destroy(struct sip_connection *conn) {
 	if(conn->inputhandler) purple_input_remove(conn->inputhandler);
+	if(conn->msg) sipmsg_free(conn->msg);
 	g_free(conn->inbuf);
 	g_free(conn);
 }
 
+static void connection_remove(struct simple_account_data *sip, int fd) {
+	g_hash_table_remove(sip->openconns, GINT_TO_POINTER(fd));
+}
+
 static void connection_free_all(struct simple_account_data *sip) {
-	struct sip_connection *ret = NULL;
-	GSList *entry = sip->openconns;
-	while(entry) {
-		ret = entry->data;
-		connection_remove(sip, ret->fd);
-		entry = sip->openconns;
-	}
+	g_hash_table_remove_all(sip->openconns);
 }
 
 static void simple_add_buddy(PurpleConnection *gc, PurpleBuddy *buddy, PurpleGroup *group)
@@ -597,39 +581,81 @@ static void send_sip_response(PurpleConnection *gc, struct sipmsg *msg, int code
 	g_string_free(outstr, TRUE);
 }
 
+static gboolean resend_timeout(struct simple_account_data *sip);
+
+/* Put trans on the wheel to fire delay ms from now, rounded up to a tick. */
+static void transactions_schedule(struct simple_account_data *sip,
+		struct transaction *trans, guint delay) {
+	GQueue *slot;
+	guint ticks = (delay + SIMPLE_TIMER_T1 - 1) / SIMPLE_TIMER_T1;
+
+	if(ticks == 0)
+		ticks = 1;
+
+	trans->due = sip->trans_tick + ticks;
+	slot = &sip->trans_wheel[trans->due % SIMPLE_TRANS_SLOTS];
+	g_queue_push_tail(slot, trans);
+	trans->link = slot->tail;
+
+	if(!sip->resendtimeout)
+		sip->resendtimeout = purple_timeout_add(SIMPLE_TIMER_T1,
+				(GSourceFunc)resend_timeout, sip);
+}
+
+static void transactions_unschedule(struct simple_account_data *sip,
+		struct transaction *trans) {
+	if(trans->link) {
+		g_queue_delete_link(&sip->trans_wheel[trans->due % SIMPLE_TRANS_SLOTS],
+				trans->link);
+		trans->link = NULL;
+	}
+}
+
+/* The next timer for trans: a retransmission over UDP, otherwise (or if
+ * that would come after it) the transaction timeout. */
+static void transactions_next(struct simple_account_data *sip,
+		struct transaction *trans) {
+	guint elapsed = (sip->trans_tick - trans->start) * SIMPLE_TIMER_T1;
+	guint left = elapsed < SIMPLE_TIMER_F ? SIMPLE_TIMER_F - elapsed : 0;
+
+	if(sip->udp && trans->interval < left)
+		transactions_schedule(sip, trans, trans->interval);
+	else
+		transactions_schedule(sip, trans, left);
+}
+
+/* Called when the request of trans has been (re)sent as a new request. */
+static void transactions_start(struct simple_account_data *sip,
+		struct transaction *trans) {
+	transactions_unschedule(sip, trans);
+	trans->start = sip->trans_tick;
+	trans->interval = SIMPLE_TIMER_T1;
+	transactions_next(sip, trans);
+}
+
 static void transactions_remove(struct simple_account_data *sip, struct transaction *trans) {
+	transactions_unschedule(sip, trans);
+	if(trans->cseq)
+		g_hash_table_remove(sip->transactions, trans->cseq);
 	if(trans->msg) sipmsg_free(trans->msg);
-	sip->transactions = g_slist_remove(sip->transactions, trans);
 	g_free(trans);
 }
 
 static void transactions_add_buf(struct simple_account_data *sip, const gchar *buf, void *callback) {
 	struct transaction *trans = g_new0(struct transaction, 1);
-	trans->time = time(NULL);
 	trans->msg = sipmsg_parse_msg(buf);
 	trans->cseq = sipmsg_find_header(trans->msg, "CSeq");
 	trans->callback = callback;
-	sip->transactions = g_slist_append(sip->transactions, trans);
+	if(trans->cseq)
+		g_hash_table_insert(sip->transactions, (gpointer)trans->cseq, trans);
+	transactions_start(sip, trans);
 }
 
 static struct transaction *transactions_find(struct simple_account_data *sip, struct sipmsg *msg) {
-	struct transaction *trans;
-	GSList *transactions = sip->transactions;
 	const gchar *cseq = sipmsg_find_header(msg, "CSeq");
 
 	if (cseq) {
-		while(transactions) {
-			trans = transactions->data;
-
-			purple_debug_info("simple",
-			                  "received CSeq %s vs known transaction CSeq %s\n",
-			                  cseq, trans->cseq);
-
-			if(purple_strequal(trans->cseq, cseq)) {
-				return trans;
-			}
-			transactions = transactions->next;
-		}
+		return g_hash_table_lookup(sip->transactions, cseq);
 	} else {
 		purple_debug(PURPLE_DEBUG_MISC, "simple", "Received message contains no CSeq header.\n");
 	}
@@ -966,26 +992,49 @@ static void simple_buddy_resub(char *name, struct simple_buddy *buddy, struct si
 }
 
 static gboolean resend_timeout(struct simple_account_data *sip) {
-	GSList *tmp = sip->transactions;
-	time_t currtime = time(NULL);
-	while(tmp) {
-		struct transaction *trans = tmp->data;
-		tmp = tmp->next;
-		purple_debug_info("simple", "have open transaction age: %lu\n", currtime- trans->time);
-		if((currtime - trans->time > 5) && trans->retries >= 1) {
-			/* TODO 408 */
-		} else {
-			if((currtime - trans->time > 2) && trans->retries == 0) {
-				trans->retries++;
-				sendout_sipmsg(sip, trans->msg);
-			}
+	GQueue *slot;
+	GList *l, *next;
+	int i;
+
+	sip->trans_tick++;
+	slot = &sip->trans_wheel[sip->trans_tick % SIMPLE_TRANS_SLOTS];
+
+	/* Entries due on a later turn of the wheel share the slot; anything
+	 * rescheduled here is due later as well, so it is skipped. */
+	for(l = slot->head; l; l = next) {
+		struct transaction *trans = l->data;
+		next = l->next;
+
+		if(trans->due != sip->trans_tick)
+			continue;
+
+		g_queue_delete_link(slot, l);
+		trans->link = NULL;
+
+		if((sip->trans_tick - trans->start) * SIMPLE_TIMER_T1 >= SIMPLE_TIMER_F) {
+			purple_debug_info("simple", "transaction %s timed out\n",
+					trans->cseq ? trans->cseq : "(no CSeq)");
+			transactions_remove(sip, trans);
+			continue;
 		}
+
+		sendout_sipmsg(sip, trans->msg);
+		trans->interval = MIN(trans->interval * 2, SIMPLE_TIMER_T2);
+		transactions_next(sip, trans);
 	}
-	return TRUE;
+
+	for(i = 0; i < SIMPLE_TRANS_SLOTS; i++) {
+		if(!g_queue_is_empty(&sip->trans_wheel[i]))
+			return TRUE;
+	}
+
+	sip->resendtimeout = 0;
+	return FALSE;
 }
 
 static gboolean subscribe_timeout(struct simple_account_data *sip) {
-	GSList *tmp;
+	GHashTableIter iter;
+	struct simple_watcher *watcher;
 	time_t curtime = time(NULL);
 	/* register again if first registration expires */
 	if(sip->reregister < curtime) {
@@ -1005,14 +1054,10 @@ static gboolean subscribe_timeout(struct simple_account_data *sip) {
 	g_hash_table_foreach(sip->buddies, (GHFunc)simple_buddy_resub, (gpointer)sip);
 
 	/* remove a timed out suscriber */
-	tmp = sip->watcher;
-	while(tmp) {
-		struct simple_watcher *watcher = tmp->data;
-		if(watcher->expire < curtime) {
-			watcher_remove(sip, watcher->name);
-			tmp = sip->watcher;
-		}
-		if(tmp) tmp = tmp->next;
+	g_hash_table_iter_init(&iter, sip->watchers);
+	while(g_hash_table_iter_next(&iter, NULL, (gpointer *)&watcher)) {
+		if(watcher->expire < curtime)
+			g_hash_table_iter_remove(&iter);
 	}
 
 	return TRUE;
@@ -1548,6 +1593,7 @@ static void process_input_message(struct simple_account_data *sip, struct sipmsg
 				/* resend request */
 				sendout_pkt(sip->gc, resend);
 				g_free(resend);
+				transactions_start(sip, trans);
 			} else {
 				if(msg->response == 100) {
 					/* ignore provisional response */
@@ -1589,18 +1635,21 @@ static void process_input_message(struct simple_account_data *sip, struct sipmsg
 							sipmsg_add_header(trans->msg, "Authorization", auth);
 							g_free(auth);
 
-							/* bump cseq */
+							/* bump cseq; the old one is the table key */
+							g_hash_table_remove(sip->transactions, trans->cseq);
 							sipmsg_remove_header(trans->msg, "CSeq");
 							sip->cseq++;
 							cseq = g_strdup_printf("%d %s", sip->cseq, trans->msg->method);
 							sipmsg_add_header(trans->msg, "CSeq", cseq);
 							g_free(cseq);
 							trans->cseq = sipmsg_find_header(trans->msg, "CSeq");
+							g_hash_table_insert(sip->transactions, (gpointer)trans->cseq, trans);
 
 							resend = sipmsg_to_string(trans->msg);
 							/* resend request */
 							sendout_pkt(sip->gc, resend);
 							g_free(resend);
+							transactions_start(sip, trans);
 
 							/* exit here - no need to call callback, don't remove trans */
 							return;
@@ -1628,57 +1677,73 @@ static void process_input_message(struct simple_account_data *sip, struct sipmsg
 	}
 }
 
+/*
+ * Handle every complete message in the buffer, then move what is left to the
+ * front. A header that has been parsed but whose body hasn't fully arrived
+ * is kept in conn->msg, and conn->scanned remembers how far the search for
+ * the end of the next header got, so neither is repeated on the next read.
+ */
 static void process_input(struct simple_account_data *sip, struct sip_connection *conn)
 {
+	char *buf = conn->inbuf;
+	char *end = conn->inbuf + conn->inbufused;
 	char *cur;
-	char *dummy;
 	struct sipmsg *msg;
-	int restlen;
-	cur = conn->inbuf;
-
-	/* according to the RFC remove CRLF at the beginning */
-	while(*cur == '\r' || *cur == '\n') {
-		cur++;
-	}
-	if(cur != conn->inbuf) {
-		memmove(conn->inbuf, cur, conn->inbufused - (cur - conn->inbuf));
-		conn->inbufused = strlen(conn->inbuf);
-	}
 
-	/* Received a full Header? */
-	if((cur = strstr(conn->inbuf, "\r\n\r\n")) != NULL) {
-		time_t currtime = time(NULL);
-		cur += 2;
-		cur[0] = '\0';
-		purple_debug_info("simple", "\n\nreceived - %s\n######\n%s\n#######\n\n", ctime(&currtime), conn->inbuf);
-		msg = sipmsg_parse_header(conn->inbuf);
+	while(TRUE) {
+		if(!conn->msg) {
+			char *search;
+			time_t currtime;
+
+			/* according to the RFC remove CRLF at the beginning */
+			while(buf < end && (*buf == '\r' || *buf == '\n'))
+				buf++;
+
+			/* Received a full Header? */
+			search = buf + MAX(conn->scanned - 3, 0);
+			if(search >= end || !(cur = g_strstr_len(search, end - search, "\r\n\r\n"))) {
+				if(end - buf > 0)
+					purple_debug(PURPLE_DEBUG_MISC, "simple", "received a incomplete sip msg: %.*s\n", (int)(end - buf), buf);
+				conn->scanned = end - buf;
+				break;
+			}
+			conn->scanned = 0;
+
+			currtime = time(NULL);
+			cur += 2;
+			cur[0] = '\0';
+			purple_debug_info("simple", "\n\nreceived - %s\n######\n%s\n#######\n\n", ctime(&currtime), buf);
+			msg = sipmsg_parse_header(buf);
+			cur[0] = '\r';
+			cur += 2;
+
+			if(!msg) {
+				purple_debug_misc("simple", "dropping unparseable sip msg header\n");
+				buf = cur;
+				continue;
+			}
 
-		if(!msg) {
-			/* Should we re-use this error message (from lower in the function)? */
-			purple_debug_misc("simple", "received a incomplete sip msg: %s\n", conn->inbuf);
-			return;
+			conn->msg = msg;
+			buf = cur;
 		}
 
-		cur[0] = '\r';
-		cur += 2;
-		restlen = conn->inbufused - (cur - conn->inbuf);
-		if(restlen >= msg->bodylen) {
-			dummy = g_new(char, msg->bodylen + 1);
-			memcpy(dummy, cur, msg->bodylen);
-			dummy[msg->bodylen] = '\0';
-			msg->body = dummy;
-			cur += msg->bodylen;
-			memmove(conn->inbuf, cur, conn->inbuflen - (cur - conn->inbuf));
-			conn->inbufused = strlen(conn->inbuf);
-		} else {
-			sipmsg_free(msg);
-			return;
-		}
+		msg = conn->msg;
+		if(end - buf < msg->bodylen)
+			break;
+
+		msg->body = g_strndup(buf, msg->bodylen);
+		buf += msg->bodylen;
+		conn->msg = NULL;
+
 		purple_debug(PURPLE_DEBUG_MISC, "simple", "in process response response: %d\n", msg->response);
 		process_input_message(sip, msg);
 		sipmsg_free(msg);
-	} else {
-		purple_debug(PURPLE_DEBUG_MISC, "simple", "received a incomplete sip msg: %s\n", conn->inbuf);
+	}
+
+	if(buf != conn->inbuf) {
+		conn->inbufused = end - buf;
+		memmove(conn->inbuf, buf, conn->inbufused);
+		conn->inbuf[conn->inbufused] = '\0';
 	}
 }
 
@@ -1812,7 +1877,6 @@ static void simple_udp_host_resolved_listen_cb(int listenfd, gpointer data) {
 
 	sip->listenpa = purple_input_add(sip->fd, PURPLE_INPUT_READ, simple_udp_process, sip->gc);
 
-	sip->resendtimeout = purple_timeout_add(2500, (GSourceFunc) resend_timeout, sip);
 	sip->registertimeout = purple_timeout_add((rand()%100)+10*1000, (GSourceFunc)subscribe_timeout, sip);
 	do_register(sip);
 }
@@ -1951,6 +2015,11 @@ static void simple_login(PurpleAccount *account)
 	}
 
 	gc->proto_data = sip = g_new0(struct simple_account_data, 1);
+	sip->transactions = g_hash_table_new(g_str_hash, g_str_equal);
+	sip->watchers = g_hash_table_new_full(g_str_hash, g_str_equal,
+			NULL, (GDestroyNotify)watcher_destroy);
+	sip->openconns = g_hash_table_new_full(g_direct_hash, g_direct_equal,
+			NULL, (GDestroyNotify)connection_destroy);
 	sip->gc = gc;
 	sip->fd = -1;
 	sip->listenfd = -1;
@@ -1995,6 +2064,7 @@ static void simple_login(PurpleAccount *account)
 static void simple_close(PurpleConnection *gc)
 {
 	struct simple_account_data *sip = gc->proto_data;
+	int i;
 
 	if (!sip)
 		return;
@@ -2051,8 +2121,14 @@ static void simple_close(PurpleConnection *gc)
 	g_free(sip->status);
 	g_hash_table_destroy(sip->buddies);
 	g_free(sip->regcallid);
-	while (sip->transactions)
-		transactions_remove(sip, sip->transactions->data);
+	/* every open transaction is on the wheel */
+	for (i = 0; i < SIMPLE_TRANS_SLOTS; i++) {
+		while (!g_queue_is_empty(&sip->trans_wheel[i]))
+			transactions_remove(sip, g_queue_peek_head(&sip->trans_wheel[i]));
+	}
+	g_hash_table_destroy(sip->transactions);
+	g_hash_table_destroy(sip->watchers);
+	g_hash_table_destroy(sip->openconns);
 	g_free(sip->publish_etag);
 	if (sip->txbuf)
 		purple_circ_buffer_destroy(sip->txbuf);
@@ -46,6 +46,13 @@
 #define PUBLISH_EXPIRATION 600
 #define SUBSCRIBE_EXPIRATION 1200
 
+/* Transaction timers from RFC 3261 section 17.1.2, in milliseconds. T1 is
+ * also the resolution of the retransmission wheel. */
+#define SIMPLE_TIMER_T1 500
+#define SIMPLE_TIMER_T2 4000
+#define SIMPLE_TIMER_F (64 * SIMPLE_TIMER_T1)
+#define SIMPLE_TRANS_SLOTS 16
+
 struct sip_dialog {
 	gchar *ourtag;
 	gchar *theirtag;
@@ -104,9 +111,11 @@ struct simple_account_data {
 	PurpleCircBuffer *txbuf;
 	guint tx_handler;
 	gchar *regcallid;
-	GSList *transactions;
-	GSList *watcher;
-	GSList *openconns;
+	GHashTable *transactions; /* by CSeq */
+	GQueue trans_wheel[SIMPLE_TRANS_SLOTS];
+	guint trans_tick;
+	GHashTable *watchers; /* by name */
+	GHashTable *openconns; /* by fd */
 	gboolean udp;
 	struct sockaddr_in serveraddr;
 	int registerexpire;
@@ -120,6 +129,8 @@ struct sip_connection {
 	gchar *inbuf;
 	int inbuflen;
 	int inbufused;
+	int scanned; /* bytes already searched for the end of the header */
+	struct sipmsg *msg; /* header parsed, waiting for the body */
 	int inputhandler;
 };
 
@@ -128,8 +139,10 @@ struct transaction;
 typedef gboolean (*TransCallback) (struct simple_account_data *, struct sipmsg *, struct transaction *);
 
 struct transaction {
-	time_t time;
-	int retries;
+	guint start; /* wheel tick the request was (re)sent on */
+	guint due; /* wheel tick of the next retransmission or timeout */
+	guint interval; /* current retransmission interval in ms */
+	GList *link; /* entry in sip->trans_wheel */
 	int transport; /* 0 = tcp, 1 = udp */
 	int fd;
 	const gchar *cseq;
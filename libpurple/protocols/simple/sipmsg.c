@@ -56,62 +56,117 @@ struct sipmsg *sipmsg_parse_msg(const gchar *msg) {
 	return smsg;
 }
 
+/* Header names are case-insensitive. */
+static guint sipmsg_header_hash(gconstpointer key) {
+	const gchar *p = key;
+	guint h = 5381;
+
+	for(; *p; p++)
+		h = (h << 5) + h + g_ascii_tolower(*p);
+
+	return h;
+}
+
+static gboolean sipmsg_header_equal(gconstpointer a, gconstpointer b) {
+	return g_ascii_strcasecmp(a, b) == 0;
+}
+
+/* Append the header from name to name_end with the value from value to
+ * value_end, folding any continuation lines in the value into single
+ * spaces. */
+static void sipmsg_add_header_len(struct sipmsg *msg, const gchar *name,
+		const gchar *name_end, const gchar *value, const gchar *value_end) {
+	struct siphdrelement *element = g_new(struct siphdrelement, 1);
+	GString *folded = g_string_sized_new(value_end - value);
+
+	while(value < value_end) {
+		const gchar *eol = g_strstr_len(value, value_end - value, "\r\n");
+		if(!eol)
+			eol = value_end;
+		if(folded->len)
+			g_string_append_c(folded, ' ');
+		while(value < eol && (*value == ' ' || *value == '\t'))
+			value++;
+		g_string_append_len(folded, value, eol - value);
+		value = eol + 2;
+	}
+
+	element->name = g_strndup(name, name_end - name);
+	element->value = g_string_free(folded, FALSE);
+	msg->headers = g_slist_append(msg->headers, element);
+
+	if(!msg->header_table)
+		msg->header_table = g_hash_table_new(sipmsg_header_hash, sipmsg_header_equal);
+	if(!g_hash_table_lookup(msg->header_table, element->name))
+		g_hash_table_insert(msg->header_table, element->name, element);
+}
+
+/*
+ * This walks the header block once, in place, instead of splitting it into
+ * lines and each line into name and value.
+ */
 struct sipmsg *sipmsg_parse_header(const gchar *header) {
 	struct sipmsg *msg;
-	gchar **parts, **lines;
-	gchar *dummy, *dummy2, *tmp;
+	const gchar *cur, *eol, *sp1, *sp2, *end;
 	const gchar *tmp2;
-	int i = 1;
 
-	lines = g_strsplit(header,"\r\n",0);
-	if(!lines[0]) {
-		g_strfreev(lines);
+	end = header + strlen(header);
+
+	eol = strstr(header, "\r\n");
+	if(!eol)
+		eol = end;
+	if(eol == header)
 		return NULL;
-	}
 
-	parts = g_strsplit(lines[0], " ", 3);
-	if(!parts[0] || !parts[1] || !parts[2]) {
-		g_strfreev(parts);
-		g_strfreev(lines);
+	sp1 = memchr(header, ' ', eol - header);
+	sp2 = sp1 ? memchr(sp1 + 1, ' ', eol - sp1 - 1) : NULL;
+	if(!sp1 || !sp2)
 		return NULL;
-	}
 
 	msg = g_new0(struct sipmsg,1);
-	if(strstr(parts[0],"SIP")) { /* numeric response */
-		msg->method = g_strdup(parts[2]);
-		msg->response = strtol(parts[1],NULL,10);
+	if(g_strstr_len(header, sp1 - header, "SIP")) { /* numeric response */
+		msg->method = g_strndup(sp2 + 1, eol - sp2 - 1);
+		msg->response = strtol(sp1 + 1,NULL,10);
 	} else { /* request */
-		msg->method = g_strdup(parts[0]);
-		msg->target = g_strdup(parts[1]);
+		msg->method = g_strndup(header, sp1 - header);
+		msg->target = g_strndup(sp1 + 1, sp2 - sp1 - 1);
 		msg->response = 0;
 	}
-	g_strfreev(parts);
 
-	for(i=1; lines[i] && strlen(lines[i])>2; i++) {
-		parts = g_strsplit(lines[i], ":", 2);
-		if(!parts[0] || !parts[1]) {
-			g_strfreev(parts);
-			g_strfreev(lines);
+	for(cur = eol + 2; cur < end && end - cur > 2; cur = eol + 2) {
+		const gchar *colon, *value;
+
+		/* A header ends at a line break that isn't followed by
+		 * whitespace, which would continue it. */
+		eol = cur;
+		do {
+			eol = strstr(eol, "\r\n");
+			if(!eol) {
+				eol = end;
+				break;
+			}
+			if(eol[2] != ' ' && eol[2] != '\t')
+				break;
+			eol += 2;
+		} while(TRUE);
+
+		/* Same as the line-by-line parser: stop at a short line. */
+		if(eol - cur <= 2)
+			break;
+
+		colon = memchr(cur, ':', eol - cur);
+		if(!colon) {
 			sipmsg_free(msg);
 			return NULL;
 		}
-		dummy = parts[1];
-		dummy2 = 0;
-		while(*dummy==' ' || *dummy=='\t') dummy++;
-		dummy2 = g_strdup(dummy);
-		while(lines[i+1] && (lines[i+1][0]==' ' || lines[i+1][0]=='\t')) {
-			i++;
-			dummy = lines[i];
-			while(*dummy==' ' || *dummy=='\t') dummy++;
-			tmp = g_strdup_printf("%s %s",dummy2, dummy);
-			g_free(dummy2);
-			dummy2 = tmp;
-		}
-		sipmsg_add_header(msg, parts[0], dummy2);
-		g_free(dummy2);
-		g_strfreev(parts);
+		value = colon + 1;
+		while(value < eol && (*value == ' ' || *value == '\t'))
+			value++;
+		sipmsg_add_header_len(msg, cur, colon, value, eol);
+
+		if(eol == end)
+			break;
 	}
-	g_strfreev(lines);
 
 	tmp2 = sipmsg_find_header(msg, "Content-Length");
 	if (tmp2 != NULL)
@@ -134,9 +189,8 @@ struct sipmsg *sipmsg_parse_header(const gchar *header) {
 			/* SHOULD NOT HAPPEN */
 			msg->method = NULL;
 		} else {
-			parts = g_strsplit(tmp2, " ", 2);
-			msg->method = g_strdup(parts[1]);
-			g_strfreev(parts);
+			const gchar *method = strchr(tmp2, ' ');
+			msg->method = method ? g_strdup(method + 1) : NULL;
 		}
 	}
 
@@ -186,13 +240,20 @@ void sipmsg_add_header(struct sipmsg *msg, const gchar *name, const gchar *value
 	element->name = g_strdup(name);
 	element->value = g_strdup(value);
 	msg->headers = g_slist_append(msg->headers, element);
+
+	if(!msg->header_table)
+		msg->header_table = g_hash_table_new(sipmsg_header_hash, sipmsg_header_equal);
+	if(!g_hash_table_lookup(msg->header_table, element->name))
+		g_hash_table_insert(msg->header_table, element->name, element);
 }
 
 void sipmsg_free(struct sipmsg *msg) {
 	struct siphdrelement *elem;
+	if(msg->header_table)
+		g_hash_table_destroy(msg->header_table);
 	while(msg->headers) {
 		elem = msg->headers->data;
-		msg->headers = g_slist_remove(msg->headers,elem);
+		msg->headers = g_slist_delete_link(msg->headers, msg->headers);
 		g_free(elem->name);
 		g_free(elem->value);
 		g_free(elem);
@@ -205,32 +266,37 @@ void sipmsg_free(struct sipmsg *msg) {
 
 void sipmsg_remove_header(struct sipmsg *msg, const gchar *name) {
 	struct siphdrelement *elem;
-	GSList *tmp = msg->headers;
-	while(tmp) {
-		elem = tmp->data;
-		if(g_ascii_strcasecmp(elem->name, name)==0) {
-			msg->headers = g_slist_remove(msg->headers, elem);
-			g_free(elem->name);
-			g_free(elem->value);
-			g_free(elem);
-			return;
+	GSList *tmp;
+
+	if(!msg->header_table)
+		return;
+	elem = g_hash_table_lookup(msg->header_table, name);
+	if(!elem)
+		return;
+
+	g_hash_table_remove(msg->header_table, name);
+	msg->headers = g_slist_remove(msg->headers, elem);
+
+	/* A later header of the same name is now the first one. */
+	for(tmp = msg->headers; tmp; tmp = tmp->next) {
+		struct siphdrelement *next = tmp->data;
+		if(g_ascii_strcasecmp(next->name, elem->name) == 0) {
+			g_hash_table_insert(msg->header_table, next->name, next);
+			break;
 		}
-		tmp = g_slist_next(tmp);
 	}
-	return;
+
+	g_free(elem->name);
+	g_free(elem->value);
+	g_free(elem);
 }
 
 const gchar *sipmsg_find_header(struct sipmsg *msg, const gchar *name) {
-	GSList *tmp;
 	struct siphdrelement *elem;
-	tmp = msg->headers;
-	while(tmp) {
-		elem = tmp->data;
-		if(g_ascii_strcasecmp(elem->name, name)==0) {
-			return elem->value;
-		}
-		tmp = g_slist_next(tmp);
-	}
-	return NULL;
-}
 
+	if(!msg->header_table)
+		return NULL;
+	elem = g_hash_table_lookup(msg->header_table, name);
+
+	return elem ? elem->value : NULL;
+}
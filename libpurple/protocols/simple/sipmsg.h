@@ -30,6 +30,7 @@ struct sipmsg {
 	gchar *method;
 	gchar *target;
 	GSList *headers;
+	GHashTable *header_table; /* first header of each name, by name */
 	int bodylen;
 	gchar *body;
 };
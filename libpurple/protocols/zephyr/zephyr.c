@@ -50,6 +50,9 @@
 #define ZEPHYR_FD_READ 0
 #define ZEPHYR_FD_WRITE 1
 
+/* Most notices handled per main loop iteration before yielding. */
+#define ZEPHYR_NOTICE_BATCH 64
+
 extern Code_t ZGetLocations(ZLocations_t *, int *);
 extern Code_t ZSetLocation(char *);
 extern Code_t ZUnsetLocation(void);
@@ -74,7 +77,8 @@ struct _zephyr_account {
 	char *encoding;
 	char* galaxy; /* not yet useful */
 	char* krbtkfile; /* not yet useful */
-	guint32 nottimer;
+	guint notify_input;
+	guint notify_drain;
 	guint32 loctimer;
 	GList *pending_zloc_names;
 	GSList *subscrips;
@@ -85,6 +89,7 @@ struct _zephyr_account {
 	zephyr_connection_type connection_type;
 	int totzc[2];
 	int fromtzc[2];
+	GString *tzc_buf;
 	char *exposure;
 	pid_t tzc_pid;
 	gchar *away;
@@ -154,6 +159,20 @@ struct _zephyr_triple {
 extern const char *username;
 #endif
 
+static gboolean zephyr_notify_drain_cb(gpointer data);
+
+/*
+ * Notices can end up in libzephyr's queue without the socket becoming
+ * readable again, when it reads ahead while waiting for an ack.  Call this
+ * after anything that may do that so they aren't left sitting there.
+ */
+static void zephyr_check_queue(zephyr_account *zephyr)
+{
+	if (use_zeph02(zephyr) && zephyr->notify_input && !zephyr->notify_drain && ZQLength() > 0)
+		zephyr->notify_drain = purple_timeout_add(0, zephyr_notify_drain_cb,
+		                                          purple_account_get_connection(zephyr->account));
+}
+
 static Code_t zephyr_subscribe_to(zephyr_account* zephyr, char* class, char *instance, char *recipient, char* galaxy) {
 	size_t result;
 	Code_t ret_val = -1;
@@ -177,6 +196,7 @@ static Code_t zephyr_subscribe_to(zephyr_account* zephyr, char* class, char *ins
 			sub.zsub_classinst = instance;
 			sub.zsub_recipient = recipient;
 			ret_val = ZSubscribeTo(&sub,1,0);
+			zephyr_check_queue(zephyr);
 		}
 	}
 	return ret_val;
@@ -1066,54 +1086,38 @@ static parse_tree *parse_buffer(gchar* source, gboolean do_parse) {
 	}
 }
 
-static parse_tree  *read_from_tzc(zephyr_account* zephyr){
-	struct timeval tv;
-	fd_set rfds;
-	int bufsize = 2048;
-	char *buf = (char *)calloc(bufsize, 1);
-	char *bufcur = buf;
-	int selected = 0;
-	parse_tree *incoming_msg;
-
-	FD_ZERO(&rfds);
-	FD_SET(zephyr->fromtzc[ZEPHYR_FD_READ], &rfds);
-	tv.tv_sec = 0;
-	tv.tv_usec = 0;
-	incoming_msg=NULL;
-
-	while (select(zephyr->fromtzc[ZEPHYR_FD_READ] + 1, &rfds, NULL, NULL, &tv)) {
-		selected = 1;
-		if (read(zephyr->fromtzc[ZEPHYR_FD_READ], bufcur, 1) != 1) {
-			purple_debug_error("zephyr", "couldn't read\n");
-			purple_connection_error(purple_account_get_connection(zephyr->account), "couldn't read");
-			free(buf);
-			return NULL;
-		}
-		bufcur++;
-		if ((bufcur - buf) > (bufsize - 1)) {
-			if ((buf = realloc(buf, bufsize * 2)) == NULL) {
-				purple_debug_error("zephyr","Ran out of memory\n");
-				exit(-1);
-			} else {
-				bufcur = buf + bufsize;
-				bufsize *= 2;
+/*
+ * Return the length of the first complete s-expression in buf, counting
+ * anything in front of it, or 0 if tzc hasn't sent all of one yet.
+ */
+static gsize tzc_sexp_length(const char *buf, gsize len)
+{
+	gsize i;
+	int nesting = 0;
+	gboolean in_quote = FALSE, escape_next = FALSE;
+
+	for (i = 0; i < len; i++) {
+		if (escape_next) {
+			escape_next = FALSE;
+		} else if (buf[i] == '\\') {
+			escape_next = TRUE;
+		} else if (buf[i] == '"') {
+			in_quote = !in_quote;
+		} else if (!in_quote) {
+			if (buf[i] == '(') {
+				nesting++;
+			} else if (buf[i] == ')' && nesting > 0 && --nesting == 0) {
+				return i + 1;
 			}
 		}
 	}
-	*bufcur = '\0';
 
-	if (selected) {
-		incoming_msg = parse_buffer(buf,TRUE);
-	}
-	free(buf);
-	return incoming_msg;
+	return 0;
 }
 
-static gint check_notify_tzc(gpointer data)
+static void handle_tzc_spew(PurpleConnection *gc, parse_tree *newparsetree)
 {
-	PurpleConnection *gc = (PurpleConnection *)data;
 	zephyr_account* zephyr = gc->proto_data;
-	parse_tree *newparsetree = read_from_tzc(zephyr);
 	if (newparsetree != NULL) {
 		gchar *spewtype;
 		if ( (spewtype =  tree_child(find_node(newparsetree,"tzcspew"),2)->contents) ) {
@@ -1214,22 +1218,60 @@ static gint check_notify_tzc(gpointer data)
 			}
 		}
 	}
+}
 
-	free_parse_tree(newparsetree);
-	g_free(newparsetree);
-	return TRUE;
+static void zephyr_tzc_input_cb(gpointer data, gint source, PurpleInputCondition cond)
+{
+	PurpleConnection *gc = (PurpleConnection *)data;
+	zephyr_account* zephyr = gc->proto_data;
+	char buf[4096];
+	gssize len;
+	gsize msglen;
+
+	len = read(source, buf, sizeof(buf));
+	if (len < 0 && errno == EAGAIN)
+		return;
+	if (len <= 0) {
+		purple_debug_error("zephyr", "couldn't read\n");
+		purple_input_remove(zephyr->notify_input);
+		zephyr->notify_input = 0;
+		purple_connection_error(gc, "couldn't read");
+		return;
+	}
+
+	g_string_append_len(zephyr->tzc_buf, buf, len);
+
+	/* Handle every message that has arrived in full; the rest waits for
+	 * more input. */
+	while ((msglen = tzc_sexp_length(zephyr->tzc_buf->str, zephyr->tzc_buf->len)) > 0) {
+		gchar *msg = g_strndup(zephyr->tzc_buf->str, msglen);
+		parse_tree *newparsetree;
+
+		g_string_erase(zephyr->tzc_buf, 0, msglen);
+
+		newparsetree = parse_buffer(msg, TRUE);
+		g_free(msg);
+
+		handle_tzc_spew(gc, newparsetree);
+		free_parse_tree(newparsetree);
+		g_free(newparsetree);
+	}
 }
 
-static gint check_notify_zeph02(gpointer data)
+/* Handle what libzephyr has queued, up to a batch at a time. */
+static void zephyr_notify_drain(PurpleConnection *gc)
 {
-	/* XXX add real error reporting */
-	PurpleConnection *gc = (PurpleConnection*) data;
-	while (ZPending()) {
+	zephyr_account* zephyr = gc->proto_data;
+	int handled = 0;
+
+	while (handled < ZEPHYR_NOTICE_BATCH && ZPending() > 0) {
 		ZNotice_t notice;
 		struct sockaddr_in from;
 		/* XXX add real error reporting */
 
-		z_call_r(ZReceiveNotice(&notice, &from));
+		if (ZReceiveNotice(&notice, &from) != ZERR_NONE)
+			break;
+		handled++;
 
 		switch (notice.z_kind) {
 		case UNSAFE:
@@ -1256,7 +1298,25 @@ static gint check_notify_zeph02(gpointer data)
 		ZFreeNotice(&notice);
 	}
 
-	return TRUE;
+	/* Let the rest of the main loop run before finishing a large backlog. */
+	if (handled == ZEPHYR_NOTICE_BATCH)
+		zephyr_check_queue(zephyr);
+}
+
+static gboolean zephyr_notify_drain_cb(gpointer data)
+{
+	PurpleConnection *gc = (PurpleConnection *)data;
+	zephyr_account* zephyr = gc->proto_data;
+
+	zephyr->notify_drain = 0;
+	zephyr_notify_drain(gc);
+
+	return FALSE;
+}
+
+static void zephyr_notify_input_cb(gpointer data, gint source, PurpleInputCondition cond)
+{
+	zephyr_notify_drain((PurpleConnection *)data);
 }
 
 #ifdef WIN32
@@ -1348,6 +1408,7 @@ static gint check_loc(gpointer data)
 				g_free(zlocstr);
 			}
 	}
+	zephyr_check_queue(zephyr);
 
 	return TRUE;
 }
@@ -1858,9 +1919,15 @@ static void zephyr_login(PurpleAccount * account)
 		process_zsubs(zephyr);
 
 	if (use_zeph02(zephyr)) {
-		zephyr->nottimer = purple_timeout_add(100, check_notify_zeph02, gc);
+		zephyr->notify_input = purple_input_add(ZGetFD(), PURPLE_INPUT_READ,
+		                                        zephyr_notify_input_cb, gc);
+		/* Anything that came in while we were subscribing */
+		zephyr_check_queue(zephyr);
 	} else if (use_tzc(zephyr)) {
-		zephyr->nottimer = purple_timeout_add(100, check_notify_tzc, gc);
+		zephyr->tzc_buf = g_string_new(NULL);
+		zephyr->notify_input = purple_input_add(zephyr->fromtzc[ZEPHYR_FD_READ],
+		                                        PURPLE_INPUT_READ,
+		                                        zephyr_tzc_input_cb, gc);
 	}
 	zephyr->loctimer = purple_timeout_add_seconds(20, check_loc, gc);
 
@@ -1988,9 +2055,15 @@ static void zephyr_close(PurpleConnection * gc)
 	}
 	g_slist_free(zephyr->subscrips);
 
-	if (zephyr->nottimer)
-		purple_timeout_remove(zephyr->nottimer);
-	zephyr->nottimer = 0;
+	if (zephyr->notify_input)
+		purple_input_remove(zephyr->notify_input);
+	zephyr->notify_input = 0;
+	if (zephyr->notify_drain)
+		purple_timeout_remove(zephyr->notify_drain);
+	zephyr->notify_drain = 0;
+	if (zephyr->tzc_buf)
+		g_string_free(zephyr->tzc_buf, TRUE);
+	zephyr->tzc_buf = NULL;
 	if (zephyr->loctimer)
 		purple_timeout_remove(zephyr->loctimer);
 	zephyr->loctimer = 0;
@@ -2197,6 +2270,7 @@ static int zephyr_send_message(zephyr_account *zephyr,char* zclass, char* instan
 			g_free(html_buf);
 			return 0;
 		}
+		zephyr_check_queue(zephyr);
 		purple_debug_info("zephyr","notice sent\n");
 		g_free(buf);
 	}
@@ -2259,6 +2333,7 @@ static void zephyr_zloc(PurpleConnection *gc, const char *who)
 		if (ZRequestLocations(normalized_who, &ald, UNACKED, ZAUTH) == ZERR_NONE) {
 			zephyr->pending_zloc_names = g_list_append(zephyr->pending_zloc_names,
 								   g_strdup(normalized_who));
+			zephyr_check_queue(zephyr);
 		} else {
 			/* XXX deal with errors somehow */
 		}
@@ -2293,6 +2368,7 @@ static void zephyr_set_status(PurpleAccount *account, PurpleStatus *status) {
 	else if (primitive == PURPLE_STATUS_AVAILABLE) {
 		if (use_zeph02(zephyr)) {
 			ZSetLocation(zephyr->exposure);
+			zephyr_check_queue(zephyr);
 		}
 		else {
 			char *zexpstr = g_strdup_printf("((tzcfodder . set-location) (hostname . \"%s\") (exposure . \"%s\"))\n",zephyr->ourhost,zephyr->exposure);
@@ -2308,6 +2384,7 @@ static void zephyr_set_status(PurpleAccount *account, PurpleStatus *status) {
 		/* XXX handle errors */
 		if (use_zeph02(zephyr)) {
 			ZSetLocation(EXPOSE_OPSTAFF);
+			zephyr_check_queue(zephyr);
 		} else {
 			char *zexpstr = g_strdup_printf("((tzcfodder . set-location) (hostname . \"%s\") (exposure . \"%s\"))\n",zephyr->ourhost,EXPOSE_OPSTAFF);
 			len = strlen(zexpstr);
@@ -2818,6 +2895,7 @@ static void zephyr_action_get_subs_from_server(PurplePluginAction *action)
 					       subs.zsub_class, subs.zsub_classinst,
 					       subs.zsub_recipient);
 		}
+		zephyr_check_queue(zephyr);
 
 		if (retval == ZERR_NONE) {
 			gchar *title = g_strdup_printf("Server subscriptions for %s", zephyr->username);
@@ -80,6 +80,14 @@ struct _PurplePresence
 
 	PurpleStatus *active_status;
 
+	/*
+	 * The presence's score from its active statuses and idleness, which
+	 * is what purple_presence_compare() ranks presences by.  It's only
+	 * recomputed when score_serial no longer matches the global one.
+	 */
+	int score;
+	guint score_serial;
+
 	union
 	{
 		PurpleAccount *account;
@@ -148,6 +156,21 @@ static int primitive_scores[] =
 #define SCORE_IDLE_TIME 10
 #define SCORE_OFFLINE_MESSAGE 11
 
+/*
+ * Bumped whenever something every presence's score depends on changes:
+ * the score weights, or which accounts are connected (and so which
+ * buddies can get offline messages).  Presences reset their own copy to
+ * 0 when their statuses or idleness change.
+ */
+static guint score_serial = 1;
+
+void
+_purple_presence_scores_changed(void)
+{
+	if (++score_serial == 0)
+		score_serial = 1;
+}
+
 /**************************************************************************
  * PurpleStatusPrimitive API
  **************************************************************************/
@@ -688,6 +711,7 @@ status_has_changed(PurpleStatus *status)
 	PurpleStatus *old_status;
 
 	presence   = purple_status_get_presence(status);
+	presence->score_serial = 0;
 
 	/*
 	 * If this status is exclusive, then we must be setting it to "active."
@@ -1190,6 +1214,7 @@ purple_presence_add_status(PurplePresence *presence, PurpleStatus *status)
 	g_return_if_fail(status   != NULL);
 
 	presence->statuses = g_list_append(presence->statuses, status);
+	presence->score_serial = 0;
 
 	g_hash_table_insert(presence->status_table,
 	g_strdup(purple_status_get_id(status)), status);
@@ -1296,7 +1321,7 @@ update_buddy_idle(PurpleBuddy *buddy, PurplePresence *presence,
 		purple_signal_emit(purple_blist_get_handle(), "buddy-idle-changed", buddy,
 		                 old_idle, idle);
 
-	purple_contact_invalidate_priority_buddy(purple_buddy_get_contact(buddy));
+	_purple_contact_buddy_presence_changed(buddy);
 
 	/* Should this be done here? It'd perhaps make more sense to
 	 * connect to buddy-[un]idle signals and update from there
@@ -1320,6 +1345,7 @@ purple_presence_set_idle(PurplePresence *presence, gboolean idle, time_t idle_ti
 	old_idle            = presence->idle;
 	presence->idle      = idle;
 	presence->idle_time = (idle ? idle_time : 0);
+	presence->score_serial = 0;
 
 	current_time = time(NULL);
 
@@ -1575,6 +1601,9 @@ purple_presence_compute_score(const PurplePresence *presence)
 	GList *l;
 	int score = 0;
 
+	if (presence->score_serial == score_serial)
+		return presence->score;
+
 	for (l = purple_presence_get_statuses(presence); l != NULL; l = l->next) {
 		PurpleStatus *status = (PurpleStatus *)l->data;
 		PurpleStatusType *type = purple_status_get_type(status);
@@ -1588,9 +1617,12 @@ purple_presence_compute_score(const PurplePresence *presence)
 			}
 		}
 	}
-	score += purple_account_get_int(purple_presence_get_account(presence), "score", 0);
 	if (purple_presence_is_idle(presence))
 		score += primitive_scores[SCORE_IDLE];
+
+	((PurplePresence *)presence)->score = score;
+	((PurplePresence *)presence)->score_serial = score_serial;
+
 	return score;
 }
 
@@ -1621,6 +1653,12 @@ purple_presence_compare(const PurplePresence *presence1,
 	/* Compute the score of the second set of statuses. */
 	score2 = purple_presence_compute_score(presence2);
 
+	/* The per-account weights from the Contact Priority plugin are plain
+	 * account settings, with nothing to say when they change, so they're
+	 * looked up each time rather than kept in the score. */
+	score1 += purple_account_get_int(purple_presence_get_account(presence1), "score", 0);
+	score2 += purple_account_get_int(purple_presence_get_account(presence2), "score", 0);
+
 	idle_time_1 = time(NULL) - purple_presence_get_idle_time(presence1);
 	idle_time_2 = time(NULL) - purple_presence_get_idle_time(presence2);
 
@@ -1646,8 +1684,23 @@ score_pref_changed_cb(const char *name, PurplePrefType type,
 					  gconstpointer value, gpointer data)
 {
 	int index = GPOINTER_TO_INT(data);
+	PurpleBlistNode *gnode, *cnode;
 
 	primitive_scores[index] = GPOINTER_TO_INT(value);
+	_purple_presence_scores_changed();
+
+	/* Contacts only check changed buddies against their priority buddy,
+	 * which the new weights may well have put behind another one. */
+	for (gnode = purple_blist_get_root(); gnode;
+			gnode = purple_blist_node_get_sibling_next(gnode)) {
+		if (!PURPLE_BLIST_NODE_IS_GROUP(gnode))
+			continue;
+		for (cnode = purple_blist_node_get_first_child(gnode); cnode;
+				cnode = purple_blist_node_get_sibling_next(cnode)) {
+			if (PURPLE_BLIST_NODE_IS_CONTACT(cnode))
+				purple_contact_invalidate_priority_buddy((PurpleContact *)cnode);
+		}
+	}
 }
 
 void *
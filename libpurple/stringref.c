@@ -55,10 +55,21 @@ struct _PurpleStringref {
 					 *   is to save an allocation. */
 };
 
-#define REFCOUNT(x) ((x) & 0x7fffffff)
+#define REFCOUNT(x) ((x) & 0x3fffffff)
+#define STRINGREF_GC     0x80000000	/**< Queued on gclist */
+#define STRINGREF_ATOM   0x40000000	/**< Owned by the intern table */
+
+#define ATOM_TO_STRINGREF(atom) \
+	((PurpleStringref *)((atom) - G_STRUCT_OFFSET(PurpleStringref, value)))
 
 static GList *gclist = NULL;
 
+/**
+ * The intern table.  The key is the value of the stringref it maps to,
+ * so it lives exactly as long as the entry does.
+ */
+static GHashTable *atoms = NULL;
+
 static void stringref_free(PurpleStringref *stringref);
 static gboolean gs_idle_cb(gpointer data);
 
@@ -90,7 +101,7 @@ PurpleStringref *purple_stringref_new_noref(const char *value)
 
 	newref = g_malloc(sizeof(PurpleStringref) + strlen(value));
 	strcpy(newref->value, value);
-	newref->ref = 0x80000000;
+	newref->ref = STRINGREF_GC;
 
 	if (gclist == NULL)
 		purple_timeout_add(0, gs_idle_cb, NULL);
@@ -129,7 +140,7 @@ void purple_stringref_unref(PurpleStringref *stringref)
 	if (stringref == NULL)
 		return;
 	if (REFCOUNT(--(stringref->ref)) == 0) {
-		if (stringref->ref & 0x80000000)
+		if (stringref->ref & STRINGREF_GC)
 			gclist = g_list_remove(gclist, stringref);
 		stringref_free(stringref);
 	}
@@ -150,6 +161,74 @@ size_t purple_stringref_len(const PurpleStringref *stringref)
 	return strlen(purple_stringref_value(stringref));
 }
 
+const char *purple_stringref_intern(const char *value)
+{
+	PurpleStringref *ref;
+
+	if (value == NULL)
+		return NULL;
+
+	if (atoms == NULL)
+		atoms = g_hash_table_new(g_str_hash, g_str_equal);
+
+	ref = g_hash_table_lookup(atoms, value);
+	if (ref != NULL) {
+		/* This may revive an atom that is waiting on the gclist; the
+		 * idle callback only frees atoms that are still unreferenced. */
+		ref->ref++;
+		return ref->value;
+	}
+
+	ref = purple_stringref_new(value);
+	ref->ref |= STRINGREF_ATOM;
+	g_hash_table_insert(atoms, ref->value, ref);
+
+	return ref->value;
+}
+
+const char *purple_stringref_intern_ref(const char *atom)
+{
+	if (atom == NULL)
+		return NULL;
+
+	ATOM_TO_STRINGREF(atom)->ref++;
+	return atom;
+}
+
+void purple_stringref_intern_unref(const char *atom)
+{
+	PurpleStringref *ref;
+
+	if (atom == NULL)
+		return;
+
+	ref = ATOM_TO_STRINGREF(atom);
+
+#ifdef DEBUG
+	if (!(ref->ref & STRINGREF_ATOM) || REFCOUNT(ref->ref) == 0 ||
+			g_hash_table_lookup(atoms, atom) != ref) {
+		purple_debug_error("stringref", "Unref of non-interned string %s!\n", atom);
+		return;
+	}
+#endif /* DEBUG */
+
+	if (REFCOUNT(--(ref->ref)) != 0 || (ref->ref & STRINGREF_GC))
+		return;
+
+	/* Defer the free so that dropping a whole buddy list (or an atom
+	 * that is about to be interned again) costs one idle pass instead
+	 * of a hash table removal per reference. */
+	ref->ref |= STRINGREF_GC;
+	if (gclist == NULL)
+		purple_timeout_add(0, gs_idle_cb, NULL);
+	gclist = g_list_prepend(gclist, ref);
+}
+
+guint purple_stringref_intern_count(void)
+{
+	return (atoms == NULL ? 0 : g_hash_table_size(atoms));
+}
+
 static void stringref_free(PurpleStringref *stringref)
 {
 #ifdef DEBUG
@@ -158,6 +237,8 @@ static void stringref_free(PurpleStringref *stringref)
 		return;
 	}
 #endif /* DEBUG */
+	if (stringref->ref & STRINGREF_ATOM)
+		g_hash_table_remove(atoms, stringref->value);
 	g_free(stringref);
 }
 
@@ -170,6 +251,10 @@ static gboolean gs_idle_cb(gpointer data)
 		ref = gclist->data;
 		if (REFCOUNT(ref->ref) == 0) {
 			stringref_free(ref);
+		} else {
+			/* Revived before we got to it; it must be queued again
+			 * the next time it drops to zero. */
+			ref->ref &= ~STRINGREF_GC;
 		}
 		del = gclist;
 		gclist = gclist->next;
@@ -29,6 +29,8 @@
 #ifndef _PURPLE_STRINGREF_H_
 #define _PURPLE_STRINGREF_H_
 
+#include <glib.h>
+
 #ifdef __cplusplus
 extern "C" {
 #endif
@@ -131,6 +133,58 @@ int purple_stringref_cmp(const PurpleStringref *s1, const PurpleStringref *s2);
  */
 size_t purple_stringref_len(const PurpleStringref *stringref);
 
+/**
+ * Interns a string, returning a shared, immutable atom for its value.
+ * Every call with an equal string returns the same pointer, so two
+ * atoms can be compared for equality with <tt>==</tt>.  Each call adds
+ * a reference to the atom, which must be released with
+ * purple_stringref_intern_unref().
+ *
+ * Atoms whose last reference is dropped are not freed immediately;
+ * they are released in bulk from an idle callback, and an atom that is
+ * interned again before then is simply revived.
+ *
+ * @param value The string to intern.
+ *
+ * @return The atom for @a value, or @c NULL if @a value is @c NULL.
+ *
+ * @since 2.15.0
+ */
+const char *purple_stringref_intern(const char *value);
+
+/**
+ * Adds a reference to an atom returned by purple_stringref_intern().
+ *
+ * @param atom The atom to reference.
+ *
+ * @return @a atom.
+ *
+ * @since 2.15.0
+ */
+const char *purple_stringref_intern_ref(const char *atom);
+
+/**
+ * Releases a reference to an atom returned by purple_stringref_intern()
+ * or purple_stringref_intern_ref().  The atom MUST NOT be used after
+ * its last reference is released.
+ *
+ * @param atom The atom to release.  Passing a string that was not
+ *             obtained from purple_stringref_intern() is an error.
+ *
+ * @since 2.15.0
+ */
+void purple_stringref_intern_unref(const char *atom);
+
+/**
+ * Returns the number of distinct atoms currently interned, including
+ * those waiting to be released by the idle collector.
+ *
+ * @return The number of interned atoms.
+ *
+ * @since 2.15.0
+ */
+guint purple_stringref_intern_count(void);
+
 #ifdef __cplusplus
 }
 #endif
@@ -0,0 +1,706 @@
+/*
+ * bosh_standin - a tiny local BOSH connection manager for benchmarking
+ *
+ * Purple is the legal property of its developers, whose names are too numerous
+ * to list here.  Please refer to the COPYRIGHT file distributed with this
+ * source distribution.
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02111-1301  USA
+ */
+
+/*
+ * This stands in for both the BOSH connection manager and the XMPP server,
+ * with just enough of each to get a libpurple account logged in: any
+ * username and password are accepted over SASL PLAIN, and IQs are answered
+ * with empty results.
+ *
+ * Once the session is bound it pings the client (XEP-0199) every interval
+ * and times how long each reply takes to come back. That round trip goes
+ * through the client's whole BOSH send path, so it shows any batching
+ * delay there, and prints min/avg/max when done.
+ *
+ * Messages sent to any JID are echoed back from that JID.
+ *
+ * Usage: bosh_standin [-p port] [-n pings] [-i interval_ms]
+ * then point an XMPP account's BOSH URL at http://127.0.0.1:port/http-bind
+ *
+ * It only uses POSIX, so it builds without the rest of the tree:
+ *   cc -o bosh_standin bosh_standin.c
+ */
+#include <ctype.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <netinet/in.h>
+#include <poll.h>
+#include <stdarg.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <sys/time.h>
+#include <unistd.h>
+
+#define MAX_CLIENTS 16
+#define MAX_PINGS   10000
+#define NS_BOSH     "http://jabber.org/protocol/httpbind"
+
+typedef struct {
+	char *data;
+	size_t len;
+	size_t size;
+} Buffer;
+
+typedef struct _Request Request;
+typedef struct _Client Client;
+
+struct _Request {
+	Client *client;
+	Request *next;       /* in the client's pipeline */
+	Request *next_held;  /* in the session's held list */
+	double arrived;
+	Buffer response;
+	int answered;
+};
+
+struct _Client {
+	int fd;
+	Buffer in;
+	Buffer out;
+	Request *head, *tail;
+};
+
+static Client *clients[MAX_CLIENTS];
+
+static struct {
+	int active;
+	int bound;
+	int hold;
+	int wait;
+	char jid[256];
+	Buffer outq;                 /* stanzas waiting for a held request */
+	Request *held, *held_tail;
+	int nheld;
+} session;
+
+static struct {
+	int count;
+	int interval;
+	unsigned sent;
+	unsigned received;
+	double sent_at[MAX_PINGS];
+	double last;
+	double min, max, total;
+} bench;
+
+static double
+now_ms(void)
+{
+	struct timeval tv;
+
+	gettimeofday(&tv, NULL);
+	return tv.tv_sec * 1000.0 + tv.tv_usec / 1000.0;
+}
+
+static void
+buffer_append(Buffer *buf, const char *data, size_t len)
+{
+	if (buf->len + len + 1 > buf->size) {
+		buf->size = (buf->len + len + 1) * 2;
+		buf->data = realloc(buf->data, buf->size);
+		if (buf->data == NULL) {
+			perror("realloc");
+			exit(1);
+		}
+	}
+	memcpy(buf->data + buf->len, data, len);
+	buf->len += len;
+	buf->data[buf->len] = '\0';
+}
+
+static void
+buffer_printf(Buffer *buf, const char *format, ...)
+{
+	char tmp[4096];
+	va_list args;
+	int len;
+
+	va_start(args, format);
+	len = vsnprintf(tmp, sizeof(tmp), format, args);
+	va_end(args);
+
+	if (len > 0)
+		buffer_append(buf, tmp, (size_t)len < sizeof(tmp) ? (size_t)len : sizeof(tmp) - 1);
+}
+
+static void
+buffer_consume(Buffer *buf, size_t len)
+{
+	memmove(buf->data, buf->data + len, buf->len - len);
+	buf->len -= len;
+	if (buf->data)
+		buf->data[buf->len] = '\0';
+}
+
+/* Copy the value of attribute name from the start tag at tag into value */
+static int
+get_attr(const char *tag, const char *tag_end, const char *name,
+         char *value, size_t size)
+{
+	size_t namelen = strlen(name);
+	const char *p;
+
+	for (p = tag; p + namelen + 2 < tag_end; p++) {
+		const char *start, *end;
+		char quote;
+
+		if (!isspace((unsigned char)p[0]) || strncmp(p + 1, name, namelen) ||
+				p[namelen + 1] != '=')
+			continue;
+
+		quote = p[namelen + 2];
+		if (quote != '\'' && quote != '"')
+			continue;
+
+		start = p + namelen + 3;
+		end = memchr(start, quote, tag_end - start);
+		if (end == NULL)
+			return 0;
+
+		if ((size_t)(end - start) >= size)
+			return 0;
+		memcpy(value, start, end - start);
+		value[end - start] = '\0';
+		return 1;
+	}
+
+	return 0;
+}
+
+/* Find the end of the tag starting at p, skipping over quoted attributes */
+static const char *
+tag_end(const char *p, const char *end)
+{
+	char quote = 0;
+
+	for (; p < end; p++) {
+		if (quote) {
+			if (*p == quote)
+				quote = 0;
+		} else if (*p == '\'' || *p == '"') {
+			quote = *p;
+		} else if (*p == '>') {
+			return p;
+		}
+	}
+
+	return NULL;
+}
+
+static void
+deliver(void);
+
+static void
+queue_stanza(const char *format, ...)
+{
+	char tmp[4096];
+	va_list args;
+	int len;
+
+	va_start(args, format);
+	len = vsnprintf(tmp, sizeof(tmp), format, args);
+	va_end(args);
+
+	if (len > 0 && (size_t)len < sizeof(tmp))
+		buffer_append(&session.outq, tmp, len);
+}
+
+static void
+handle_iq(const char *stanza, const char *stag_end, const char *end)
+{
+	char id[128], type[16], child[64], xmlns[256];
+	const char *c, *cend;
+
+	if (!get_attr(stanza, stag_end, "id", id, sizeof(id)) ||
+			!get_attr(stanza, stag_end, "type", type, sizeof(type)))
+		return;
+
+	if (!strcmp(type, "result") || !strcmp(type, "error")) {
+		unsigned seq;
+
+		if (sscanf(id, "bench%u", &seq) == 1 && seq < bench.sent &&
+				bench.sent_at[seq] > 0) {
+			double rtt = now_ms() - bench.sent_at[seq];
+
+			bench.sent_at[seq] = 0;
+			bench.received++;
+			bench.total += rtt;
+			if (bench.received == 1 || rtt < bench.min)
+				bench.min = rtt;
+			if (rtt > bench.max)
+				bench.max = rtt;
+			printf("ping %u: %.1f ms\n", seq, rtt);
+		}
+		return;
+	}
+
+	/* The first child element says what's being asked for */
+	child[0] = xmlns[0] = '\0';
+	for (c = stag_end + 1; c < end && *c != '<'; c++)
+		;
+	if (c < end && c[1] != '/' && (cend = tag_end(c, end)) != NULL) {
+		size_t n = strcspn(c + 1, " \t\r\n/>");
+
+		if (n < sizeof(child)) {
+			memcpy(child, c + 1, n);
+			child[n] = '\0';
+		}
+		get_attr(c, cend, "xmlns", xmlns, sizeof(xmlns));
+	}
+
+	if (!strcmp(child, "bind")) {
+		char resource[128];
+		const char *r = strstr(stanza, "<resource>");
+
+		if (r == NULL || r > end ||
+				sscanf(r, "<resource>%127[^<]", resource) != 1)
+			strcpy(resource, "standin");
+
+		snprintf(session.jid, sizeof(session.jid), "bench@localhost/%s",
+		         resource);
+		queue_stanza("<iq type='result' id='%s'><bind xmlns='%s'>"
+		             "<jid>%s</jid></bind></iq>", id, xmlns, session.jid);
+		session.bound = 1;
+		bench.last = now_ms();
+	} else if (!strcmp(type, "get") && *child) {
+		/* An empty answer is a fine answer to roster, disco, vCard... */
+		queue_stanza("<iq type='result' id='%s'><%s xmlns='%s'/></iq>",
+		             id, child, xmlns);
+	} else {
+		queue_stanza("<iq type='result' id='%s'/>", id);
+	}
+}
+
+static void
+handle_message(const char *stanza, const char *stag_end, const char *end)
+{
+	char to[256];
+	const char *body = strstr(stanza, "<body>");
+	const char *body_end = strstr(stanza, "</body>");
+
+	if (!get_attr(stanza, stag_end, "to", to, sizeof(to)) ||
+			body == NULL || body_end == NULL || body_end > end)
+		return;
+
+	body += strlen("<body>");
+	queue_stanza("<message type='chat' from='%s' to='%s'><body>%.*s</body>"
+	             "</message>", to, session.jid, (int)(body_end - body), body);
+}
+
+/* Split the children of a <body/> into stanzas and handle each one */
+static void
+handle_stanzas(const char *p, const char *end)
+{
+	while (p < end) {
+		const char *stanza, *stag_end, *e;
+		int depth = 0;
+
+		stanza = memchr(p, '<', end - p);
+		if (stanza == NULL || !strncmp(stanza, "</body", 6))
+			return;
+
+		stag_end = tag_end(stanza, end);
+		if (stag_end == NULL)
+			return;
+
+		/* Walk to the matching end tag */
+		for (e = stanza; e && e < end; ) {
+			const char *te = tag_end(e, end);
+
+			if (te == NULL)
+				return;
+			if (e[1] == '/')
+				depth--;
+			else if (te[-1] != '/')
+				depth++;
+			e = te + 1;
+			if (depth == 0)
+				break;
+			e = memchr(e, '<', end - e);
+		}
+		if (e == NULL)
+			return;
+
+		if (!strncmp(stanza, "<auth", 5))
+			queue_stanza("<success xmlns='urn:ietf:params:xml:ns:xmpp-sasl'/>");
+		else if (!strncmp(stanza, "<iq", 3))
+			handle_iq(stanza, stag_end, e);
+		else if (!strncmp(stanza, "<message", 8))
+			handle_message(stanza, stag_end, e);
+
+		p = e;
+	}
+}
+
+static void
+client_flush(Client *client)
+{
+	while (client->head && client->head->answered) {
+		Request *req = client->head;
+
+		buffer_append(&client->out, req->response.data, req->response.len);
+		client->head = req->next;
+		if (client->head == NULL)
+			client->tail = NULL;
+		free(req->response.data);
+		free(req);
+	}
+
+	while (client->out.len > 0) {
+		ssize_t ret = write(client->fd, client->out.data, client->out.len);
+
+		if (ret <= 0)
+			break;
+		buffer_consume(&client->out, ret);
+	}
+}
+
+static void
+respond(Request *req, const char *attrs, const char *payload, size_t len)
+{
+	Buffer body = { NULL, 0, 0 };
+
+	buffer_printf(&body, "<body xmlns='" NS_BOSH "' "
+	              "xmlns:xmpp='urn:xmpp:xbosh'%s>", attrs);
+	buffer_append(&body, payload, len);
+	buffer_printf(&body, "</body>");
+
+	buffer_printf(&req->response, "HTTP/1.1 200 OK\r\n"
+	              "Content-Type: text/xml; charset=utf-8\r\n"
+	              "Content-Length: %lu\r\n\r\n", (unsigned long)body.len);
+	buffer_append(&req->response, body.data, body.len);
+	free(body.data);
+
+	req->answered = 1;
+	if (req->client)
+		client_flush(req->client);
+}
+
+static Request *
+pop_held(void)
+{
+	Request *req = session.held;
+
+	if (req) {
+		session.held = req->next_held;
+		if (session.held == NULL)
+			session.held_tail = NULL;
+		session.nheld--;
+	}
+
+	return req;
+}
+
+/*
+ * Hand queued stanzas to the oldest held request, and never hold on to
+ * more requests than we told the client we would.
+ */
+static void
+deliver(void)
+{
+	while (session.held &&
+			(session.outq.len > 0 || session.nheld > session.hold)) {
+		Request *req = pop_held();
+
+		respond(req, "", session.outq.data ? session.outq.data : "",
+		        session.outq.len);
+		session.outq.len = 0;
+	}
+}
+
+static void
+handle_request(Request *req, const char *body, size_t len)
+{
+	const char *end = body + len;
+	const char *stag_end = tag_end(body, end);
+	char sid[64], value[32];
+
+	if (stag_end == NULL || strncmp(body, "<body", 5)) {
+		respond(req, " type='terminate' condition='bad-request'", "", 0);
+		return;
+	}
+
+	if (!get_attr(body, stag_end, "sid", sid, sizeof(sid))) {
+		char attrs[512];
+
+		/* Session creation: one session at a time is all we need */
+		while (pop_held())
+			;
+		memset(&session, 0, sizeof(session));
+		session.active = 1;
+		session.hold = 1;
+		session.wait = 60;
+		if (get_attr(body, stag_end, "wait", value, sizeof(value)) &&
+				atoi(value) < session.wait)
+			session.wait = atoi(value);
+
+		snprintf(attrs, sizeof(attrs), " sid='standin%ld' wait='%d' "
+		         "requests='2' hold='%d' ver='1.6' inactivity='60' "
+		         "polling='5' from='localhost' xmpp:version='1.0' "
+		         "xmlns:stream='http://etherx.jabber.org/streams'",
+		         (long)getpid(), session.wait, session.hold);
+		respond(req, attrs, "<stream:features><mechanisms "
+		        "xmlns='urn:ietf:params:xml:ns:xmpp-sasl'>"
+		        "<mechanism>PLAIN</mechanism></mechanisms></stream:features>",
+		        strlen("<stream:features><mechanisms "
+		        "xmlns='urn:ietf:params:xml:ns:xmpp-sasl'>"
+		        "<mechanism>PLAIN</mechanism></mechanisms></stream:features>"));
+		return;
+	}
+
+	if (!session.active) {
+		respond(req, " type='terminate' condition='item-not-found'", "", 0);
+		return;
+	}
+
+	if (get_attr(body, stag_end, "type", value, sizeof(value)) &&
+			!strcmp(value, "terminate")) {
+		while (session.held)
+			respond(pop_held(), "", "", 0);
+		respond(req, " type='terminate'", "", 0);
+		session.active = session.bound = 0;
+		return;
+	}
+
+	if (get_attr(body, stag_end, "xmpp:restart", value, sizeof(value)))
+		queue_stanza("<stream:features><bind "
+		             "xmlns='urn:ietf:params:xml:ns:xmpp-bind'/><session "
+		             "xmlns='urn:ietf:params:xml:ns:xmpp-session'/>"
+		             "</stream:features>");
+	else if (stag_end[-1] != '/')
+		handle_stanzas(stag_end + 1, end);
+
+	if (session.held_tail)
+		session.held_tail->next_held = req;
+	else
+		session.held = req;
+	session.held_tail = req;
+	session.nheld++;
+
+	deliver();
+}
+
+static void
+client_close(int i)
+{
+	Client *client = clients[i];
+	Request *req, *held, **prev;
+
+	/* Forget its requests, including any the session is holding */
+	for (req = client->head; req; req = req->next) {
+		for (prev = &session.held; (held = *prev); prev = &held->next_held) {
+			if (held == req) {
+				*prev = held->next_held;
+				session.nheld--;
+				break;
+			}
+		}
+	}
+	session.held_tail = session.held;
+	while (session.held_tail && session.held_tail->next_held)
+		session.held_tail = session.held_tail->next_held;
+
+	while ((req = client->head)) {
+		client->head = req->next;
+		free(req->response.data);
+		free(req);
+	}
+
+	close(client->fd);
+	free(client->in.data);
+	free(client->out.data);
+	free(client);
+	clients[i] = NULL;
+}
+
+/* Pull every complete (possibly pipelined) request out of the input */
+static void
+client_read(int i)
+{
+	Client *client = clients[i];
+	char buf[4096];
+	ssize_t ret;
+
+	while ((ret = read(client->fd, buf, sizeof(buf))) > 0)
+		buffer_append(&client->in, buf, ret);
+
+	if (ret == 0 || (ret < 0 && errno != EAGAIN && errno != EWOULDBLOCK)) {
+		client_close(i);
+		return;
+	}
+
+	for (;;) {
+		char *headers_end, *cl;
+		size_t header_len, body_len = 0;
+		Request *req;
+
+		if (client->in.len == 0 ||
+				(headers_end = strstr(client->in.data, "\r\n\r\n")) == NULL)
+			return;
+
+		header_len = headers_end - client->in.data + 4;
+		for (cl = client->in.data; cl < headers_end; cl++) {
+			if (!strncasecmp(cl, "\r\nContent-Length:", 17)) {
+				body_len = strtoul(cl + 17, NULL, 10);
+				break;
+			}
+		}
+
+		if (client->in.len < header_len + body_len)
+			return;
+
+		req = calloc(1, sizeof(Request));
+		req->client = client;
+		req->arrived = now_ms();
+		if (client->tail)
+			client->tail->next = req;
+		else
+			client->head = req;
+		client->tail = req;
+
+		handle_request(req, client->in.data + header_len, body_len);
+		buffer_consume(&client->in, header_len + body_len);
+	}
+}
+
+static void
+tick(void)
+{
+	double now = now_ms();
+	Request *req;
+
+	/* Answer requests that have been held for 'wait' seconds */
+	while ((req = session.held) && now - req->arrived >= session.wait * 1000.0)
+		respond(pop_held(), "", "", 0);
+
+	if (!session.bound || bench.sent >= (unsigned)bench.count ||
+			now - bench.last < bench.interval)
+		return;
+
+	bench.last = now;
+	bench.sent_at[bench.sent] = now;
+	queue_stanza("<iq type='get' id='bench%u' from='localhost' to='%s'>"
+	             "<ping xmlns='urn:xmpp:ping'/></iq>", bench.sent, session.jid);
+	bench.sent++;
+	deliver();
+}
+
+int
+main(int argc, char *argv[])
+{
+	struct sockaddr_in addr;
+	int port = 5280, listener, opt, one = 1;
+
+	bench.count = 20;
+	bench.interval = 1000;
+
+	while ((opt = getopt(argc, argv, "p:n:i:")) != -1) {
+		switch (opt) {
+			case 'p':
+				port = atoi(optarg);
+				break;
+			case 'n':
+				bench.count = atoi(optarg);
+				if (bench.count > MAX_PINGS)
+					bench.count = MAX_PINGS;
+				break;
+			case 'i':
+				bench.interval = atoi(optarg);
+				break;
+			default:
+				fprintf(stderr, "Usage: %s [-p port] [-n pings] "
+				        "[-i interval_ms]\n", argv[0]);
+				return 1;
+		}
+	}
+
+	listener = socket(AF_INET, SOCK_STREAM, 0);
+	setsockopt(listener, SOL_SOCKET, SO_REUSEADDR, &one, sizeof(one));
+	memset(&addr, 0, sizeof(addr));
+	addr.sin_family = AF_INET;
+	addr.sin_port = htons(port);
+	addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+	if (bind(listener, (struct sockaddr *)&addr, sizeof(addr)) < 0 ||
+			listen(listener, 8) < 0) {
+		perror("bind");
+		return 1;
+	}
+
+	printf("BOSH stand-in listening on http://127.0.0.1:%d/http-bind\n", port);
+	fflush(stdout);
+
+	while (bench.received < (unsigned)bench.count) {
+		struct pollfd fds[MAX_CLIENTS + 1];
+		int map[MAX_CLIENTS + 1];
+		int n = 0, i;
+
+		fds[n].fd = listener;
+		fds[n].events = POLLIN;
+		map[n++] = -1;
+		for (i = 0; i < MAX_CLIENTS; i++) {
+			if (clients[i]) {
+				fds[n].fd = clients[i]->fd;
+				fds[n].events = POLLIN |
+						(clients[i]->out.len ? POLLOUT : 0);
+				map[n++] = i;
+			}
+		}
+
+		if (poll(fds, n, 50) < 0 && errno != EINTR) {
+			perror("poll");
+			return 1;
+		}
+
+		for (i = 1; i < n; i++) {
+			if (clients[map[i]] == NULL)
+				continue;
+			if (fds[i].revents & POLLOUT)
+				client_flush(clients[map[i]]);
+			if (fds[i].revents & (POLLIN | POLLHUP | POLLERR))
+				client_read(map[i]);
+		}
+
+		if (fds[0].revents & POLLIN) {
+			int fd = accept(listener, NULL, NULL);
+
+			for (i = 0; fd >= 0 && i < MAX_CLIENTS; i++) {
+				if (clients[i] == NULL) {
+					clients[i] = calloc(1, sizeof(Client));
+					clients[i]->fd = fd;
+					fcntl(fd, F_SETFL, fcntl(fd, F_GETFL) | O_NONBLOCK);
+					break;
+				}
+			}
+			if (fd >= 0 && i == MAX_CLIENTS)
+				close(fd);
+		}
+
+		tick();
+	}
+
+	printf("%u pings: min %.1f ms, avg %.1f ms, max %.1f ms\n",
+	       bench.received, bench.min, bench.total / bench.received, bench.max);
+
+	return 0;
+}
@@ -91,6 +91,8 @@ int main(void)
 	srunner_add_suite(sr, jabber_digest_md5_suite());
 	srunner_add_suite(sr, jabber_jutil_suite());
 	srunner_add_suite(sr, jabber_scram_suite());
+	srunner_add_suite(sr, log_suite());
+	srunner_add_suite(sr, stringref_suite());
 	srunner_add_suite(sr, util_suite());
 	srunner_add_suite(sr, xmlnode_suite());
 
@@ -0,0 +1,117 @@
+/*
+ * gg_userlist_gen - write a made up Gadu-Gadu buddylist file
+ *
+ * Purple is the legal property of its developers, whose names are too numerous
+ * to list here.  Please refer to the COPYRIGHT file distributed with this
+ * source distribution.
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02111-1301  USA
+ */
+
+/*
+ * This writes a buddylist in the format the Gadu-Gadu prpl exports and
+ * imports with "Load buddylist from file...": CP1250 text, one contact per
+ * CRLF-terminated line, with the fields
+ *
+ *   first;last;(unused);nick;phone;groups;uin;email...
+ *
+ * Names use Polish letters so the charset conversion is exercised, contacts
+ * are spread over a couple of dozen groups and a few lines are malformed or
+ * repeat an earlier UIN, as real exported lists do.  Load the file with the
+ * "gg" debug category on; the prpl logs how many buddies it added and how
+ * long that took.
+ *
+ * Usage: gg_userlist_gen [-n contacts] [-g groups] [-s seed] > list.txt
+ *
+ * It only uses the C library, so it builds without the rest of the tree:
+ *   cc -o gg_userlist_gen gg_userlist_gen.c
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+
+/* "Łukasz", "Małgorzata", ... in CP1250 */
+static const char *first_names[] = {
+	"Anna", "Pawe\xb3", "\xa3ukasz", "Ma\xb3gorzata", "Krzysztof",
+	"Agnieszka", "Micha\xb3", "Zofia", "Grzegorz", "El\xbf""bieta",
+	"Tomasz", "Katarzyna", "J\xf3zef", "Ma\xb3""gosia", "Wojciech",
+	"Barbara"
+};
+
+static const char *last_names[] = {
+	"Nowak", "Kowalski", "Wi\x9cniewska", "W\xf3jcik", "Kowalczyk",
+	"Kami\xf1ski", "Lewandowska", "Zieli\xf1ski", "Szyma\xf1ska",
+	"Wo\x9fniak", "D\xb9""browski", "Koz\xb3owska", "Jankowski",
+	"Mazur", "Krawczyk", "Pi\xb9tek"
+};
+
+#define N_FIRST (sizeof(first_names) / sizeof(first_names[0]))
+#define N_LAST (sizeof(last_names) / sizeof(last_names[0]))
+
+int
+main(int argc, char *argv[])
+{
+	unsigned long contacts = 20000, i;
+	unsigned groups = 24;
+	unsigned seed = 1;
+	int opt;
+
+	while ((opt = getopt(argc, argv, "n:g:s:")) != -1) {
+		switch (opt) {
+		case 'n':
+			contacts = strtoul(optarg, NULL, 10);
+			break;
+		case 'g':
+			groups = strtoul(optarg, NULL, 10);
+			break;
+		case 's':
+			seed = strtoul(optarg, NULL, 10);
+			break;
+		default:
+			fprintf(stderr, "Usage: %s [-n contacts] [-g groups] "
+					"[-s seed] > list.txt\n", argv[0]);
+			return 1;
+		}
+	}
+
+	if (groups == 0)
+		groups = 1;
+	srand(seed);
+
+	for (i = 0; i < contacts; i++) {
+		const char *first = first_names[rand() % N_FIRST];
+		const char *last = last_names[rand() % N_LAST];
+		unsigned long uin = 1000000 + i * 7;
+		int r = rand() % 100;
+
+		if (r == 0) {
+			/* Too few fields */
+			printf("%s;%s;;%s\r\n", first, last, first);
+			continue;
+		} else if (r == 1 && i > 0) {
+			/* Repeat an earlier contact */
+			uin = 1000000 + (rand() % i) * 7;
+		}
+
+		printf("%s;%s;%s %s;%s %.1s.;%s;Grupa %u%s;%lu;%s\r\n",
+				first, last, first, last, first, last,
+				r < 30 ? "+48 600 000 000" : "",
+				(unsigned)(rand() % groups),
+				r < 10 ? ",Znajomi" : "",
+				uin, r < 50 ? "kto\x9b@example.invalid" : "");
+	}
+
+	return 0;
+}
@@ -0,0 +1,510 @@
+/*
+ * irc_replay - a tiny local IRC server that replays channel traffic
+ *
+ * Purple is the legal property of its developers, whose names are too numerous
+ * to list here.  Please refer to the COPYRIGHT file distributed with this
+ * source distribution.
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02111-1301  USA
+ */
+
+/*
+ * This registers a single client, joins it to every channel the trace
+ * talks to, and then sends the whole trace as fast as the socket takes it,
+ * followed by a PING.  The client answers the PING only once it has parsed
+ * every line in front of it, so the time until the PONG comes back is the
+ * time the client took to get through the trace.  Each round is timed and
+ * min/avg/max lines per second are printed when done.
+ *
+ * A trace is just the lines a server sent, one per line, exactly as they
+ * appear after ">> " in the IRC debug output.  Without one, a busy channel
+ * is made up: mostly PRIVMSGs with a mix of ASCII, Latin-1 range and CJK
+ * text and mIRC colors, plus joins, parts, quits, nick and mode changes.
+ *
+ * Usage: irc_replay [-p port] [-t trace] [-g lines] [-n rounds]
+ * then point an IRC account at 127.0.0.1:port
+ *
+ * It only uses POSIX, so it builds without the rest of the tree:
+ *   cc -o irc_replay irc_replay.c
+ */
+#include <errno.h>
+#include <fcntl.h>
+#include <netinet/in.h>
+#include <poll.h>
+#include <stdarg.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <sys/time.h>
+#include <unistd.h>
+
+#define MAX_CHANNELS 64
+#define MAX_ROUNDS   1000
+#define NUM_USERS    60
+#define SERVER_NAME  "irc.replay.invalid"
+
+typedef struct {
+	char *data;
+	size_t len;
+	size_t size;
+} Buffer;
+
+static struct {
+	int fd;
+	Buffer in;
+	Buffer out;
+	char nick[64];
+	int got_user;
+	int registered;
+} client = { .fd = -1 };
+
+static struct {
+	Buffer trace;
+	unsigned lines;
+	char *channels[MAX_CHANNELS];
+	int nchannels;
+	int rounds;
+	int round;
+	int waiting;
+	double started;
+	double settle;
+	double min, max, total;
+} bench;
+
+static double
+now_ms(void)
+{
+	struct timeval tv;
+
+	gettimeofday(&tv, NULL);
+	return tv.tv_sec * 1000.0 + tv.tv_usec / 1000.0;
+}
+
+static void
+buffer_append(Buffer *buf, const char *data, size_t len)
+{
+	if (buf->len + len + 1 > buf->size) {
+		buf->size = (buf->len + len + 1) * 2;
+		buf->data = realloc(buf->data, buf->size);
+		if (buf->data == NULL) {
+			perror("realloc");
+			exit(1);
+		}
+	}
+	memcpy(buf->data + buf->len, data, len);
+	buf->len += len;
+	buf->data[buf->len] = '\0';
+}
+
+static void
+buffer_printf(Buffer *buf, const char *format, ...)
+{
+	char tmp[4096];
+	va_list args;
+	int len;
+
+	va_start(args, format);
+	len = vsnprintf(tmp, sizeof(tmp), format, args);
+	va_end(args);
+
+	if (len > 0)
+		buffer_append(buf, tmp, (size_t)len < sizeof(tmp) ? (size_t)len : sizeof(tmp) - 1);
+}
+
+static void
+buffer_consume(Buffer *buf, size_t len)
+{
+	memmove(buf->data, buf->data + len, buf->len - len);
+	buf->len -= len;
+	if (buf->data)
+		buf->data[buf->len] = '\0';
+}
+
+static void
+add_channel(const char *name, size_t len)
+{
+	int i;
+
+	for (i = 0; i < bench.nchannels; i++) {
+		if (strlen(bench.channels[i]) == len &&
+				!strncmp(bench.channels[i], name, len))
+			return;
+	}
+	if (bench.nchannels == MAX_CHANNELS)
+		return;
+
+	bench.channels[bench.nchannels] = malloc(len + 1);
+	memcpy(bench.channels[bench.nchannels], name, len);
+	bench.channels[bench.nchannels][len] = '\0';
+	bench.nchannels++;
+}
+
+/* Remember the channel in the third field of a trace line, if any */
+static void
+scan_line(const char *line, size_t len)
+{
+	const char *end = line + len, *p = line, *target;
+	int field;
+
+	for (field = 0; field < 2; field++) {
+		p = memchr(p, ' ', end - p);
+		if (p == NULL)
+			return;
+		p++;
+	}
+
+	target = p;
+	if (*target == ':')
+		target++;
+	if (target < end && *target == '#') {
+		p = target;
+		while (p < end && *p != ' ' && *p != ',')
+			p++;
+		add_channel(target, p - target);
+	}
+}
+
+static void
+load_trace(const char *filename)
+{
+	char line[4096];
+	FILE *fp = fopen(filename, "r");
+
+	if (fp == NULL) {
+		perror(filename);
+		exit(1);
+	}
+
+	while (fgets(line, sizeof(line), fp)) {
+		size_t len = strcspn(line, "\r\n");
+
+		if (len == 0)
+			continue;
+		scan_line(line, len);
+		buffer_append(&bench.trace, line, len);
+		buffer_append(&bench.trace, "\r\n", 2);
+		bench.lines++;
+	}
+
+	fclose(fp);
+}
+
+static void
+make_trace(unsigned lines)
+{
+	static const char *texts[] = {
+		"anyone around?",
+		"I pushed the fix, can someone review it before the release",
+		"lol",
+		"na\xc3\xafve caf\xc3\xa9 r\xc3\xa9sum\xc3\xa9, \xc3\xbc\xc3\xb6\xc3\xa4 \xc3\x9f",
+		"\xe6\x97\xa5\xe6\x9c\xac\xe8\xaa\x9e\xe3\x81\xae\xe3\x83\x86\xe3\x82\xad\xe3\x82\xb9\xe3\x83\x88",
+		"\x02" "bold" "\x02 and \x03" "04,01red on black\x03 and \x1funderline\x1f",
+		"https://example.com/some/long/path?with=query&and=more#fragment",
+		"\x01" "ACTION waves\x01",
+		"Lorem ipsum dolor sit amet, consectetur adipiscing elit, sed do "
+			"eiusmod tempor incididunt ut labore et dolore magna aliqua. Ut "
+			"enim ad minim veniam, quis nostrud exercitation ullamco laboris",
+	};
+	int present[NUM_USERS], renamed[NUM_USERS];
+	unsigned i;
+
+	srand(42);
+	for (i = 0; i < NUM_USERS; i++) {
+		present[i] = 1;
+		renamed[i] = 0;
+	}
+	add_channel("#bench", 6);
+
+	for (i = 0; i < lines; i++) {
+		int r = rand() % 100, u = rand() % NUM_USERS;
+		char nick[32];
+
+		snprintf(nick, sizeof(nick), "user%02d%s", u, renamed[u] ? "_" : "");
+
+		if (!present[u]) {
+			buffer_printf(&bench.trace, ":%s!~u%d@host%d.example.net JOIN :#bench\r\n",
+			              nick, u, u);
+			present[u] = 1;
+		} else if (r < 80) {
+			buffer_printf(&bench.trace, ":%s!~u%d@host%d.example.net PRIVMSG #bench :%s\r\n",
+			              nick, u, u, texts[rand() % (sizeof(texts) / sizeof(texts[0]))]);
+		} else if (r < 85) {
+			buffer_printf(&bench.trace, ":%s!~u%d@host%d.example.net PART #bench :bye\r\n",
+			              nick, u, u);
+			present[u] = 0;
+		} else if (r < 88) {
+			buffer_printf(&bench.trace, ":%s!~u%d@host%d.example.net QUIT :Ping timeout: 240 seconds\r\n",
+			              nick, u, u);
+			present[u] = 0;
+		} else if (r < 93) {
+			renamed[u] = !renamed[u];
+			buffer_printf(&bench.trace, ":%s!~u%d@host%d.example.net NICK :user%02d%s\r\n",
+			              nick, u, u, u, renamed[u] ? "_" : "");
+		} else {
+			buffer_printf(&bench.trace, ":ChanServ!ChanServ@services. MODE #bench %cv %s\r\n",
+			              r % 2 ? '+' : '-', nick);
+		}
+		bench.lines++;
+	}
+}
+
+static void
+start_round(void)
+{
+	buffer_append(&client.out, bench.trace.data, bench.trace.len);
+	buffer_printf(&client.out, "PING :round-%d\r\n", bench.round);
+	bench.started = now_ms();
+	bench.waiting = 1;
+}
+
+static void
+finish_round(void)
+{
+	double elapsed = now_ms() - bench.started;
+	double rate = bench.lines / (elapsed / 1000.0);
+
+	printf("round %d: %u lines in %.1f ms, %.0f lines/s\n",
+	       bench.round + 1, bench.lines, elapsed, rate);
+	fflush(stdout);
+
+	if (bench.round == 0 || rate < bench.min)
+		bench.min = rate;
+	if (rate > bench.max)
+		bench.max = rate;
+	bench.total += rate;
+
+	bench.waiting = 0;
+	bench.round++;
+	if (bench.round < bench.rounds)
+		start_round();
+}
+
+static void
+welcome(void)
+{
+	int i;
+
+	buffer_printf(&client.out, ":%s 001 %s :Welcome to the replay network %s\r\n",
+	              SERVER_NAME, client.nick, client.nick);
+	buffer_printf(&client.out, ":%s 005 %s PREFIX=(ov)@+ CHANTYPES=# "
+	              ":are supported by this server\r\n", SERVER_NAME, client.nick);
+	buffer_printf(&client.out, ":%s 251 %s :There are %d users on 1 server\r\n",
+	              SERVER_NAME, client.nick, NUM_USERS);
+	buffer_printf(&client.out, ":%s 422 %s :MOTD File is missing\r\n",
+	              SERVER_NAME, client.nick);
+
+	for (i = 0; i < bench.nchannels; i++) {
+		buffer_printf(&client.out, ":%s!~me@localhost JOIN :%s\r\n",
+		              client.nick, bench.channels[i]);
+		buffer_printf(&client.out, ":%s 353 %s = %s :@%s\r\n",
+		              SERVER_NAME, client.nick, bench.channels[i], client.nick);
+		buffer_printf(&client.out, ":%s 366 %s %s :End of /NAMES list.\r\n",
+		              SERVER_NAME, client.nick, bench.channels[i]);
+	}
+
+	client.registered = 1;
+
+	/* Give the client a moment to open its chat windows first */
+	bench.settle = now_ms() + 1000;
+}
+
+static void
+handle_line(char *line)
+{
+	if (!strncmp(line, "NICK ", 5)) {
+		snprintf(client.nick, sizeof(client.nick), "%s", line + 5);
+	} else if (!strncmp(line, "USER ", 5)) {
+		client.got_user = 1;
+	} else if (!strncmp(line, "PING ", 5)) {
+		buffer_printf(&client.out, ":%s PONG %s %s\r\n", SERVER_NAME,
+		              SERVER_NAME, line + 5);
+	} else if (!strncmp(line, "PONG ", 5)) {
+		char expect[32];
+
+		snprintf(expect, sizeof(expect), "round-%d", bench.round);
+		if (bench.waiting && strstr(line, expect))
+			finish_round();
+	} else if (!strncmp(line, "QUIT", 4)) {
+		buffer_printf(&client.out, "ERROR :Closing link\r\n");
+	}
+
+	if (!client.registered && client.nick[0] && client.got_user)
+		welcome();
+}
+
+static void
+client_close(void)
+{
+	close(client.fd);
+	client.fd = -1;
+	client.in.len = 0;
+	client.out.len = 0;
+	client.nick[0] = '\0';
+	client.got_user = 0;
+	client.registered = 0;
+	bench.waiting = 0;
+	bench.settle = 0;
+}
+
+static void
+client_read(void)
+{
+	char buf[4096];
+	char *eol;
+	ssize_t len = read(client.fd, buf, sizeof(buf));
+
+	if (len <= 0) {
+		if (len < 0 && errno == EAGAIN)
+			return;
+		printf("client disconnected\n");
+		client_close();
+		return;
+	}
+
+	buffer_append(&client.in, buf, len);
+	while ((eol = strchr(client.in.data, '\n')) != NULL) {
+		size_t linelen = eol - client.in.data + 1;
+
+		*eol = '\0';
+		if (eol > client.in.data && eol[-1] == '\r')
+			eol[-1] = '\0';
+		handle_line(client.in.data);
+		buffer_consume(&client.in, linelen);
+	}
+}
+
+static void
+client_flush(void)
+{
+	ssize_t len;
+
+	if (client.out.len == 0)
+		return;
+
+	len = write(client.fd, client.out.data, client.out.len);
+	if (len > 0)
+		buffer_consume(&client.out, len);
+	else if (len < 0 && errno != EAGAIN) {
+		printf("client disconnected\n");
+		client_close();
+	}
+}
+
+int
+main(int argc, char *argv[])
+{
+	struct sockaddr_in addr;
+	const char *trace = NULL;
+	unsigned lines = 20000;
+	int port = 16667, listener, opt, one = 1;
+
+	bench.rounds = 5;
+
+	while ((opt = getopt(argc, argv, "p:t:g:n:")) != -1) {
+		switch (opt) {
+			case 'p':
+				port = atoi(optarg);
+				break;
+			case 't':
+				trace = optarg;
+				break;
+			case 'g':
+				lines = atoi(optarg);
+				break;
+			case 'n':
+				bench.rounds = atoi(optarg);
+				if (bench.rounds > MAX_ROUNDS)
+					bench.rounds = MAX_ROUNDS;
+				break;
+			default:
+				fprintf(stderr, "Usage: %s [-p port] [-t trace] [-g lines] "
+				        "[-n rounds]\n", argv[0]);
+				return 1;
+		}
+	}
+
+	if (trace)
+		load_trace(trace);
+	else
+		make_trace(lines);
+
+	if (bench.lines == 0) {
+		fprintf(stderr, "The trace is empty\n");
+		return 1;
+	}
+
+	listener = socket(AF_INET, SOCK_STREAM, 0);
+	setsockopt(listener, SOL_SOCKET, SO_REUSEADDR, &one, sizeof(one));
+	memset(&addr, 0, sizeof(addr));
+	addr.sin_family = AF_INET;
+	addr.sin_port = htons(port);
+	addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+	if (bind(listener, (struct sockaddr *)&addr, sizeof(addr)) < 0 ||
+			listen(listener, 1) < 0) {
+		perror("bind");
+		return 1;
+	}
+
+	printf("IRC replay listening on 127.0.0.1:%d with %u lines in %d channel(s)\n",
+	       port, bench.lines, bench.nchannels);
+	fflush(stdout);
+
+	while (bench.round < bench.rounds) {
+		struct pollfd fds[2];
+		int n = 0;
+
+		fds[n].fd = listener;
+		fds[n++].events = POLLIN;
+		if (client.fd >= 0) {
+			fds[n].fd = client.fd;
+			fds[n++].events = POLLIN | (client.out.len ? POLLOUT : 0);
+		}
+
+		if (poll(fds, n, 50) < 0 && errno != EINTR) {
+			perror("poll");
+			return 1;
+		}
+
+		if (n > 1 && (fds[1].revents & POLLOUT))
+			client_flush();
+		if (n > 1 && client.fd >= 0 &&
+				(fds[1].revents & (POLLIN | POLLHUP | POLLERR)))
+			client_read();
+
+		if (fds[0].revents & POLLIN) {
+			int fd = accept(listener, NULL, NULL);
+
+			if (fd >= 0 && client.fd >= 0) {
+				close(fd);
+			} else if (fd >= 0) {
+				client.fd = fd;
+				fcntl(fd, F_SETFL, fcntl(fd, F_GETFL) | O_NONBLOCK);
+			}
+		}
+
+		if (client.registered && bench.settle && now_ms() >= bench.settle &&
+				!bench.waiting && bench.round == 0) {
+			bench.settle = 0;
+			start_round();
+		}
+	}
+
+	printf("%d rounds of %u lines: min %.0f, avg %.0f, max %.0f lines/s\n",
+	       bench.rounds, bench.lines, bench.min, bench.total / bench.rounds,
+	       bench.max);
+
+	return 0;
+}
@@ -0,0 +1,246 @@
+#include <string.h>
+#include <unistd.h>
+
+#include <glib/gstdio.h>
+
+#include "tests.h"
+#include "../internal.h"
+#include "../log.h"
+
+static char *tail_path;
+static PurpleLogCommonLoggerData tail_data;
+static PurpleLog tail_log;
+
+static void
+tail_setup(const char *contents)
+{
+	int fd = g_file_open_tmp("purple-log-XXXXXX", &tail_path, NULL);
+
+	fail_if(fd < 0, NULL);
+	close(fd);
+	fail_unless(g_file_set_contents(tail_path, contents, -1, NULL), NULL);
+
+	tail_data.path = tail_path;
+	tail_log.logger_data = &tail_data;
+}
+
+static void
+tail_teardown(void)
+{
+	g_unlink(tail_path);
+	g_free(tail_path);
+	tail_path = NULL;
+}
+
+START_TEST(test_log_tail_whole_file)
+{
+	gboolean header = FALSE;
+
+	tail_setup("header\nfirst\nsecond\n");
+	assert_string_equal_free("header\nfirst\nsecond\n",
+			purple_log_common_tail_reader(&tail_log, 100, &header));
+	fail_unless(header, NULL);
+	tail_teardown();
+}
+END_TEST
+
+START_TEST(test_log_tail_line_boundary)
+{
+	gboolean header = TRUE;
+
+	tail_setup("header\nfirst\nsecond\n");
+	/* "first\nsecond\n" is 13 bytes; a line starting right at the cut stays */
+	assert_string_equal_free("first\nsecond\n",
+			purple_log_common_tail_reader(&tail_log, 13, &header));
+	fail_if(header, NULL);
+	assert_string_equal_free("second\n",
+			purple_log_common_tail_reader(&tail_log, 12, NULL));
+	tail_teardown();
+}
+END_TEST
+
+START_TEST(test_log_tail_long_line)
+{
+	tail_setup("header\na very long last line\n");
+	assert_string_equal_free("",
+			purple_log_common_tail_reader(&tail_log, 8, NULL));
+	tail_teardown();
+}
+END_TEST
+
+START_TEST(test_log_tail_missing)
+{
+	PurpleLogCommonLoggerData data = { "/nonexistent/purple.log", NULL, NULL };
+	PurpleLog log;
+
+	memset(&log, 0, sizeof(log));
+	log.logger_data = &data;
+	fail_unless(purple_log_common_tail_reader(&log, 100, NULL) == NULL, NULL);
+}
+END_TEST
+
+/* A logger whose logs only have a time and a size, kept in logger_data */
+#define ACTIVITY_HALF_LIFE (14 * 24 * 60 * 60)
+
+static PurpleLogLogger *activity_logger;
+static PurpleAccount *activity_account;
+static char *activity_dir;
+static time_t activity_now;
+static gboolean activity_list_logs;
+
+static gsize
+activity_write(PurpleLog *log, PurpleMessageFlags type, const char *from,
+               time_t time, const char *message)
+{
+	return strlen(message);
+}
+
+static PurpleLog *
+activity_log_new(const char *name, time_t when, int size)
+{
+	PurpleLog *log = purple_log_new(PURPLE_LOG_IM, name, activity_account,
+			NULL, when, NULL);
+
+	log->logger_data = GINT_TO_POINTER(size);
+	return log;
+}
+
+static GList *
+activity_list(PurpleLogType type, const char *name, PurpleAccount *account)
+{
+	GList *logs = NULL;
+
+	if (!activity_list_logs || !purple_strequal(name, "buddy"))
+		return NULL;
+
+	logs = g_list_append(logs, activity_log_new(name,
+			activity_now - ACTIVITY_HALF_LIFE, 1000));
+	logs = g_list_append(logs, activity_log_new(name, activity_now, 1000));
+	return logs;
+}
+
+static int
+activity_size(PurpleLog *log)
+{
+	return GPOINTER_TO_INT(log->logger_data);
+}
+
+static void
+activity_setup(void)
+{
+	int fd = g_file_open_tmp("purple-log-XXXXXX", &activity_dir, NULL);
+
+	fail_if(fd < 0, NULL);
+	close(fd);
+	g_unlink(activity_dir);
+	fail_if(g_mkdir(activity_dir, 0700) != 0, NULL);
+	purple_util_set_user_dir(activity_dir);
+
+	activity_account = purple_account_new("tester", "prpl-check");
+	purple_accounts_add(activity_account);
+
+	activity_logger = purple_log_logger_new("check", "Check", 6, NULL,
+			activity_write, NULL, activity_list, NULL, activity_size);
+	purple_log_logger_add(activity_logger);
+	purple_prefs_set_string("/purple/logging/format", "check");
+
+	activity_now = time(NULL);
+	activity_list_logs = TRUE;
+}
+
+static void
+activity_teardown(void)
+{
+	char *path = g_build_filename(activity_dir, "logactivity.xml", NULL);
+
+	purple_prefs_set_string("/purple/logging/format", "html");
+	purple_log_logger_remove(activity_logger);
+	purple_log_logger_free(activity_logger);
+	activity_logger = NULL;
+
+	purple_accounts_delete(activity_account);
+	activity_account = NULL;
+
+	purple_util_set_user_dir("/dev/null");
+	g_unlink(path);
+	g_free(path);
+	g_rmdir(activity_dir);
+	g_free(activity_dir);
+	activity_dir = NULL;
+}
+
+START_TEST(test_log_activity_decay)
+{
+	/* 1000 bytes a half-life ago count for half as much as 1000 now */
+	assert_int_equal(1500, purple_log_get_activity_score(PURPLE_LOG_IM,
+			"buddy", activity_account));
+	assert_int_equal(0, purple_log_get_activity_score(PURPLE_LOG_IM,
+			"nobody", activity_account));
+}
+END_TEST
+
+START_TEST(test_log_activity_write)
+{
+	PurpleLog *log;
+
+	assert_int_equal(1500, purple_log_get_activity_score(PURPLE_LOG_IM,
+			"buddy", activity_account));
+
+	/* Writing adds to the score without the logs being listed again */
+	activity_list_logs = FALSE;
+	log = activity_log_new("buddy", activity_now, 0);
+	purple_log_write(log, PURPLE_MESSAGE_RECV, "buddy", activity_now,
+			"0123456789");
+	purple_log_free(log);
+
+	assert_int_equal(1510, purple_log_get_activity_score(PURPLE_LOG_IM,
+			"buddy", activity_account));
+}
+END_TEST
+
+START_TEST(test_log_activity_round_trip)
+{
+	char *path, *contents = NULL;
+
+	assert_int_equal(1500, purple_log_get_activity_score(PURPLE_LOG_IM,
+			"buddy", activity_account));
+
+	_purple_log_activity_flush();
+	path = g_build_filename(activity_dir, "logactivity.xml", NULL);
+	fail_unless(g_file_get_contents(path, &contents, NULL, NULL), NULL);
+	fail_if(strstr(contents, "name='buddy' score='1500.0'") == NULL,
+			"Unexpected logactivity.xml:\n%s", contents);
+	g_free(contents);
+	g_free(path);
+
+	/* Start over from the saved file, with no logs to scan */
+	purple_log_uninit();
+	purple_log_init();
+	activity_list_logs = FALSE;
+
+	assert_int_equal(1500, purple_log_get_activity_score(PURPLE_LOG_IM,
+			"buddy", activity_account));
+}
+END_TEST
+
+Suite *
+log_suite(void)
+{
+	Suite *s = suite_create("Log Functions");
+
+	TCase *tc = tcase_create("Tail reading");
+	tcase_add_test(tc, test_log_tail_whole_file);
+	tcase_add_test(tc, test_log_tail_line_boundary);
+	tcase_add_test(tc, test_log_tail_long_line);
+	tcase_add_test(tc, test_log_tail_missing);
+	suite_add_tcase(s, tc);
+
+	tc = tcase_create("Activity scores");
+	tcase_add_checked_fixture(tc, activity_setup, activity_teardown);
+	tcase_add_test(tc, test_log_activity_decay);
+	tcase_add_test(tc, test_log_activity_write);
+	tcase_add_test(tc, test_log_activity_round_trip);
+	suite_add_tcase(s, tc);
+
+	return s;
+}
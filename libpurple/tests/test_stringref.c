@@ -0,0 +1,77 @@
+#include <string.h>
+
+#include "tests.h"
+#include "../stringref.h"
+
+START_TEST(test_stringref_intern_same_atom)
+{
+	char *copy = g_strdup("romeo@montague.lit");
+	const char *a, *b;
+
+	a = purple_stringref_intern("romeo@montague.lit");
+	b = purple_stringref_intern(copy);
+	g_free(copy);
+
+	fail_unless(a == b, NULL);
+	assert_string_equal("romeo@montague.lit", a);
+
+	purple_stringref_intern_unref(a);
+	purple_stringref_intern_unref(b);
+}
+END_TEST
+
+START_TEST(test_stringref_intern_distinct)
+{
+	const char *a = purple_stringref_intern("juliet");
+	const char *b = purple_stringref_intern("Juliet");
+
+	fail_if(a == b, NULL);
+
+	purple_stringref_intern_unref(a);
+	purple_stringref_intern_unref(b);
+}
+END_TEST
+
+START_TEST(test_stringref_intern_null)
+{
+	fail_unless(purple_stringref_intern(NULL) == NULL, NULL);
+	fail_unless(purple_stringref_intern_ref(NULL) == NULL, NULL);
+	purple_stringref_intern_unref(NULL);
+}
+END_TEST
+
+START_TEST(test_stringref_intern_revive)
+{
+	const char *a, *b;
+	guint count;
+
+	a = purple_stringref_intern("nurse");
+	count = purple_stringref_intern_count();
+
+	/* Dropping the last reference defers the free to the idle collector,
+	 * so interning again before then must hand back the same atom. */
+	purple_stringref_intern_unref(a);
+	b = purple_stringref_intern("nurse");
+	fail_unless(a == b, NULL);
+	assert_int_equal(count, purple_stringref_intern_count());
+
+	fail_unless(purple_stringref_intern_ref(b) == b, NULL);
+	purple_stringref_intern_unref(b);
+	purple_stringref_intern_unref(b);
+}
+END_TEST
+
+Suite *
+stringref_suite(void)
+{
+	Suite *s = suite_create("Stringref Functions");
+
+	TCase *tc = tcase_create("Interning");
+	tcase_add_test(tc, test_stringref_intern_same_atom);
+	tcase_add_test(tc, test_stringref_intern_distinct);
+	tcase_add_test(tc, test_stringref_intern_null);
+	tcase_add_test(tc, test_stringref_intern_revive);
+	suite_add_tcase(s, tc);
+
+	return s;
+}
@@ -13,7 +13,9 @@ Suite * jabber_caps_suite(void);
 Suite * jabber_digest_md5_suite(void);
 Suite * jabber_jutil_suite(void);
 Suite * jabber_scram_suite(void);
+Suite * log_suite(void);
 Suite * oscar_util_suite(void);
+Suite * stringref_suite(void);
 Suite * util_suite(void);
 Suite * xmlnode_suite(void);
 
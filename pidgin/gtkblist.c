@@ -123,8 +123,15 @@ typedef struct
 	PidginBlistTheme *current_theme;
 
 	guint select_page_timeout;       /**< The timeout for pidgin_blist_select_notebook_page_cb */
+
+	GHashTable *dirty_nodes;         /**< Nodes libpurple updated since the last flush */
+	guint flush_timeout;             /**< The timeout for pidgin_blist_flush_updates_cb */
+	GHashTable *flushed_groups;      /**< Groups already redrawn by the running flush */
 } PidginBuddyListPrivate;
 
+/* How often queued updates from libpurple are drawn, in milliseconds */
+#define BLIST_UPDATE_INTERVAL 40
+
 #define PIDGIN_BUDDY_LIST_GET_PRIVATE(list) \
 	((PidginBuddyListPrivate *)((list)->priv))
 
@@ -149,6 +156,7 @@ static gboolean pidgin_blist_refresh_timer(PurpleBuddyList *list);
 static void pidgin_blist_update_buddy(PurpleBuddyList *list, PurpleBlistNode *node, gboolean status_change);
 static void pidgin_blist_selection_changed(GtkTreeSelection *selection, gpointer data);
 static void pidgin_blist_update(PurpleBuddyList *list, PurpleBlistNode *node);
+static void pidgin_blist_queue_update(PurpleBuddyList *list, PurpleBlistNode *node);
 static void pidgin_blist_update_group(PurpleBuddyList *list, PurpleBlistNode *node);
 static void pidgin_blist_update_contact(PurpleBuddyList *list, PurpleBlistNode *node);
 static char *pidgin_get_tooltip_text(PurpleBlistNode *node, gboolean full);
@@ -2654,7 +2662,131 @@ do_alphashift(GdkPixbuf *pixbuf, int shift)
 	}
 }
 
+/*
+ * Buddy icons as they're drawn in the list and tooltips, so scrolling or
+ * redrawing a row doesn't decode and scale the same image again.  Entries
+ * are keyed by a hash of the image data rather than by buddy, so buddies
+ * sharing an icon share the entry and a changed icon just misses.  The
+ * least recently used entries go once ICON_CACHE_BUDGET bytes of pixels
+ * are held.
+ */
+#define ICON_CACHE_BUDGET (4 * 1024 * 1024)
+
+typedef struct
+{
+	guint64 hash;
+	gsize len;
+	gconstpointer spec;   /* icon_spec when the prpl asks to scale for display */
+	gboolean scaled;
+	gboolean offline;
+	gboolean idle;
+} IconCacheKey;
+
+typedef struct
+{
+	IconCacheKey key;
+	GdkPixbuf *pixbuf;
+	gsize size;
+	GList *link;          /* in icon_cache_lru, most recently used first */
+} IconCacheEntry;
+
+static GHashTable *icon_cache = NULL;
+static GQueue icon_cache_lru = G_QUEUE_INIT;
+static gsize icon_cache_size = 0;
+
+static guint
+icon_cache_key_hash(gconstpointer key)
+{
+	const IconCacheKey *k = key;
+
+	return (guint)k->hash ^ (guint)(k->hash >> 32) ^
+		((k->scaled << 2) | (k->offline << 1) | k->idle);
+}
+
+static gboolean
+icon_cache_key_equal(gconstpointer a, gconstpointer b)
+{
+	const IconCacheKey *ka = a, *kb = b;
+
+	return ka->hash == kb->hash && ka->len == kb->len && ka->spec == kb->spec &&
+		ka->scaled == kb->scaled && ka->offline == kb->offline &&
+		ka->idle == kb->idle;
+}
 
+/* FNV-1a */
+static guint64
+icon_data_hash(const guchar *data, gsize len)
+{
+	guint64 hash = G_GUINT64_CONSTANT(14695981039346656037);
+
+	while (len--) {
+		hash ^= *data++;
+		hash *= G_GUINT64_CONSTANT(1099511628211);
+	}
+
+	return hash;
+}
+
+static void
+icon_cache_entry_free(IconCacheEntry *entry)
+{
+	g_object_unref(entry->pixbuf);
+	g_free(entry);
+}
+
+static GdkPixbuf *
+icon_cache_lookup(const IconCacheKey *key)
+{
+	IconCacheEntry *entry;
+
+	if (icon_cache == NULL || (entry = g_hash_table_lookup(icon_cache, key)) == NULL)
+		return NULL;
+
+	g_queue_unlink(&icon_cache_lru, entry->link);
+	g_queue_push_head_link(&icon_cache_lru, entry->link);
+
+	return g_object_ref(entry->pixbuf);
+}
+
+static void
+icon_cache_insert(const IconCacheKey *key, GdkPixbuf *pixbuf)
+{
+	IconCacheEntry *entry;
+
+	if (icon_cache == NULL)
+		icon_cache = g_hash_table_new_full(icon_cache_key_hash,
+				icon_cache_key_equal, NULL, (GDestroyNotify)icon_cache_entry_free);
+
+	entry = g_new(IconCacheEntry, 1);
+	entry->key = *key;
+	entry->pixbuf = g_object_ref(pixbuf);
+	entry->size = gdk_pixbuf_get_rowstride(pixbuf) * gdk_pixbuf_get_height(pixbuf);
+	g_queue_push_head(&icon_cache_lru, entry);
+	entry->link = icon_cache_lru.head;
+	g_hash_table_insert(icon_cache, &entry->key, entry);
+	icon_cache_size += entry->size;
+
+	/* Always keep the newest one, however big it is */
+	while (icon_cache_size > ICON_CACHE_BUDGET && icon_cache_lru.length > 1) {
+		IconCacheEntry *old = g_queue_pop_tail(&icon_cache_lru);
+		icon_cache_size -= old->size;
+		g_hash_table_remove(icon_cache, &old->key);
+	}
+}
+
+static void
+icon_cache_clear(void)
+{
+	if (icon_cache == NULL)
+		return;
+
+	g_queue_clear(&icon_cache_lru);
+	g_hash_table_destroy(icon_cache);
+	icon_cache = NULL;
+	icon_cache_size = 0;
+}
+
+/* The returned pixbuf may be shared; copy it before changing it. */
 static GdkPixbuf *pidgin_blist_get_buddy_icon(PurpleBlistNode *node,
                                               gboolean scaled, gboolean greyed)
 {
@@ -2669,6 +2801,8 @@ static GdkPixbuf *pidgin_blist_get_buddy_icon(PurpleBlistNode *node,
 	PurpleStoredImage *custom_img;
 	PurplePluginProtocolInfo *prpl_info = NULL;
 	gint orig_width, orig_height, scale_width, scale_height;
+	gboolean offline = FALSE, idle = FALSE;
+	IconCacheKey key;
 
 	if (PURPLE_BLIST_NODE_IS_CONTACT(node)) {
 		buddy = purple_contact_get_priority_buddy((PurpleContact*)node);
@@ -2725,6 +2859,33 @@ static GdkPixbuf *pidgin_blist_get_buddy_icon(PurpleBlistNode *node,
 			return NULL;
 	}
 
+	if (greyed) {
+		if (buddy) {
+			PurplePresence *presence = purple_buddy_get_presence(buddy);
+			if (!PURPLE_BUDDY_IS_ONLINE(buddy))
+				offline = TRUE;
+			if (purple_presence_is_idle(presence))
+				idle = TRUE;
+		} else if (group) {
+			if (purple_blist_get_group_online_count(group) == 0)
+				offline = TRUE;
+		}
+	}
+
+	key.hash = icon_data_hash(data, len);
+	key.len = len;
+	key.spec = (prpl_info && prpl_info->icon_spec.scale_rules & PURPLE_ICON_SCALE_DISPLAY) ?
+			&prpl_info->icon_spec : NULL;
+	key.scaled = scaled;
+	key.offline = offline;
+	key.idle = idle;
+
+	if ((ret = icon_cache_lookup(&key)) != NULL) {
+		purple_buddy_icon_unref(icon);
+		purple_imgstore_unref(custom_img);
+		return ret;
+	}
+
 	buf = pidgin_pixbuf_from_data(data, len);
 	purple_buddy_icon_unref(icon);
 	if (!buf) {
@@ -2740,26 +2901,11 @@ static GdkPixbuf *pidgin_blist_get_buddy_icon(PurpleBlistNode *node,
 	}
 	purple_imgstore_unref(custom_img);
 
-	if (greyed) {
-		gboolean offline = FALSE, idle = FALSE;
+	if (offline)
+		gdk_pixbuf_saturate_and_pixelate(buf, buf, 0.0, FALSE);
 
-		if (buddy) {
-			PurplePresence *presence = purple_buddy_get_presence(buddy);
-			if (!PURPLE_BUDDY_IS_ONLINE(buddy))
-				offline = TRUE;
-			if (purple_presence_is_idle(presence))
-				idle = TRUE;
-		} else if (group) {
-			if (purple_blist_get_group_online_count(group) == 0)
-				offline = TRUE;
-		}
-
-		if (offline)
-			gdk_pixbuf_saturate_and_pixelate(buf, buf, 0.0, FALSE);
-
-		if (idle)
-			gdk_pixbuf_saturate_and_pixelate(buf, buf, 0.25, FALSE);
-	}
+	if (idle)
+		gdk_pixbuf_saturate_and_pixelate(buf, buf, 0.25, FALSE);
 
 	/* I'd use the pidgin_buddy_icon_get_scale_size() thing, but it won't
 	 * tell me the original size, which I need for scaling purposes. */
@@ -2795,6 +2941,9 @@ static GdkPixbuf *pidgin_blist_get_buddy_icon(PurpleBlistNode *node,
 	}
 	g_object_unref(G_OBJECT(buf));
 
+	if (ret)
+		icon_cache_insert(&key, ret);
+
 	return ret;
 }
 
@@ -4799,6 +4948,8 @@ static void pidgin_blist_new_list(PurpleBuddyList *blist)
 	gtkblist->connection_errors = g_hash_table_new_full(g_direct_hash,
 												g_direct_equal, NULL, g_free);
 	gtkblist->priv = g_new0(PidginBuddyListPrivate, 1);
+	PIDGIN_BUDDY_LIST_GET_PRIVATE(gtkblist)->dirty_nodes =
+		g_hash_table_new(g_direct_hash, g_direct_equal);
 
 	blist->ui_data = gtkblist;
 }
@@ -6316,6 +6467,9 @@ static void pidgin_blist_remove(PurpleBuddyList *list, PurpleBlistNode *node)
 
 	purple_request_close_with_handle(node);
 
+	if (gtkblist)
+		g_hash_table_remove(PIDGIN_BUDDY_LIST_GET_PRIVATE(gtkblist)->dirty_nodes, node);
+
 	pidgin_blist_hide_node(list, node, TRUE);
 
 	if(node->parent)
@@ -6469,6 +6623,7 @@ static void pidgin_blist_update_group(PurpleBuddyList *list,
 	gint count;
 	PurpleGroup *group;
 	PurpleBlistNode* gnode;
+	PidginBuddyListPrivate *priv;
 	gboolean show = FALSE, show_offline = FALSE;
 
 	g_return_if_fail(node != NULL);
@@ -6485,6 +6640,11 @@ static void pidgin_blist_update_group(PurpleBuddyList *list,
 	else
 		return;
 
+	/* Every buddy in a flush redraws its group; once is enough. */
+	priv = PIDGIN_BUDDY_LIST_GET_PRIVATE(gtkblist);
+	if (priv->flushed_groups && g_hash_table_lookup(priv->flushed_groups, gnode))
+		return;
+
 	group = (PurpleGroup*)gnode;
 
 	show_offline = purple_prefs_get_bool(PIDGIN_PREFS_ROOT "/blist/show_offline_buddies");
@@ -6549,6 +6709,11 @@ static void pidgin_blist_update_group(PurpleBuddyList *list,
 				   EMBLEM_VISIBLE_COLUMN, FALSE,
 				   -1);
 		g_free(title);
+		if (avatar)
+			g_object_unref(avatar);
+
+		if (priv->flushed_groups)
+			g_hash_table_insert(priv->flushed_groups, gnode, gnode);
 	} else {
 		pidgin_blist_hide_node(list, gnode, TRUE);
 	}
@@ -6643,6 +6808,9 @@ static void buddy_node(PurpleBuddy *buddy, GtkTreeIter *iter, PurpleBlistNode *n
 		g_object_ref(G_OBJECT(gtkblist->empty_avatar));
 		avatar = gtkblist->empty_avatar;
 	} else if ((!PURPLE_BUDDY_IS_ONLINE(buddy) || purple_presence_is_idle(presence))) {
+		GdkPixbuf *faded = gdk_pixbuf_copy(avatar);
+		g_object_unref(avatar);
+		avatar = faded;
 		do_alphashift(avatar, 77);
 	}
 
@@ -6993,6 +7161,57 @@ static void pidgin_blist_update(PurpleBuddyList *list, PurpleBlistNode *node)
 
 }
 
+static gboolean
+pidgin_blist_flush_updates_cb(gpointer data)
+{
+	PidginBuddyListPrivate *priv = PIDGIN_BUDDY_LIST_GET_PRIVATE(gtkblist);
+	GList *nodes, *l;
+
+	priv->flush_timeout = 0;
+
+	/* Drawing a row doesn't change the buddy list, so none of these can
+	 * go away before we get to them. */
+	nodes = g_hash_table_get_keys(priv->dirty_nodes);
+	g_hash_table_remove_all(priv->dirty_nodes);
+
+	priv->flushed_groups = g_hash_table_new(g_direct_hash, g_direct_equal);
+	for (l = nodes; l != NULL; l = l->next)
+		pidgin_blist_update(purple_get_blist(), l->data);
+	g_hash_table_destroy(priv->flushed_groups);
+	priv->flushed_groups = NULL;
+
+	g_list_free(nodes);
+
+	return FALSE;
+}
+
+/* libpurple calls this for every change to a node, which during a burst of
+ * presence updates is far more often than it's worth redrawing.  Changed
+ * nodes are drawn together every BLIST_UPDATE_INTERVAL ms, each once.
+ * Groups, and nodes being moved (which libpurple removes from the UI
+ * first), are still drawn right away so the tree has them when the
+ * caller returns. */
+static void pidgin_blist_queue_update(PurpleBuddyList *list, PurpleBlistNode *node)
+{
+	PidginBuddyListPrivate *priv;
+
+	if (list)
+		gtkblist = PIDGIN_BLIST(list);
+	if (!gtkblist || !gtkblist->treeview || !node)
+		return;
+
+	if (node->ui_data == NULL || PURPLE_BLIST_NODE_IS_GROUP(node)) {
+		pidgin_blist_update(list, node);
+		return;
+	}
+
+	priv = PIDGIN_BUDDY_LIST_GET_PRIVATE(gtkblist);
+	g_hash_table_insert(priv->dirty_nodes, node, node);
+	if (!priv->flush_timeout)
+		priv->flush_timeout = purple_timeout_add(BLIST_UPDATE_INTERVAL,
+				pidgin_blist_flush_updates_cb, NULL);
+}
+
 static void pidgin_blist_destroy(PurpleBuddyList *list)
 {
 	PidginBuddyListPrivate *priv;
@@ -7019,6 +7238,7 @@ static void pidgin_blist_destroy(PurpleBuddyList *list)
 		g_source_remove(gtkblist->drag_timeout);
 
 	g_hash_table_destroy(gtkblist->connection_errors);
+	icon_cache_clear();
 	gtkblist->refresh_timer = 0;
 	gtkblist->timeout = 0;
 	gtkblist->drag_timeout = 0;
@@ -7038,6 +7258,9 @@ static void pidgin_blist_destroy(PurpleBuddyList *list)
 		g_object_unref(priv->current_theme);
 	if (priv->select_page_timeout)
 		purple_timeout_remove(priv->select_page_timeout);
+	if (priv->flush_timeout)
+		purple_timeout_remove(priv->flush_timeout);
+	g_hash_table_destroy(priv->dirty_nodes);
 	g_free(priv);
 
 	g_free(gtkblist);
@@ -7540,7 +7763,7 @@ static PurpleBlistUiOps blist_ui_ops =
 	pidgin_blist_new_list,
 	pidgin_blist_new_node,
 	pidgin_blist_show,
-	pidgin_blist_update,
+	pidgin_blist_queue_update,
 	pidgin_blist_remove,
 	pidgin_blist_destroy,
 	pidgin_blist_set_visible,
@@ -7608,7 +7831,7 @@ static gboolean buddy_signonoff_timeout_cb(PurpleBuddy *buddy)
 	gtknode->recent_signonoff = FALSE;
 	gtknode->recent_signonoff_timer = 0;
 
-	pidgin_blist_update(NULL, (PurpleBlistNode*)buddy);
+	pidgin_blist_queue_update(NULL, (PurpleBlistNode*)buddy);
 
 	return FALSE;
 }
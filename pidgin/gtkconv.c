@@ -382,14 +382,84 @@ debug_command_cb(PurpleConversation *conv,
 	return PURPLE_CMD_RET_OK;
 }
 
+/* The marks where each message in the conversation window starts, oldest
+ * first, so the scrollback can be trimmed a message at a time. */
+static GQueue *
+get_scrollback_marks(PidginConversation *gtkconv)
+{
+	GQueue *marks = g_object_get_data(G_OBJECT(gtkconv->imhtml), "scrollback-marks");
+
+	if (marks == NULL) {
+		marks = g_queue_new();
+		g_object_set_data_full(G_OBJECT(gtkconv->imhtml), "scrollback-marks",
+				marks, (GDestroyNotify)g_queue_free);
+	}
+
+	return marks;
+}
+
+static void
+clear_scrollback_marks(PidginConversation *gtkconv)
+{
+	GtkTextBuffer *buffer = gtk_text_view_get_buffer(GTK_TEXT_VIEW(gtkconv->imhtml));
+	GQueue *marks = get_scrollback_marks(gtkconv);
+	GtkTextMark *mark;
+
+	while ((mark = g_queue_pop_head(marks)) != NULL)
+		gtk_text_buffer_delete_mark(buffer, mark);
+}
+
+/* Drops whole messages from the top of the conversation window while that
+ * still leaves at least max_lines lines, so each new message only costs
+ * removing the one or two it pushes out. */
+static void
+trim_scrollback(PidginConversation *gtkconv, int max_lines)
+{
+	GtkTextBuffer *buffer = gtk_text_view_get_buffer(GTK_TEXT_VIEW(gtkconv->imhtml));
+	GQueue *marks = get_scrollback_marks(gtkconv);
+	int line_count = gtk_text_buffer_get_line_count(buffer);
+	GtkTextIter start, end;
+	gboolean trim = FALSE;
+
+	while (g_queue_get_length(marks) > 1) {
+		GtkTextMark *next = g_queue_peek_nth(marks, 1);
+
+		gtk_text_buffer_get_iter_at_mark(buffer, &end, next);
+		if (line_count - gtk_text_iter_get_line(&end) < max_lines)
+			break;
+
+		gtk_text_buffer_delete_mark(buffer, g_queue_pop_head(marks));
+		trim = TRUE;
+	}
+
+	if (trim) {
+		gtk_text_buffer_get_start_iter(buffer, &start);
+		gtk_text_buffer_get_iter_at_mark(buffer, &end, g_queue_peek_head(marks));
+		if (!gtk_text_iter_equal(&start, &end))
+			gtk_imhtml_delete(GTK_IMHTML(gtkconv->imhtml), &start, &end);
+		line_count = gtk_text_buffer_get_line_count(buffer);
+	}
+
+	/* Anything written without a mark, like the history plugin's text,
+	 * still gets trimmed by the line once it's more than 100 lines over. */
+	if (line_count > (max_lines + 100)) {
+		gtk_text_buffer_get_start_iter(buffer, &start);
+		gtk_text_buffer_get_iter_at_line(buffer, &end,
+			(line_count - max_lines));
+		gtk_imhtml_delete(GTK_IMHTML(gtkconv->imhtml), &start, &end);
+	}
+}
+
 static void clear_conversation_scrollback_cb(PurpleConversation *conv,
                                              void *data)
 {
 	PidginConversation *gtkconv = NULL;
 
 	gtkconv = PIDGIN_CONVERSATION(conv);
-	if (gtkconv)
+	if (gtkconv) {
+		clear_scrollback_marks(gtkconv);
 		gtk_imhtml_clear(GTK_IMHTML(gtkconv->imhtml));
+	}
 }
 
 static PurpleCmdRet
@@ -5810,7 +5880,6 @@ pidgin_conv_write_conv(PurpleConversation *conv, const char *name, const char *a
 	int gtk_font_options = 0;
 	int gtk_font_options_all = 0;
 	int max_scrollback_lines;
-	int line_count;
 	char buf2[BUF_LONG];
 	gboolean show_date;
 	char *mdate;
@@ -5893,25 +5962,10 @@ pidgin_conv_write_conv(PurpleConversation *conv, const char *name, const char *a
 		g_free(tmp);
 	}
 
-	line_count = gtk_text_buffer_get_line_count(
-			gtk_text_view_get_buffer(GTK_TEXT_VIEW(
-				gtkconv->imhtml)));
-
 	max_scrollback_lines = purple_prefs_get_int(
 		PIDGIN_PREFS_ROOT "/conversations/scrollback_lines");
-	/* If we're sitting at more than 100 lines more than the
-	   max scrollback, trim down to max scrollback */
-	if (max_scrollback_lines > 0
-			&& line_count > (max_scrollback_lines + 100)) {
-		GtkTextBuffer *text_buffer = gtk_text_view_get_buffer(
-			GTK_TEXT_VIEW(gtkconv->imhtml));
-		GtkTextIter start, end;
-
-		gtk_text_buffer_get_start_iter(text_buffer, &start);
-		gtk_text_buffer_get_iter_at_line(text_buffer, &end,
-			(line_count - max_scrollback_lines));
-		gtk_imhtml_delete(GTK_IMHTML(gtkconv->imhtml), &start, &end);
-	}
+	if (max_scrollback_lines > 0)
+		trim_scrollback(gtkconv, max_scrollback_lines);
 
 	if (type == PURPLE_CONV_TYPE_CHAT)
 	{
@@ -5931,6 +5985,16 @@ pidgin_conv_write_conv(PurpleConversation *conv, const char *name, const char *a
 	if (gtk_text_buffer_get_char_count(gtk_text_view_get_buffer(GTK_TEXT_VIEW(gtkconv->imhtml))))
 		gtk_imhtml_append_text(GTK_IMHTML(gtkconv->imhtml), "<BR>", gtk_font_options_all | GTK_IMHTML_NO_SCROLL);
 
+	/* Remember where this message starts, for trim_scrollback() */
+	{
+		GtkTextBuffer *buffer = gtk_text_view_get_buffer(GTK_TEXT_VIEW(gtkconv->imhtml));
+		GtkTextIter end;
+
+		gtk_text_buffer_get_end_iter(buffer, &end);
+		g_queue_push_tail(get_scrollback_marks(gtkconv),
+				gtk_text_buffer_create_mark(buffer, NULL, &end, TRUE));
+	}
+
 	/* First message in a conversation. */
 	if (gtkconv->newday == 0)
 		pidgin_conv_calculate_newday(gtkconv, mtime);
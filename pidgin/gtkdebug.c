@@ -48,12 +48,27 @@
 
 #include <gdk/gdkkeysyms.h>
 
+/* How many messages the debug window keeps, and shows at most */
+#define DEBUG_RING_SIZE 20000
+
+#ifdef USE_REGEX
+/* The columns of DebugWindow.store, one row per debug message */
+enum {
+	DEBUG_COLUMN_TIME,
+	DEBUG_COLUMN_LEVEL,
+	DEBUG_COLUMN_CATEGORY,
+	DEBUG_COLUMN_MESSAGE,
+	DEBUG_NUM_COLUMNS
+};
+#endif /* USE_REGEX */
+
 typedef struct
 {
 	GtkWidget *window;
 	GtkWidget *text;
 
 	GtkListStore *store;
+	int records;           /**< The number of rows in store */
 
 	gboolean paused;
 
@@ -88,6 +103,80 @@ static const char debug_fg_colors[][8] = {
 static DebugWindow *debug_win = NULL;
 static guint debug_enabled_timer = 0;
 
+static gchar *
+debug_format_markup(time_t mtime, PurpleDebugLevel level,
+                    const char *category, const char *message)
+{
+	gchar *esc_s, *cat_s, *s, *tmp;
+
+	if (category == NULL)
+		cat_s = g_strdup("");
+	else
+		cat_s = g_strdup_printf("<b>%s:</b> ", category);
+
+	esc_s = g_markup_escape_text(message, -1);
+
+	s = g_strdup_printf("<font color=\"%s\">(%s) %s%s</font>",
+						debug_fg_colors[level],
+						purple_utf8_strftime("%H:%M:%S", localtime(&mtime)),
+						cat_s, esc_s);
+
+	g_free(cat_s);
+	g_free(esc_s);
+
+	if (level == PURPLE_DEBUG_FATAL) {
+		tmp = g_strdup_printf("<b>%s</b>", s);
+		g_free(s);
+		s = tmp;
+	}
+
+	return s;
+}
+
+#ifdef USE_REGEX
+/* The text debug_format_markup() shows, which is what the regex sees */
+static gchar *
+debug_format_text(time_t mtime, const char *category, const char *message)
+{
+	return g_strdup_printf("(%s) %s%s%s",
+						   purple_utf8_strftime("%H:%M:%S", localtime(&mtime)),
+						   category ? category : "", category ? ": " : "",
+						   message);
+}
+
+static void
+debug_get_record(GtkTreeModel *model, GtkTreeIter *iter, time_t *mtime,
+                 PurpleDebugLevel *level, gchar **category, gchar **message)
+{
+	glong t;
+
+	gtk_tree_model_get(model, iter,
+					   DEBUG_COLUMN_TIME, &t,
+					   DEBUG_COLUMN_LEVEL, level,
+					   DEBUG_COLUMN_CATEGORY, category,
+					   DEBUG_COLUMN_MESSAGE, message,
+					   -1);
+	*mtime = t;
+}
+#endif /* USE_REGEX */
+
+/* Keeps the shown text to about as many lines as the window keeps
+ * messages, dropping the oldest in bursts of 100 lines. */
+static void
+debug_window_trim(DebugWindow *win)
+{
+	GtkTextBuffer *buffer = GTK_IMHTML(win->text)->text_buffer;
+	int lines = gtk_text_buffer_get_line_count(buffer);
+
+	if (lines > DEBUG_RING_SIZE + 100) {
+		GtkTextIter start, end;
+
+		gtk_text_buffer_get_start_iter(buffer, &start);
+		gtk_text_buffer_get_iter_at_line(buffer, &end, lines - DEBUG_RING_SIZE);
+		gtk_imhtml_delete(GTK_IMHTML(win->text), &start, &end);
+	}
+}
+
 #ifdef USE_REGEX
 static void regex_filter_all(DebugWindow *win);
 static void regex_show_all(DebugWindow *win);
@@ -219,22 +308,59 @@ find_cb(GtkWidget *w, DebugWindow *win)
 }
 #endif /* USE_REGEX */
 
+#ifdef USE_REGEX
+static gboolean regex_filtering(DebugWindow *win);
+static gboolean regex_test(DebugWindow *win, const gchar *text);
+#endif /* USE_REGEX */
+
 static void
 save_writefile_cb(void *user_data, const char *filename)
 {
 	DebugWindow *win = (DebugWindow *)user_data;
 	FILE *fp;
+#ifdef USE_REGEX
+	GtkTreeModel *model = GTK_TREE_MODEL(win->store);
+	GtkTreeIter iter;
+	gboolean valid, filtering;
+	PurpleDebugLevel filterlevel;
+#else
 	char *tmp;
+#endif /* USE_REGEX */
 
 	if ((fp = g_fopen(filename, "w+")) == NULL) {
 		purple_notify_error(win, NULL, _("Unable to open file."), NULL);
 		return;
 	}
 
-	tmp = gtk_imhtml_get_text(GTK_IMHTML(win->text), NULL, NULL);
 	fprintf(fp, "Pidgin Debug Log : %s\n", purple_date_format_full(NULL));
+
+#ifdef USE_REGEX
+	/* Write what the window shows a message at a time, rather than
+	 * building it all up as one string first. */
+	filterlevel = purple_prefs_get_int(PIDGIN_PREFS_ROOT "/debug/filterlevel");
+	filtering = regex_filtering(win);
+
+	for (valid = gtk_tree_model_get_iter_first(model, &iter); valid;
+	     valid = gtk_tree_model_iter_next(model, &iter)) {
+		time_t mtime;
+		PurpleDebugLevel level;
+		gchar *category, *message, *text;
+
+		debug_get_record(model, &iter, &mtime, &level, &category, &message);
+		if (level >= filterlevel) {
+			text = debug_format_text(mtime, category, message);
+			if (!filtering || regex_test(win, text))
+				fputs(text, fp);
+			g_free(text);
+		}
+		g_free(category);
+		g_free(message);
+	}
+#else
+	tmp = gtk_imhtml_get_text(GTK_IMHTML(win->text), NULL, NULL);
 	fprintf(fp, "%s", tmp);
 	g_free(tmp);
+#endif /* USE_REGEX */
 
 	fclose(fp);
 }
@@ -255,6 +381,7 @@ clear_cb(GtkWidget *w, DebugWindow *win)
 
 #ifdef USE_REGEX
 	gtk_list_store_clear(win->store);
+	win->records = 0;
 #endif /* USE_REGEX */
 }
 
@@ -303,8 +430,30 @@ regex_highlight_clear(DebugWindow *win) {
 	gtk_text_buffer_remove_tag_by_name(imhtml->text_buffer, "regex", &s, &e);
 }
 
+static gboolean
+regex_filtering(DebugWindow *win)
+{
+	return win->filter != NULL &&
+		gtk_toggle_tool_button_get_active(GTK_TOGGLE_TOOL_BUTTON(win->filter));
+}
+
+/* Whether the filter lets text through */
+static gboolean
+regex_test(DebugWindow *win, const gchar *text)
+{
+#ifdef HAVE_REGEX_H
+	return regexec(&win->regex, text, 0, NULL, 0) == (win->invert ? REG_NOMATCH : 0);
+#else
+	return win->regex != NULL &&
+		g_regex_match(win->regex, text, 0, NULL) != win->invert;
+#endif /* HAVE_REGEX_H */
+}
+
+/* text is the markup to show, and plaintext what it reads as; matching
+ * against the latter makes the ^ and $ operators work and gives us the
+ * offsets to highlight. */
 static void
-regex_match(DebugWindow *win, const gchar *text) {
+regex_match(DebugWindow *win, const gchar *text, const gchar *plaintext) {
 	GtkIMHtml *imhtml = GTK_IMHTML(win->text);
 #ifdef HAVE_REGEX_H
 	regmatch_t matches[4]; /* adjust if necessary */
@@ -313,16 +462,10 @@ regex_match(DebugWindow *win, const gchar *text) {
 #else
 	GMatchInfo *match_info;
 #endif /* HAVE_REGEX_H */
-	gchar *plaintext;
 
 	if(!text)
 		return;
 
-	/* I don't like having to do this, but we need it for highlighting.  Plus
-	 * it makes the ^ and $ operators work :)
-	 */
-	plaintext = purple_markup_strip_html(text);
-
 	/* we do a first pass to see if it matches at all.  If it does we append
 	 * it, and work out the offsets to highlight.
 	 */
@@ -332,7 +475,7 @@ regex_match(DebugWindow *win, const gchar *text) {
 #else
 	if(g_regex_match(win->regex, plaintext, 0, &match_info) != win->invert) {
 #endif /* HAVE_REGEX_H */
-		gchar *p = plaintext;
+		const gchar *p = plaintext;
 		GtkTextIter ins;
 		gint i, offset = 0;
 
@@ -346,7 +489,6 @@ regex_match(DebugWindow *win, const gchar *text) {
 		 * done and move on.
 		 */
 		if(!win->highlight || win->invert) {
-			g_free(plaintext);
 #ifndef HAVE_REGEX_H
 			g_match_info_free(match_info);
 #endif
@@ -415,64 +557,73 @@ regex_match(DebugWindow *win, const gchar *text) {
 		g_match_info_free(match_info);
 #endif /* HAVE_REGEX_H */
 	}
-
-	g_free(plaintext);
+#ifndef HAVE_REGEX_H
+	else
+		g_match_info_free(match_info);
+#endif
 }
 
-static gboolean
-regex_filter_all_cb(GtkTreeModel *m, GtkTreePath *p, GtkTreeIter *iter,
-				    gpointer data)
-{
-	DebugWindow *win = (DebugWindow *)data;
-	gchar *text;
-	PurpleDebugLevel level;
+/* Redraws the window from the stored messages.  Unless matches have to be
+ * highlighted one message at a time, everything shown goes in with a
+ * single append. */
+static void
+regex_redraw(DebugWindow *win, gboolean filter) {
+	GtkTreeModel *model = GTK_TREE_MODEL(win->store);
+	GtkTreeIter iter;
+	GString *str = g_string_new(NULL);
+	gboolean valid, highlight = filter && win->highlight && !win->invert;
+	PurpleDebugLevel filterlevel;
 
-	gtk_tree_model_get(m, iter, 0, &text, 1, &level, -1);
+	gtk_imhtml_clear(GTK_IMHTML(win->text));
 
-	if (level >= (PurpleDebugLevel)purple_prefs_get_int(PIDGIN_PREFS_ROOT "/debug/filterlevel"))
-		regex_match(win, text);
+	if(win->highlight)
+		regex_highlight_clear(win);
 
-	g_free(text);
+	filterlevel = purple_prefs_get_int(PIDGIN_PREFS_ROOT "/debug/filterlevel");
 
-	return FALSE;
-}
+	for (valid = gtk_tree_model_get_iter_first(model, &iter); valid;
+	     valid = gtk_tree_model_iter_next(model, &iter)) {
+		time_t mtime;
+		PurpleDebugLevel level;
+		gchar *category, *message, *markup, *text = NULL;
 
-static void
-regex_filter_all(DebugWindow *win) {
-	gtk_imhtml_clear(GTK_IMHTML(win->text));
+		debug_get_record(model, &iter, &mtime, &level, &category, &message);
+		if (level < filterlevel) {
+			g_free(category);
+			g_free(message);
+			continue;
+		}
 
-	if(win->highlight)
-		regex_highlight_clear(win);
+		if (filter)
+			text = debug_format_text(mtime, category, message);
 
-	gtk_tree_model_foreach(GTK_TREE_MODEL(win->store), regex_filter_all_cb,
-						   win);
-}
+		if (!filter || regex_test(win, text)) {
+			markup = debug_format_markup(mtime, level, category, message);
+			if (highlight)
+				regex_match(win, markup, text);
+			else
+				g_string_append(str, markup);
+			g_free(markup);
+		}
 
-static gboolean
-regex_show_all_cb(GtkTreeModel *m, GtkTreePath *p, GtkTreeIter *iter,
-				  gpointer data)
-{
-	DebugWindow *win = (DebugWindow *)data;
-	gchar *text;
-	PurpleDebugLevel level;
+		g_free(text);
+		g_free(category);
+		g_free(message);
+	}
 
-	gtk_tree_model_get(m, iter, 0, &text, 1, &level, -1);
-	if (level >= (PurpleDebugLevel)purple_prefs_get_int(PIDGIN_PREFS_ROOT "/debug/filterlevel"))
-		gtk_imhtml_append_text(GTK_IMHTML(win->text), text, 0);
-	g_free(text);
+	if (str->len > 0)
+		gtk_imhtml_append_text(GTK_IMHTML(win->text), str->str, 0);
+	g_string_free(str, TRUE);
+}
 
-	return FALSE;
+static void
+regex_filter_all(DebugWindow *win) {
+	regex_redraw(win, TRUE);
 }
 
 static void
 regex_show_all(DebugWindow *win) {
-	gtk_imhtml_clear(GTK_IMHTML(win->text));
-
-	if(win->highlight)
-		regex_highlight_clear(win);
-
-	gtk_tree_model_foreach(GTK_TREE_MODEL(win->store), regex_show_all_cb,
-						   win);
+	regex_redraw(win, FALSE);
 }
 
 static void
@@ -567,8 +718,9 @@ static void
 regex_row_changed_cb(GtkTreeModel *model, GtkTreePath *path,
 					 GtkTreeIter *iter, DebugWindow *win)
 {
-	gchar *text;
+	time_t mtime;
 	PurpleDebugLevel level;
+	gchar *category, *message, *markup;
 
 	if(!win || !win->window)
 		return;
@@ -582,17 +734,23 @@ regex_row_changed_cb(GtkTreeModel *model, GtkTreePath *path,
 	if(win->paused)
 		return;
 
-	gtk_tree_model_get(model, iter, 0, &text, 1, &level, -1);
+	debug_get_record(model, iter, &mtime, &level, &category, &message);
 
 	if (level >= (PurpleDebugLevel)purple_prefs_get_int(PIDGIN_PREFS_ROOT "/debug/filterlevel")) {
-		if(gtk_toggle_tool_button_get_active(GTK_TOGGLE_TOOL_BUTTON(win->filter))) {
-			regex_match(win, text);
+		markup = debug_format_markup(mtime, level, category, message);
+		if(regex_filtering(win)) {
+			gchar *text = debug_format_text(mtime, category, message);
+			regex_match(win, markup, text);
+			g_free(text);
 		} else {
-			gtk_imhtml_append_text(GTK_IMHTML(win->text), text, 0);
+			gtk_imhtml_append_text(GTK_IMHTML(win->text), markup, 0);
 		}
+		g_free(markup);
+		debug_window_trim(win);
 	}
 
-	g_free(text);
+	g_free(category);
+	g_free(message);
 }
 
 static gboolean
@@ -767,7 +925,8 @@ debug_window_new(void)
 
 #ifdef USE_REGEX
 	/* the list store for all the messages */
-	win->store = gtk_list_store_new(2, G_TYPE_STRING, G_TYPE_INT);
+	win->store = gtk_list_store_new(DEBUG_NUM_COLUMNS, G_TYPE_LONG, G_TYPE_INT,
+	                                G_TYPE_STRING, G_TYPE_STRING);
 
 	/* row-changed gets called when we do gtk_list_store_set, and row-inserted
 	 * gets called with gtk_list_store_append, which is a
@@ -1135,10 +1294,10 @@ pidgin_debug_print(PurpleDebugLevel level, const char *category,
 {
 #ifdef USE_REGEX
 	GtkTreeIter iter;
+#else
+	gchar *s;
 #endif /* USE_REGEX */
-	gchar *ts_s;
-	gchar *esc_s, *cat_s, *tmp, *s;
-	const char *mdate;
+	gchar *cat_s = NULL, *msg_s;
 	time_t mtime;
 
 	if (debug_win == NULL ||
@@ -1148,42 +1307,37 @@ pidgin_debug_print(PurpleDebugLevel level, const char *category,
 	}
 
 	mtime = time(NULL);
-	mdate = purple_utf8_strftime("%H:%M:%S", localtime(&mtime));
-	ts_s = g_strdup_printf("(%s) ", mdate);
-	if (category == NULL)
-		cat_s = g_strdup("");
-	else
-		cat_s = g_strdup_printf("<b>%s:</b> ", category);
-
-	esc_s = g_markup_escape_text(arg_s, -1);
-
-	s = g_strdup_printf("<font color=\"%s\">%s%s%s</font>",
-						debug_fg_colors[level], ts_s, cat_s, esc_s);
-
-	g_free(ts_s);
-	g_free(cat_s);
-	g_free(esc_s);
-
-	tmp = purple_utf8_try_convert(s);
-	g_free(s);
-	s = tmp;
-
-	if (level == PURPLE_DEBUG_FATAL) {
-		tmp = g_strdup_printf("<b>%s</b>", s);
-		g_free(s);
-		s = tmp;
-	}
+	if (category != NULL)
+		cat_s = purple_utf8_try_convert(category);
+	msg_s = purple_utf8_try_convert(arg_s);
 
 #ifdef USE_REGEX
-	/* add the text to the list store */
+	/* add the message to the list store, dropping the oldest once it's
+	 * full */
 	gtk_list_store_append(debug_win->store, &iter);
-	gtk_list_store_set(debug_win->store, &iter, 0, s, 1, level, -1);
+	gtk_list_store_set(debug_win->store, &iter,
+					   DEBUG_COLUMN_TIME, (glong)mtime,
+					   DEBUG_COLUMN_LEVEL, level,
+					   DEBUG_COLUMN_CATEGORY, cat_s,
+					   DEBUG_COLUMN_MESSAGE, msg_s,
+					   -1);
+
+	if (++debug_win->records > DEBUG_RING_SIZE &&
+			gtk_tree_model_get_iter_first(GTK_TREE_MODEL(debug_win->store), &iter)) {
+		gtk_list_store_remove(debug_win->store, &iter);
+		debug_win->records--;
+	}
 #else /* USE_REGEX */
-	if(!debug_win->paused && level >= purple_prefs_get_int(PIDGIN_PREFS_ROOT "/debug/filterlevel"))
+	if(!debug_win->paused && level >= purple_prefs_get_int(PIDGIN_PREFS_ROOT "/debug/filterlevel")) {
+		s = debug_format_markup(mtime, level, cat_s, msg_s);
 		gtk_imhtml_append_text(GTK_IMHTML(debug_win->text), s, 0);
+		g_free(s);
+		debug_window_trim(debug_win);
+	}
 #endif /* !USE_REGEX */
 
-	g_free(s);
+	g_free(cat_s);
+	g_free(msg_s);
 }
 
 static gboolean
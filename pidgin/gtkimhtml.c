@@ -173,6 +173,7 @@ enum {
 	LAST_SIGNAL
 };
 static guint signals [LAST_SIGNAL] = { 0 };
+static GQuark smiley_table_quark;
 
 static char *html_clipboard = NULL;
 static char *text_clipboard = NULL;
@@ -1576,6 +1577,7 @@ static void gtk_imhtml_class_init (GtkIMHtmlClass *klass)
 	GObjectClass   *gobject_class;
 	gobject_class = (GObjectClass*) klass;
 	parent_class = g_type_class_ref(GTK_TYPE_TEXT_VIEW);
+	smiley_table_quark = g_quark_from_static_string("gtkimhtml-smiley-table");
 	signals[URL_CLICKED] = g_signal_new("url_clicked",
 						G_TYPE_FROM_CLASS(gobject_class),
 						G_SIGNAL_RUN_FIRST,
@@ -2246,13 +2248,121 @@ gtk_imhtml_associate_smiley (GtkIMHtml       *imhtml,
 		smiley);
 }
 
+/*
+ * A smiley theme compiled once and shared by every GtkIMHtml showing it.
+ * The trees are never changed after the table is handed to a widget, so
+ * themeizing a conversation is just taking a reference.  The widget's own
+ * trees (imhtml->smiley_data and imhtml->default_smilies) hold whatever is
+ * added on top, like custom smileys, and are looked at first.
+ */
+struct _GtkIMHtmlSmileyTable {
+	int ref;
+	GHashTable *trees;            /* sml -> GtkSmileyTree */
+	GtkSmileyTree *default_tree;
+	guint32 starts[256 / 32];     /* first bytes of the smileys in the table */
+};
+
+#define SMILEY_TABLE_STARTS(table, c) \
+	((table)->starts[(guchar)(c) / 32] & (1u << ((guchar)(c) % 32)))
+
+GtkIMHtmlSmileyTable *
+gtk_imhtml_smiley_table_new(void)
+{
+	GtkIMHtmlSmileyTable *table = g_new0(GtkIMHtmlSmileyTable, 1);
+
+	table->ref = 1;
+	table->trees = g_hash_table_new_full(g_str_hash, g_str_equal,
+			g_free, (GDestroyNotify)gtk_smiley_tree_destroy);
+	table->default_tree = gtk_smiley_tree_new();
+
+	/* The text is matched with its entities unescaped, so anything
+	 * starting with one has to be looked up. */
+	table->starts['&' / 32] |= 1u << ('&' % 32);
+
+	return table;
+}
+
+GtkIMHtmlSmileyTable *
+gtk_imhtml_smiley_table_ref(GtkIMHtmlSmileyTable *table)
+{
+	g_return_val_if_fail(table != NULL, NULL);
+
+	table->ref++;
+	return table;
+}
+
+void
+gtk_imhtml_smiley_table_unref(GtkIMHtmlSmileyTable *table)
+{
+	g_return_if_fail(table != NULL);
+
+	if (--table->ref > 0)
+		return;
+
+	g_hash_table_destroy(table->trees);
+	gtk_smiley_tree_destroy(table->default_tree);
+	g_free(table);
+}
+
+void
+gtk_imhtml_smiley_table_add(GtkIMHtmlSmileyTable *table, const gchar *sml,
+		GtkIMHtmlSmiley *smiley)
+{
+	GtkSmileyTree *tree;
+	guchar c;
+
+	g_return_if_fail(table != NULL);
+	g_return_if_fail(smiley != NULL && smiley->smile != NULL);
+
+	if (sml == NULL)
+		tree = table->default_tree;
+	else if (!(tree = g_hash_table_lookup(table->trees, sml))) {
+		tree = gtk_smiley_tree_new();
+		g_hash_table_insert(table->trees, g_strdup(sml), tree);
+	}
+
+	gtk_smiley_tree_insert(tree, smiley);
+
+	c = smiley->smile[0];
+	table->starts[c / 32] |= 1u << (c % 32);
+}
+
+void
+gtk_imhtml_set_smiley_table(GtkIMHtml *imhtml, GtkIMHtmlSmileyTable *table)
+{
+	g_return_if_fail(imhtml != NULL);
+	g_return_if_fail(GTK_IS_IMHTML(imhtml));
+
+	if (table)
+		gtk_imhtml_smiley_table_ref(table);
+
+	g_object_set_qdata_full(G_OBJECT(imhtml), smiley_table_quark, table,
+			(GDestroyNotify)gtk_imhtml_smiley_table_unref);
+}
+
+/* Finds the widget's own tree and the shared tree for sml.  As before the
+ * table existed, a category with no smileys of its own uses the defaults. */
+static void
+gtk_imhtml_get_smiley_trees(GtkIMHtml *imhtml, const char *sml,
+		GtkIMHtmlSmileyTable *table, GtkSmileyTree **own, GtkSmileyTree **shared)
+{
+	*own = sml ? g_hash_table_lookup(imhtml->smiley_data, sml) : NULL;
+	*shared = (sml && table) ? g_hash_table_lookup(table->trees, sml) : NULL;
+
+	if (*own == NULL && *shared == NULL) {
+		*own = imhtml->default_smilies;
+		*shared = table ? table->default_tree : NULL;
+	}
+}
+
 static gboolean
 gtk_imhtml_is_smiley (GtkIMHtml   *imhtml,
 		      GSList      *fonts,
 		      const gchar *text,
 		      gint        *len)
 {
-	GtkSmileyTree *tree;
+	GtkIMHtmlSmileyTable *table;
+	GtkSmileyTree *own, *shared;
 	GtkIMHtmlFontDetail *font;
 	char *sml = NULL;
 
@@ -2264,13 +2374,18 @@ gtk_imhtml_is_smiley (GtkIMHtml   *imhtml,
 	if (!sml)
 		sml = imhtml->protocol_name;
 
-	if (!sml || !(tree = g_hash_table_lookup(imhtml->smiley_data, sml)))
-		tree = imhtml->default_smilies;
+	table = g_object_get_qdata(G_OBJECT(imhtml), smiley_table_quark);
+	gtk_imhtml_get_smiley_trees(imhtml, sml, table, &own, &shared);
 
-	if (tree == NULL)
-		return FALSE;
+	*len = own ? gtk_smiley_tree_lookup(own, text) : 0;
+
+	/* Most of the text can't start a smiley; skip the walk for that. */
+	if (shared && SMILEY_TABLE_STARTS(table, *text)) {
+		gint shared_len = gtk_smiley_tree_lookup(shared, text);
+		if (shared_len > *len)
+			*len = shared_len;
+	}
 
-	*len = gtk_smiley_tree_lookup (tree, text);
 	return (*len > 0);
 }
 
@@ -2300,17 +2415,26 @@ static GtkIMHtmlSmiley *gtk_imhtml_smiley_get_from_tree(GtkSmileyTree *t, const
 GtkIMHtmlSmiley *
 gtk_imhtml_smiley_get(GtkIMHtml *imhtml, const gchar *sml, const gchar *text)
 {
+	GtkIMHtmlSmileyTable *table;
 	GtkIMHtmlSmiley *ret;
 
+	table = g_object_get_qdata(G_OBJECT(imhtml), smiley_table_quark);
+
 	/* Look for custom smileys first */
 	if (sml != NULL) {
 		ret = gtk_imhtml_smiley_get_from_tree(g_hash_table_lookup(imhtml->smiley_data, sml), text);
+		if (ret == NULL && table != NULL)
+			ret = gtk_imhtml_smiley_get_from_tree(g_hash_table_lookup(table->trees, sml), text);
 		if (ret != NULL)
 			return ret;
 	}
 
 	/* Fall back to check for default smileys */
-	return gtk_imhtml_smiley_get_from_tree(imhtml->default_smilies, text);
+	ret = gtk_imhtml_smiley_get_from_tree(imhtml->default_smilies, text);
+	if (ret == NULL && table != NULL)
+		ret = gtk_imhtml_smiley_get_from_tree(table->default_tree, text);
+
+	return ret;
 }
 
 static GdkPixbufAnimation *
@@ -2967,7 +3091,7 @@ void gtk_imhtml_insert_html_at_iter(GtkIMHtml        *imhtml,
 					minus = gtk_text_view_get_left_margin(GTK_TEXT_VIEW(imhtml)) +
 					        gtk_text_view_get_right_margin(GTK_TEXT_VIEW(imhtml));
 					scalable->scale(scalable, rect.width - minus, rect.height);
-					imhtml->scalables = g_list_append(imhtml->scalables, sd);
+					imhtml->scalables = g_list_prepend(imhtml->scalables, sd);
 					ws[0] = '\0';
 					wpos = 0;
 					ws[wpos++] = '\n';
@@ -3613,6 +3737,7 @@ void gtk_imhtml_insert_html_at_iter(GtkIMHtml        *imhtml,
 
 void gtk_imhtml_remove_smileys(GtkIMHtml *imhtml)
 {
+	gtk_imhtml_set_smiley_table(imhtml, NULL);
 	g_hash_table_destroy(imhtml->smiley_data);
 	gtk_smiley_tree_destroy(imhtml->default_smilies);
 	imhtml->smiley_data = g_hash_table_new_full(g_str_hash, g_str_equal,
@@ -4450,12 +4575,29 @@ static void insert_cb(GtkTextBuffer *buffer, GtkTextIter *end, gchar *text, gint
 	}
 }
 
+/* Images and rules sit in the buffer as U+FFFC, so a range without one
+ * can't hold anything from imhtml->scalables or imhtml->im_images. */
+static gboolean
+range_has_object(const GtkTextIter *start, const GtkTextIter *end)
+{
+	GtkTextIter i = *start;
+
+	while (gtk_text_iter_compare(&i, end) < 0) {
+		if (gtk_text_iter_get_char(&i) == 0xFFFC)
+			return TRUE;
+		gtk_text_iter_forward_char(&i);
+	}
+
+	return FALSE;
+}
+
 static void delete_cb(GtkTextBuffer *buffer, GtkTextIter *start, GtkTextIter *end, GtkIMHtml *imhtml)
 {
 	PidginConversation *gtkconv;
 	GList *l;
 	GSList *tags, *sl;
 	GtkTextIter i;
+	gboolean objects;
 
 	/* clean up tags */
 	tags = gtk_text_iter_get_tags(start);
@@ -4476,8 +4618,12 @@ static void delete_cb(GtkTextBuffer *buffer, GtkTextIter *start, GtkTextIter *en
 	}
 	g_slist_free(tags);
 
+	/* Trimming scrollback deletes from the top on every new message, so
+	 * don't walk every image in the buffer unless this range has one. */
+	objects = range_has_object(start, end);
+
 	/* remove scalables */
-	l = imhtml->scalables;
+	l = objects ? imhtml->scalables : NULL;
 	while (l) {
 		GList *next = l->next;
 		struct scalable_data *sd = l->data;
@@ -4493,7 +4639,7 @@ static void delete_cb(GtkTextBuffer *buffer, GtkTextIter *start, GtkTextIter *en
 	}
 
 	/* remove images */
-	sl = imhtml->im_images;
+	sl = objects ? imhtml->im_images : NULL;
 	while (sl) {
 		GSList *next = sl->next;
 		struct im_image_data *img_data = sl->data;
@@ -5237,7 +5383,7 @@ void gtk_imhtml_insert_image_at_iter(GtkIMHtml *imhtml, int id, GtkTextIter *ite
 	minus = gtk_text_view_get_left_margin(GTK_TEXT_VIEW(imhtml)) +
 		gtk_text_view_get_right_margin(GTK_TEXT_VIEW(imhtml));
 	scalable->scale(scalable, rect.width - minus, rect.height);
-	imhtml->scalables = g_list_append(imhtml->scalables, sd);
+	imhtml->scalables = g_list_prepend(imhtml->scalables, sd);
 }
 
 static const gchar *tag_to_html_start(GtkTextTag *tag)
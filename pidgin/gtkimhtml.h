@@ -61,6 +61,12 @@ typedef struct _GtkIMHtmlAnimation	GtkIMHtmlAnimation;
 typedef struct _GtkIMHtmlHr			GtkIMHtmlHr;
 typedef struct _GtkIMHtmlFuncs		GtkIMHtmlFuncs;
 
+/**
+ * A set of smileys that can be shared by many GTK+ IM/HTMLs.
+ * @since 2.15.0
+ */
+typedef struct _GtkIMHtmlSmileyTable	GtkIMHtmlSmileyTable;
+
 /**
  * @since 2.6.0
  */
@@ -323,12 +329,64 @@ GtkIMHtmlSmiley *gtk_imhtml_smiley_get(GtkIMHtml * imhtml,
 void gtk_imhtml_associate_smiley(GtkIMHtml *imhtml, const gchar *sml, GtkIMHtmlSmiley *smiley);
 
 /**
- * Removes all smileys associated with a GTK+ IM/HTML.
+ * Removes all smileys associated with a GTK+ IM/HTML, including its
+ * smiley table.
  *
  * @param imhtml The GTK+ IM/HTML.
  */
 void gtk_imhtml_remove_smileys(GtkIMHtml *imhtml);
 
+/**
+ * Creates an empty smiley table.
+ *
+ * @return The new table, with a reference count of one.
+ * @since 2.15.0
+ */
+GtkIMHtmlSmileyTable *gtk_imhtml_smiley_table_new(void);
+
+/**
+ * Adds a reference to a smiley table.
+ *
+ * @param table The smiley table.
+ *
+ * @return @a table
+ * @since 2.15.0
+ */
+GtkIMHtmlSmileyTable *gtk_imhtml_smiley_table_ref(GtkIMHtmlSmileyTable *table);
+
+/**
+ * Removes a reference from a smiley table, freeing it when the last one
+ * is gone.  The smileys in it are not freed.
+ *
+ * @param table The smiley table.
+ * @since 2.15.0
+ */
+void gtk_imhtml_smiley_table_unref(GtkIMHtmlSmileyTable *table);
+
+/**
+ * Adds a smiley to a smiley table.  This should only be done before the
+ * table is given to any GTK+ IM/HTML.
+ *
+ * @param table  The smiley table.
+ * @param sml    The name of the smiley category, or @c NULL for the default.
+ * @param smiley The smiley to add.
+ * @since 2.15.0
+ */
+void gtk_imhtml_smiley_table_add(GtkIMHtmlSmileyTable *table, const gchar *sml,
+                                 GtkIMHtmlSmiley *smiley);
+
+/**
+ * Sets the smiley table a GTK+ IM/HTML uses.  Smileys associated with the
+ * GTK+ IM/HTML by gtk_imhtml_associate_smiley() are matched first, then
+ * the ones in the table.
+ *
+ * @param imhtml The GTK+ IM/HTML.
+ * @param table  The smiley table, or @c NULL to stop using one.  The
+ *               GTK+ IM/HTML takes its own reference.
+ * @since 2.15.0
+ */
+void gtk_imhtml_set_smiley_table(GtkIMHtml *imhtml, GtkIMHtmlSmileyTable *table);
+
 /**
  * Sets the function callbacks to use with a GTK+ IM/HTML instance.
  *
@@ -127,6 +127,7 @@ static void search_cb(GtkWidget *button, PidginLogViewer *lv)
 
 	if (!(*search_term)) {
 		/* reset the tree */
+		g_object_set_data(G_OBJECT(lv->imhtml), "log-render", NULL);
 		gtk_tree_store_clear(lv->treestore);
 		populate_log_tree(lv);
 		g_free(lv->search);
@@ -149,6 +150,7 @@ static void search_cb(GtkWidget *button, PidginLogViewer *lv)
 	lv->search = g_strdup(search_term);
 
 	gtk_tree_store_clear(lv->treestore);
+	g_object_set_data(G_OBJECT(lv->imhtml), "log-render", NULL);
 	gtk_imhtml_clear(GTK_IMHTML(lv->imhtml));
 
 	for (logs = lv->logs; logs != NULL; logs = logs->next) {
@@ -424,6 +426,128 @@ static gboolean search_find_cb(gpointer data)
 	return FALSE;
 }
 
+static void log_search_after_render(PidginLogViewer *viewer)
+{
+	guint source;
+
+	if (viewer->search == NULL)
+		return;
+
+	gtk_imhtml_search_clear(GTK_IMHTML(viewer->imhtml));
+	source = g_idle_add(search_find_cb, viewer);
+	g_object_set_data_full(G_OBJECT(viewer->entry), "search-find-cb",
+	                       GINT_TO_POINTER(source), (GDestroyNotify)g_source_remove);
+}
+
+/*
+ * A log being put into the viewer.  Parsing a big log into the GtkIMHtml
+ * in one go blocks the UI for seconds, so it goes in LOG_RENDER_CHUNK
+ * bytes at a time: the top of the log, which is what the viewer shows,
+ * right away and the rest from an idle callback.  Each append closes
+ * whatever tags are still open, so chunks only end after a line break.
+ */
+#define LOG_RENDER_CHUNK (32 * 1024)
+
+struct log_render {
+	PidginLogViewer *viewer;
+	char *text;
+	char *pos;         /* what's left to append */
+	char *end;
+	GtkIMHtmlOptions options;
+	guint source;
+};
+
+static void log_render_free(struct log_render *render)
+{
+	if (render->source)
+		g_source_remove(render->source);
+	g_free(render->text);
+	g_free(render);
+}
+
+/*
+ * Finds the end of the first line at or after from that ends in a line
+ * break.  Without GTK_IMHTML_NO_NEWLINE every newline is one.  HTML logs
+ * end each message with "<br>" (or "<br/>" in older logs) and a newline,
+ * while newlines inside a message may be in the middle of its markup.
+ */
+static char *log_render_boundary(struct log_render *render, char *from)
+{
+	char *nl;
+
+	for (nl = strchr(from, '\n'); nl; nl = strchr(nl + 1, '\n')) {
+		if (!(render->options & GTK_IMHTML_NO_NEWLINE))
+			return nl + 1;
+		if (nl - render->pos >= 4 && !g_ascii_strncasecmp(nl - 4, "<br>", 4))
+			return nl + 1;
+		if (nl - render->pos >= 5 && !g_ascii_strncasecmp(nl - 5, "<br/>", 5))
+			return nl + 1;
+	}
+
+	return NULL;
+}
+
+/* Appends the next chunk; returns whether there's more */
+static gboolean log_render_next(struct log_render *render)
+{
+	char *end, save;
+
+	if (render->end - render->pos <= LOG_RENDER_CHUNK ||
+			(end = log_render_boundary(render, render->pos + LOG_RENDER_CHUNK)) == NULL)
+		end = render->end;
+
+	save = *end;
+	*end = '\0';
+	gtk_imhtml_append_text(GTK_IMHTML(render->viewer->imhtml), render->pos,
+	                       render->options);
+	*end = save;
+	render->pos = end;
+
+	return end != render->end;
+}
+
+static gboolean log_render_cb(gpointer data)
+{
+	struct log_render *render = data;
+	PidginLogViewer *viewer = render->viewer;
+
+	if (log_render_next(render))
+		return TRUE;
+
+	render->source = 0;
+	g_object_set_data(G_OBJECT(viewer->imhtml), "log-render", NULL);
+	log_search_after_render(viewer);
+
+	return FALSE;
+}
+
+/* Takes ownership of text */
+static void log_render(PidginLogViewer *viewer, char *text, GtkIMHtmlOptions options)
+{
+	struct log_render *render;
+
+	if (text == NULL) {
+		log_search_after_render(viewer);
+		return;
+	}
+
+	render = g_new0(struct log_render, 1);
+	render->viewer = viewer;
+	render->text = render->pos = text;
+	render->end = text + strlen(text);
+	render->options = options;
+
+	if (!log_render_next(render)) {
+		log_render_free(render);
+		log_search_after_render(viewer);
+		return;
+	}
+
+	render->source = g_idle_add(log_render_cb, render);
+	g_object_set_data_full(G_OBJECT(viewer->imhtml), "log-render", render,
+	                       (GDestroyNotify)log_render_free);
+}
+
 static void log_select_cb(GtkTreeSelection *sel, PidginLogViewer *viewer) {
 	GtkTreeIter iter;
 	GValue val;
@@ -461,24 +585,18 @@ static void log_select_cb(GtkTreeSelection *sel, PidginLogViewer *viewer) {
 	read = purple_log_read(log, &flags);
 	viewer->flags = flags;
 
+	/* Stop putting in whatever log was selected before */
+	g_object_set_data(G_OBJECT(viewer->imhtml), "log-render", NULL);
+
 	gtk_imhtml_clear(GTK_IMHTML(viewer->imhtml));
 	gtk_imhtml_set_protocol_name(GTK_IMHTML(viewer->imhtml),
 	                            purple_account_get_protocol_name(log->account));
 
 	purple_signal_emit(pidgin_log_get_handle(), "log-displaying", viewer, log);
 
-	gtk_imhtml_append_text(GTK_IMHTML(viewer->imhtml), read,
+	log_render(viewer, read,
 			       GTK_IMHTML_NO_COMMENTS | GTK_IMHTML_NO_TITLE | GTK_IMHTML_NO_SCROLL |
 			       ((flags & PURPLE_LOG_READ_NO_NEWLINE) ? GTK_IMHTML_NO_NEWLINE : 0));
-	g_free(read);
-
-	if (viewer->search != NULL) {
-		guint source;
-		gtk_imhtml_search_clear(GTK_IMHTML(viewer->imhtml));
-		source = g_idle_add(search_find_cb, viewer);
-		g_object_set_data_full(G_OBJECT(viewer->entry), "search-find-cb",
-		                       GINT_TO_POINTER(source), (GDestroyNotify)g_source_remove);
-	}
 
 	pidgin_clear_cursor(viewer->window);
 }
@@ -37,8 +37,44 @@
 GSList *smiley_themes = NULL;
 struct smiley_theme *current_smiley_theme;
 
+/* The current theme's smileys, shared by every conversation */
+static GtkIMHtmlSmileyTable *smiley_table = NULL;
+static struct smiley_theme *smiley_table_theme = NULL;
+
 static void pidgin_themes_destroy_smiley_theme_smileys(struct smiley_theme *theme);
 
+static void
+smiley_table_invalidate(void)
+{
+	if (smiley_table)
+		gtk_imhtml_smiley_table_unref(smiley_table);
+	smiley_table = NULL;
+	smiley_table_theme = NULL;
+}
+
+static GtkIMHtmlSmileyTable *
+smiley_table_get(void)
+{
+	struct smiley_list *list;
+
+	if (smiley_table && smiley_table_theme == current_smiley_theme)
+		return smiley_table;
+
+	smiley_table_invalidate();
+	smiley_table = gtk_imhtml_smiley_table_new();
+	smiley_table_theme = current_smiley_theme;
+
+	for (list = current_smiley_theme->list; list; list = list->next) {
+		char *sml = purple_strequal(list->sml, "default") ? NULL : list->sml;
+		GSList *icons;
+
+		for (icons = list->smileys; icons; icons = icons->next)
+			gtk_imhtml_smiley_table_add(smiley_table, sml, icons->data);
+	}
+
+	return smiley_table;
+}
+
 gboolean pidgin_themes_smileys_disabled()
 {
 	if (!current_smiley_theme)
@@ -127,14 +163,12 @@ static void _pidgin_themes_smiley_themeize(GtkWidget *imhtml, gboolean custom)
 		return;
 
 	gtk_imhtml_remove_smileys(GTK_IMHTML(imhtml));
+	gtk_imhtml_set_smiley_table(GTK_IMHTML(imhtml), smiley_table_get());
+
 	list = current_smiley_theme->list;
 	while (list) {
 		char *sml = purple_strequal(list->sml, "default") ? NULL : list->sml;
-		GSList *icons = list->smileys;
-		while (icons) {
-			gtk_imhtml_associate_smiley(GTK_IMHTML(imhtml), sml, icons->data);
-			icons = icons->next;
-		}
+		GSList *icons;
 
 		if (custom == TRUE) {
 			icons = pidgin_smileys_get_all();
@@ -165,6 +199,9 @@ pidgin_themes_destroy_smiley_theme_smileys(struct smiley_theme *theme)
 	GHashTable *already_freed;
 	struct smiley_list *wer;
 
+	if (theme == smiley_table_theme)
+		smiley_table_invalidate();
+
 	already_freed = g_hash_table_new_full(g_direct_hash, g_direct_equal, g_free,
 	                                      NULL);
 	for (wer = theme->list; wer != NULL; wer = theme->list) {
@@ -368,6 +405,9 @@ void pidgin_themes_load_smiley_theme(const char *file, gboolean load)
 		return;
 	}
 
+	if (load || theme == smiley_table_theme)
+		smiley_table_invalidate();
+
 	if (load) {
 		GList *cnv;
 
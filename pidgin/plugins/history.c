@@ -22,6 +22,11 @@
 
 #define HISTORY_SIZE (4 * 1024)
 
+/* Conversations waiting for their history, mapped to the idle source
+ * that will put it in.  Looking the logs up means listing and reading
+ * files, so it's left until after the conversation window is up. */
+static GHashTable *pending = NULL;
+
 static gboolean _scroll_imhtml_to_end(gpointer data)
 {
 	GtkIMHtml *imhtml = data;
@@ -45,6 +50,7 @@ static void historize(PurpleConversation *c)
 	char *protocol;
 	char *escaped_alias;
 	const char *header_date;
+	GtkTextIter iter;
 
 	convtype = purple_conversation_get_type(c);
 	gtkconv = PIDGIN_CONVERSATION(c);
@@ -115,7 +121,12 @@ static void historize(PurpleConversation *c)
 	if (logs == NULL)
 		return;
 
-	history = purple_log_read((PurpleLog*)logs->data, &flags);
+	history = purple_log_read_tail((PurpleLog*)logs->data, HISTORY_SIZE, &flags);
+	if (history == NULL) {
+		g_list_free_full(logs, (GDestroyNotify)purple_log_free);
+		return;
+	}
+
 	gtkconv = PIDGIN_CONVERSATION(c);
 	if (flags & PURPLE_LOG_READ_NO_NEWLINE)
 		options |= GTK_IMHTML_NO_NEWLINE;
@@ -124,8 +135,9 @@ static void historize(PurpleConversation *c)
 	gtk_imhtml_set_protocol_name(GTK_IMHTML(gtkconv->imhtml),
 			purple_account_get_protocol_name(((PurpleLog*)logs->data)->account));
 
-	if (gtk_text_buffer_get_char_count(gtk_text_view_get_buffer(GTK_TEXT_VIEW(gtkconv->imhtml))))
-		gtk_imhtml_append_text(GTK_IMHTML(gtkconv->imhtml), "<BR>", options);
+	/* Messages may have come in since the conversation was created, so the
+	 * history goes in above them. */
+	gtk_text_buffer_get_start_iter(GTK_IMHTML(gtkconv->imhtml)->text_buffer, &iter);
 
 	escaped_alias = g_markup_escape_text(alias, -1);
 
@@ -135,15 +147,16 @@ static void historize(PurpleConversation *c)
 		header_date = purple_date_format_full(localtime(&((PurpleLog *)logs->data)->time));
 
 	header = g_strdup_printf(_("<b>Conversation with %s on %s:</b><br>"), escaped_alias, header_date);
-	gtk_imhtml_append_text(GTK_IMHTML(gtkconv->imhtml), header, options|GTK_IMHTML_NO_SMILEY);
+	gtk_imhtml_insert_html_at_iter(GTK_IMHTML(gtkconv->imhtml), header,
+			options | GTK_IMHTML_NO_SMILEY, &iter);
 	g_free(header);
 	g_free(escaped_alias);
 
 	g_strchomp(history);
-	gtk_imhtml_append_text(GTK_IMHTML(gtkconv->imhtml), history, options);
+	gtk_imhtml_insert_html_at_iter(GTK_IMHTML(gtkconv->imhtml), history, options, &iter);
 	g_free(history);
 
-	gtk_imhtml_append_text(GTK_IMHTML(gtkconv->imhtml), "<hr>", options);
+	gtk_imhtml_insert_html_at_iter(GTK_IMHTML(gtkconv->imhtml), "<hr>", options, &iter);
 
 	gtk_imhtml_set_protocol_name(GTK_IMHTML(gtkconv->imhtml), protocol);
 	g_free(protocol);
@@ -154,6 +167,28 @@ static void historize(PurpleConversation *c)
 	g_list_free_full(logs, (GDestroyNotify)purple_log_free);
 }
 
+static gboolean historize_cb(gpointer data)
+{
+	PurpleConversation *c = data;
+
+	g_hash_table_steal(pending, c);
+	historize(c);
+
+	return FALSE;
+}
+
+static void history_queue(PurpleConversation *c)
+{
+	if (!g_hash_table_lookup(pending, c))
+		g_hash_table_insert(pending, c,
+				GUINT_TO_POINTER(g_idle_add(historize_cb, c)));
+}
+
+static void history_cancel(PurpleConversation *c)
+{
+	g_hash_table_remove(pending, c);
+}
+
 static void
 history_prefs_check(PurplePlugin *plugin)
 {
@@ -176,9 +211,15 @@ static void history_prefs_cb(const char *name, PurplePrefType type,
 static gboolean
 plugin_load(PurplePlugin *plugin)
 {
+	pending = g_hash_table_new_full(g_direct_hash, g_direct_equal, NULL,
+			(GDestroyNotify)g_source_remove);
+
 	purple_signal_connect(purple_conversations_get_handle(),
 						"conversation-created",
-						plugin, PURPLE_CALLBACK(historize), NULL);
+						plugin, PURPLE_CALLBACK(history_queue), NULL);
+	purple_signal_connect(purple_conversations_get_handle(),
+						"deleting-conversation",
+						plugin, PURPLE_CALLBACK(history_cancel), NULL);
 	/* XXX: Do we want to listen to pidgin's "conversation-displayed" signal? */
 
 	purple_prefs_connect_callback(plugin, "/purple/logging/log_ims",
@@ -191,6 +232,15 @@ plugin_load(PurplePlugin *plugin)
 	return TRUE;
 }
 
+static gboolean
+plugin_unload(PurplePlugin *plugin)
+{
+	g_hash_table_destroy(pending);
+	pending = NULL;
+
+	return TRUE;
+}
+
 static PurplePluginInfo info =
 {
 	PURPLE_PLUGIN_MAGIC,
@@ -210,7 +260,7 @@ static PurplePluginInfo info =
 	"Sean Egan <seanegan@gmail.com>",
 	PURPLE_WEBSITE,
 	plugin_load,
-	NULL,
+	plugin_unload,
 	NULL,
 	NULL,
 	NULL,